@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Arduino.h"
+
+typedef struct {
+  float temperature;
+  float relative_humidity;
+} sensors_event_t;
+
+// Simulated AHTx0, readings come from the simulated environment
+class Adafruit_AHTX0 {
+  public:
+    bool begin() { return true; }
+    bool getEvent(sensors_event_t *humidity, sensors_event_t *temperature);
+};
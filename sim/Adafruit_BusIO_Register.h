@@ -0,0 +1,3 @@
+#pragma once
+
+#include "Adafruit_I2CDevice.h"
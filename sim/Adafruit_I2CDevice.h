@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Wire.h"
+
+// I2C device, transfers are routed to the simulated device at the same address
+class Adafruit_I2CDevice {
+  public:
+    Adafruit_I2CDevice(uint8_t addr, TwoWire *wire = &Wire) : i2cAddress(addr) { (void)wire; }
+    bool begin(bool addrDetect = true);
+    bool write(const uint8_t *buffer, size_t length, bool stop = true,
+               const uint8_t *prefix = nullptr, size_t prefixLength = 0);
+    bool read(uint8_t *buffer, size_t length, bool stop = true);
+    uint8_t address() { return i2cAddress; }
+
+  private:
+    uint8_t i2cAddress;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Arduino.h"
+
+typedef struct {
+  uint16_t framelen;
+  uint16_t pm10_standard, pm25_standard, pm100_standard;
+  uint16_t pm10_env, pm25_env, pm100_env;
+  uint16_t particles_03um, particles_05um, particles_10um;
+  uint16_t particles_25um, particles_50um, particles_100um;
+  uint16_t unused;
+  uint16_t checksum;
+} PM25_AQI_Data;
+
+// PMS5003 frame reader, same behaviour as the Adafruit library on top of the simulated serial port
+class Adafruit_PM25AQI {
+  public:
+    bool begin_UART(Stream *stream) { serial = stream; return true; }
+    bool read(PM25_AQI_Data *data);
+
+  private:
+    Stream *serial = nullptr;
+};
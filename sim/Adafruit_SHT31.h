@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Wire.h"
+
+#define SHT31_DEFAULT_ADDR 0x44
+
+// Simulated SHT31, readings come from the simulated environment
+class Adafruit_SHT31 {
+  public:
+    Adafruit_SHT31(TwoWire *wire = &Wire) { (void)wire; }
+    bool begin(uint8_t address = SHT31_DEFAULT_ADDR) { (void)address; return true; }
+    bool readBoth(float *temperature, float *humidity);
+    float readTemperature();
+    float readHumidity();
+    void heater(bool enable) { (void)enable; }
+};
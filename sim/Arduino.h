@@ -0,0 +1,142 @@
+#pragma once
+
+// Native stand-in for the Arduino core, backed by the simulation
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+#include "pgmspace.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+
+using std::min;
+using std::max;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+// Wall clock time follows the simulated clock
+// Until configTime() has synced with the network it counts from 1970
+time_t simTime(time_t *t);
+#define time(t) simTime(t)
+void configTime(const char *tz, const char *server1, const char *server2 = nullptr,
+                const char *server3 = nullptr);
+
+class String {
+  public:
+    String() {}
+    String(const char *s) : s(s ? s : "") {}
+    String(const std::string &s) : s(s) {}
+    explicit String(int value) : s(std::to_string(value)) {}
+    explicit String(unsigned int value) : s(std::to_string(value)) {}
+    explicit String(long value) : s(std::to_string(value)) {}
+    explicit String(unsigned long value) : s(std::to_string(value)) {}
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    bool operator==(const String &other) const { return s == other.s; }
+    String &operator+=(const String &other) { s += other.s; return *this; }
+    String &operator+=(const char *other) { s += other; return *this; }
+    String &operator+=(char c) { s += c; return *this; }
+    String operator+(const String &other) const { return String(s + other.s); }
+
+  private:
+    std::string s;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t byte) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      for (size_t i = 0; i < size; i++) write(buffer[i]);
+      return size;
+    }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long value, int base = DEC);
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned long value, int base = DEC) { return print((long)value, base); }
+    size_t print(double value, int digits = 2);
+    size_t println() { return write("\n"); }
+    template <typename T>
+    size_t println(const T &value) { return print(value) + println(); }
+    template <typename T>
+    size_t println(const T &value, int format) { return print(value, format) + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+    size_t readBytes(uint8_t *buffer, size_t length) {
+      size_t n = 0;
+      while (n < length && available() > 0) buffer[n++] = read();
+      return n;
+    }
+};
+
+// Console, written to stdout unless the simulation runs quietly
+class HardwareSerial : public Stream {
+  public:
+    HardwareSerial(int uart = 0) : uart(uart) {}
+    void begin(unsigned long baud) { this->baud = baud; }
+    size_t write(uint8_t byte) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int availableForWrite();
+    int available() override;
+    int read() override;
+    int peek() override;
+
+  private:
+    void drain();
+
+    int uart;
+    unsigned long baud = 115200;
+    double fifoLevel = 0;     // bytes in the transmit FIFO as of drainTime
+    uint64_t drainTime = 0;   // us
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return 40000; }
+    void restart() { exit(0); }
+};
+
+extern EspClass ESP;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+
+#include "Arduino.h"
+
+// WiFi station, connected whenever the simulated network is up
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+typedef enum { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 } WiFiSleepType_t;
+
+class ESP8266WiFiClass {
+  public:
+    void persistent(bool enable) { (void)enable; }
+    bool mode(WiFiMode_t mode) { (void)mode; return true; }
+    wl_status_t begin(const char *ssid, const char *passphrase = nullptr);
+    bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0);
+    WiFiSleepType_t getSleepMode() { return sleepMode; }
+    wl_status_t status();
+    String SSID();
+    int32_t RSSI();
+
+  private:
+    WiFiSleepType_t sleepMode = WIFI_NONE_SLEEP;
+    uint32_t associated = UINT32_MAX; // ms, when the association started by begin() completes
+};
+
+extern ESP8266WiFiClass WiFi;
+
+struct SimConnection;
+
+// TCP connection accepted from a simulated client (see SimHttpLoad), or opened by connect() to the
+// simulated InfluxDB server
+class WiFiClient {
+  public:
+    WiFiClient() {}
+    explicit WiFiClient(std::shared_ptr<SimConnection> connection) : connection(connection) {}
+    virtual ~WiFiClient() {}
+
+    // Blocks for a round trip, or for the timeout while the network is down
+    int connect(const char *host, uint16_t port);
+    void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+    uint8_t connected();
+    int available();
+    int read();
+    size_t write(const uint8_t *buffer, size_t size);
+    int availableForWrite();
+    void setNoDelay(bool noDelay) { (void)noDelay; }
+    void stop();
+    // Close with a RST instead of the FIN handshake, dropping anything not yet sent
+    void abort();
+    operator bool() const { return connection != nullptr; }
+
+  private:
+    std::shared_ptr<SimConnection> connection;
+    unsigned long timeout = 5000; // ms
+};
+
+// Listens for the connections opened by the simulated clients
+class WiFiServer {
+  public:
+    WiFiServer(uint16_t port) : port(port) {}
+    void begin() { listening = true; }
+    void setNoDelay(bool noDelay) { (void)noDelay; }
+    WiFiClient accept();
+    WiFiClient available() { return accept(); }
+
+  private:
+    uint16_t port;
+    bool listening = false;
+};
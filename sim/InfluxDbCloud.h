@@ -0,0 +1,5 @@
+#pragma once
+
+#include "Arduino.h"
+
+extern const char InfluxDbCloud2CACert[];
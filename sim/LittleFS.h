@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+
+// LittleFS on top of a directory on the host (Simulation::fsRoot)
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File : public Stream {
+  public:
+    File() {}
+    File(FILE *file, const std::string &name);
+
+    size_t write(uint8_t byte) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buffer, size_t size);
+    bool seek(uint32_t position, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close() { file.reset(); }
+    const char *name() const { return fileName.c_str(); }
+    operator bool() const { return file != nullptr; }
+
+  private:
+    std::shared_ptr<FILE> file;
+    std::string fileName;
+};
+
+class Dir {
+  public:
+    Dir() {}
+    Dir(const std::vector<std::string> &names) : names(names) {}
+    bool next() { return ++index < (int)names.size(); }
+    String fileName() const { return names[index]; }
+
+  private:
+    std::vector<std::string> names;
+    int index = -1;
+};
+
+class FS {
+  public:
+    bool begin();
+    void end() {}
+    bool format();
+    bool exists(const char *path);
+    bool mkdir(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    File open(const char *path, const char *mode);
+    Dir openDir(const char *path);
+
+  private:
+    std::string hostPath(const char *path);
+};
+
+extern FS LittleFS;
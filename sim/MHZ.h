@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Arduino.h"
+
+enum MHZ_type { MHZ14A, MHZ14B, MHZ19B, MHZ19C };
+
+const int STATUS_NO_RESPONSE = -2;
+const int STATUS_CHECKSUM_MISMATCH = -3;
+const int STATUS_INCOMPLETE = -4;
+const int STATUS_NOT_READY = -5;
+
+// MH-Z19 UART protocol, same behaviour as the MH-Z CO2 Sensors library on top of the simulated
+// serial port
+class MHZ {
+  public:
+    MHZ(Stream *serial, MHZ_type type) : serial(serial) { (void)type; }
+    int readCO2UART();
+    void setAutoCalibrate(bool enable);
+    void setDebug(bool enable) { (void)enable; }
+
+  private:
+    Stream *serial;
+};
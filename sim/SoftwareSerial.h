@@ -0,0 +1,30 @@
+#pragma once
+
+#include <deque>
+
+#include "Arduino.h"
+
+#define SWSERIAL_8N1 0
+
+// Software serial port connected to the simulated device on its RX pin
+class SoftwareSerial : public Stream {
+  public:
+    void begin(uint32_t baud, int config, int rxPin, int txPin, bool invert = false,
+               int bufferSize = 64);
+    size_t write(uint8_t byte) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    bool overflow();
+
+  private:
+    void update();
+    void receive(uint8_t byte);
+
+    std::deque<uint8_t> rx;
+    std::deque<uint8_t> incoming; // kept between updates so polling doesn't allocate
+    size_t bufferSize = 64;
+    bool overflowed = false;
+    class SimSerialDevice *device = nullptr;
+};
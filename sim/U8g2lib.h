@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Simulated 128x32 SSD1306 with a real U8g2 style full frame buffer
+// Shapes are rasterized exactly, text is drawn as a pattern derived from each character so that
+// changes in text change the same pixels they would on the device
+
+typedef struct {
+  uint32_t bytes; // bytes sent over I2C, including commands
+} u8x8_t;
+
+uint8_t u8x8_cad_StartTransfer(u8x8_t *u8x8);
+uint8_t u8x8_cad_SendCmd(u8x8_t *u8x8, uint8_t cmd);
+uint8_t u8x8_cad_SendArg(u8x8_t *u8x8, uint8_t arg);
+uint8_t u8x8_cad_EndTransfer(u8x8_t *u8x8);
+
+// Fonts are described by glyph width and height
+extern const uint8_t u8g2_font_profont22_tf[];
+extern const uint8_t u8g2_font_profont12_tf[];
+extern const uint8_t u8g2_font_profont10_tf[];
+extern const uint8_t u8g2_font_tom_thumb_4x6_mn[];
+extern const uint8_t u8g2_font_tom_thumb_4x6_mr[];
+extern const uint8_t u8g2_font_tom_thumb_4x6_tf[];
+
+typedef int u8g2_cb_t;
+const u8g2_cb_t U8G2_R0 = 0;
+const u8g2_cb_t U8G2_R2 = 2;
+
+class U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C {
+  public:
+    static const uint8_t Width = 128;
+    static const uint8_t Height = 32;
+
+    U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C(u8g2_cb_t rotation) { (void)rotation; }
+
+    bool begin();
+    void enableUTF8Print() {}
+    void setFontMode(uint8_t mode) { fontMode = mode; }
+    void setFont(const uint8_t *font) { this->font = font; }
+    void setContrast(uint8_t value);
+    void setPowerSave(uint8_t enable);
+
+    uint8_t drawStr(uint8_t x, uint8_t y, const char *s);
+    uint8_t drawUTF8(uint8_t x, uint8_t y, const char *s);
+    uint8_t getStrWidth(const char *s);
+    uint8_t getUTF8Width(const char *s);
+    void drawPixel(uint8_t x, uint8_t y);
+    void drawLine(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1);
+    void drawBox(uint8_t x, uint8_t y, uint8_t w, uint8_t h);
+    void drawFrame(uint8_t x, uint8_t y, uint8_t w, uint8_t h);
+
+    void clearBuffer() { memset(buffer, 0, sizeof(buffer)); }
+    void sendBuffer();
+    void updateDisplayArea(uint8_t tx, uint8_t ty, uint8_t tw, uint8_t th);
+    uint8_t *getBufferPtr() { return buffer; }
+    uint8_t getBufferTileWidth() { return Width / 8; }
+    uint8_t getBufferTileHeight() { return Height / 8; }
+    u8x8_t *getU8x8() { return &u8x8; }
+
+    // Contents of the simulated display controller, for checking what was actually sent
+    uint8_t screen[Width * Height / 8];
+
+  private:
+    uint8_t drawText(uint8_t x, uint8_t y, const char *s, bool utf8);
+
+    uint8_t buffer[Width * Height / 8];
+    const uint8_t *font = u8g2_font_profont10_tf;
+    uint8_t fontMode = 0;
+    u8x8_t u8x8 = { 0 };
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "ESP8266WiFi.h"
+
+// TLS is not simulated, certificates are accepted and ignored
+
+namespace BearSSL {
+
+class X509List {
+  public:
+    X509List(const char *certificate) { (void)certificate; }
+};
+
+class WiFiClientSecure : public WiFiClient {
+  public:
+    void setTrustAnchors(const X509List *anchors) { (void)anchors; }
+};
+
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Arduino.h"
+
+// I2C bus, devices are simulated behind Adafruit_I2CDevice
+class TwoWire {
+  public:
+    void begin() {}
+    void setClock(uint32_t frequency) { (void)frequency; }
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Arduino.h"
+
+// HomeKit server, notifications are counted instead of sent
+
+typedef struct {
+  bool is_null;
+  union {
+    bool bool_value;
+    int int_value;
+    float float_value;
+  };
+} homekit_value_t;
+
+typedef struct {
+  const char *type;
+  homekit_value_t value;
+} homekit_characteristic_t;
+
+typedef struct {
+  void *accessories;
+  const char *password;
+} homekit_server_config_t;
+
+extern "C" {
+void arduino_homekit_setup(homekit_server_config_t *config);
+void arduino_homekit_loop();
+void homekit_characteristic_notify(homekit_characteristic_t *characteristic, homekit_value_t value);
+}
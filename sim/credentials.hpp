@@ -0,0 +1,13 @@
+#pragma once
+
+// Placeholder credentials for the native simulation, src/credentials.hpp takes precedence
+const char * const WiFiSSID[] = { "simulated" };
+const char * const WiFiPassword[] = { "" };
+const uint8_t WiFiCount = 1;
+
+const char * const INFLUXDB_URL = "http://localhost:8086";
+const char * const INFLUXDB_TOKEN = "";
+const char * const INFLUXDB_ORG = "sim";
+const char * const INFLUXDB_BUCKET = "sim";
+
+const char * const TZ_INFO = "UTC0";
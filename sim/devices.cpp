@@ -0,0 +1,383 @@
+#include "Arduino.h"
+#include "Wire.h"
+#include "Adafruit_I2CDevice.h"
+#include "Adafruit_SHT31.h"
+#include "Adafruit_AHTX0.h"
+#include "Adafruit_PM25AQI.h"
+#include "MHZ.h"
+#include "SoftwareSerial.h"
+#include "sim.hpp"
+#include "constants.hpp"
+
+TwoWire Wire;
+
+// Time to clock one byte out over the bus, including the ack bit
+static const uint32_t I2CByteTime = 90;    // us, 100 kHz
+static const uint32_t SerialByteTime = 1042; // us, 9600 baud 8N1
+
+static const uint8_t SGP30Address = 0x58;
+
+static uint8_t sensirionCRC(const uint8_t *data, uint8_t length) {
+  uint8_t crc = 0xFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+  }
+  return crc;
+}
+
+// SGP30, replies are NACKed until the sensor has finished processing the last command
+class SimSGP30 {
+  public:
+    bool write(const uint8_t *buffer, size_t length) {
+      if (length < 2) return false;
+      uint16_t command = buffer[0] << 8 | buffer[1];
+      replyLength = 0;
+      readyAt = simulation.micros();
+      switch (command) {
+        case 0x3682: // Get serial ID
+          setReply({ 0x0000, 0x0123, 0x4567 }, 500);
+          break;
+        case 0x202F: // Get feature set
+          setReply({ 0x0022 }, 10000);
+          break;
+        case 0x2003: // IAQ init
+          readyAt += 10000;
+          break;
+        case 0x2008: { // Measure IAQ
+          sim_environment env = simulation.environment();
+          setReply({ env.eco2, env.tvoc }, 12000);
+          break;
+        }
+        case 0x2050: // Measure raw
+          setReply({ 13000, 18000 }, 25000);
+          break;
+        case 0x2015: // Get baseline
+          setReply({ baselineECO2, baselineTVOC }, 10000);
+          break;
+        case 0x201E: // Set baseline
+          if (length < 8 || sensirionCRC(buffer + 2, 2) != buffer[4] || sensirionCRC(buffer + 5, 2) != buffer[7]) {
+            return false;
+          }
+          baselineTVOC = buffer[2] << 8 | buffer[3];
+          baselineECO2 = buffer[5] << 8 | buffer[6];
+          readyAt += 10000;
+          break;
+        case 0x2061: // Set humidity
+          if (length < 5 || sensirionCRC(buffer + 2, 2) != buffer[4]) return false;
+          readyAt += 10000;
+          break;
+        default:
+          return false;
+      }
+      return true;
+    }
+
+    bool read(uint8_t *buffer, size_t length) {
+      if (simulation.micros() < readyAt || length > replyLength) return false;
+      memcpy(buffer, reply, length);
+      replyLength = 0;
+      return true;
+    }
+
+  private:
+    void setReply(std::initializer_list<uint16_t> words, uint32_t processingTime) {
+      replyLength = 0;
+      for (uint16_t word : words) {
+        reply[replyLength] = word >> 8;
+        reply[replyLength + 1] = word & 0xFF;
+        reply[replyLength + 2] = sensirionCRC(reply + replyLength, 2);
+        replyLength += 3;
+      }
+      // Faults requested by a test apply to this reply only
+      if (simulation.sgp30CorruptByte >= 0 && (size_t)simulation.sgp30CorruptByte < replyLength) {
+        reply[simulation.sgp30CorruptByte] ^= 0x01;
+      }
+      replyLength = simulation.sgp30ShortReply < replyLength ? replyLength - simulation.sgp30ShortReply : 0;
+      simulation.sgp30CorruptByte = -1;
+      simulation.sgp30ShortReply = 0;
+      readyAt += processingTime;
+    }
+
+    uint8_t reply[9];
+    size_t replyLength = 0;
+    uint64_t readyAt = 0;
+    uint16_t baselineECO2 = 0x8F00;
+    uint16_t baselineTVOC = 0x9100;
+};
+
+static SimSGP30 sgp30Device;
+
+bool Adafruit_I2CDevice::begin(bool addrDetect) {
+  (void)addrDetect;
+  return i2cAddress == SGP30Address;
+}
+
+bool Adafruit_I2CDevice::write(const uint8_t *buffer, size_t length, bool stop,
+                               const uint8_t *prefix, size_t prefixLength) {
+  (void)stop;
+  uint8_t data[32];
+  if (prefixLength + length > sizeof(data)) return false;
+  if (prefixLength > 0) memcpy(data, prefix, prefixLength);
+  memcpy(data + prefixLength, buffer, length);
+  length += prefixLength;
+
+  simulation.i2cBytes += length + 1;
+  simulation.advance((length + 1) * I2CByteTime);
+  if (i2cAddress != SGP30Address) return false;
+  return sgp30Device.write(data, length);
+}
+
+bool Adafruit_I2CDevice::read(uint8_t *buffer, size_t length, bool stop) {
+  (void)stop;
+  simulation.i2cBytes += length + 1;
+  simulation.advance((length + 1) * I2CByteTime);
+  if (i2cAddress != SGP30Address) return false;
+  return sgp30Device.read(buffer, length);
+}
+
+// Temperature/humidity sensors, including their conversion time
+
+bool Adafruit_SHT31::readBoth(float *temperature, float *humidity) {
+  delay(15);
+  simulation.i2cBytes += 10;
+  simulation.first(simulation.firstClimateReading);
+  sim_environment env = simulation.environment();
+  *temperature = env.temperature;
+  *humidity = env.humidity;
+  return true;
+}
+
+float Adafruit_SHT31::readTemperature() {
+  float temperature, humidity;
+  readBoth(&temperature, &humidity);
+  return temperature;
+}
+
+float Adafruit_SHT31::readHumidity() {
+  float temperature, humidity;
+  readBoth(&temperature, &humidity);
+  return humidity;
+}
+
+bool Adafruit_AHTX0::getEvent(sensors_event_t *humidity, sensors_event_t *temperature) {
+  delay(80);
+  simulation.i2cBytes += 10;
+  simulation.first(simulation.firstClimateReading);
+  sim_environment env = simulation.environment();
+  temperature->temperature = env.temperature;
+  humidity->relative_humidity = env.humidity;
+  return true;
+}
+
+// MH-Z19, answers a read command about one frame time after the command has been sent
+class SimMHZ19 : public SimSerialDevice {
+  public:
+    void receive(uint8_t byte) override {
+      if (commandLength == 0 && byte != 0xFF) return;
+      command[commandLength++] = byte;
+      if (commandLength < sizeof(command)) return;
+      commandLength = 0;
+
+      uint8_t checksum = 0;
+      for (uint8_t i = 1; i < 8; i++) checksum += command[i];
+      if ((uint8_t)(0xFF - checksum + 1) != command[8] || command[2] != 0x86) return;
+
+      simulation.first(simulation.firstCO2Reading);
+      uint16_t co2 = simulation.environment().co2;
+      uint8_t response[9] = { 0xFF, 0x86, (uint8_t)(co2 >> 8), (uint8_t)co2, 0x40, 0, 0, 0, 0 };
+      checksum = 0;
+      for (uint8_t i = 1; i < 8; i++) checksum += response[i];
+      response[8] = 0xFF - checksum + 1;
+      for (uint8_t i = 0; i < 9; i++) {
+        pending.push_back({ simulation.micros() + (10 + i) * SerialByteTime, response[i] });
+      }
+    }
+
+    void update(std::deque<uint8_t> &rx) override {
+      while (!pending.empty() && pending.front().first <= simulation.micros()) {
+        rx.push_back(pending.front().second);
+        pending.pop_front();
+      }
+    }
+
+  private:
+    uint8_t command[9];
+    uint8_t commandLength = 0;
+    std::deque<std::pair<uint64_t, uint8_t>> pending;
+};
+
+// PMS5003 in active mode, sends a frame every second while its enable pin is high
+class SimPMS5003 : public SimSerialDevice {
+  public:
+    void receive(uint8_t byte) override { (void)byte; }
+
+    void update(std::deque<uint8_t> &rx) override {
+      uint64_t now = simulation.micros();
+      if (!simulation.pins[PinPMS5003Enable]) {
+        awake = false;
+        return;
+      }
+      if (!awake) {
+        awake = true;
+        nextFrame = now + FrameInterval;
+        sent = FrameLength;
+      }
+
+      // Bytes of the current frame arrive one at a time
+      while (true) {
+        if (sent == FrameLength) {
+          if (now < nextFrame) break;
+          buildFrame();
+          frameStart = nextFrame;
+          nextFrame += FrameInterval;
+          sent = 0;
+        }
+        if (now < frameStart + sent * SerialByteTime) break;
+        rx.push_back(frame[sent++]);
+      }
+    }
+
+  private:
+    static const uint8_t FrameLength = 32;
+    static const uint64_t FrameInterval = 1000000; // us
+
+    void buildFrame() {
+      sim_environment env = simulation.environment();
+      uint16_t words[15] = { 28, env.pm10, env.pm25, env.pm100, env.pm10, env.pm25, env.pm100,
+                             1200, 350, 60, 8, 2, 1, 0, 0 };
+      frame[0] = 0x42;
+      frame[1] = 0x4D;
+      uint16_t checksum = 0x42 + 0x4D;
+      for (uint8_t i = 0; i < 14; i++) {
+        frame[2 + i * 2] = words[i] >> 8;
+        frame[3 + i * 2] = words[i] & 0xFF;
+        checksum += frame[2 + i * 2] + frame[3 + i * 2];
+      }
+      frame[30] = checksum >> 8;
+      frame[31] = checksum & 0xFF;
+    }
+
+    uint8_t frame[FrameLength];
+    uint8_t sent = FrameLength;
+    bool awake = false;
+    uint64_t frameStart = 0;
+    uint64_t nextFrame = 0;
+};
+
+static SimMHZ19 mhz19Device;
+static SimPMS5003 pms5003Device;
+
+SimSerialDevice *Simulation::serialDevice(uint8_t rxPin) {
+  if (rxPin == PinMHZ19SerialRx) return &mhz19Device;
+  if (rxPin == PinPMS5003SerialRx) return &pms5003Device;
+  return nullptr;
+}
+
+void SoftwareSerial::begin(uint32_t baud, int config, int rxPin, int txPin, bool invert,
+                           int bufferSize) {
+  (void)baud;
+  (void)config;
+  (void)txPin;
+  (void)invert;
+  this->bufferSize = bufferSize;
+  device = simulation.serialDevice(rxPin);
+}
+
+// Receive the bytes the device has sent so far, dropping what doesn't fit into the buffer
+void SoftwareSerial::update() {
+  if (!device) return;
+  SimHeapExempt exempt;
+  incoming.clear();
+  device->update(incoming);
+  for (uint8_t byte : incoming) {
+    if (simulation.chance(simulation.serialNoise)) byte ^= 1 << (int)(simulation.noise(4) + 4);
+    receive(byte);
+    if (simulation.chance(simulation.serialNoise)) receive(simulation.noise(128) + 128);
+  }
+}
+
+void SoftwareSerial::receive(uint8_t byte) {
+  if (rx.size() < bufferSize) rx.push_back(byte);
+  else overflowed = true;
+}
+
+size_t SoftwareSerial::write(uint8_t byte) {
+  simulation.advance(SerialByteTime);
+  SimHeapExempt exempt;
+  if (device) device->receive(byte);
+  return 1;
+}
+
+int SoftwareSerial::available() {
+  update();
+  return rx.size();
+}
+
+int SoftwareSerial::read() {
+  update();
+  if (rx.empty()) return -1;
+  uint8_t byte = rx.front();
+  rx.pop_front();
+  return byte;
+}
+
+int SoftwareSerial::peek() {
+  update();
+  return rx.empty() ? -1 : rx.front();
+}
+
+bool SoftwareSerial::overflow() {
+  bool result = overflowed;
+  overflowed = false;
+  return result;
+}
+
+// Sensor libraries, same protocol handling as the real ones
+
+bool Adafruit_PM25AQI::read(PM25_AQI_Data *data) {
+  if (!serial || !serial->available()) return false;
+
+  // Skip to the start of a frame, then wait until all of it has arrived
+  while (serial->available() && serial->peek() != 0x42) serial->read();
+  if (serial->available() < 32) return false;
+
+  uint8_t buffer[32];
+  serial->readBytes(buffer, 32);
+  uint16_t sum = 0;
+  for (uint8_t i = 0; i < 30; i++) sum += buffer[i];
+
+  uint16_t words[15];
+  for (uint8_t i = 0; i < 15; i++) words[i] = buffer[2 + i * 2] << 8 | buffer[3 + i * 2];
+  memcpy((void *)data, (void *)words, sizeof(words));
+  return sum == data->checksum;
+}
+
+static const uint8_t MHZReadCommand[9] = { 0xFF, 0x01, 0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x79 };
+static const uint32_t MHZReadTimeout = 100; // ms
+
+int MHZ::readCO2UART() {
+  while (serial->available()) serial->read();
+  serial->write(MHZReadCommand, sizeof(MHZReadCommand));
+
+  uint32_t start = millis();
+  while (serial->available() < 9) {
+    if (millis() - start > MHZReadTimeout) return STATUS_NO_RESPONSE;
+    delay(1);
+  }
+
+  uint8_t response[9];
+  serial->readBytes(response, 9);
+  uint8_t checksum = 0;
+  for (uint8_t i = 1; i < 8; i++) checksum += response[i];
+  if ((uint8_t)(0xFF - checksum + 1) != response[8]) return STATUS_CHECKSUM_MISMATCH;
+  return response[2] << 8 | response[3];
+}
+
+void MHZ::setAutoCalibrate(bool enable) {
+  uint8_t command[9] = { 0xFF, 0x01, 0x79, (uint8_t)(enable ? 0xA0 : 0x00), 0, 0, 0, 0, 0 };
+  uint8_t checksum = 0;
+  for (uint8_t i = 1; i < 8; i++) checksum += command[i];
+  command[8] = 0xFF - checksum + 1;
+  serial->write(command, sizeof(command));
+}
@@ -0,0 +1,140 @@
+#include "U8g2lib.h"
+#include "sim.hpp"
+
+// Bytes sent for the addressing commands in front of each block of display data
+static const uint8_t AreaCommandBytes = 8;
+// Time to clock one byte out over the display's 400 kHz bus, including the ack bit
+static const uint32_t DisplayByteTime = 23; // us
+
+// Glyph sizes stand in for the fonts: width, height, ascent
+const uint8_t u8g2_font_profont22_tf[] = { 11, 22, 14 };
+const uint8_t u8g2_font_profont12_tf[] = { 6, 12, 9 };
+const uint8_t u8g2_font_profont10_tf[] = { 5, 10, 7 };
+const uint8_t u8g2_font_tom_thumb_4x6_mn[] = { 4, 6, 5 };
+const uint8_t u8g2_font_tom_thumb_4x6_mr[] = { 4, 6, 5 };
+const uint8_t u8g2_font_tom_thumb_4x6_tf[] = { 4, 6, 5 };
+
+static void sendBytes(u8x8_t *u8x8, uint32_t bytes) {
+  u8x8->bytes += bytes;
+  simulation.displayBytes += bytes;
+  simulation.advance(bytes * DisplayByteTime);
+}
+
+uint8_t u8x8_cad_StartTransfer(u8x8_t *u8x8) { sendBytes(u8x8, 1); return 1; }
+uint8_t u8x8_cad_SendCmd(u8x8_t *u8x8, uint8_t cmd) { (void)cmd; sendBytes(u8x8, 2); return 1; }
+uint8_t u8x8_cad_SendArg(u8x8_t *u8x8, uint8_t arg) { (void)arg; sendBytes(u8x8, 1); return 1; }
+uint8_t u8x8_cad_EndTransfer(u8x8_t *u8x8) { (void)u8x8; return 1; }
+
+bool U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::begin() {
+  clearBuffer();
+  memset(screen, 0, sizeof(screen));
+  sendBytes(&u8x8, 26); // init sequence
+  return true;
+}
+
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::setContrast(uint8_t value) {
+  (void)value;
+  sendBytes(&u8x8, 3);
+}
+
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::setPowerSave(uint8_t enable) {
+  (void)enable;
+  sendBytes(&u8x8, 2);
+}
+
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::drawPixel(uint8_t x, uint8_t y) {
+  if (x >= Width || y >= Height) return;
+  buffer[(y / 8) * Width + x] |= 1 << (y % 8);
+}
+
+static void clearPixel(uint8_t *buffer, uint8_t x, uint8_t y) {
+  if (x >= U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::Width ||
+      y >= U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::Height) return;
+  buffer[(y / 8) * U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::Width + x] &= ~(1 << (y % 8));
+}
+
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::drawLine(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1) {
+  int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+  int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+  int error = dx + dy;
+  int x = x0, y = y0;
+  while (true) {
+    drawPixel(x, y);
+    if (x == x1 && y == y1) break;
+    int e2 = 2 * error;
+    if (e2 >= dy) { error += dy; x += sx; }
+    if (e2 <= dx) { error += dx; y += sy; }
+  }
+}
+
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::drawBox(uint8_t x, uint8_t y, uint8_t w, uint8_t h) {
+  for (uint8_t j = 0; j < h; j++) {
+    for (uint8_t i = 0; i < w; i++) drawPixel(x + i, y + j);
+  }
+}
+
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::drawFrame(uint8_t x, uint8_t y, uint8_t w, uint8_t h) {
+  if (w == 0 || h == 0) return;
+  for (uint8_t i = 0; i < w; i++) {
+    drawPixel(x + i, y);
+    drawPixel(x + i, y + h - 1);
+  }
+  for (uint8_t j = 0; j < h; j++) {
+    drawPixel(x, y + j);
+    drawPixel(x + w - 1, y + j);
+  }
+}
+
+// Each character is drawn as a pattern hashed from its code, y is the baseline
+uint8_t U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::drawText(uint8_t x, uint8_t y, const char *s, bool utf8) {
+  uint8_t glyphW = font[0], glyphH = font[1], ascent = font[2];
+  uint8_t width = 0;
+  for (const uint8_t *c = (const uint8_t *)s; *c; c++) {
+    if (utf8 && (*c & 0xC0) == 0x80) continue;
+    uint32_t hash = *c * 2654435761u;
+    for (uint8_t i = 0; i < glyphW; i++) {
+      for (uint8_t j = 0; j < glyphH; j++) {
+        uint8_t px = x + width + i, py = y - ascent + j;
+        bool set = i + 1 < glyphW && (hash >> ((i * 7 + j * 3) % 32)) & 1;
+        if (set) drawPixel(px, py);
+        else if (fontMode == 0) clearPixel(buffer, px, py);
+      }
+    }
+    width += glyphW;
+  }
+  return width;
+}
+
+uint8_t U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::drawStr(uint8_t x, uint8_t y, const char *s) {
+  return drawText(x, y, s, false);
+}
+
+uint8_t U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::drawUTF8(uint8_t x, uint8_t y, const char *s) {
+  return drawText(x, y, s, true);
+}
+
+uint8_t U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::getStrWidth(const char *s) {
+  return strlen(s) * font[0];
+}
+
+uint8_t U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::getUTF8Width(const char *s) {
+  uint8_t width = 0;
+  for (const uint8_t *c = (const uint8_t *)s; *c; c++) {
+    if ((*c & 0xC0) != 0x80) width += font[0];
+  }
+  return width;
+}
+
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::sendBuffer() {
+  updateDisplayArea(0, 0, Width / 8, Height / 8);
+}
+
+// Copy tiles to the display controller, one addressed block per tile row
+void U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C::updateDisplayArea(uint8_t tx, uint8_t ty, uint8_t tw, uint8_t th) {
+  for (uint8_t row = ty; row < ty + th && row < Height / 8; row++) {
+    size_t offset = row * Width + tx * 8;
+    size_t length = min((size_t)tw * 8, (size_t)Width - tx * 8);
+    memcpy(screen + offset, buffer + offset, length);
+    sendBytes(&u8x8, AreaCommandBytes + length);
+  }
+}
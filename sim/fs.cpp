@@ -0,0 +1,116 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "LittleFS.h"
+#include "sim.hpp"
+
+FS LittleFS;
+
+File::File(FILE *file, const std::string &name) : file(file, fclose), fileName(name) {}
+
+size_t File::write(uint8_t byte) {
+  return write(&byte, 1);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size) {
+  if (!file) return 0;
+  if (simulation.fsWriteBudget >= 0) {
+    if ((int64_t)size > simulation.fsWriteBudget) size = simulation.fsWriteBudget;
+    simulation.fsWriteBudget -= size;
+  }
+  return fwrite(buffer, 1, size, file.get());
+}
+
+int File::available() {
+  return file ? size() - position() : 0;
+}
+
+int File::read() {
+  return file ? fgetc(file.get()) : -1;
+}
+
+int File::peek() {
+  if (!file) return -1;
+  int c = fgetc(file.get());
+  if (c != EOF) ungetc(c, file.get());
+  return c;
+}
+
+size_t File::read(uint8_t *buffer, size_t size) {
+  return file ? fread(buffer, 1, size, file.get()) : 0;
+}
+
+bool File::seek(uint32_t position, SeekMode mode) {
+  int whence = mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END;
+  return file && fseek(file.get(), position, whence) == 0;
+}
+
+size_t File::position() const {
+  return file ? ftell(file.get()) : 0;
+}
+
+size_t File::size() const {
+  if (!file) return 0;
+  fflush(file.get());
+  struct stat info;
+  return fstat(fileno(file.get()), &info) == 0 ? info.st_size : 0;
+}
+
+std::string FS::hostPath(const char *path) {
+  return simulation.fsRoot + path;
+}
+
+bool FS::begin() {
+  ::mkdir(simulation.fsRoot.c_str(), 0755);
+  struct stat info;
+  return stat(simulation.fsRoot.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+bool FS::format() {
+  return false;
+}
+
+bool FS::exists(const char *path) {
+  struct stat info;
+  return stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool FS::mkdir(const char *path) {
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::remove(const char *path) {
+  return ::remove(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to) {
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+// The File handle takes one allocation, as the shared FileImpl pointer does on the device
+File FS::open(const char *path, const char *mode) {
+  FILE *file;
+  {
+    SimHeapExempt exempt;
+    std::string hostMode = mode[0] == 'r' ? "rb" : mode[0] == 'w' ? "wb" : "ab";
+    if (mode[1] == '+') hostMode += '+';
+    file = fopen(hostPath(path).c_str(), hostMode.c_str());
+  }
+  if (!file) return File();
+  if (simulation.countAllocations) simulation.fileOpens++;
+  const char *name = strrchr(path, '/');
+  return File(file, name ? name + 1 : path);
+}
+
+Dir FS::openDir(const char *path) {
+  std::vector<std::string> names;
+  DIR *dir = opendir(hostPath(path).c_str());
+  if (dir) {
+    for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    }
+    closedir(dir);
+  }
+  return Dir(names);
+}
@@ -0,0 +1,215 @@
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "sim.hpp"
+#include "constants.hpp"
+#include "series_log.hpp"
+
+SimHttpLoad httpLoad;
+
+static const uint32_t ScrapeTimeout = 30000; // ms, clients give up after this long
+
+// Connections
+
+uint8_t WiFiClient::connected() {
+  if (connection) connection->update();
+  return connection && !connection->remoteClosed && !connection->firmwareClosed;
+}
+
+int WiFiClient::available() {
+  if (connection) connection->update();
+  return connection ? connection->incoming.size() : 0;
+}
+
+int WiFiClient::read() {
+  if (!connection || connection->incoming.empty()) return -1;
+  uint8_t byte = connection->incoming.front();
+  connection->incoming.pop_front();
+  return byte;
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size) {
+  if (!connected()) return 0;
+  SimHeapExempt exempt;
+  size = std::min(size, (size_t)availableForWrite());
+  connection->outgoing.insert(connection->outgoing.end(), buffer, buffer + size);
+  return size;
+}
+
+int WiFiClient::availableForWrite() {
+  if (!connected()) return 0;
+  return SendWindow - std::min(SendWindow, connection->outgoing.size());
+}
+
+void WiFiClient::stop() {
+  if (connection) connection->firmwareClosed = true;
+  SimHeapExempt exempt;
+  connection.reset();
+}
+
+void WiFiClient::abort() {
+  if (connection) {
+    connection->firmwareClosed = true;
+    connection->reset = true;
+    SimHeapExempt exempt;
+    connection->outgoing.clear();
+  }
+  SimHeapExempt exempt;
+  connection.reset();
+}
+
+WiFiClient WiFiServer::accept() {
+  SimHeapExempt exempt;
+  std::deque<std::shared_ptr<SimConnection>> &pending = simulation.pendingConnections;
+  if (!listening || pending.empty() || pending.front()->port != port) return WiFiClient();
+  std::shared_ptr<SimConnection> connection = pending.front();
+  pending.pop_front();
+  return WiFiClient(connection);
+}
+
+// Clients
+
+static const char *const ScrapePath[] = { "/metrics", "/history?tier=1h", "/log?from=" };
+static const uint8_t ScrapePaths = 3;
+
+void SimHttpLoad::update() {
+  if (clients == 0) return;
+  SimHeapExempt exempt;
+  if (scrapers.size() != clients) scrapers.resize(clients);
+  uint64_t now = simulation.millis();
+
+  for (uint8_t i = 0; i < clients; i++) {
+    SimScraper &scraper = scrapers[i];
+    if (!scraper.connection) {
+      // All clients scrape at the same moment, the worst case for the server
+      if (now < scraper.next) continue;
+      scraper.next = now - now % (interval * 1000) + interval * 1000;
+      if (WiFi.status() != WL_CONNECTED) {
+        refused++;
+        continue;
+      }
+      scraper.path = onlyPath >= 0 ? onlyPath : (i + scraper.count++) % ScrapePaths;
+      std::string request = std::string("GET ") + ScrapePath[scraper.path];
+      scraper.from = simTime(nullptr) - 3600;
+      if (scraper.path == 2) request += std::to_string(scraper.from);
+      request += " HTTP/1.1\r\nHost: sensor.local\r\nUser-Agent: sim\r\nAccept: */*\r\n\r\n";
+
+      scraper.connection = std::make_shared<SimConnection>();
+      scraper.connection->port = HttpPort;
+      scraper.connection->incoming.assign(request.begin(), request.end());
+      simulation.pendingConnections.push_back(scraper.connection);
+      scraper.start = now;
+      scraper.lastReceive = now;
+      scraper.received.clear();
+      continue;
+    }
+
+    // Receive at the link rate
+    SimConnection &connection = *scraper.connection;
+    size_t bytes = std::min((size_t)((now - scraper.lastReceive) * LinkRate), connection.outgoing.size());
+    scraper.received.append(connection.outgoing.begin(), connection.outgoing.begin() + bytes);
+    connection.outgoing.erase(connection.outgoing.begin(), connection.outgoing.begin() + bytes);
+    scraper.lastReceive = now;
+
+    if (connection.reset) {
+      resets++;
+      scraper.connection.reset();
+    } else if (connection.firmwareClosed && connection.outgoing.empty()) {
+      if (validate(scraper)) {
+        ok++;
+        bytesReceived += scraper.received.size();
+        uint32_t latency = now - scraper.start;
+        latencySum += latency;
+        if (latency > maxLatency) maxLatency = latency;
+      } else {
+        failed++;
+        if (!simulation.quiet) printf("[sim] bad response to %s:\n%s\n", ScrapePath[scraper.path], scraper.received.c_str());
+      }
+      scraper.connection.reset();
+    } else if (now - scraper.start > ScrapeTimeout) {
+      timeouts++;
+      connection.remoteClosed = true;
+      scraper.connection.reset();
+    }
+  }
+}
+
+// Check the status, the chunked framing and the body of a response
+bool SimHttpLoad::validate(const SimScraper &scraper) {
+  const std::string &response = scraper.received;
+  size_t headerEnd = response.find("\r\n\r\n");
+  if (headerEnd == std::string::npos || response.compare(0, 15, "HTTP/1.1 200 OK") != 0) return false;
+  if (response.find("Transfer-Encoding: chunked") > headerEnd) return false;
+
+  std::string body;
+  size_t position = headerEnd + 4;
+  while (true) {
+    size_t lineEnd = response.find("\r\n", position);
+    if (lineEnd == std::string::npos) return false;
+    size_t size = strtoul(response.c_str() + position, nullptr, 16);
+    position = lineEnd + 2;
+    if (size == 0) break;
+    if (position + size + 2 > response.size() || response.compare(position + size, 2, "\r\n") != 0) return false;
+    body.append(response, position, size);
+    position += size + 2;
+  }
+  if (response.compare(position, std::string::npos, "\r\n") != 0) return false;
+
+  if (scraper.path == 0) {
+    // Prometheus text: comments, and a name and a number on every other line
+    uint32_t samples = 0;
+    size_t start = 0;
+    while (start < body.size()) {
+      size_t end = body.find('\n', start);
+      if (end == std::string::npos) return false;
+      std::string line = body.substr(start, end - start);
+      start = end + 1;
+      if (line[0] == '#') continue;
+      size_t space = line.find(' ');
+      if (space == std::string::npos) return false;
+      char *numberEnd;
+      strtod(line.c_str() + space + 1, &numberEnd);
+      if (*numberEnd != '\0') return false;
+      samples++;
+    }
+    return samples == Metrics;
+  } else if (scraper.path == 1) {
+    // CSV with a header row and a column per history channel
+    uint32_t rows = 0;
+    size_t start = 0;
+    while (start < body.size()) {
+      size_t end = body.find('\n', start);
+      if (end == std::string::npos) return false;
+      if (std::count(body.begin() + start, body.begin() + end, ',') != HistoryChannels) return false;
+      start = end + 1;
+      rows++;
+    }
+    return rows >= 2 && body.compare(0, 6, "age_s,") == 0;
+  } else {
+    // Whole log blocks that decode
+    if (body.size() % SeriesBlockSize != 0) return false;
+    uint32_t first = 0, last = 0;
+    for (size_t b = 0; b < body.size(); b += SeriesBlockSize) {
+      SeriesDecoder decoder;
+      if (!decoder.begin((const uint8_t *)body.data() + b, SeriesBlockSize)) return false;
+      series_record record;
+      uint16_t records = 0;
+      while (decoder.next(record)) {
+        // Every record from the one covering the start time to the newest, none left out
+        if (logInterval && (first ? record.time != last + logInterval : record.time > scraper.from)) {
+          return false;
+        }
+        if (!first) first = record.time;
+        last = record.time;
+        records++;
+      }
+      if (records != decoder.records()) return false;
+    }
+    return !logInterval || last + logInterval >= scraper.from + 3600;
+  }
+}
+
+void SimHttpLoad::print() {
+  if (clients == 0) return;
+  printf("HTTP scrapes          : %u ok, %u failed, %u timed out, %u reset, %u without WiFi (%.1f MB, latency mean %.0f ms, max %u ms)\n",
+         ok, failed, timeouts, resets, refused, bytesReceived / 1e6, ok ? (double)latencySum / ok : 0.0, maxLatency);
+}
@@ -0,0 +1,4 @@
+# Libraries the native build links against, which build_flags would pass to the compiler too
+Import("env")
+
+env.Append(LIBS=["z"], LINKFLAGS=["-pthread"])
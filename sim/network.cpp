@@ -0,0 +1,269 @@
+#include <zlib.h>
+#include <algorithm>
+
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "InfluxDbCloud.h"
+#include "arduino_homekit_server.h"
+#include "sim.hpp"
+#include "constants.hpp"
+
+ESP8266WiFiClass WiFi;
+
+const char InfluxDbCloud2CACert[] = "";
+
+// WiFi
+
+bool ESP8266WiFiClass::setSleepMode(WiFiSleepType_t type, uint8_t listenInterval) {
+  (void)listenInterval;
+  sleepMode = type;
+  return true;
+}
+
+// Association and DHCP take a couple of seconds after begin(), then the station stays connected
+// while the network is up and reconnects by itself after an outage
+static const uint32_t AssociationTime = 2000; // ms
+
+wl_status_t ESP8266WiFiClass::begin(const char *ssid, const char *passphrase) {
+  (void)ssid;
+  (void)passphrase;
+  associated = simulation.millis() + AssociationTime;
+  return WL_DISCONNECTED;
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+  bool connected = associated != UINT32_MAX && simulation.millis() >= associated && simulation.networkUp();
+  return connected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+String ESP8266WiFiClass::SSID() {
+  return simulation.networkUp() ? "simulated" : "";
+}
+
+int32_t ESP8266WiFiClass::RSSI() {
+  return simulation.networkUp() ? -60 : 31;
+}
+
+// InfluxDB server
+// Write requests are decompressed and every line is checked, so malformed line protocol or a broken
+// gzip stream fails the write with a 400 as the real server would
+
+// Measurement, optional tags, fields and a timestamp, with backslash escapes
+static bool validLine(const std::string &line) {
+  int spaces = 0;
+  size_t fieldsStart = 0;
+  size_t timeStart = 0;
+  for (size_t i = 0; i < line.size(); i++) {
+    if (line[i] == '\\') {
+      i++;
+      continue;
+    }
+    if (line[i] != ' ') continue;
+    spaces++;
+    if (spaces == 1) fieldsStart = i + 1;
+    if (spaces == 2) timeStart = i + 1;
+  }
+  if (spaces != 2 || fieldsStart <= 1 || timeStart <= fieldsStart + 1 || timeStart >= line.size()) return false;
+  if (line.find('=', fieldsStart) >= timeStart) return false;
+  for (size_t i = timeStart; i < line.size(); i++) {
+    if (!isdigit((unsigned char)line[i])) return false;
+  }
+  return true;
+}
+
+static bool inflateGzip(const uint8_t *data, size_t size, std::string &out) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) return false;
+  stream.next_in = (Bytef *)data;
+  stream.avail_in = size;
+  int result;
+  do {
+    char buffer[4096];
+    stream.next_out = (Bytef *)buffer;
+    stream.avail_out = sizeof(buffer);
+    result = inflate(&stream, Z_NO_FLUSH);
+    out.append(buffer, sizeof(buffer) - stream.avail_out);
+  } while (result == Z_OK);
+  inflateEnd(&stream);
+  return result == Z_STREAM_END && stream.avail_in == 0;
+}
+
+// Value of a request header, empty if it's missing
+static std::string headerValue(const std::string &head, const char *name) {
+  std::string lower = head;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  size_t start = lower.find(std::string("\r\n") + name + ":");
+  if (start == std::string::npos) return "";
+  start += strlen(name) + 3;
+  while (start < head.size() && head[start] == ' ') start++;
+  size_t end = head.find("\r\n", start);
+  return head.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+// InfluxDB's end of a connection opened by the firmware
+// Requests are answered a round trip after they have been received in full and the connection is
+// kept open between them. An outage stalls it, and once the network is back the server has
+// forgotten it and resets it, so a request sent on it meanwhile times out on the firmware's side.
+class SimInfluxConnection : public SimConnection {
+  public:
+    SimInfluxConnection() : lastUpdate(simulation.millis()) {}
+    // Closed by the firmware before the response arrived
+    ~SimInfluxConnection() { if (!lost && (!received.empty() || !reply.empty())) simulation.networkFailures++; }
+    void update() override;
+
+  private:
+    int handle(const std::string &head, const std::string &body, std::string &message);
+
+    std::string received;
+    std::string reply;
+    uint64_t replyTime = 0;  // ms
+    uint64_t lastUpdate;     // ms
+    bool lost = false;
+};
+
+void SimInfluxConnection::update() {
+  if (remoteClosed || firmwareClosed) return;
+  SimHeapExempt exempt;
+  uint64_t now = simulation.millis();
+  if (!lost && simulation.outageBetween(lastUpdate, now)) {
+    if (!received.empty() || !reply.empty() || !outgoing.empty()) simulation.networkFailures++;
+    lost = true;
+  }
+  if (!simulation.networkUp()) {
+    lastUpdate = now;
+    return;
+  }
+  if (lost) {
+    remoteClosed = true;
+    return;
+  }
+
+  size_t bytes = std::min((size_t)((now - lastUpdate) * LinkRate), outgoing.size());
+  received.append(outgoing.begin(), outgoing.begin() + bytes);
+  outgoing.erase(outgoing.begin(), outgoing.begin() + bytes);
+  lastUpdate = now;
+
+  size_t headEnd = received.find("\r\n\r\n");
+  if (reply.empty() && headEnd != std::string::npos) {
+    size_t length = strtoul(headerValue(received.substr(0, headEnd + 2), "content-length").c_str(), nullptr, 10);
+    if (received.size() >= headEnd + 4 + length) {
+      std::string head = received.substr(0, headEnd + 2);
+      std::string body = received.substr(headEnd + 4, length);
+      received.erase(0, headEnd + 4 + length);
+      simulation.networkRequests++;
+
+      std::string message;
+      int status = handle(head, body, message);
+      const char *reason = status == 200 ? "OK" : status == 204 ? "No Content" : status == 400 ? "Bad Request"
+                         : status == 401 ? "Unauthorized" : "Not Found";
+      reply = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+      if (status != 204) {
+        reply += "Content-Type: application/json; charset=utf-8\r\nContent-Length: " +
+                 std::to_string(message.size()) + "\r\n";
+      }
+      reply += "\r\n" + message;
+      replyTime = now + simulation.networkLatency;
+    }
+  }
+  if (!reply.empty() && now >= replyTime) {
+    incoming.insert(incoming.end(), reply.begin(), reply.end());
+    reply.clear();
+  }
+}
+
+// Status and body of the response to a request
+int SimInfluxConnection::handle(const std::string &head, const std::string &body, std::string &message) {
+  std::string target = head.substr(0, head.find("\r\n"));
+  if (target.compare(0, 11, "GET /health") == 0) {
+    message = "{\"name\":\"influxdb\",\"status\":\"pass\"}";
+    return 200;
+  }
+  if (target.compare(0, 19, "POST /api/v2/write?") != 0 || target.find("precision=s") == std::string::npos) {
+    message = "{\"code\":\"not found\"}";
+    return 404;
+  }
+  if (headerValue(head, "authorization").compare(0, 6, "Token ") != 0) {
+    message = "{\"code\":\"unauthorized\"}";
+    return 401;
+  }
+
+  std::string lines;
+  if (headerValue(head, "content-encoding") == "gzip") {
+    if (!inflateGzip((const uint8_t *)body.data(), body.size(), lines)) {
+      simulation.rejectedRequests++;
+      message = "{\"code\":\"invalid\",\"message\":\"gzip\"}";
+      return 400;
+    }
+  } else {
+    lines = body;
+  }
+
+  uint32_t records = 0;
+  uint32_t stale = 0;
+  size_t start = 0;
+  while (start < lines.size()) {
+    size_t end = lines.find('\n', start);
+    if (end == std::string::npos) end = lines.size();
+    std::string line = lines.substr(start, end - start);
+    start = end + 1;
+    if (line.empty()) continue;
+    if (!validLine(line)) {
+      simulation.rejectedRequests++;
+      message = "{\"code\":\"invalid\",\"message\":\"unable to parse '" + line + "'\"}";
+      return 400;
+    }
+    records++;
+    // Timestamps from before NTP synced are stored as they are by the real server too
+    if (strtoull(line.c_str() + line.rfind(' ') + 1, nullptr, 10) < ValidTimeStart) stale++;
+  }
+
+  simulation.recordsWritten += records;
+  simulation.staleRecords += stale;
+  simulation.bytesWritten += lines.size();
+  simulation.bytesSent += body.size();
+  simulation.first(simulation.firstUpload);
+  return 204;
+}
+
+// Every outgoing connection goes to the InfluxDB server, TLS isn't simulated
+int WiFiClient::connect(const char *host, uint16_t port) {
+  (void)host;
+  stop();
+  simulation.connectAttempts++;
+  if (!simulation.networkUp() || simulation.networkLatency > timeout) {
+    // SYN retries until the timeout
+    delay(timeout);
+    simulation.networkRequests++;
+    simulation.networkFailures++;
+    return 0;
+  }
+  delay(simulation.networkLatency);
+  SimHeapExempt exempt;
+  connection = std::make_shared<SimInfluxConnection>();
+  connection->port = port;
+  return 1;
+}
+
+// HomeKit, notifications are only counted
+
+extern "C" {
+homekit_characteristic_t cha_temperature = { "temperature", { false, { false } } };
+homekit_characteristic_t cha_humidity = { "humidity", { false, { false } } };
+homekit_characteristic_t cha_co2_detected = { "co2_detected", { false, { false } } };
+homekit_characteristic_t cha_co2_level = { "co2_level", { false, { false } } };
+homekit_characteristic_t cha_air_quality = { "air_quality", { false, { false } } };
+homekit_characteristic_t cha_pm25 = { "pm25", { false, { false } } };
+homekit_characteristic_t cha_voc = { "voc", { false, { false } } };
+homekit_server_config_t config = { nullptr, "111-11-111" };
+
+void arduino_homekit_setup(homekit_server_config_t *config) { (void)config; }
+void arduino_homekit_loop() {}
+
+void homekit_characteristic_notify(homekit_characteristic_t *characteristic, homekit_value_t value) {
+  (void)characteristic;
+  (void)value;
+  simulation.homekitNotifications++;
+  simulation.first(simulation.firstNotification);
+}
+}
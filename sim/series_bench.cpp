@@ -0,0 +1,84 @@
+#include <chrono>
+#include <vector>
+
+#include "Arduino.h"
+#include "sim.hpp"
+#include "series_log.hpp"
+
+// Compression and speed of the time-series log, measured on the log the simulated firmware wrote
+// Blocks are read back with SeriesLog, then decoded and encoded again in memory with the wall clock
+// timing each pass, so the numbers describe the host and are only comparable between runs.
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void benchSeriesLog() {
+  SimHeapExempt exempt;
+  SeriesLog log;
+  if (!log.begin() || log.blocks() == 0) {
+    printf("Series log            : empty, run for a few hours or more first\n");
+    return;
+  }
+
+  std::vector<uint8_t> blocks(log.blocks() * SeriesBlockSize);
+  for (uint32_t b = 0; b < log.blocks(); b++) log.readBlock(b, &blocks[b * SeriesBlockSize]);
+  size_t encodedBytes = 0;
+  std::vector<series_record> records;
+  for (uint32_t b = 0; b < log.blocks(); b++) {
+    SeriesDecoder decoder;
+    if (!decoder.begin(&blocks[b * SeriesBlockSize], SeriesBlockSize)) continue;
+    series_record record;
+    while (decoder.next(record)) records.push_back(record);
+  }
+
+  // Decode and encode everything until each has taken at least a quarter of a second
+  uint64_t decoded = 0;
+  Clock::time_point start = Clock::now();
+  double decodeTime;
+  do {
+    for (uint32_t b = 0; b < log.blocks(); b++) {
+      SeriesDecoder decoder;
+      decoder.begin(&blocks[b * SeriesBlockSize], SeriesBlockSize);
+      series_record record;
+      while (decoder.next(record)) decoded++;
+    }
+  } while ((decodeTime = seconds(start)) < 0.25);
+
+  SeriesBlock block;
+  uint64_t encoded = 0;
+  uint32_t encodedBlocks = 0;
+  start = Clock::now();
+  double encodeTime;
+  do {
+    encodedBytes = 0;
+    encodedBlocks = 1;
+    block.begin(records[0].time);
+    for (const series_record &record : records) {
+      if (!block.append(record)) {
+        encodedBytes += block.length();
+        encodedBlocks++;
+        block.begin(record.time);
+        block.append(record);
+      }
+      encoded++;
+    }
+    encodedBytes += block.length();
+  } while ((encodeTime = seconds(start)) < 0.25);
+
+  // A plain binary record: the time and each channel as a float
+  const size_t rawSize = sizeof(uint32_t) + SeriesChannels * sizeof(float);
+  double perRecord = (double)encodedBlocks * SeriesBlockSize / records.size();
+  double days = (records.back().time - records.front().time) / 86400.0;
+  printf("Series log            : %u records over %.1f days in %u blocks\n", (unsigned int)records.size(),
+         days, (unsigned int)log.blocks());
+  printf("Series compression    : %.2f bytes per record encoded, %.2f with block padding, %.1fx vs %u byte raw records\n",
+         (double)encodedBytes / records.size(), perRecord, rawSize / perRecord, (unsigned int)rawSize);
+  printf("Series capacity       : %.0f days in %u KB of flash\n",
+         (double)SeriesSegments * SeriesSegmentBlocks * SeriesBlockSize / perRecord / 1440,
+         (unsigned int)(SeriesSegments * SeriesSegmentBlocks * SeriesBlockSize / 1024));
+  printf("Series throughput     : encode %.1f M records/s, decode %.1f M records/s\n",
+         encoded / encodeTime / 1e6, decoded / decodeTime / 1e6);
+}
@@ -0,0 +1,333 @@
+#include <ctype.h>
+#include <chrono>
+#include <new>
+
+#include "Arduino.h"
+#include "sim.hpp"
+#include "constants.hpp"
+
+Simulation simulation;
+HardwareSerial Serial(0);
+EspClass ESP;
+
+// Time between loop passes, stands in for the time the firmware itself takes
+static const uint32_t LoopStep = 1000; // us
+
+// Count the heap allocations made while the firmware runs, the ESP8266 heap fragments when the
+// main loop allocates and frees Strings every few seconds
+void *operator new(size_t size) {
+  if (simulation.countAllocations) {
+    simulation.heapAllocations++;
+    simulation.heapAllocatedBytes += size;
+  }
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+Simulation::Simulation() {
+  memset(pins, 0, sizeof(pins));
+  pins[PinButton] = HIGH;
+}
+
+float Simulation::noise(float amplitude) {
+  seed = seed * 1103515245 + 12345;
+  return amplitude * (((seed >> 8) & 0xFFFF) / 32768.0f - 1.0f);
+}
+
+bool Simulation::networkUp() const {
+  uint64_t seconds = clock / 1000000;
+  return !(seconds >= outageStart && seconds < outageEnd);
+}
+
+bool Simulation::outageBetween(uint64_t from, uint64_t to) const {
+  return outageEnd > outageStart && from / 1000 < outageEnd && to / 1000 >= outageStart;
+}
+
+static float saturationVaporPressure(float t) {
+  return 6.112f * expf(17.62f * t / (243.12f + t));
+}
+
+// Daily cycle of temperature and humidity, with CO2, VOC and particulates following occupancy
+sim_environment Simulation::environment() {
+  float seconds = clock / 1000000.0f;
+  float day = fmodf(seconds / 86400.0f, 1.0f);
+  float occupancy = 0.5f - 0.5f * cosf(2 * M_PI * day);
+
+  float ambient = 21.0f + 2.0f * sinf(2 * M_PI * (day - 0.3f)) + noise(0.05f);
+  float ambientHumidity = 45.0f + 8.0f * sinf(6 * M_PI * day) + noise(0.2f);
+  float sensorTemperature = ambient - TemperatureOffset;
+
+  sim_environment env;
+  env.temperature = sensorTemperature;
+  env.humidity = ambientHumidity * saturationVaporPressure(ambient) / saturationVaporPressure(sensorTemperature);
+  env.co2 = 420 + 600 * occupancy + noise(15);
+  env.eco2 = 400 + 300 * occupancy + noise(10);
+  env.tvoc = 30 + 200 * occupancy + noise(10);
+  float pm = 4 + 6 * (0.5f + 0.5f * sinf(4 * M_PI * day)) + noise(1);
+  env.pm10 = pm * 0.7f;
+  env.pm25 = pm;
+  env.pm100 = pm * 1.3f;
+  return env;
+}
+
+// Arduino core
+
+uint32_t millis() { return simulation.millis(); }
+uint32_t micros() { return (uint32_t)simulation.micros(); }
+void delay(uint32_t ms) { simulation.advance((uint64_t)ms * 1000); }
+void delayMicroseconds(uint32_t us) { simulation.advance(us); }
+void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (mode == INPUT_PULLUP && pin < 32) simulation.pins[pin] = HIGH;
+}
+
+int digitalRead(uint8_t pin) { return pin < 32 ? simulation.pins[pin] : LOW; }
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < 32) simulation.pins[pin] = value;
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+// SNTP answers after about a second, once the network is reachable
+static const uint32_t TimeSyncDelay = 1000; // ms
+
+time_t simTime(time_t *t) {
+  if (!simulation.timeSynced && simulation.timeSyncStart != Simulation::NotYet &&
+      simulation.millis() - simulation.timeSyncStart >= TimeSyncDelay && simulation.networkUp()) {
+    simulation.timeSynced = true;
+  }
+  time_t now = simulation.millis() / 1000;
+  if (simulation.timeSynced) now += simulation.epochStart;
+  if (t) *t = now;
+  return now;
+}
+
+void configTime(const char *tz, const char *server1, const char *server2, const char *server3) {
+  (void)tz;
+  (void)server1;
+  (void)server2;
+  (void)server3;
+  if (simulation.timeSyncStart == Simulation::NotYet) simulation.timeSyncStart = simulation.millis();
+}
+
+size_t Print::printf(const char *format, ...) {
+  char stackBuffer[128];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(stackBuffer, sizeof(stackBuffer), format, args);
+  va_end(args);
+  if (length < 0) return 0;
+  if ((size_t)length < sizeof(stackBuffer)) return write((const uint8_t *)stackBuffer, length);
+
+  std::string buffer(length + 1, '\0');
+  va_start(args, format);
+  vsnprintf(&buffer[0], buffer.size(), format, args);
+  va_end(args);
+  return write((const uint8_t *)buffer.data(), length);
+}
+
+size_t Print::print(long value, int base) {
+  char buffer[24];
+  if (base == HEX) snprintf(buffer, sizeof(buffer), "%lX", value);
+  else snprintf(buffer, sizeof(buffer), "%ld", value);
+  return write(buffer);
+}
+
+size_t Print::print(double value, int digits) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return write(buffer);
+}
+
+size_t HardwareSerial::write(uint8_t byte) {
+  return write(&byte, 1);
+}
+
+// The console transmits from a FIFO at the baud rate, 10 bits per byte, and writes wait for room
+// in it the way the core's do, which holds up the loop
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  if (uart == 0) {
+    drain();
+    double excess = fifoLevel + size - SerialTxFifo;
+    if (excess > 0) {
+      uint64_t wait = excess * 10e6 / baud;
+      simulation.advance(wait);
+      simulation.consoleWait += wait;
+      drain();
+    }
+    fifoLevel += size;
+    simulation.consoleBytes += size;
+    if (simulation.consoleCapture) fwrite(buffer, 1, size, simulation.consoleCapture);
+  }
+  if (!simulation.quiet) fwrite(buffer, 1, size, stdout);
+  return size;
+}
+
+int HardwareSerial::availableForWrite() {
+  if (uart != 0) return SerialTxFifo;
+  drain();
+  return SerialTxFifo - (size_t)ceil(fifoLevel);
+}
+
+void HardwareSerial::drain() {
+  uint64_t now = simulation.micros();
+  fifoLevel = std::max(0.0, fifoLevel - (now - drainTime) * baud / 10e6);
+  drainTime = now;
+}
+
+// Only the console receives input
+int HardwareSerial::available() {
+  int count = 0;
+  if (uart != 0) return 0;
+  for (auto &input : simulation.consoleInput) {
+    if (input.first > simulation.micros()) break;
+    count++;
+  }
+  return count;
+}
+
+int HardwareSerial::read() {
+  int byte = peek();
+  if (byte >= 0) simulation.consoleInput.pop_front();
+  return byte;
+}
+
+int HardwareSerial::peek() {
+  if (available() == 0) return -1;
+  return simulation.consoleInput.front().second;
+}
+
+// Entry point, runs the firmware on the simulated clock
+// Unit tests under test/ link the firmware and the simulation with their own main()
+#ifndef PIO_UNIT_TESTING
+
+void setup();
+void loop();
+
+static std::string firstTime(uint32_t ms) {
+  if (ms == Simulation::NotYet) return "never";
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%.1f s", ms / 1000.0);
+  return buffer;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --seconds N        simulated run time (default 600)\n"
+          "  --quiet            don't print the firmware's serial output\n"
+          "  --outage START:LEN take WiFi down for LEN seconds starting at START\n"
+          "  --latency MS       network round trip time (default 150)\n"
+          "  --fs DIR           host directory backing LittleFS (default sim_fs)\n"
+          "  --epoch S          unix time at the start of the run, later than the last run to simulate the device being off\n"
+          "  --seed N           random seed\n"
+          "  --serial-noise P   corrupt each sensor serial byte, and insert garbage, with probability P\n"
+          "  --send TIME:TEXT   type TEXT into the serial console at TIME seconds, \\xHH for any byte\n"
+          "  --serial-out FILE  save everything the firmware writes to the console, for tools/serial_dump.py\n"
+          "  --http-clients N   scrape the metrics server with N concurrent clients\n"
+          "  --http-interval S  seconds between the scrapes of each client (default 15)\n"
+          "  --bench-series     measure the compression and speed of the time-series log at the end\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  uint64_t seconds = 600;
+  bool benchSeries = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--quiet")) {
+      simulation.quiet = true;
+    } else if (!strcmp(argv[i], "--outage") && i + 1 < argc) {
+      char *end;
+      simulation.outageStart = strtoull(argv[++i], &end, 10);
+      simulation.outageEnd = simulation.outageStart + strtoull(end + 1, nullptr, 10);
+    } else if (!strcmp(argv[i], "--latency") && i + 1 < argc) {
+      simulation.networkLatency = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--fs") && i + 1 < argc) {
+      simulation.fsRoot = argv[++i];
+    } else if (!strcmp(argv[i], "--epoch") && i + 1 < argc) {
+      simulation.epochStart = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--send") && i + 1 < argc) {
+      char *text;
+      uint64_t at = strtoull(argv[++i], &text, 10) * 1000000;
+      if (*text == ':') text++;
+      for (; *text; text++) {
+        // \xHH for binary requests
+        if (text[0] == '\\' && text[1] == 'x' && isxdigit(text[2]) && isxdigit(text[3])) {
+          char hex[3] = { text[2], text[3], 0 };
+          simulation.consoleInput.push_back({ at, (uint8_t)strtoul(hex, nullptr, 16) });
+          text += 3;
+        } else {
+          simulation.consoleInput.push_back({ at, (uint8_t)*text });
+        }
+      }
+    } else if (!strcmp(argv[i], "--serial-out") && i + 1 < argc) {
+      simulation.consoleCapture = fopen(argv[++i], "wb");
+      if (!simulation.consoleCapture) {
+        perror(argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--serial-noise") && i + 1 < argc) {
+      simulation.serialNoise = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--http-clients") && i + 1 < argc) {
+      httpLoad.clients = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--http-interval") && i + 1 < argc) {
+      httpLoad.interval = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--bench-series")) {
+      benchSeries = true;
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      simulation.seed = strtoul(argv[++i], nullptr, 10);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  auto wallStart = std::chrono::steady_clock::now();
+  uint64_t passes = 0;
+  uint64_t end = seconds * 1000000;
+
+  setup();
+  simulation.countAllocations = true;
+  while (simulation.micros() < end) {
+    loop();
+    httpLoad.update();
+    simulation.advance(LoopStep);
+    passes++;
+  }
+  simulation.countAllocations = false;
+
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  printf("\n--- Simulation summary ---\n");
+  printf("Simulated time        : %llu s\n", (unsigned long long)seconds);
+  printf("Wall time             : %.2f s (%.0fx real time)\n", wall, seconds / wall);
+  printf("Loop passes           : %llu\n", (unsigned long long)passes);
+  printf("Network requests      : %u (%u failed)\n", simulation.networkRequests, simulation.networkFailures);
+  printf("Records written       : %u (%llu bytes, %llu sent, %u requests rejected, %u before the clock was set)\n",
+         simulation.recordsWritten, (unsigned long long)simulation.bytesWritten,
+         (unsigned long long)simulation.bytesSent, simulation.rejectedRequests, simulation.staleRecords);
+  printf("Display I2C bytes     : %llu\n", (unsigned long long)simulation.displayBytes);
+  printf("HomeKit notifications : %u\n", simulation.homekitNotifications);
+  printf("Console output        : %llu bytes, %.1f s waiting for the UART\n",
+         (unsigned long long)simulation.consoleBytes, simulation.consoleWait / 1e6);
+  printf("Heap allocations      : %llu (%llu bytes, %.1f per minute, %llu of them file opens)\n",
+         (unsigned long long)simulation.heapAllocations, (unsigned long long)simulation.heapAllocatedBytes,
+         simulation.heapAllocations * 60.0 / seconds, (unsigned long long)simulation.fileOpens);
+  printf("Time to first reading : %s climate, %s CO2, %s upload, %s HomeKit\n",
+         firstTime(simulation.firstClimateReading).c_str(), firstTime(simulation.firstCO2Reading).c_str(),
+         firstTime(simulation.firstUpload).c_str(), firstTime(simulation.firstNotification).c_str());
+  httpLoad.print();
+  if (benchSeries) benchSeriesLog();
+  if (simulation.consoleCapture) fclose(simulation.consoleCapture);
+  return 0;
+}
+#endif
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdio.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Simulated device state shared by the native stand-ins for the Arduino core and libraries
+// Time is virtual: it only advances when firmware code waits (delay()), when a simulated blocking
+// operation such as a network request completes, or when the main loop steps it between passes.
+
+// Ambient conditions at the current simulated time
+typedef struct {
+  float temperature;    // C, at the sensor including self heating
+  float humidity;       // %RH, at the sensor
+  uint16_t tvoc;        // ppb
+  uint16_t eco2;        // ppm
+  uint16_t co2;         // ppm
+  uint16_t pm10;        // μg/m^3
+  uint16_t pm25;        // μg/m^3
+  uint16_t pm100;       // μg/m^3
+} sim_environment;
+
+// A device on a simulated serial port
+class SimSerialDevice {
+  public:
+    virtual ~SimSerialDevice() {}
+    virtual void receive(uint8_t byte) = 0;       // byte written by the firmware
+    virtual void update(std::deque<uint8_t> &rx) = 0; // append bytes the device has sent by now
+};
+
+// lwIP on the ESP8266 buffers two segments per connection
+const size_t SendWindow = 2 * 1460; // bytes
+// Roughly 1 Mbit/s in both directions
+const uint32_t LinkRate = 128; // bytes per ms
+
+// A TCP connection of the firmware, accepted by its WiFiServer from a simulated client or opened
+// by WiFiClient::connect() to a simulated server
+// Data for the firmware arrives at once, what it writes goes through a send buffer the other end
+// drains at the link rate
+struct SimConnection {
+  virtual ~SimConnection() {}
+  // Called whenever the firmware uses the connection, for servers to catch up with the clock
+  virtual void update() {}
+
+  uint16_t port;
+  std::deque<uint8_t> incoming; // not yet read by the firmware
+  std::deque<uint8_t> outgoing; // written by the firmware, not yet received by the other end
+  bool remoteClosed = false;
+  bool firmwareClosed = false;
+  bool reset = false; // aborted by the firmware, what was still in outgoing is lost
+};
+
+class Simulation {
+  public:
+    Simulation();
+
+    uint64_t micros() const { return clock; }
+    uint32_t millis() const { return clock / 1000; }
+    void advance(uint64_t us) { clock += us; }
+
+    sim_environment environment();
+    bool networkUp() const;
+    // True if the network was down at any time between the two, ms
+    bool outageBetween(uint64_t from, uint64_t to) const;
+    SimSerialDevice *serialDevice(uint8_t rxPin);
+
+    // GPIO
+    uint8_t pins[32];
+
+    // Connections waiting to be accepted by a WiFiServer
+    std::deque<std::shared_ptr<SimConnection>> pendingConnections;
+
+    // Bytes typed into the console, each with the time it arrives at
+    std::deque<std::pair<uint64_t, uint8_t>> consoleInput;
+
+    // Options
+    bool quiet = false;
+    uint64_t outageStart = 0; // s
+    uint64_t outageEnd = 0;   // s
+    uint32_t networkLatency = 150; // ms, round trip
+    float serialNoise = 0; // probability of each serial byte being corrupted, and of garbage after it
+    uint32_t seed = 1; // noise generator state
+    int sgp30CorruptByte = -1; // byte of the next SGP30 reply to flip, -1 for none
+    uint8_t sgp30ShortReply = 0; // bytes missing from the next SGP30 reply, the read is NACKed
+    std::string fsRoot = "sim_fs";
+    int64_t fsWriteBudget = -1; // bytes file writes may still store before coming up short, as on a full flash, -1 for no limit
+    uint64_t epochStart = 1700000000; // s, unix time NTP reports at the start of the run
+    FILE *consoleCapture = nullptr; // every byte the firmware writes to the console
+
+    // Statistics
+    uint32_t networkRequests = 0;
+    uint32_t networkFailures = 0;
+    uint32_t connectAttempts = 0; // each blocks for a round trip, or the timeout
+    uint32_t recordsWritten = 0;
+    uint64_t bytesWritten = 0; // line protocol accepted by the server
+    uint64_t bytesSent = 0;    // request bodies as sent, after compression
+    uint32_t rejectedRequests = 0;
+    uint32_t staleRecords = 0; // timestamped before the clock was set
+    uint64_t displayBytes = 0;
+    uint64_t i2cBytes = 0;
+    uint32_t homekitNotifications = 0;
+    uint64_t consoleBytes = 0;
+    uint64_t consoleWait = 0; // us the firmware spent waiting for room in the console UART FIFO
+    // Time of the first of each event since power on, ms
+    static const uint32_t NotYet = UINT32_MAX;
+    uint32_t firstClimateReading = NotYet; // temperature/humidity sensor read
+    uint32_t firstCO2Reading = NotYet;     // MH-Z19 reply
+    uint32_t firstUpload = NotYet;         // write accepted by the server
+    uint32_t firstNotification = NotYet;   // HomeKit notification
+    void first(uint32_t &event) { if (event == NotYet) event = millis(); }
+    uint64_t heapAllocations = 0;      // operator new calls made by the firmware after setup()
+    uint64_t heapAllocatedBytes = 0;
+    uint64_t fileOpens = 0;            // each takes one of the allocations above
+    bool countAllocations = false;
+
+    // SNTP: wall clock time is only valid once a sync has completed
+    uint32_t timeSyncStart = NotYet; // ms, when configTime() was called
+    bool timeSynced = false;
+
+    float noise(float amplitude);
+    bool chance(float probability) { return noise(0.5f) + 0.5f < probability; }
+
+  private:
+    uint64_t clock = 0;
+};
+
+extern Simulation simulation;
+
+// HTTP clients scraping the firmware's metrics server, every response is checked
+typedef struct {
+  std::shared_ptr<SimConnection> connection;
+  uint64_t next;        // ms, time of the next scrape
+  uint64_t start;       // ms
+  uint64_t lastReceive; // ms
+  uint32_t count;
+  uint8_t path;
+  uint32_t from;        // s, /log
+  std::string received;
+} SimScraper;
+
+class SimHttpLoad {
+  public:
+    void update(); // called every loop pass
+    void print();
+
+    // Options
+    uint8_t clients = 0;    // concurrent clients, all scraping at the same moment
+    uint32_t interval = 15; // s, between scrapes of each client
+    int8_t onlyPath = -1;   // 0 /metrics, 1 /history, 2 /log, -1 for each in turn
+    uint32_t logInterval = 0; // s between the records logged, if set /log must return every one of them
+
+    // Statistics
+    uint32_t ok = 0;
+    uint32_t failed = 0;
+    uint32_t timeouts = 0;
+    uint32_t resets = 0; // aborted by the firmware
+    uint32_t refused = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t latencySum = 0; // ms
+    uint32_t maxLatency = 0; // ms
+
+  private:
+    bool validate(const SimScraper &scraper);
+
+    std::vector<SimScraper> scrapers;
+};
+
+extern SimHttpLoad httpLoad;
+
+// Decode the time-series log left in fsRoot and time encoding and decoding it
+void benchSeriesLog();
+
+// Keeps the simulator's own bookkeeping out of the firmware's heap statistics
+class SimHeapExempt {
+  public:
+    SimHeapExempt() : saved(simulation.countAllocations) { simulation.countAllocations = false; }
+    ~SimHeapExempt() { simulation.countAllocations = saved; }
+
+  private:
+    bool saved;
+};
@@ -2,9 +2,15 @@
 
 //#define AHTx0
 #define SHT31
-#define SWSERIAL // Uncomment for ESP8266
-#define ESP8266_WIFI // Uncomment for ESP8266
+#ifdef ESP8266
+#define SWSERIAL
+#define ESP8266_WIFI
 #define ESP8266_HOMEKIT
+#endif
+#ifdef ESP32
+#define DUAL_CORE // Sensors and display run in loop() on one core, uploads in a task on the other
+#endif
+#define PROFILING // Comment out for release builds, removes the tick stage timers
 
 const uint8_t PinButton = 0;
 const uint8_t PinPMS5003Enable = 13;
@@ -29,29 +35,311 @@ typedef enum : uint8_t {
   DisplayStates
 } DisplayState;
 
+const uint8_t DisplayTileWidth = 16; // 8x8 tiles, 128x32 display
+const uint8_t DisplayTileHeight = 4;
+
 const bool DisplayAlwaysOn = true;
 const uint8_t DisplayBrightness = 128;
 
 const uint8_t DebounceInterval = 20;
-const uint16_t UpdateInterval = 1000; // ms per tick
+const uint16_t UpdateInterval = 1000; // ms between sensor reads
 const uint32_t DataHistoryUpdateInterval = 60000; // ms
-const uint32_t DataPushToServerInterval = 30000; // ms
 const uint32_t DisplayAutoCycleInterval = 5000; // ms
 const uint32_t DisplayTimeout = 30000; // ms
 
-const uint8_t DataHistoryLength = 60; // samples
+const uint16_t DataHistoryLength = 60; // buckets per history tier
+const size_t DataHistoryMaxBytes = 7680; // all tiers, held in System and so taken from the free heap
+
+// Channels kept in the data history
+typedef enum : uint8_t {
+  HistoryTemperature,
+  HistoryHumidity,
+  HistoryTVOC,
+  HistoryCO2,
+  HistoryPM25,
+  HistoryChannels
+} HistoryChannel;
+
+// History tiers, each bucket of a tier aggregates HistoryTierFactor buckets of the tier below it
+// Every tier stores min/max/mean of each channel, 6 bytes per channel per bucket
+typedef enum : uint8_t {
+  HistoryTierMinute,
+  HistoryTier10Minutes,
+  HistoryTierHour,
+  HistoryTierDay,
+  HistoryTiers
+} HistoryTier;
+
+const uint8_t HistoryTierFactor[HistoryTiers] = { 1, 10, 6, 24 }; // minute buckets close every DataHistoryUpdateInterval
+const char * const HistoryTierLabel[HistoryTiers] = { "1h", "10h", "60h", "60d" }; // span of DataHistoryLength buckets
+const char * const HistoryChannelName[HistoryChannels] = { "temperature", "humidity", "tvoc", "co2", "pm25" };
+
+typedef enum : uint8_t {
+  HistoryMean,
+  HistoryMin,
+  HistoryMax,
+  HistoryStats
+} HistoryStat;
+
+// History values are stored as uint16: stored = (value - offset) / step
+const float HistoryStep[HistoryChannels] = { 0.01, 0.1, 1, 1, 1 }; // C, %RH, ppb, ppm, μg/m^3
+const float HistoryOffset[HistoryChannels] = { -100, 0, 0, 0, 0 };
+
+// Measurements sent to the server
+typedef enum : uint8_t {
+  MeasurementTemperature,
+  MeasurementHumidity,
+  MeasurementVOC,
+  MeasurementCO2,
+  MeasurementPM,
+  MeasurementProfile,
+  Measurements
+} Measurement;
+const char *const MeasurementName[Measurements] = {
+  "Temperature", "Humidity", "Volatile Organic Compounds", "Carbon Dioxide", "Particulate Matter", "Profiling"
+};
+const size_t LineProtocolMaxLength = 256; // bytes, longest single record
+
+// Change-driven publishing to InfluxDB and HomeKit
+// A measurement is sent when a field moved by its deadband since it was last sent, fields with a
+// deadband of 0 are ignored. Profiling records bypass the filter.
+const float PublishDeadband[Measurements][3] = {
+  { 0.1, 0.2, 0 }, // Temperature: C, dew point C
+  { 0.5, 0.1, 0 }, // Humidity: %RH, g/m^3
+  { 20, 0, 0 },    // VOC: ppb
+  { 25, 0, 0 },    // CO2: ppm, the MH-Z19 is only accurate to ±50
+  { 1, 1, 1 },     // PM: μg/m^3
+  { 0, 0, 0 },     // Profile, unused
+};
+const uint32_t PublishHeartbeat = 300000; // ms, longest time a measurement goes unsent
+
+// Hand-off from the sensor core to the network core
+const size_t SampleQueueLength = 64; // records, power of 2
+const uint32_t NetworkTaskStack = 8192; // bytes
+const uint32_t NetworkTaskInterval = 10; // ms between checks for new samples
+
+// Server upload queue
+const size_t UploadQueueSize = 2048; // bytes of line protocol buffered in RAM
+const size_t UploadQueueFlushThreshold = 1536; // bytes, flush early once the queue is this full
+const uint32_t UploadFlushInterval = 10000; // ms, interval between batched writes
+const uint16_t UploadTimeout = 2000; // ms, longest wait for progress on a request, and for a connection to open
+const uint32_t UploadMaxBackoff = 600000; // ms, maximum retry interval while the server is unreachable
+
+// Request to InfluxDB in progress, it takes a step every pass of the loop until it's complete
+typedef enum : uint8_t {
+  UploadIdle,
+  UploadHealthCheck, // waiting for the server to come back
+  UploadQueued,      // the upload queue
+  UploadOffline      // a batch from the offline buffer
+} UploadState;
+
+// Offline buffer in flash, holds data while WiFi or the server is down
+const uint8_t OfflineBufferSegments = 64; // segment files, the oldest is dropped when all are used
+const size_t OfflineBufferSegmentSize = 8192; // bytes per segment file
+const size_t OfflineDrainBatchSize = 2048; // bytes per write request when catching up
+const uint32_t OfflineDrainInterval = 1000; // ms, interval between catch-up write requests
+
+// Upload compression
+const bool UploadCompression = true; // gzip request bodies, batches that don't shrink are sent as is
+const size_t UploadCompressedSize = 1024; // bytes, compressed body buffer
+const uint16_t GzipWindowSize = 512; // bytes, match distance limit, power of 2
+const uint8_t GzipHashBits = 9;
+const uint8_t GzipMaxChain = 8; // candidates checked per position
+const size_t InfluxUrlMaxLength = 256; // bytes, write path including org and bucket
+const size_t InfluxHostMaxLength = 64; // bytes
+const size_t InfluxHeaderMaxLength = 512; // bytes, request line and headers
+const size_t InfluxErrorMaxLength = 96; // bytes, kept from the last failed request
+
+// Time-series log in flash, minute averages of each measured channel kept for months
+typedef enum : uint8_t {
+  SeriesTemperature,
+  SeriesHumidity,
+  SeriesTVOC,
+  SeriesECO2,
+  SeriesCO2,
+  SeriesPM10,
+  SeriesPM25,
+  SeriesPM100,
+  SeriesChannels
+} SeriesChannel;
+
+const char * const SeriesChannelName[SeriesChannels] = {
+  "temperature", "humidity", "tvoc", "eco2", "co2", "pm10", "pm25", "pm100"
+};
+const float SeriesStep[SeriesChannels] = { 0.01, 0.01, 1, 1, 1, 1, 1, 1 }; // C, %RH, ppb, ppm, ppm, μg/m^3...
+const size_t SeriesBlockSize = 512; // bytes, a multiple of the 256 byte flash page
+const uint16_t SeriesSegmentBlocks = 32; // blocks per segment file
+const uint8_t SeriesSegments = 64; // segment files, the oldest is dropped when all are used
+
+// Local HTTP server for scrapes
+// /metrics is Prometheus text, /history?tier=1h a CSV of one history tier, /log?from=TIME the raw
+// time-series log blocks from that unix time on
+const uint16_t HttpPort = 80;
+const uint8_t HttpMaxClients = 2; // connections served at once, more wait in the TCP backlog
+const size_t HttpChunkSize = SeriesBlockSize; // bytes, largest body chunk, holds one log block
+const uint8_t HttpRequestMaxLength = 96; // bytes of the request line kept, longer targets are cut off
+const uint32_t HttpTimeout = 5000; // ms, connections that stall this long are closed
+
+typedef enum : uint8_t {
+  MetricTemperature,
+  MetricHumidity,
+  MetricTemperatureRaw,
+  MetricHumidityRaw,
+  MetricAbsoluteHumidity,
+  MetricDewPoint,
+  MetricTVOC,
+  MetricECO2,
+  MetricCO2,
+  MetricPM10,
+  MetricPM25,
+  MetricPM100,
+  MetricUptime,
+  MetricFreeHeap,
+  MetricRSSI,
+  MetricLogBlocks,
+  MetricHttpRequests,
+  Metrics
+} Metric;
+
+const char * const MetricName[Metrics] = {
+  "air_temperature_celsius", "air_humidity_percent", "air_temperature_raw_celsius",
+  "air_humidity_raw_percent", "air_absolute_humidity_grams_per_cubic_meter", "air_dew_point_celsius",
+  "air_tvoc_ppb", "air_eco2_ppm", "air_co2_ppm", "air_pm1_micrograms_per_cubic_meter",
+  "air_pm2_5_micrograms_per_cubic_meter", "air_pm10_micrograms_per_cubic_meter", "device_uptime_seconds",
+  "device_free_heap_bytes", "device_wifi_rssi_dbm", "device_log_blocks", "device_http_requests_total"
+};
+const char * const MetricHelp[Metrics] = {
+  "Temperature, compensated for sensor self heating", "Relative humidity, compensated for sensor self heating",
+  "Temperature at the sensor", "Relative humidity at the sensor", "Absolute humidity", "Dew point",
+  "Total volatile organic compounds", "Equivalent CO2 estimated by the SGP30", "CO2 measured by the MH-Z19",
+  "PM1.0 concentration", "PM2.5 concentration", "PM10 concentration", "Time since boot",
+  "Free heap", "WiFi signal strength", "Blocks in the time-series log", "HTTP requests served"
+};
+
+// Serial console, text diagnostics and the binary dump protocol share it
+const uint32_t SerialBaudRate = 115200;
+const size_t SerialTxFifo = 128; // bytes, the UART transmit FIFO
+const uint8_t SerialFramePayload = 112; // bytes, largest payload, so a whole frame fits in the FIFO
+const uint8_t SerialRequestMaxPayload = 16; // bytes, longer requests are dropped
+const uint32_t SerialRequestTimeout = 500; // ms without a byte before a partial request is dropped
+const uint16_t SerialProtocolVersion = 1;
+
+typedef enum : uint8_t {
+  LogLevelStatus,  // startup, checkpoints, errors
+  LogLevelVerbose  // every reading, printed each UpdateInterval
+} LogLevel;
+
+const uint8_t DefaultLogLevel = LogLevelStatus; // 'v' on the console toggles verbose output
+
+// State kept across reboots: SGP30 baseline, history, the last PM reading and the log block in progress
+const uint8_t StateSlots = 4; // checkpoint files written in turn
+const size_t StateWriteChunk = 512; // bytes written per loop pass while a checkpoint is saved
+const uint32_t StateCheckpointInterval = 600000; // ms
+const uint16_t StateVersion = 3; // bump when the layout of the saved state changes
+// Ages are checked once NTP has synced, a checkpoint saved before the clock was ever set counts as too old
+const uint32_t StateBaselineMaxAge = 7 * 86400; // s, the SGP30 datasheet allows restoring a baseline up to 7 days old
+const uint32_t StateHistoryMaxAge = 86400; // s, a longer gap would join readings from unrelated days in the graphs
+
+// Scheduled tasks, see the task table in system.cpp for their timing
+typedef enum : uint8_t {
+  TaskSensors,
+  TaskUpload,
+  TaskHistory,
+  TaskBaseline,
+  TaskPMWake,
+  TaskPMSleep,
+  TaskDisplayCycle,
+  TaskDisplayTimeout,
+  TaskProfile,
+  TaskHomeKit,
+  TaskNetwork,
+  TaskCheckpoint,
+  Tasks
+} Task;
+
+const char * const TaskName[Tasks] = {
+  "Sensors", "Upload", "History", "Baseline", "PMWake", "PMSleep", "DisplayCycle",
+  "DisplayOff", "Profile", "HomeKit", "Network", "Checkpoint"
+};
+const uint32_t UploadCheckInterval = 1000; // ms, the upload task has its own flush interval and backoff
+
+// Idle between scheduled tasks
+const bool IdleSleep = true; // false keeps the loop spinning as before, for comparing power use
+const uint32_t IdleMaxSleep = DebounceInterval; // ms, longest single sleep - bounds button latency
+const uint8_t WiFiListenInterval = 3; // DTIM beacons the modem sleeps through
+
+// Network startup, runs in the background after boot and keeps WiFi connected afterwards
+typedef enum : uint8_t {
+  NetworkConnecting,  // trying the access points in turn
+  NetworkTimeSync,    // waiting for NTP
+  NetworkServerCheck, // waiting for the InfluxDB health check
+  NetworkReady,       // InfluxDB checked and HomeKit started
+  NetworkReconnecting // WiFi dropped after startup, the services stay set up
+} NetworkState;
+
+const uint32_t NetworkCheckInterval = 250; // ms
+const uint32_t WiFiConnectTimeout = 10000; // ms per access point before trying the next one
+const uint32_t ValidTimeStart = 1600000000; // s, an earlier clock means NTP hasn't synced yet
+
+// Current estimates for the duty cycle report
+const float PowerActiveCurrent = 80; // mA, CPU running with the radio on
+const float PowerIdleCurrent = 2; // mA, light sleep averaged over the DTIM wakeups
+
+// Tick profiling, only compiled in with PROFILING
+typedef enum : uint8_t {
+  ProfileTick,
+  ProfileHomeKit,
+  ProfileSensors,
+  ProfileSGP30,
+  ProfileCO2,
+  ProfilePM,
+  ProfileSerial,
+  ProfileUpload,
+  ProfileDisplay,
+  ProfileState,
+  ProfileHttp,
+  ProfileStages
+} ProfileStage;
+
+const char * const ProfileStageName[ProfileStages] = {
+  "Tick", "HomeKit", "Sensors", "SGP30", "CO2", "PM", "Serial", "Upload", "Display", "State", "HTTP"
+};
+const uint8_t ProfileHistogramBuckets = 20; // power of 2 buckets, the last one holds everything from 2^18 us up
+const uint32_t ProfileReportInterval = 60000; // ms, stats are exported and reset after each interval
 
 // Sensor stuff
 const float TemperatureOffset = -13.5; // degrees C, compensate for sensor self heating
 const uint32_t SGP30BaselineCheckInterval = 60000; // ms
 const float VOCPPBToUGM3 = 4.5;
 
+// HomeKit characteristics, notifications are coalesced and sent once per HomeKitFlushInterval
+typedef enum : uint8_t {
+  HomeKitTemperature,
+  HomeKitHumidity,
+  HomeKitCO2Detected,
+  HomeKitCO2Level,
+  HomeKitAirQuality,
+  HomeKitPM25,
+  HomeKitVOC,
+  HomeKitCharacteristics
+} HomeKitCharacteristic;
+
+const char * const HomeKitCharacteristicName[HomeKitCharacteristics] = {
+  "Temperature", "Humidity", "CO2 detected", "CO2 level", "Air quality", "PM2.5", "VOC"
+};
+// ms, shortest time between notifications of each characteristic
+// The first change after a quiet period goes out at the next flush, so CO2 alarms are not delayed,
+// but readings hovering around a threshold can't toggle them more than once a minute
+const uint32_t HomeKitMinInterval[HomeKitCharacteristics] = { 10000, 10000, 60000, 10000, 60000, 10000, 10000 };
+const uint32_t HomeKitFlushInterval = 1000; // ms
+
 // Calibration values - specific to each SGP30 sensor
 const uint16_t SGP30BaselineECO2 = 0x941d;
 const uint16_t SGP30BaselineTVOC = 0x953f;
 
 // CO2 sensor preheat
 const uint16_t MHZ19StartupPeriod = 60; // s
+const uint32_t MHZ19ReplyTimeout = 100; // ms, the loop stays awake this long for a reply
 
 // Particulate matter sensor schedule (to extend sensor life)
 const uint32_t PMMeasurementInterval = 180000; // ms, interval between readings
@@ -0,0 +1,41 @@
+#include <string.h>
+
+#include "frame_diff.hpp"
+
+uint8_t FrameDiff::diff(const uint8_t *frame, tile_run runs[MaxRuns]) {
+  uint8_t count = 0;
+  uint16_t tiles = 0;
+
+  for (uint8_t y = 0; y < DisplayTileHeight; y++) {
+    tile_run *run = nullptr;
+    for (uint8_t x = 0; x < DisplayTileWidth; x++) {
+      if (valid && !tileChanged(frame, x, y)) continue;
+      tiles++;
+      if (run && run->x + run->w + 1 >= x) {
+        // Extend the current run, a single unchanged tile in between is cheaper to resend than
+        // the addressing commands of a new run
+        tiles += x - (run->x + run->w);
+        run->w = x - run->x + 1;
+      } else {
+        run = &runs[count++];
+        run->x = x;
+        run->y = y;
+        run->w = 1;
+      }
+    }
+  }
+
+  memcpy(previous, frame, sizeof(previous));
+  valid = true;
+
+  lastFrameBytes = tiles * 8;
+  totalBytes += lastFrameBytes;
+  frames++;
+  if (count == 0) unchangedFrames++;
+  return count;
+}
+
+bool FrameDiff::tileChanged(const uint8_t *frame, uint8_t x, uint8_t y) const {
+  size_t offset = (size_t)y * DisplayTileWidth * 8 + x * 8;
+  return memcmp(frame + offset, previous + offset, 8) != 0;
+}
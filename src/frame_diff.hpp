@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "constants.hpp"
+
+// Horizontal run of changed 8x8 tiles in one tile row
+typedef struct {
+  uint8_t x;
+  uint8_t y;
+  uint8_t w;
+} tile_run;
+
+// Compares display frames against the last frame sent, so only changed tiles go over I2C
+// Frames use the U8g2 full buffer layout: one 8 pixel high page per tile row, one byte per column
+class FrameDiff {
+  public:
+    static const uint8_t MaxRuns = DisplayTileWidth / 2 * DisplayTileHeight;
+
+    // Find the tiles that changed and remember the frame as sent, returns the number of runs
+    uint8_t diff(const uint8_t *frame, tile_run runs[MaxRuns]);
+    // Force the next frame to be sent in full
+    void invalidate() { valid = false; }
+
+    uint16_t lastFrameBytes = 0; // bytes of pixel data sent for the last frame
+    uint32_t totalBytes = 0;
+    uint32_t frames = 0;
+    uint32_t unchangedFrames = 0;
+
+  private:
+    bool tileChanged(const uint8_t *frame, uint8_t x, uint8_t y) const;
+
+    uint8_t previous[DisplayTileWidth * DisplayTileHeight * 8];
+    bool valid = false;
+};
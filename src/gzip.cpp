@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include "gzip.hpp"
+
+// Deflate length and distance codes (RFC 1951 3.2.5)
+static const uint16_t LengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DistanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+  4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DistanceExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint16_t MinMatch = 3;
+static const uint16_t MaxMatch = 258;
+
+static_assert((GzipWindowSize & (GzipWindowSize - 1)) == 0, "GzipWindowSize must be a power of 2");
+static_assert(GzipWindowSize <= 32768, "deflate distances are limited to 32 KiB");
+
+size_t GzipEncoder::compress(const uint8_t *data, size_t length, uint8_t *out, size_t capacity) {
+  // Positions are stored as uint16 + 1
+  if (length >= 65535) return 0;
+  this->out = out;
+  this->capacity = capacity;
+  position = 0;
+  bitBuffer = 0;
+  bitCount = 0;
+  overflow = false;
+  memset(head, 0, sizeof(head));
+
+  // Gzip header: deflate, no flags, no mtime, no extra flags, unknown OS
+  static const uint8_t Header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+  for (uint8_t i = 0; i < sizeof(Header); i++) putByte(Header[i]);
+
+  // A single final block with the fixed codes
+  putBits(1, 1);
+  putBits(1, 2);
+
+  size_t i = 0;
+  while (i < length && !overflow) {
+    uint16_t bestLength = 0;
+    uint16_t bestDistance = 0;
+    if (i + MinMatch <= length) {
+      size_t limit = length - i < MaxMatch ? length - i : MaxMatch;
+      uint16_t candidate = head[hash(data + i)];
+      for (uint8_t chain = 0; candidate > 0 && chain < GzipMaxChain; chain++) {
+        size_t match = candidate - 1;
+        if (match >= i || i - match > GzipWindowSize) break;
+        uint16_t matchLength = 0;
+        while (matchLength < limit && data[match + matchLength] == data[i + matchLength]) matchLength++;
+        if (matchLength > bestLength) {
+          bestLength = matchLength;
+          bestDistance = i - match;
+          if (matchLength == limit) break;
+        }
+        candidate = prev[match & (GzipWindowSize - 1)];
+      }
+    }
+
+    if (bestLength >= MinMatch) {
+      putMatch(bestLength, bestDistance);
+      for (uint16_t k = 0; k < bestLength; k++) insert(data, length, i + k);
+      i += bestLength;
+    } else {
+      putLiteral(data[i]);
+      insert(data, length, i);
+      i++;
+    }
+  }
+
+  putLiteral(256); // end of block
+  if (bitCount > 0) putBits(0, 8 - bitCount);
+
+  uint32_t crc = crc32(0, data, length);
+  for (uint8_t b = 0; b < 4; b++) putByte(crc >> (8 * b));
+  for (uint8_t b = 0; b < 4; b++) putByte(length >> (8 * b));
+  return overflow ? 0 : position;
+}
+
+// CRC-32 as used by gzip, nibble at a time to keep the table small
+uint32_t GzipEncoder::crc32(uint32_t crc, const uint8_t *data, size_t length) {
+  static const uint32_t Table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+  };
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ Table[crc & 15];
+    crc = (crc >> 4) ^ Table[crc & 15];
+  }
+  return ~crc;
+}
+
+// Deflate packs values starting at the least significant bit
+void GzipEncoder::putBits(uint32_t value, uint8_t count) {
+  bitBuffer |= value << bitCount;
+  bitCount += count;
+  while (bitCount >= 8) {
+    putByte(bitBuffer);
+    bitBuffer >>= 8;
+    bitCount -= 8;
+  }
+}
+
+// Huffman codes are packed starting at the most significant bit
+void GzipEncoder::putCode(uint16_t code, uint8_t length) {
+  uint16_t reversed = 0;
+  for (uint8_t b = 0; b < length; b++) {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+  putBits(reversed, length);
+}
+
+void GzipEncoder::putByte(uint8_t byte) {
+  if (position < capacity) out[position++] = byte;
+  else overflow = true;
+}
+
+// Fixed literal/length code (RFC 1951 3.2.6)
+void GzipEncoder::putLiteral(uint16_t symbol) {
+  if (symbol < 144) putCode(0x30 + symbol, 8);
+  else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+  else if (symbol < 280) putCode(symbol - 256, 7);
+  else putCode(0xc0 + symbol - 280, 8);
+}
+
+void GzipEncoder::putMatch(uint16_t length, uint16_t distance) {
+  uint8_t code = 28;
+  while (LengthBase[code] > length) code--;
+  putLiteral(257 + code);
+  putBits(length - LengthBase[code], LengthExtra[code]);
+
+  code = 29;
+  while (DistanceBase[code] > distance) code--;
+  putCode(code, 5);
+  putBits(distance - DistanceBase[code], DistanceExtra[code]);
+}
+
+// Make the three bytes at a position findable by later matches
+void GzipEncoder::insert(const uint8_t *data, size_t length, size_t position) {
+  if (position + MinMatch > length) return;
+  uint16_t h = hash(data + position);
+  prev[position & (GzipWindowSize - 1)] = head[h];
+  head[h] = position + 1;
+}
+
+uint16_t GzipEncoder::hash(const uint8_t *p) {
+  return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & ((1 << GzipHashBits) - 1);
+}
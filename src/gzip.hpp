@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "constants.hpp"
+
+// Gzip encoder for upload batches
+// Deflate with the fixed Huffman codes and LZ77 matches found through hash chains over a bounded
+// window, so the working memory is the two tables below regardless of the batch size. Line protocol
+// is mostly measurement, tag and field names repeated every few records, which the match window
+// covers; the fixed codes avoid building and sending a dynamic code for every small batch.
+class GzipEncoder {
+  public:
+    // Compress length bytes of data into out, returns the compressed length or 0 if it didn't fit
+    size_t compress(const uint8_t *data, size_t length, uint8_t *out, size_t capacity);
+
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+  private:
+    void putBits(uint32_t value, uint8_t count);
+    void putCode(uint16_t code, uint8_t length);
+    void putByte(uint8_t byte);
+    void putLiteral(uint16_t symbol);
+    void putMatch(uint16_t length, uint16_t distance);
+    void insert(const uint8_t *data, size_t length, size_t position);
+    static uint16_t hash(const uint8_t *p);
+
+    uint16_t head[1 << GzipHashBits];  // newest position + 1 with each hash, 0 if none
+    uint16_t prev[GzipWindowSize];     // previous position + 1 with the same hash, by position
+    uint8_t *out;
+    size_t capacity;
+    size_t position;
+    uint32_t bitBuffer;
+    uint8_t bitCount;
+    bool overflow;
+};
@@ -0,0 +1,78 @@
+#include "history.hpp"
+
+SensorHistory::SensorHistory() {
+  for (uint8_t t = 0; t < HistoryTiers; t++) {
+    resetAccumulator(accumulators[t]);
+    versions[t] = 0;
+  }
+}
+
+// Add a live sample to the minute bucket being filled
+void SensorHistory::addSample(const sensor_data &data) {
+  history_accumulator &acc = accumulators[HistoryTierMinute];
+  for (uint8_t c = 0; c < HistoryChannels; c++) {
+    uint16_t value = historyQuantize(historyChannelValue(data, c), c);
+    acc.sum[c] += value;
+    if (value < acc.min[c]) acc.min[c] = value;
+    if (value > acc.max[c]) acc.max[c] = value;
+  }
+  acc.count++;
+  updates++;
+}
+
+// Close the current minute bucket, called every DataHistoryUpdateInterval
+void SensorHistory::closeMinute() {
+  if (accumulators[HistoryTierMinute].count > 0) closeBucket(HistoryTierMinute);
+  updates++;
+}
+
+// Fill every tier with one reading, so graphs start out flat instead of empty
+void SensorHistory::fill(const sensor_data &data) {
+  history_accumulator acc;
+  resetAccumulator(acc);
+  for (uint8_t c = 0; c < HistoryChannels; c++) {
+    uint16_t value = historyQuantize(historyChannelValue(data, c), c);
+    acc.sum[c] = value;
+    acc.min[c] = value;
+    acc.max[c] = value;
+  }
+  acc.count = 1;
+
+  for (uint8_t t = 0; t < HistoryTiers; t++) {
+    tiers[t].fill(acc);
+    resetAccumulator(accumulators[t]);
+    versions[t]++;
+  }
+  updates++;
+}
+
+// Store the finished bucket of a tier and fold it into the bucket of the next tier
+void SensorHistory::closeBucket(uint8_t t) {
+  history_accumulator &acc = accumulators[t];
+  tiers[t].push(acc);
+  versions[t]++;
+
+  if (t + 1 < HistoryTiers) {
+    // Buckets of a tier all span the same time, so the next tier averages their means
+    history_accumulator &next = accumulators[t + 1];
+    for (uint8_t c = 0; c < HistoryChannels; c++) {
+      next.sum[c] += (acc.sum[c] + acc.count / 2) / acc.count;
+      if (acc.min[c] < next.min[c]) next.min[c] = acc.min[c];
+      if (acc.max[c] > next.max[c]) next.max[c] = acc.max[c];
+    }
+    next.count++;
+    resetAccumulator(acc);
+    if (next.count >= HistoryTierFactor[t + 1]) closeBucket(t + 1);
+  } else {
+    resetAccumulator(acc);
+  }
+}
+
+void SensorHistory::resetAccumulator(history_accumulator &acc) {
+  for (uint8_t c = 0; c < HistoryChannels; c++) {
+    acc.sum[c] = 0;
+    acc.min[c] = 65535;
+    acc.max[c] = 0;
+  }
+  acc.count = 0;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "constants.hpp"
+#include "sensor_data.hpp"
+#include "ring_buffer.hpp"
+
+// Get the value of one history channel from a full sensor reading
+inline float historyChannelValue(const sensor_data &data, uint8_t channel) {
+  switch (channel) {
+    case HistoryTemperature: return data.temperature;
+    case HistoryHumidity: return data.humidity;
+    case HistoryTVOC: return data.tvoc;
+    case HistoryCO2: return data.co2;
+    case HistoryPM25: return data.pm25;
+    default: return 0;
+  }
+}
+
+// Convert a channel value to its stored representation, clamped to the uint16 range
+inline uint16_t historyQuantize(float value, uint8_t channel) {
+  float q = (value - HistoryOffset[channel]) / HistoryStep[channel] + 0.5f;
+  if (q <= 0) return 0;
+  if (q >= 65535) return 65535;
+  return (uint16_t)q;
+}
+
+inline float historyDequantize(uint16_t raw, uint8_t channel) {
+  return raw * HistoryStep[channel] + HistoryOffset[channel];
+}
+
+// Min/max/sum of the quantized samples in the bucket currently being filled
+typedef struct {
+  uint32_t sum[HistoryChannels];
+  uint16_t min[HistoryChannels];
+  uint16_t max[HistoryChannels];
+  uint16_t count;
+} history_accumulator;
+
+// Column oriented storage for one history tier
+// Each statistic of each channel is its own array of quantized uint16 values, so scanning one
+// channel for a graph only touches that channel's memory
+template <size_t N>
+class HistoryBuckets {
+  public:
+    // Read-only view of one statistic of one channel, indexed from the oldest bucket
+    class ChannelView {
+      public:
+        ChannelView(const HistoryBuckets *buckets, uint8_t channel, uint8_t stat)
+          : buckets(buckets), channel(channel), stat(stat) {}
+        float operator[](size_t i) const { return historyDequantize(raw(i), channel); }
+        uint16_t raw(size_t i) const { return buckets->columns[stat][channel][buckets->index.slot(i)]; }
+        size_t size() const { return buckets->size(); }
+
+      private:
+        const HistoryBuckets *buckets;
+        uint8_t channel;
+        uint8_t stat;
+    };
+
+    void push(const history_accumulator &bucket) {
+      bool evicting = index.full();
+      size_t slot = index.push();
+      for (uint8_t c = 0; c < HistoryChannels; c++) {
+        uint16_t mean = (bucket.sum[c] + bucket.count / 2) / bucket.count;
+        if (evicting) {
+          uint16_t old = columns[HistoryMean][c][slot];
+          if (old == meanMin[c] || old == meanMax[c]) rangeStale |= 1 << c;
+        }
+        if (index.size() == 1) {
+          meanMin[c] = mean;
+          meanMax[c] = mean;
+        } else {
+          if (mean < meanMin[c]) meanMin[c] = mean;
+          if (mean > meanMax[c]) meanMax[c] = mean;
+        }
+        columns[HistoryMean][c][slot] = mean;
+        columns[HistoryMin][c][slot] = bucket.min[c];
+        columns[HistoryMax][c][slot] = bucket.max[c];
+      }
+    }
+
+    // Range of the stored means of a channel
+    // Kept up to date as buckets are added, and only rescanned after the bucket holding the
+    // current minimum or maximum has been overwritten
+    void meanRange(uint8_t c, uint16_t &min, uint16_t &max) const {
+      if (rangeStale & (1 << c)) {
+        meanMin[c] = 65535;
+        meanMax[c] = 0;
+        for (size_t i = 0; i < index.size(); i++) {
+          uint16_t value = columns[HistoryMean][c][index.slot(i)];
+          if (value < meanMin[c]) meanMin[c] = value;
+          if (value > meanMax[c]) meanMax[c] = value;
+        }
+        rangeStale &= ~(1 << c);
+      }
+      min = meanMin[c];
+      max = meanMax[c];
+    }
+
+    // Fill every bucket with the same values
+    void fill(const history_accumulator &bucket) {
+      for (size_t i = 0; i < N; i++) push(bucket);
+    }
+
+    ChannelView channel(uint8_t c, uint8_t stat = HistoryMean) const { return ChannelView(this, c, stat); }
+
+    size_t size() const { return index.size(); }
+    static constexpr size_t capacity() { return N; }
+    bool empty() const { return index.empty(); }
+
+  private:
+    uint16_t columns[HistoryStats][HistoryChannels][N];
+    RingIndex<N> index;
+    mutable uint16_t meanMin[HistoryChannels];
+    mutable uint16_t meanMax[HistoryChannels];
+    mutable uint8_t rangeStale = 0; // bit per channel
+};
+
+// Multi-resolution history
+// Samples are aggregated into minute buckets, and every closed bucket is folded into the bucket of
+// the next tier, so each sample costs O(1) work no matter how many tiers there are
+class SensorHistory {
+  public:
+    typedef HistoryBuckets<DataHistoryLength> Tier;
+
+    SensorHistory();
+
+    void addSample(const sensor_data &data);
+    void closeMinute();
+    void fill(const sensor_data &data);
+
+    const Tier &tier(uint8_t t) const { return tiers[t]; }
+    Tier::ChannelView channel(uint8_t t, uint8_t c, uint8_t stat = HistoryMean) const {
+      return tiers[t].channel(c, stat);
+    }
+
+    // Incremented whenever a bucket is added to the given tier
+    uint32_t version(uint8_t t) const { return versions[t]; }
+    // Incremented by every change, samples included
+    uint32_t changes() const { return updates; }
+
+  private:
+    void closeBucket(uint8_t t);
+    static void resetAccumulator(history_accumulator &acc);
+
+    Tier tiers[HistoryTiers];
+    history_accumulator accumulators[HistoryTiers];
+    uint32_t versions[HistoryTiers];
+    uint32_t updates = 0;
+};
+
+static_assert(sizeof(SensorHistory) <= DataHistoryMaxBytes, "history outgrew its share of the heap");
@@ -0,0 +1,56 @@
+#include "homekit_notifier.hpp"
+
+HomeKitNotifier::HomeKitNotifier(homekit_characteristic_t *const *characteristics)
+  : characteristics(characteristics) {
+  memset(counters, 0, sizeof(counters));
+  for (uint8_t c = 0; c < HomeKitCharacteristics; c++) {
+    current[c] = 0;
+    sent[c] = false;
+    pending[c] = false;
+  }
+}
+
+void HomeKitNotifier::setFloat(uint8_t c, float value) {
+  characteristics[c]->value.float_value = value;
+  current[c] = value;
+}
+
+void HomeKitNotifier::setInt(uint8_t c, int value) {
+  characteristics[c]->value.int_value = value;
+  current[c] = value;
+}
+
+void HomeKitNotifier::notify(uint8_t c) {
+  if (pending[c]) counters[c].coalesced++;
+  pending[c] = true;
+}
+
+void HomeKitNotifier::flush(uint32_t time) {
+  for (uint8_t c = 0; c < HomeKitCharacteristics; c++) {
+    if (!pending[c]) continue;
+    if (sent[c] && current[c] == lastSent[c]) {
+      counters[c].unchanged++;
+      pending[c] = false;
+      continue;
+    }
+    if (sent[c] && time - lastTime[c] < HomeKitMinInterval[c]) {
+      counters[c].rateLimited++;
+      continue;
+    }
+    homekit_characteristic_notify(characteristics[c], characteristics[c]->value);
+    counters[c].sent++;
+    lastSent[c] = current[c];
+    lastTime[c] = time;
+    sent[c] = true;
+    pending[c] = false;
+  }
+}
+
+void HomeKitNotifier::print(Print &out) const {
+  out.printf("Characteristic      sent  unchanged  coalesced  rate limited\n");
+  for (uint8_t c = 0; c < HomeKitCharacteristics; c++) {
+    const homekit_notify_stats &stats = counters[c];
+    out.printf("%-14s %9u %10u %10u %13u\n", HomeKitCharacteristicName[c], (unsigned int)stats.sent,
+               (unsigned int)stats.unchanged, (unsigned int)stats.coalesced, (unsigned int)stats.rateLimited);
+  }
+}
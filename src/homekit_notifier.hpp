@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+#include <arduino_homekit_server.h>
+
+#include "constants.hpp"
+
+// Notification counts of one characteristic
+typedef struct {
+  uint32_t sent;
+  uint32_t unchanged;   // requests dropped because the value matched the last notification
+  uint32_t coalesced;   // requests merged into a notification that was already pending
+  uint32_t rateLimited; // flushes that held a pending notification back for the minimum interval
+} homekit_notify_stats;
+
+// Coalesces HomeKit characteristic notifications
+// Requests only mark a characteristic, and flush() sends the marked characteristics together once
+// per cycle. Values equal to the last one sent are dropped, and each characteristic is sent at most
+// once per HomeKitMinInterval, anything newer waits for the next flush after that.
+class HomeKitNotifier {
+  public:
+    HomeKitNotifier(homekit_characteristic_t *const *characteristics);
+
+    // Update the value served to controller reads, without notifying
+    void setFloat(uint8_t c, float value);
+    void setInt(uint8_t c, int value);
+    // Request a notification of the current value at the next flush
+    void notify(uint8_t c);
+    void flush(uint32_t time);
+
+    const homekit_notify_stats &stats(uint8_t c) const { return counters[c]; }
+    void print(Print &out) const;
+
+  private:
+    homekit_characteristic_t *const *characteristics;
+    float current[HomeKitCharacteristics];
+    float lastSent[HomeKitCharacteristics];
+    uint32_t lastTime[HomeKitCharacteristics];
+    bool sent[HomeKitCharacteristics];
+    bool pending[HomeKitCharacteristics];
+    homekit_notify_stats counters[HomeKitCharacteristics];
+};
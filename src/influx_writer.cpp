@@ -0,0 +1,229 @@
+#include "influx_writer.hpp"
+
+void InfluxWriter::begin(const char *url, const char *org, const char *bucket, const char *token,
+                         const char *certificate) {
+  this->url = url;
+  this->token = token;
+  secure = strncmp(url, "https:", 6) == 0;
+  if (secure) {
+#ifdef ESP8266_WIFI
+    trustAnchors = new BearSSL::X509List(certificate);
+    secureClient.setTrustAnchors(trustAnchors);
+#else
+    secureClient.setCACert(certificate);
+#endif
+  }
+
+  // scheme://host[:port][/path]
+  const char *authority = strstr(url, "://");
+  authority = authority ? authority + 3 : url;
+  size_t authorityLength = strcspn(authority, "/");
+  snprintf(host, sizeof(host), "%.*s", (int)authorityLength, authority);
+  char *colon = strchr(host, ':');
+  port = secure ? 443 : 80;
+  if (colon) {
+    port = atoi(colon + 1);
+    *colon = '\0';
+  }
+  const char *path = authority + authorityLength;
+  int pathLength = strlen(path);
+  if (pathLength > 0 && path[pathLength - 1] == '/') pathLength--;
+
+  char encodedOrg[InfluxUrlMaxLength / 4];
+  char encodedBucket[InfluxUrlMaxLength / 4];
+  urlEncode(encodedOrg, sizeof(encodedOrg), org);
+  urlEncode(encodedBucket, sizeof(encodedBucket), bucket);
+  snprintf(writePath, sizeof(writePath), "%.*s/api/v2/write?org=%s&bucket=%s&precision=s", pathLength, path,
+           encodedOrg, encodedBucket);
+  snprintf(healthPath, sizeof(healthPath), "%.*s/health", pathLength, path);
+}
+
+void InfluxWriter::startHealthCheck() {
+  payloadLength = 0;
+  start("GET", healthPath, nullptr, 0, false);
+}
+
+void InfluxWriter::startWrite(const char *data, size_t length) {
+  size_t compressedLength = 0;
+  if (UploadCompression) compressedLength = encoder.compress((const uint8_t *)data, length, compressed, sizeof(compressed));
+
+  payloadLength = length;
+  if (compressedLength > 0 && compressedLength < length) {
+    start("POST", writePath, compressed, compressedLength, true);
+  } else {
+    start("POST", writePath, (const uint8_t *)data, length, false);
+  }
+}
+
+// GET without a body, POST with one
+void InfluxWriter::start(const char *method, const char *path, const uint8_t *body, size_t length, bool compressed) {
+  error[0] = '\0';
+  status = 0;
+  char bodyHeaders[96] = "";
+  if (body) {
+    snprintf(bodyHeaders, sizeof(bodyHeaders), "Content-Type: text/plain; charset=utf-8\r\n%sContent-Length: %u\r\n",
+             compressed ? "Content-Encoding: gzip\r\n" : "", (unsigned int)length);
+  }
+  headerLength = snprintf(header, sizeof(header), "%s %s HTTP/1.1\r\nHost: %s:%u\r\nAuthorization: Token %s\r\n%s\r\n",
+                          method, path, host, port, token, bodyHeaders);
+  if (headerLength >= sizeof(header)) {
+    fail(InfluxRequestTooLong, "request too long");
+    return;
+  }
+
+  this->body = body;
+  requestLength = headerLength + length;
+  sent = 0;
+  lineLength = 0;
+  contentLength = -1;
+  keepAlive = true;
+  lastProgress = millis();
+  state = InfluxSending;
+  reused = client().connected();
+  if (!reused) connect();
+}
+
+uint8_t InfluxWriter::poll() {
+  if (state == InfluxIdle) return InfluxFailed;
+  if (state == InfluxSending && send()) state = InfluxResponseStatus;
+  if (state >= InfluxResponseStatus && state <= InfluxResponseBody && receive()) finish();
+
+  if (state != InfluxDone) {
+    if (!client().connected() && client().available() == 0) {
+      if (state == InfluxResponseBody && contentLength < 0) {
+        // Without a Content-Length the body ends when the server closes the connection
+        finish();
+      } else if (reused && state <= InfluxResponseStatus && lineLength == 0) {
+        // The server closed the kept-alive connection meanwhile, send the request again on a new one
+        reused = false;
+        sent = 0;
+        state = InfluxSending;
+        connect();
+      } else {
+        fail(InfluxConnectionLost, "connection lost");
+      }
+    } else if (millis() - lastProgress >= UploadTimeout) {
+      fail(InfluxReadTimeout, state == InfluxSending ? "send timeout" : "read timeout");
+    }
+  }
+
+  if (state != InfluxDone) return InfluxPending;
+  state = InfluxIdle;
+  return ok ? InfluxOk : InfluxFailed;
+}
+
+// Connecting is the one step that waits, for at most UploadTimeout
+bool InfluxWriter::connect() {
+  client().stop();
+  client().setTimeout(UploadTimeout);
+  if (client().connect(host, port)) {
+    lastProgress = millis();
+    return true;
+  }
+  fail(InfluxConnectFailed, "connection refused");
+  return false;
+}
+
+// Write as much of the request as the send buffer takes, true once it's all out
+bool InfluxWriter::send() {
+  while (sent < requestLength) {
+    const uint8_t *data = sent < headerLength ? (const uint8_t *)header + sent : body + sent - headerLength;
+    size_t length = sent < headerLength ? headerLength - sent : requestLength - sent;
+#ifndef DUAL_CORE
+    // The rest goes out on later passes, on dual core this runs in the network task and may wait
+    int room = client().availableForWrite();
+    if (room <= 0) return false;
+    if (length > (size_t)room) length = room;
+#endif
+    size_t written = client().write(data, length);
+    if (written == 0) return false;
+    sent += written;
+    lastProgress = millis();
+  }
+  return true;
+}
+
+// Parse the response as far as it has arrived, true once it's complete
+bool InfluxWriter::receive() {
+  while (client().available() > 0) {
+    char c = client().read();
+    lastProgress = millis();
+    if (state == InfluxResponseBody) {
+      if (lineLength < sizeof(line) - 1) line[lineLength++] = c;
+      if (contentLength > 0 && --contentLength == 0) return true;
+      continue;
+    }
+
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (lineLength < sizeof(line) - 1) line[lineLength++] = c;
+      continue;
+    }
+    line[lineLength] = '\0';
+    lineLength = 0;
+
+    if (state == InfluxResponseStatus) {
+      // HTTP/1.1 204 No Content
+      const char *code = strchr(line, ' ');
+      status = code ? atoi(code + 1) : 0;
+      state = InfluxResponseHeaders;
+    } else if (line[0] != '\0') {
+      const char *value = strchr(line, ':');
+      if (!value) continue;
+      value++;
+      while (*value == ' ') value++;
+      if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atol(value);
+      if (strncasecmp(line, "Connection:", 11) == 0 && strncasecmp(value, "close", 5) == 0) keepAlive = false;
+    } else {
+      // End of the headers
+      if (contentLength == 0 || status == 204 || status == 304) return true;
+      if (contentLength < 0) keepAlive = false;
+      state = InfluxResponseBody;
+    }
+  }
+  return false;
+}
+
+void InfluxWriter::finish() {
+  if (!keepAlive) client().stop();
+  ok = status >= 200 && status < 300;
+  if (ok) {
+    payloadBytes += payloadLength;
+    sentBytes += requestLength - headerLength;
+  } else {
+    line[lineLength] = '\0';
+    snprintf(error, sizeof(error), "%d %.80s", status, line);
+  }
+  state = InfluxDone;
+}
+
+// A request that got no response leaves the connection in an unknown state
+void InfluxWriter::fail(int status, const char *message) {
+  client().stop();
+  this->status = status;
+  snprintf(error, sizeof(error), "%s", message);
+  ok = false;
+  state = InfluxDone;
+}
+
+WiFiClient &InfluxWriter::client() {
+  if (secure) return secureClient;
+  return plainClient;
+}
+
+// Percent encode a query parameter, truncated to the capacity
+void InfluxWriter::urlEncode(char *out, size_t capacity, const char *s) {
+  size_t position = 0;
+  for (; *s; s++) {
+    char c = *s;
+    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      if (position + 1 >= capacity) break;
+      out[position++] = c;
+    } else {
+      if (position + 3 >= capacity) break;
+      sprintf(out + position, "%%%02X", (uint8_t)c);
+      position += 3;
+    }
+  }
+  out[position] = '\0';
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "constants.hpp"
+#include "gzip.hpp"
+
+#ifdef ESP8266_WIFI
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecureBearSSL.h>
+#else
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#endif
+
+// Status of requests that got no response
+typedef enum {
+  InfluxConnectFailed = -1,
+  InfluxSendFailed = -2,
+  InfluxReadTimeout = -3,
+  InfluxConnectionLost = -4,
+  InfluxRequestTooLong = -5
+} InfluxError;
+
+typedef enum : uint8_t {
+  InfluxIdle,
+  InfluxSending,         // request line, headers and body
+  InfluxResponseStatus,  // waiting for the status line
+  InfluxResponseHeaders,
+  InfluxResponseBody,
+  InfluxDone             // result ready for poll()
+} InfluxState;
+
+typedef enum : uint8_t {
+  InfluxPending,
+  InfluxOk,     // 2xx response
+  InfluxFailed  // see lastStatusCode()
+} InfluxResult;
+
+// InfluxDB v2 write API over a kept-alive WiFiClient
+// HTTPClient builds every request from Strings, so requests are written from fixed buffers and the
+// response is parsed as it arrives. Batches are gzip compressed with Content-Encoding when that
+// makes them smaller.
+// A request is started and then advanced by poll() once per pass of the loop: the request goes
+// out as the TCP send buffer has room and the response is read as it arrives, so only opening a
+// connection waits on the network. That takes a round trip, the TLS handshake for https and a DNS
+// lookup unless it's cached, bounded by UploadTimeout, and the connection is kept open so it only
+// happens for the first request and after a failure.
+class InfluxWriter {
+  public:
+    void begin(const char *url, const char *org, const char *bucket, const char *token,
+               const char *certificate);
+    void startHealthCheck();
+    // Write newline separated line protocol records with second precision timestamps
+    // The data must stay unchanged until the request is complete.
+    void startWrite(const char *data, size_t length);
+    // Take the next step of the request, InfluxPending until it's complete
+    uint8_t poll();
+    bool busy() const { return state != InfluxIdle; }
+
+    const char *serverUrl() const { return url; }
+    int lastStatusCode() const { return status; }
+    const char *lastErrorMessage() const { return error; }
+
+    uint32_t payloadBytes = 0; // line protocol written
+    uint32_t sentBytes = 0;    // request bodies sent, after compression
+
+  private:
+    void start(const char *method, const char *path, const uint8_t *body, size_t length, bool compressed);
+    bool connect();
+    bool send();
+    bool receive();
+    void finish();
+    void fail(int status, const char *message);
+    WiFiClient &client();
+    static void urlEncode(char *out, size_t capacity, const char *s);
+
+    const char *url = "";
+    const char *token = "";
+    char host[InfluxHostMaxLength];
+    uint16_t port = 80;
+    char writePath[InfluxUrlMaxLength];
+    char healthPath[InfluxUrlMaxLength];
+    bool secure = false;
+    int status = 0;
+    char error[InfluxErrorMaxLength] = "";
+
+    // Request in progress, the start of the response body is kept for the error message
+    uint8_t state = InfluxIdle;
+    bool ok = false;
+    bool reused = false;        // sent on a connection kept open from an earlier request
+    uint32_t lastProgress = 0;  // ms
+    const uint8_t *body = nullptr;
+    size_t headerLength = 0;
+    size_t requestLength = 0;   // header and body
+    size_t sent = 0;
+    size_t payloadLength = 0;   // line protocol in the body
+    char line[InfluxErrorMaxLength];
+    uint8_t lineLength = 0;
+    int32_t contentLength = -1; // bytes of the body still to come, -1 until the server closes
+    bool keepAlive = true;
+
+    char header[InfluxHeaderMaxLength];
+    WiFiClient plainClient;
+#ifdef ESP8266_WIFI
+    BearSSL::WiFiClientSecure secureClient;
+    BearSSL::X509List *trustAnchors = nullptr;
+#else
+    WiFiClientSecure secureClient;
+#endif
+
+    GzipEncoder encoder;
+    uint8_t compressed[UploadCompressedSize];
+};
@@ -0,0 +1,80 @@
+#include <math.h>
+#include <string.h>
+
+#include "line_protocol.hpp"
+
+void LineProtocolWriter::begin(const char *measurement) {
+  position = 0;
+  fields = 0;
+  overflow = false;
+  putEscaped(measurement, ", ");
+}
+
+void LineProtocolWriter::tag(const char *key, const char *value) {
+  if (*value == '\0') return; // empty tag values are not allowed
+  put(',');
+  putEscaped(key, ",= ");
+  put('=');
+  putEscaped(value, ",= ");
+}
+
+// Fixed point formatting, printf("%f") pulls in dtoa which allocates on newlib
+void LineProtocolWriter::field(const char *name, float value, uint8_t decimalPlaces) {
+  if (isnan(value) || isinf(value)) return; // not representable in line protocol
+  uint64_t scale = 1;
+  for (uint8_t i = 0; i < decimalPlaces; i++) scale *= 10;
+  double magnitude = fabs((double)value) * scale + 0.5;
+  if (magnitude >= 1e18) return;
+  uint64_t scaled = (uint64_t)magnitude;
+
+  fieldName(name);
+  if (value < 0 && scaled > 0) put('-');
+  putUnsigned(scaled / scale);
+  if (decimalPlaces > 0) {
+    put('.');
+    putUnsigned(scaled % scale, decimalPlaces);
+  }
+}
+
+void LineProtocolWriter::field(const char *name, uint32_t value) {
+  fieldName(name);
+  putUnsigned(value);
+  put('i');
+}
+
+size_t LineProtocolWriter::end(uint32_t time) {
+  put(' ');
+  putUnsigned(time);
+  if (position < capacity) buffer[position] = '\0';
+  else overflow = true;
+  return overflow || fields == 0 ? 0 : position;
+}
+
+void LineProtocolWriter::put(char c) {
+  if (position < capacity) buffer[position++] = c;
+  else overflow = true;
+}
+
+void LineProtocolWriter::putEscaped(const char *s, const char *special) {
+  for (; *s; s++) {
+    if (strchr(special, *s)) put('\\');
+    put(*s);
+  }
+}
+
+void LineProtocolWriter::putUnsigned(uint64_t value, uint8_t minDigits) {
+  char digits[20];
+  uint8_t count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0 || count < minDigits);
+  while (count > 0) put(digits[--count]);
+}
+
+// Separator and escaped name of the next field, the first one is separated from the tags by a space
+void LineProtocolWriter::fieldName(const char *name) {
+  put(fields++ == 0 ? ' ' : ',');
+  putEscaped(name, ",= ");
+  put('=');
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Writes one InfluxDB line protocol record into a caller supplied buffer, without touching the heap
+// Usage: begin(measurement), any number of tag(), any number of field(), then end(time). If the
+// record doesn't fit, end() returns 0 and the buffer holds a truncated record.
+class LineProtocolWriter {
+  public:
+    LineProtocolWriter(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    void begin(const char *measurement);
+    void tag(const char *key, const char *value);
+    void field(const char *name, float value, uint8_t decimalPlaces = 2);
+    void field(const char *name, uint32_t value);
+    // Append the timestamp and terminate the record, returns its length
+    size_t end(uint32_t time);
+
+    size_t length() const { return position; }
+    bool overflowed() const { return overflow; }
+
+  private:
+    void put(char c);
+    void putEscaped(const char *s, const char *special);
+    void putUnsigned(uint64_t value, uint8_t minDigits = 1);
+    void fieldName(const char *name);
+
+    char *buffer;
+    size_t capacity;
+    size_t position = 0;
+    uint8_t fields = 0;
+    bool overflow = false;
+};
@@ -8,4 +8,5 @@ void setup() {
 
 void loop() {
   device.tick();
+  device.idle();
 }
@@ -0,0 +1,303 @@
+#include <stdarg.h>
+
+#include "metrics_server.hpp"
+
+// Decimal places of the history CSV, matching HistoryStep
+static const uint8_t HistoryDecimals[HistoryChannels] = { 2, 1, 0, 0, 0 };
+// Bytes of request read from a client per pass
+static const uint16_t HttpReadLimit = 256;
+// Room for the chunk size line in front of the body, three hex digits and CRLF
+static const uint8_t ChunkHeaderLength = 5;
+
+static_assert(HttpChunkSize < 0x1000, "chunk sizes are written as three hex digits");
+
+// snprintf at the end of the text in out, false and nothing appended if it doesn't fit
+static bool appendf(char *out, size_t capacity, size_t &length, const char *format, ...)
+  __attribute__((format(printf, 4, 5)));
+static bool appendf(char *out, size_t capacity, size_t &length, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(out + length, capacity - length, format, args);
+  va_end(args);
+  if (written < 0 || (size_t)written >= capacity - length) return false;
+  length += written;
+  return true;
+}
+
+void MetricsServer::begin(const sensor_data *current, const SensorHistory *history, SeriesLog *log) {
+  this->current = current;
+  this->history = history;
+  this->seriesLog = log;
+  for (uint8_t i = 0; i < HttpMaxClients; i++) connections[i].state = HttpIdle;
+  server.begin();
+  server.setNoDelay(true);
+}
+
+void MetricsServer::poll(uint32_t time) {
+  // Accept one waiting connection if a slot is free
+  for (uint8_t i = 0; i < HttpMaxClients; i++) {
+    http_connection &connection = connections[i];
+    if (connection.state != HttpIdle) continue;
+#ifdef ESP8266_WIFI
+    WiFiClient client = server.accept();
+#else
+    WiFiClient client = server.available();
+#endif
+    if (client) {
+      connection.client = client;
+      connection.state = HttpReading;
+      connection.requestLength = 0;
+      connection.requestLine = false;
+      connection.headerEnd = 0;
+      connection.lastActivity = time;
+    }
+    break;
+  }
+
+  for (uint8_t i = 0; i < HttpMaxClients; i++) {
+    http_connection &connection = connections[i];
+    if (connection.state == HttpIdle) continue;
+    if (!connection.client.connected()) {
+      close(connection);
+      continue;
+    }
+    if (connection.state == HttpReading) receive(connection, time);
+    if (connection.state == HttpSending) send(connection, time);
+    if (connection.state != HttpIdle && time - connection.lastActivity > HttpTimeout) {
+      timeouts++;
+      close(connection, true);
+    }
+  }
+}
+
+bool MetricsServer::busy() const {
+  for (uint8_t i = 0; i < HttpMaxClients; i++) {
+    if (connections[i].state != HttpIdle) return true;
+  }
+  return false;
+}
+
+// Keep the request line and wait for the blank line that ends the headers
+void MetricsServer::receive(http_connection &connection, uint32_t time) {
+  for (uint16_t n = 0; n < HttpReadLimit && connection.client.available() > 0; n++) {
+    char c = connection.client.read();
+    connection.lastActivity = time;
+    if (c == '\n') connection.requestLine = true;
+    if (!connection.requestLine && c != '\r' && connection.requestLength < HttpRequestMaxLength - 1) {
+      connection.request[connection.requestLength++] = c;
+    }
+
+    // Two line ends in a row, with or without CR
+    if (c == '\n') connection.headerEnd++;
+    else if (c != '\r') connection.headerEnd = 0;
+
+    if (connection.headerEnd == 2) {
+      connection.request[connection.requestLength] = '\0';
+      requests++;
+      route(connection);
+      connection.state = HttpSending;
+      return;
+    }
+  }
+}
+
+// Pick the response from the request line and write its headers
+void MetricsServer::route(http_connection &connection) {
+  connection.route = HttpRouteNotFound;
+  connection.item = 0;
+  connection.finished = false;
+  connection.sent = 0;
+
+  const char *target = connection.request + 4;
+  const char *query = nullptr;
+  size_t pathLength = 0;
+  if (strncmp(connection.request, "GET ", 4) == 0) {
+    query = strchr(target, '?');
+    pathLength = strcspn(target, "? ");
+  }
+
+  if (pathLength == 8 && strncmp(target, "/metrics", 8) == 0) {
+    connection.route = HttpRouteMetrics;
+  } else if (pathLength == 8 && strncmp(target, "/history", 8) == 0) {
+    connection.route = HttpRouteHistory;
+    connection.tier = HistoryTierMinute;
+    const char *tier = query ? strstr(query, "tier=") : nullptr;
+    for (uint8_t t = 0; tier && t < HistoryTiers; t++) {
+      size_t length = strlen(HistoryTierLabel[t]);
+      // Followed by another parameter, the protocol or the end of a truncated request line
+      if (strncmp(tier + 5, HistoryTierLabel[t], length) == 0 && strchr("& ", tier[5 + length])) {
+        connection.tier = t;
+      }
+    }
+  } else if (pathLength == 4 && strncmp(target, "/log", 4) == 0) {
+    connection.route = HttpRouteLog;
+    const char *from = query ? strstr(query, "from=") : nullptr;
+    connection.block = seriesLog->findBlock(from ? strtoul(from + 5, nullptr, 10) : 0);
+    connection.pendingSent = false;
+  }
+
+  static const char *ContentType[HttpRouteNotFound] = {
+    "text/plain; version=0.0.4", "text/csv", "application/octet-stream"
+  };
+  if (connection.route == HttpRouteNotFound) {
+    connection.length = snprintf(connection.buffer, sizeof(connection.buffer),
+                                 "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n"
+                                 "Content-Length: 10\r\nConnection: close\r\n\r\nNot found\n");
+    connection.finished = true;
+  } else {
+    connection.length = snprintf(connection.buffer, sizeof(connection.buffer),
+                                 "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+                                 "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n",
+                                 ContentType[connection.route]);
+  }
+}
+
+// Write as much of the buffer as the TCP send buffer takes, generating the next chunk once it's out
+void MetricsServer::send(http_connection &connection, uint32_t time) {
+  if (connection.sent == connection.length) {
+    if (connection.finished) {
+      close(connection);
+      return;
+    }
+    nextChunk(connection);
+  }
+
+  size_t pending = connection.length - connection.sent;
+#ifdef ESP8266_WIFI
+  pending = min(pending, (size_t)connection.client.availableForWrite());
+#endif
+  if (pending == 0) return;
+  size_t written = connection.client.write((const uint8_t *)connection.buffer + connection.sent, pending);
+  if (written > 0) {
+    connection.sent += written;
+    connection.lastActivity = time;
+  }
+}
+
+// Fill the buffer with the next chunk of the body, or the final empty chunk
+void MetricsServer::nextChunk(http_connection &connection) {
+  char *body = connection.buffer + ChunkHeaderLength;
+  size_t length = 0;
+  connection.sent = 0;
+
+  switch (connection.route) {
+    case HttpRouteMetrics:
+      while (connection.item < Metrics &&
+             appendMetric(connection.item, body, HttpChunkSize, length)) {
+        connection.item++;
+      }
+      break;
+
+    case HttpRouteHistory: {
+      // A header row, then the buckets from the oldest
+      uint32_t rows = history->tier(connection.tier).size() + 1;
+      while (connection.item < rows &&
+             appendHistoryRow(connection.tier, connection.item, body, HttpChunkSize, length)) {
+        connection.item++;
+      }
+      break;
+    }
+
+    case HttpRouteLog:
+      // One block per chunk, read from flash straight into the buffer, then the block in progress
+      // A block that can't be read is left out, each block decodes on its own
+      if (connection.pendingSent) break;
+      while (length == 0 && seriesLog->seek(connection.block)) {
+        if (seriesLog->readBlock(connection.block, (uint8_t *)body)) length = SeriesBlockSize;
+        else readErrors++;
+      }
+      if (length > 0) break;
+      if (!seriesLog->pending.empty()) {
+        memcpy(body, seriesLog->pending.data(), seriesLog->pending.length());
+        memset(body + seriesLog->pending.length(), 0, SeriesBlockSize - seriesLog->pending.length());
+        length = SeriesBlockSize;
+      }
+      connection.pendingSent = true;
+      break;
+  }
+
+  if (length == 0) {
+    memcpy(connection.buffer, "0\r\n\r\n", 5);
+    connection.length = 5;
+    connection.finished = true;
+    return;
+  }
+
+  static const char Hex[] = "0123456789abcdef";
+  connection.buffer[0] = Hex[(length >> 8) & 15];
+  connection.buffer[1] = Hex[(length >> 4) & 15];
+  connection.buffer[2] = Hex[length & 15];
+  connection.buffer[3] = '\r';
+  connection.buffer[4] = '\n';
+  body[length] = '\r';
+  body[length + 1] = '\n';
+  connection.length = ChunkHeaderLength + length + 2;
+}
+
+// Append one metric with its HELP and TYPE lines, false if it doesn't fit
+bool MetricsServer::appendMetric(uint8_t metric, char *out, size_t capacity, size_t &length) {
+  const char *type = metric == MetricHttpRequests ? "counter" : "gauge";
+  uint8_t decimals = metric <= MetricDewPoint ? 2 : 0;
+  return appendf(out, capacity, length, "# HELP %s %s\n# TYPE %s %s\n%s %.*f\n", MetricName[metric],
+                 MetricHelp[metric], MetricName[metric], type, MetricName[metric], decimals, metricValue(metric));
+}
+
+// Append the header row (row 0) or one bucket of the tier, false if it doesn't fit
+bool MetricsServer::appendHistoryRow(uint8_t tier, uint32_t row, char *out, size_t capacity, size_t &length) {
+  size_t end = length;
+  bool ok;
+  if (row == 0) {
+    ok = appendf(out, capacity, end, "age_s");
+    for (uint8_t c = 0; ok && c < HistoryChannels; c++) {
+      ok = appendf(out, capacity, end, ",%s", HistoryChannelName[c]);
+    }
+  } else {
+    const SensorHistory::Tier &buckets = history->tier(tier);
+    uint32_t bucketSeconds = DataHistoryUpdateInterval / 1000;
+    for (uint8_t t = 1; t <= tier; t++) bucketSeconds *= HistoryTierFactor[t];
+    size_t i = row - 1;
+    ok = appendf(out, capacity, end, "%u", (unsigned int)((buckets.size() - 1 - i) * bucketSeconds));
+    for (uint8_t c = 0; ok && c < HistoryChannels; c++) {
+      ok = appendf(out, capacity, end, ",%.*f", HistoryDecimals[c], buckets.channel(c)[i]);
+    }
+  }
+  if (!ok || !appendf(out, capacity, end, "\n")) return false;
+  length = end;
+  return true;
+}
+
+float MetricsServer::metricValue(uint8_t metric) {
+  switch (metric) {
+    case MetricTemperature: return current->temperature;
+    case MetricHumidity: return current->humidity;
+    case MetricTemperatureRaw: return current->temperatureRaw;
+    case MetricHumidityRaw: return current->humidityRaw;
+    case MetricAbsoluteHumidity: return current->absoluteHumidity;
+    case MetricDewPoint: return current->dewPoint;
+    case MetricTVOC: return current->tvoc;
+    case MetricECO2: return current->eco2;
+    case MetricCO2: return current->co2;
+    case MetricPM10: return current->pm10;
+    case MetricPM25: return current->pm25;
+    case MetricPM100: return current->pm100;
+    case MetricUptime: return millis() / 1000;
+    case MetricFreeHeap: return ESP.getFreeHeap();
+    case MetricRSSI: return WiFi.RSSI();
+    case MetricLogBlocks: return seriesLog->blocks();
+    case MetricHttpRequests: return requests;
+    default: return 0;
+  }
+}
+
+// A connection that timed out is aborted: the client stopped reading, and a graceful close would
+// keep its unsent data and the connection's memory until the TCP stack gives up on it
+void MetricsServer::close(http_connection &connection, bool abort) {
+#ifdef ESP8266_WIFI
+  if (abort) connection.client.abort();
+  else connection.client.stop();
+#else
+  (void)abort; // the ESP32 WiFiClient has no abort()
+  connection.client.stop();
+#endif
+  connection.state = HttpIdle;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "constants.hpp"
+#include "sensor_data.hpp"
+#include "history.hpp"
+#include "series_log.hpp"
+
+#ifdef ESP8266_WIFI
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+
+typedef enum : uint8_t {
+  HttpIdle,
+  HttpReading,  // waiting for the end of the request headers
+  HttpSending   // response headers and body chunks
+} HttpState;
+
+typedef enum : uint8_t {
+  HttpRouteMetrics,
+  HttpRouteHistory,
+  HttpRouteLog,
+  HttpRouteNotFound
+} HttpRoute;
+
+// One client connection
+// The body is generated one chunk at a time into the buffer, straight from the live data, and
+// sent with chunked transfer encoding, so a response never needs more memory than one chunk.
+typedef struct {
+  WiFiClient client;
+  uint8_t state;
+  uint8_t route;
+  uint8_t tier;          // /history
+  bool finished;         // last chunk generated
+  uint32_t lastActivity; // ms
+  uint32_t item;         // next metric or history row
+  series_position block; // /log, next block in flash
+  bool pendingSent;      // /log, the block in progress is out
+  char request[HttpRequestMaxLength];
+  uint8_t requestLength;
+  bool requestLine;      // first line of the request complete
+  uint8_t headerEnd;     // characters of the blank line ending the headers seen so far
+  uint16_t length;       // bytes in the buffer
+  uint16_t sent;         // bytes of the buffer already written
+  char buffer[HttpChunkSize + 16]; // chunk size line, body and trailing CRLF
+} http_connection;
+
+// Minimal HTTP/1.1 server for local scrapes
+// poll() does a bounded amount of work per call: it accepts at most one connection, reads what
+// the clients have sent and writes at most one chunk to each, never waiting on the network. A
+// scrape therefore spreads over several passes of the loop while the sensors keep to their
+// schedule. Connections beyond HttpMaxClients wait in the TCP backlog until a slot frees up.
+class MetricsServer {
+  public:
+    MetricsServer() : server(HttpPort) {}
+
+    void begin(const sensor_data *current, const SensorHistory *history, SeriesLog *log);
+    void poll(uint32_t time);
+    // True while a connection is open, the loop shouldn't sleep then
+    bool busy() const;
+
+    uint32_t requests = 0;
+    uint32_t timeouts = 0;
+    uint32_t readErrors = 0; // log blocks skipped because flash couldn't be read
+
+  private:
+    void receive(http_connection &connection, uint32_t time);
+    void route(http_connection &connection);
+    void send(http_connection &connection, uint32_t time);
+    void nextChunk(http_connection &connection);
+    bool appendMetric(uint8_t metric, char *out, size_t capacity, size_t &length);
+    bool appendHistoryRow(uint8_t tier, uint32_t row, char *out, size_t capacity, size_t &length);
+    float metricValue(uint8_t metric);
+    void close(http_connection &connection, bool abort = false);
+
+    WiFiServer server;
+    http_connection connections[HttpMaxClients];
+    const sensor_data *current = nullptr;
+    const SensorHistory *history = nullptr;
+    SeriesLog *seriesLog = nullptr;
+};
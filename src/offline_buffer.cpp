@@ -0,0 +1,127 @@
+#include "offline_buffer.hpp"
+
+static const char *OfflineBufferDir = "/offline";
+
+OfflineBuffer::OfflineBuffer() {
+  drainBuffer[0] = '\0';
+}
+
+// Mount the filesystem and find the segments left over from before the last reboot
+bool OfflineBuffer::begin() {
+#ifdef ESP8266
+  mounted = LittleFS.begin();
+#else
+  mounted = LittleFS.begin(true);
+#endif
+  if (!mounted) return false;
+  if (!LittleFS.exists(OfflineBufferDir)) LittleFS.mkdir(OfflineBufferDir);
+
+  uint32_t first;
+  uint32_t last;
+  if (scan(first, last)) {
+    // Segments are numbered consecutively, anything outside the window is stale
+    if (last - first >= OfflineBufferSegments) first = last - OfflineBufferSegments + 1;
+    firstSegment = first;
+    endSegment = last + 1;
+
+    // Remove the stale segments one at a time, the directory isn't changed while it's being read
+    char path[24];
+    uint32_t oldest;
+    while (scan(oldest, last) && oldest < firstSegment) {
+      segmentPath(path, oldest);
+      if (!LittleFS.remove(path)) break;
+      droppedSegments++;
+    }
+  }
+  return true;
+}
+
+// Find the oldest and newest segment files, false if there are none
+bool OfflineBuffer::scan(uint32_t &first, uint32_t &last) {
+  bool found = false;
+  first = 0;
+  last = 0;
+#ifdef ESP8266
+  Dir dir = LittleFS.openDir(OfflineBufferDir);
+  while (dir.next()) {
+    uint32_t segment = strtoul(dir.fileName().c_str(), nullptr, 16);
+#else
+  File dir = LittleFS.open(OfflineBufferDir);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    const char *name = strrchr(file.name(), '/');
+    uint32_t segment = strtoul(name ? name + 1 : file.name(), nullptr, 16);
+#endif
+    if (!found || segment < first) first = segment;
+    if (!found || segment > last) last = segment;
+    found = true;
+  }
+  return found;
+}
+
+// Append records to the newest segment, starting a new segment and dropping the oldest if needed
+bool OfflineBuffer::append(const char *data, size_t length) {
+  if (!mounted || length == 0) return false;
+
+  char path[24];
+  if (!empty()) {
+    segmentPath(path, endSegment - 1);
+    File file = LittleFS.open(path, "r");
+    bool fits = file && file.size() + length <= OfflineBufferSegmentSize;
+    file.close();
+    if (!fits) endSegment++;
+  } else {
+    endSegment++;
+  }
+  if (endSegment - firstSegment > OfflineBufferSegments) {
+    removeFirstSegment();
+    droppedSegments++;
+  }
+
+  segmentPath(path, endSegment - 1);
+  File file = LittleFS.open(path, "a");
+  if (!file) return false;
+  size_t written = file.write((const uint8_t *)data, length);
+  file.close();
+  return written == length;
+}
+
+size_t OfflineBuffer::readBatch() {
+  batchLength = 0;
+  while (!empty()) {
+    char path[24];
+    segmentPath(path, firstSegment);
+    File file = LittleFS.open(path, "r");
+    size_t length = 0;
+    if (file && file.seek(readOffset)) length = file.read((uint8_t *)drainBuffer, OfflineDrainBatchSize);
+    file.close();
+
+    // Only send whole records, the rest is read again with the next batch
+    while (length > 0 && drainBuffer[length - 1] != '\n') length--;
+    if (length > 0) {
+      drainBuffer[length] = '\0';
+      batchLength = length;
+      return batchLength;
+    }
+
+    // Segment fully sent
+    removeFirstSegment();
+  }
+  return 0;
+}
+
+void OfflineBuffer::consumeBatch() {
+  readOffset += batchLength;
+  batchLength = 0;
+}
+
+void OfflineBuffer::segmentPath(char *path, uint32_t segment) {
+  sprintf(path, "%s/%08x", OfflineBufferDir, (unsigned int)segment);
+}
+
+void OfflineBuffer::removeFirstSegment() {
+  char path[24];
+  segmentPath(path, firstSegment);
+  LittleFS.remove(path);
+  firstSegment++;
+  readOffset = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include "constants.hpp"
+
+// Persistent ring log of line protocol records on LittleFS, used while WiFi or the server is down
+// Records are appended to numbered segment files. Once OfflineBufferSegments segments exist, the
+// oldest one is deleted, which bounds both flash usage and wear.
+class OfflineBuffer {
+  public:
+    OfflineBuffer();
+
+    bool begin();
+    bool append(const char *data, size_t length);
+
+    // Load the next batch of whole records from the oldest segment, returns its length
+    size_t readBatch();
+    const char *batch() const { return drainBuffer; }
+    // Mark the loaded batch as sent
+    void consumeBatch();
+
+    bool empty() const { return firstSegment == endSegment; }
+    uint8_t segments() const { return endSegment - firstSegment; }
+
+    uint32_t droppedSegments = 0;
+
+  private:
+    bool scan(uint32_t &first, uint32_t &last);
+    void segmentPath(char *path, uint32_t segment);
+    void removeFirstSegment();
+
+    bool mounted = false;
+    uint32_t firstSegment = 0; // oldest segment
+    uint32_t endSegment = 0;   // one past the segment being appended to
+    size_t readOffset = 0;     // position in the oldest segment
+    size_t batchLength = 0;
+    char drainBuffer[OfflineDrainBatchSize + 1];
+};
@@ -0,0 +1,66 @@
+#include "profiler.hpp"
+
+Profiler::Profiler() {
+  reset();
+}
+
+void Profiler::record(uint8_t stage, uint32_t duration) {
+  profile_stats &stats = stages[stage];
+  if (stats.count == 0 || duration < stats.min) stats.min = duration;
+  if (duration > stats.max) stats.max = duration;
+  stats.total += duration;
+  stats.count++;
+  uint16_t &bucketCount = stats.histogram[bucket(duration)];
+  if (bucketCount < 65535) bucketCount++;
+}
+
+void Profiler::reset() {
+  memset(stages, 0, sizeof(stages));
+  idleTotal = 0;
+}
+
+uint32_t Profiler::mean(uint8_t stage) const {
+  const profile_stats &stats = stages[stage];
+  return stats.count > 0 ? stats.total / stats.count : 0;
+}
+
+float Profiler::dutyCycle() const {
+  uint64_t active = stages[ProfileTick].total;
+  if (active + idleTotal == 0) return 1;
+  return (float)active / (active + idleTotal);
+}
+
+float Profiler::estimatedCurrent() const {
+  float duty = dutyCycle();
+  return duty * PowerActiveCurrent + (1 - duty) * PowerIdleCurrent;
+}
+
+// Index of the highest set bit, so each bucket spans twice the time of the one below it
+uint8_t Profiler::bucket(uint32_t duration) {
+  uint8_t bucket = 0;
+  while (duration > 0 && bucket < ProfileHistogramBuckets - 1) {
+    duration >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void Profiler::print(Print &out) const {
+  out.printf("Stage      count    mean us   min us     max us\n");
+  for (uint8_t s = 0; s < ProfileStages; s++) {
+    const profile_stats &stats = stages[s];
+    if (stats.count == 0) continue;
+    out.printf("%-8s %7u %10u %8u %10u\n", ProfileStageName[s], (unsigned int)stats.count,
+               (unsigned int)mean(s), (unsigned int)stats.min, (unsigned int)stats.max);
+    // Histogram, "<limit:count" in us
+    out.printf("        ");
+    for (uint8_t b = 0; b < ProfileHistogramBuckets - 1; b++) {
+      if (stats.histogram[b] > 0) out.printf(" <%u:%u", 1u << b, stats.histogram[b]);
+    }
+    uint16_t overflow = stats.histogram[ProfileHistogramBuckets - 1];
+    if (overflow > 0) out.printf(" >=%u:%u", 1u << (ProfileHistogramBuckets - 2), overflow);
+    out.printf("\n");
+  }
+  out.printf("Duty cycle %.1f %%, estimated current %.1f mA (%.0f mA without idle sleep)\n",
+             dutyCycle() * 100, estimatedCurrent(), PowerActiveCurrent);
+}
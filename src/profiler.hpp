@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "constants.hpp"
+
+// Timing statistics of one tick stage over the current report interval
+typedef struct {
+  uint32_t count;
+  uint32_t min;   // us
+  uint32_t max;   // us
+  uint64_t total; // us
+  uint16_t histogram[ProfileHistogramBuckets]; // bucket i counts durations below 2^i us
+} profile_stats;
+
+// Per-stage latency statistics for the main loop
+class Profiler {
+  public:
+    Profiler();
+
+    void record(uint8_t stage, uint32_t duration);
+    void recordIdle(uint32_t duration) { idleTotal += duration; }
+    void reset();
+    void print(Print &out) const;
+
+    const profile_stats &stats(uint8_t stage) const { return stages[stage]; }
+    uint32_t mean(uint8_t stage) const;
+    // Share of the time spent running ticks instead of sleeping, and the current draw it implies
+    float dutyCycle() const;
+    float estimatedCurrent() const;
+
+    static uint8_t bucket(uint32_t duration);
+
+  private:
+    profile_stats stages[ProfileStages];
+    uint64_t idleTotal; // us
+};
+
+// Records the time from construction to the end of the enclosing scope
+class ProfileTimer {
+  public:
+    ProfileTimer(Profiler &profiler, uint8_t stage) : profiler(profiler), stage(stage), start(micros()) {}
+    ~ProfileTimer() { profiler.record(stage, micros() - start); }
+
+  private:
+    Profiler &profiler;
+    uint8_t stage;
+    uint32_t start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef PROFILING
+#define PROFILE_STAGE(stage) ProfileTimer PROFILE_CONCAT(profileTimer, __LINE__)(profiler, stage)
+#else
+#define PROFILE_STAGE(stage)
+#endif
@@ -0,0 +1,238 @@
+#include <pgmspace.h>
+
+#include "psychrometrics.hpp"
+
+static const int8_t SaturationTableMin = -80; // C
+static const uint8_t SaturationTableLast = 170; // index of 90 C
+
+// One 1 C step of the table, with everything the interpolation would otherwise divide for
+typedef struct {
+  float value;            // hPa, 6.112 * exp(17.62 * t / (243.12 + t)) at the start of the step
+  float step;             // hPa, to the next entry
+  float curvature;        // step^2 / (2 * value)
+  float inverseStep;      // 1 / step
+  float inverseCurvature; // step / (2 * value)
+} saturation_segment;
+
+static const saturation_segment saturationTable[SaturationTableLast + 1] PROGMEM = {
+  { 0.00107952f, 0.0001873301f, 1.625378e-05f, 5338.171f, 0.08676545f },
+  { 0.00126685f, 0.00021695f, 1.85765e-05f, 4609.358f, 0.08562575f },
+  { 0.0014838f, 0.0002508099f, 2.119748e-05f, 3987.083f, 0.08451609f },
+  { 0.00173461f, 0.0002894101f, 2.414324e-05f, 3455.304f, 0.08342225f },
+  { 0.00202402f, 0.0003333599f, 2.745251e-05f, 2999.761f, 0.08235095f },
+  { 0.00235738f, 0.00038333f, 3.116636e-05f, 2608.718f, 0.08130425f },
+  { 0.00274071f, 0.0004400199f, 3.532251e-05f, 2272.625f, 0.0802748f },
+  { 0.00318073f, 0.0005042502f, 3.997011e-05f, 1983.143f, 0.07926642f },
+  { 0.00368498f, 0.0005768898f, 4.515654e-05f, 1733.433f, 0.07827584f },
+  { 0.00426187f, 0.0006589303f, 5.09388e-05f, 1517.611f, 0.0773053f },
+  { 0.0049208f, 0.0007514399f, 5.737502e-05f, 1330.778f, 0.07635343f },
+  { 0.00567224f, 0.00085558f, 6.452628e-05f, 1168.798f, 0.07541817f },
+  { 0.00652782f, 0.00097265f, 7.246278e-05f, 1028.119f, 0.07450037f },
+  { 0.00750047f, 0.00110408f, 8.126103e-05f, 905.7318f, 0.0736007f },
+  { 0.00860455f, 0.00125139f, 9.099706e-05f, 799.1113f, 0.07271677f },
+  { 0.00985594f, 0.00141626f, 0.0001017556f, 706.0849f, 0.07184806f },
+  { 0.0112722f, 0.0016006f, 0.0001136389f, 624.7658f, 0.07099767f },
+  { 0.0128728f, 0.0018063f, 0.0001267292f, 553.6179f, 0.07015957f },
+  { 0.0146791f, 0.0020357f, 0.0001411556f, 491.2316f, 0.06934007f },
+  { 0.0167148f, 0.002291f, 0.0001570069f, 436.4907f, 0.06853206f },
+  { 0.0190058f, 0.0025749f, 0.0001744234f, 388.3646f, 0.06773985f },
+  { 0.0215807f, 0.002890101f, 0.000193522f, 346.0087f, 0.06696031f },
+  { 0.0244708f, 0.003239799f, 0.0002144658f, 308.6611f, 0.06619725f },
+  { 0.0277106f, 0.0036269f, 0.0002373533f, 275.7176f, 0.06544246f },
+  { 0.0313375f, 0.004055399f, 0.0002624055f, 246.5848f, 0.06470522f },
+  { 0.0353929f, 0.004528701f, 0.0002897352f, 220.8139f, 0.06397754f },
+  { 0.0399216f, 0.0050513f, 0.0003195717f, 197.9688f, 0.06326525f },
+  { 0.0449729f, 0.0056272f, 0.0003520496f, 177.7083f, 0.06256212f },
+  { 0.0506001f, 0.006261501f, 0.0003874143f, 159.7061f, 0.06187242f },
+  { 0.0568616f, 0.0069592f, 0.0004258626f, 143.6947f, 0.0611942f },
+  { 0.0638208f, 0.007725701f, 0.0004676097f, 129.4381f, 0.06052651f },
+  { 0.0715465f, 0.008567095f, 0.0005129189f, 116.7257f, 0.05987081f },
+  { 0.0801136f, 0.009489603f, 0.0005620305f, 105.3785f, 0.05922592f },
+  { 0.0896032f, 0.0104998f, 0.0006151887f, 95.23993f, 0.05859053f },
+  { 0.100103f, 0.011605f, 0.0006726875f, 86.16974f, 0.05796531f },
+  { 0.111708f, 0.012813f, 0.0007348311f, 78.04572f, 0.05735042f },
+  { 0.124521f, 0.01413299f, 0.0008020392f, 70.75643f, 0.05674943f },
+  { 0.138654f, 0.01557101f, 0.0008743219f, 64.2219f, 0.05615061f },
+  { 0.154225f, 0.01713999f, 0.0009524367f, 58.3431f, 0.05556812f },
+  { 0.171365f, 0.018847f, 0.001036412f, 53.05883f, 0.05499082f },
+  { 0.190212f, 0.020704f, 0.001126784f, 48.29984f, 0.05442349f },
+  { 0.210916f, 0.02272201f, 0.001223922f, 44.0102f, 0.05386506f },
+  { 0.233638f, 0.024913f, 0.001328246f, 40.13969f, 0.05331538f },
+  { 0.258551f, 0.02728999f, 0.001440225f, 36.64348f, 0.05277486f },
+  { 0.285841f, 0.02986601f, 0.001560271f, 33.48288f, 0.05224235f },
+  { 0.315707f, 0.032655f, 0.001688827f, 30.62318f, 0.05171726f },
+  { 0.348362f, 0.03567299f, 0.001826494f, 28.03241f, 0.05120104f },
+  { 0.384035f, 0.03893501f, 0.001973693f, 25.68383f, 0.050692f },
+  { 0.42297f, 0.042458f, 0.00213098f, 23.55269f, 0.05019032f },
+  { 0.465428f, 0.04626101f, 0.002299047f, 21.61647f, 0.04969728f },
+  { 0.511689f, 0.05036098f, 0.002478291f, 19.85664f, 0.04921053f },
+  { 0.56205f, 0.05477899f, 0.002669458f, 18.25517f, 0.04873142f },
+  { 0.616829f, 0.05953604f, 0.002873195f, 16.79655f, 0.04825976f },
+  { 0.676365f, 0.06465197f, 0.003089956f, 15.46743f, 0.04779369f },
+  { 0.741017f, 0.07015401f, 0.003320832f, 14.25435f, 0.0473363f },
+  { 0.811171f, 0.07606202f, 0.003566099f, 13.14717f, 0.04688409f },
+  { 0.887233f, 0.08240497f, 0.00382683f, 12.13519f, 0.04643931f },
+  { 0.969638f, 0.08921206f, 0.004104002f, 11.20925f, 0.04600277f },
+  { 1.05885f, 0.09648991f, 0.004396421f, 10.36378f, 0.04556354f },
+  { 1.15534f, 0.10431f, 0.004708823f, 9.586805f, 0.04514257f },
+  { 1.25965f, 0.1126701f, 0.005038917f, 8.875472f, 0.04472277f },
+  { 1.37232f, 0.1215999f, 0.005387424f, 8.22369f, 0.0443045f },
+  { 1.49392f, 0.13116f, 0.005757655f, 7.624274f, 0.04389794f },
+  { 1.62508f, 0.1413701f, 0.00614908f, 7.073634f, 0.04349634f },
+  { 1.76645f, 0.1522599f, 0.006562057f, 6.567715f, 0.04309772f },
+  { 1.91871f, 0.1638801f, 0.006998632f, 6.102022f, 0.04270581f },
+  { 2.08259f, 0.17627f, 0.007459729f, 5.673115f, 0.0423199f },
+  { 2.25886f, 0.1894698f, 0.007946223f, 5.277886f, 0.04193925f },
+  { 2.44833f, 0.20351f, 0.00845808f, 4.913762f, 0.04156099f },
+  { 2.65184f, 0.2184701f, 0.008999258f, 4.577285f, 0.04119217f },
+  { 2.87031f, 0.23437f, 0.00956853f, 4.266758f, 0.0408266f },
+  { 3.10468f, 0.25125f, 0.01016636f, 3.980099f, 0.04046311f },
+  { 3.35593f, 0.2692099f, 0.01079789f, 3.714574f, 0.04010958f },
+  { 3.62514f, 0.28825f, 0.01145998f, 3.469211f, 0.03975708f },
+  { 3.91339f, 0.30846f, 0.01215667f, 3.241911f, 0.03941084f },
+  { 4.22185f, 0.3298802f, 0.01288783f, 3.031403f, 0.03906821f },
+  { 4.55173f, 0.3525801f, 0.01365554f, 2.836235f, 0.03873034f },
+  { 4.90431f, 0.3766198f, 0.014461f, 2.655198f, 0.03839682f },
+  { 5.28093f, 0.4020801f, 0.01530681f, 2.487067f, 0.03806906f },
+  { 5.68301f, 0.4289899f, 0.01619145f, 2.331057f, 0.03774319f },
+  { 6.112f, 0.4574599f, 0.01711957f, 2.185984f, 0.0374231f },
+  { 6.56946f, 0.4875402f, 0.01809095f, 2.051113f, 0.03710657f },
+  { 7.057f, 0.51932f, 0.01910821f, 1.925595f, 0.03679467f },
+  { 7.57632f, 0.5528598f, 0.02017166f, 1.808777f, 0.03648604f },
+  { 8.12918f, 0.5882502f, 0.02128371f, 1.699957f, 0.0361814f },
+  { 8.71743f, 0.6255703f, 0.02244573f, 1.598541f, 0.03588043f },
+  { 9.343f, 0.6648998f, 0.02365898f, 1.503986f, 0.03558278f },
+  { 10.0079f, 0.7063999f, 0.02493035f, 1.415629f, 0.03529211f },
+  { 10.7143f, 0.75f, 0.02624996f, 1.333333f, 0.03499995f },
+  { 11.4643f, 0.7959995f, 0.02763428f, 1.256282f, 0.03471645f },
+  { 12.2603f, 0.8443003f, 0.02907119f, 1.184413f, 0.03443229f },
+  { 13.1046f, 0.8951998f, 0.03057639f, 1.117069f, 0.03415594f },
+  { 13.9998f, 0.9485006f, 0.03213094f, 1.054296f, 0.03387551f },
+  { 14.9483f, 1.0048f, 0.03377049f, 0.9952231f, 0.03360917f },
+  { 15.9531f, 1.063601f, 0.03545537f, 0.9402026f, 0.03333523f },
+  { 17.0167f, 1.125599f, 0.03722734f, 0.8884159f, 0.03307336f },
+  { 18.1423f, 1.190401f, 0.03905389f, 0.840053f, 0.03280734f },
+  { 19.3327f, 1.258598f, 0.04096866f, 0.7945347f, 0.03255102f },
+  { 20.5913f, 1.329901f, 0.0429462f, 0.7519358f, 0.03229278f },
+  { 21.9212f, 1.4048f, 0.04501269f, 0.7118449f, 0.03204205f },
+  { 23.326f, 1.483f, 0.04714242f, 0.6743089f, 0.03178856f },
+  { 24.809f, 1.565201f, 0.04937429f, 0.6388957f, 0.03154502f },
+  { 26.3742f, 1.6509f, 0.05166925f, 0.6057302f, 0.03129763f },
+  { 28.0251f, 1.740799f, 0.05406548f, 0.5744489f, 0.03105785f },
+  { 29.7659f, 1.8347f, 0.05654327f, 0.5450483f, 0.03081882f },
+  { 31.6006f, 1.932802f, 0.05910844f, 0.5173835f, 0.03058173f },
+  { 33.5334f, 2.0355f, 0.06177808f, 0.4912799f, 0.03035033f },
+  { 35.5689f, 2.142597f, 0.06453282f, 0.4667233f, 0.03011897f },
+  { 37.7115f, 2.254501f, 0.06739027f, 0.4435571f, 0.02989143f },
+  { 39.966f, 2.371201f, 0.07034219f, 0.4217273f, 0.02966522f },
+  { 42.3372f, 2.493099f, 0.07340523f, 0.4011072f, 0.02944336f },
+  { 44.8303f, 2.620201f, 0.07657158f, 0.3816501f, 0.02922355f },
+  { 47.4505f, 2.752598f, 0.07983893f, 0.3632932f, 0.02900494f },
+  { 50.2031f, 2.8908f, 0.0832292f, 0.3459249f, 0.02879106f },
+  { 53.0939f, 3.0345f, 0.08671609f, 0.3295436f, 0.02857673f },
+  { 56.1284f, 3.184402f, 0.09033234f, 0.3140307f, 0.02836712f },
+  { 59.3128f, 3.340298f, 0.09405717f, 0.2993745f, 0.02815832f },
+  { 62.6531f, 3.502701f, 0.09791146f, 0.285494f, 0.02795313f },
+  { 66.1558f, 3.6716f, 0.1018856f, 0.2723608f, 0.02774965f },
+  { 69.8274f, 3.847198f, 0.1059823f, 0.2599294f, 0.02754791f },
+  { 73.6746f, 4.0298f, 0.1102096f, 0.2481512f, 0.02734864f },
+  { 77.7044f, 4.219704f, 0.1145746f, 0.2369835f, 0.02715228f },
+  { 81.9241f, 4.416794f, 0.1190618f, 0.2264086f, 0.02695662f },
+  { 86.3409f, 4.621803f, 0.1237019f, 0.2163658f, 0.02676486f },
+  { 90.9627f, 4.834396f, 0.1284669f, 0.2068511f, 0.02657351f },
+  { 95.7971f, 5.054901f, 0.1333653f, 0.1978278f, 0.02638337f },
+  { 100.852f, 5.285004f, 0.1384765f, 0.1892146f, 0.02620178f },
+  { 106.137f, 5.521996f, 0.1436466f, 0.181094f, 0.02601353f },
+  { 111.659f, 5.768005f, 0.1489799f, 0.1733702f, 0.02582866f },
+  { 117.427f, 6.025002f, 0.1545668f, 0.1659751f, 0.02565424f },
+  { 123.452f, 6.288994f, 0.1601896f, 0.1590079f, 0.02547141f },
+  { 129.741f, 6.563004f, 0.1659962f, 0.1523693f, 0.02529271f },
+  { 136.304f, 6.847992f, 0.1720235f, 0.1460282f, 0.02512029f },
+  { 143.152f, 7.142014f, 0.1781615f, 0.1400165f, 0.02494556f },
+  { 150.294f, 7.447998f, 0.1845472f, 0.1342643f, 0.02477809f },
+  { 157.742f, 7.761993f, 0.1909718f, 0.1288329f, 0.02460344f },
+  { 165.504f, 8.089005f, 0.197675f, 0.1236246f, 0.02443749f },
+  { 173.593f, 8.427002f, 0.2045427f, 0.1186662f, 0.0242723f },
+  { 182.02f, 8.776001f, 0.2115652f, 0.1139471f, 0.02410724f },
+  { 190.796f, 9.136993f, 0.2187799f, 0.1094452f, 0.0239444f },
+  { 199.933f, 9.509995f, 0.2261758f, 0.1051525f, 0.02378295f },
+  { 209.443f, 9.895004f, 0.2337417f, 0.1010611f, 0.02362219f },
+  { 219.338f, 10.29401f, 0.24156f, 0.09714391f, 0.02346608f },
+  { 229.632f, 10.705f, 0.2495233f, 0.09341428f, 0.02330904f },
+  { 240.337f, 11.12999f, 0.2577145f, 0.08984734f, 0.02315496f },
+  { 251.467f, 11.56801f, 0.2660763f, 0.0864453f, 0.02300105f },
+  { 263.035f, 12.021f, 0.2746865f, 0.08318778f, 0.02285056f },
+  { 275.056f, 12.487f, 0.2834426f, 0.08008329f, 0.02269901f },
+  { 287.543f, 12.96899f, 0.292469f, 0.07710698f, 0.0225514f },
+  { 300.512f, 13.465f, 0.301662f, 0.07426664f, 0.02240343f },
+  { 313.977f, 13.97702f, 0.311101f, 0.07154601f, 0.02225803f },
+  { 327.954f, 14.504f, 0.3207248f, 0.06894651f, 0.02211285f },
+  { 342.458f, 15.048f, 0.3306134f, 0.066454f, 0.02197058f },
+  { 357.506f, 15.608f, 0.3407072f, 0.0640697f, 0.02182901f },
+  { 373.114f, 16.185f, 0.3510377f, 0.06178561f, 0.02168908f },
+  { 389.299f, 16.77798f, 0.3615483f, 0.05960191f, 0.02154897f },
+  { 406.077f, 17.39099f, 0.3724005f, 0.05750104f, 0.02141342f },
+  { 423.468f, 18.01901f, 0.3833641f, 0.05549694f, 0.02127553f },
+  { 441.487f, 18.668f, 0.3946823f, 0.0535676f, 0.02114218f },
+  { 460.155f, 19.33401f, 0.406172f, 0.05172231f, 0.02100815f },
+  { 479.489f, 20.01898f, 0.4179028f, 0.04995259f, 0.02087533f },
+  { 499.508f, 20.724f, 0.4299072f, 0.04825324f, 0.02074441f },
+  { 520.232f, 21.44904f, 0.4421692f, 0.04662214f, 0.02061488f },
+  { 541.681f, 22.19397f, 0.4546701f, 0.04505728f, 0.0204862f },
+  { 563.875f, 22.95898f, 0.4674041f, 0.04355593f, 0.02035822f },
+  { 586.834f, 23.74701f, 0.480477f, 0.04211057f, 0.02023316f },
+  { 610.581f, 24.55402f, 0.4937099f, 0.04072654f, 0.02010709f },
+  { 635.135f, 25.38501f, 0.5072927f, 0.03939333f, 0.01998395f },
+  { 660.52f, 26.237f, 0.5210895f, 0.03811411f, 0.01986087f },
+  { 686.757f, 27.11298f, 0.5352064f, 0.03688271f, 0.01973986f },
+  { 713.87f, 0, 0, 0, 0 }
+};
+
+static inline float tableValue(uint8_t i) {
+  return pgm_read_float(&saturationTable[i].value);
+}
+
+float getSaturationVaporPressure(float t) {
+  float x = t - SaturationTableMin;
+  if (x <= 0) return tableValue(0);
+  if (x >= SaturationTableLast) return tableValue(SaturationTableLast);
+  uint8_t i = (uint8_t)x;
+  const saturation_segment *segment = &saturationTable[i];
+  float u = x - i;
+  // The chord lies above the exponential, the second order term of a * (1 + d)^u pulls it back
+  return pgm_read_float(&segment->value) +
+         u * (pgm_read_float(&segment->step) - (1 - u) * pgm_read_float(&segment->curvature));
+}
+
+// Temperature at which the saturation vapor pressure equals e
+static float getSaturationTemperature(float e) {
+  if (e <= tableValue(0)) return SaturationTableMin;
+  if (e >= tableValue(SaturationTableLast)) return SaturationTableMin + SaturationTableLast;
+  uint8_t lo = 0;
+  uint8_t hi = SaturationTableLast;
+  while (hi - lo > 1) {
+    uint8_t mid = (lo + hi) / 2;
+    if (tableValue(mid) <= e) lo = mid;
+    else hi = mid;
+  }
+  // Inverse of the interpolation above, to second order as well: ln(1 + u * d) / ln(1 + d), d being
+  // the step between the entries relative to the lower one
+  const saturation_segment *segment = &saturationTable[lo];
+  float u = (e - pgm_read_float(&segment->value)) * pgm_read_float(&segment->inverseStep);
+  return SaturationTableMin + lo + u + u * (1 - u) * pgm_read_float(&segment->inverseCurvature);
+}
+
+// Approximate absolute humidity formula (grams / m^3)
+float getAbsoluteHumidity(float t, float h) {
+  return 216.7f * (h / 100.0f) * getSaturationVaporPressure(t) / (273.15f + t);
+}
+
+// Approximate dew point formula
+float getDewPoint(float t, float h) {
+  return getSaturationTemperature(h * 0.01f * getSaturationVaporPressure(t));
+}
+
+// Approximate relative humidity formula
+float getRelativeHumidity(float t, float td) {
+  return 100.0f * getSaturationVaporPressure(td) / getSaturationVaporPressure(t);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Psychrometric formulas without exp() or log(), which are slow soft-float routines on the ESP8266
+// Saturation vapor pressure (Magnus formula, b = 17.62, c = 243.12) is interpolated from a 1 C
+// lookup table covering -80 to 90 C with a second order correction for the curvature, and the dew
+// point is found by inverting the same interpolation. Each table step carries its own slope and
+// curvature terms, so neither direction divides.
+// Maximum error compared to the exp()/log() formulas, T -40 to 85 C, RH 1 to 100 %, checked by
+// test/test_psychrometrics:
+//   absolute humidity  0.021 % relative
+//   dew point          0.004 C
+//   relative humidity  0.021 %RH
+float getSaturationVaporPressure(float t);  // hPa
+float getAbsoluteHumidity(float t, float h); // g/m^3
+float getDewPoint(float t, float h);         // C
+float getRelativeHumidity(float t, float td); // %RH
@@ -0,0 +1,39 @@
+#include "publish_filter.hpp"
+
+PublishFilter::PublishFilter() {
+  memset(measurements, 0, sizeof(measurements));
+  for (uint8_t m = 0; m < Measurements; m++) valid[m] = false;
+}
+
+bool PublishFilter::update(uint8_t measurement, const float *values, uint32_t time) {
+  publish_stats &stats = measurements[measurement];
+  bool publish = !valid[measurement] || time - lastTime[measurement] >= PublishHeartbeat;
+  for (uint8_t f = 0; f < 3 && !publish; f++) {
+    float band = PublishDeadband[measurement][f];
+    if (band > 0 && fabsf(values[f] - last[measurement][f]) >= band) publish = true;
+  }
+
+  if (!publish) {
+    stats.suppressed++;
+    for (uint8_t f = 0; f < 3; f++) {
+      float error = fabsf(values[f] - last[measurement][f]);
+      if (error > stats.maxError[f]) stats.maxError[f] = error;
+    }
+    return false;
+  }
+
+  stats.published++;
+  for (uint8_t f = 0; f < 3; f++) last[measurement][f] = values[f];
+  lastTime[measurement] = time;
+  valid[measurement] = true;
+  return true;
+}
+
+void PublishFilter::print(Print &out) const {
+  out.printf("Measurement                 published  suppressed  max error\n");
+  for (uint8_t m = 0; m < Measurements; m++) {
+    const publish_stats &stats = measurements[m];
+    out.printf("%-27s %9u %11u  %.2f %.2f %.2f\n", MeasurementName[m], (unsigned int)stats.published,
+               (unsigned int)stats.suppressed, stats.maxError[0], stats.maxError[1], stats.maxError[2]);
+  }
+}
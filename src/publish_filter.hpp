@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "constants.hpp"
+
+// Publishing statistics of one measurement
+typedef struct {
+  uint32_t published;
+  uint32_t suppressed;
+  float maxError[3]; // largest difference between a suppressed value and the last published one
+} publish_stats;
+
+// Change-driven publishing with a deadband per field and a heartbeat per measurement
+// A measurement is published when any field moved by at least its deadband since the last publish,
+// or once PublishHeartbeat has passed. Comparing against the last published value rather than the
+// previous reading means slow drifts are still published, and a receiver holding the last value
+// is never further off than the deadband.
+class PublishFilter {
+  public:
+    PublishFilter();
+
+    // Returns true if the values should be published, and records them as published
+    bool update(uint8_t measurement, const float *values, uint32_t time);
+    // Publish the next reading of a measurement no matter what
+    void reset(uint8_t measurement) { valid[measurement] = false; }
+
+    const publish_stats &stats(uint8_t measurement) const { return measurements[measurement]; }
+    void print(Print &out) const;
+
+  private:
+    publish_stats measurements[Measurements];
+    float last[Measurements][3];
+    uint32_t lastTime[Measurements];
+    bool valid[Measurements];
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Head/count bookkeeping for a ring of N slots, shared by buffers that store their data differently
+template <size_t N>
+class RingIndex {
+  public:
+    // Advance the ring and return the slot to write the new element to
+    size_t push() {
+      size_t slot = head;
+      if (++head == N) head = 0;
+      if (count < N) count++;
+      return slot;
+    }
+
+    void reset(size_t size = 0) {
+      head = size == N ? 0 : size;
+      count = size;
+    }
+
+    // Slot holding element i, counted from the oldest
+    size_t slot(size_t i) const {
+      size_t index = head + (N - count) + i;
+      return index >= N ? index - N : index;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == N; }
+
+  private:
+    size_t head = 0;  // next slot to write
+    size_t count = 0;
+};
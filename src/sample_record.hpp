@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "constants.hpp"
+
+// One measurement as handed from the sensor side to the upload side
+// Kept small and free of pointers so it can be copied through a queue between cores
+typedef struct {
+  uint32_t time;       // s, unix time of the reading
+  uint8_t measurement; // Measurement
+  uint8_t index;       // profile stage for MeasurementProfile, ProfileStages for the power estimate
+  float values[3];     // fields in the order they are written
+} sample_record;
@@ -0,0 +1,69 @@
+#include "scheduler.hpp"
+
+Scheduler::Scheduler(const task_config *configs) : configs(configs) {
+  memset(tasks, 0, sizeof(tasks));
+}
+
+void Scheduler::begin(uint32_t now) {
+  for (uint8_t t = 0; t < Tasks; t++) {
+    tasks[t].next = now + configs[t].phase;
+    tasks[t].enabled = true;
+  }
+}
+
+uint8_t Scheduler::due(uint32_t now) {
+  uint8_t task = Tasks;
+  uint32_t lateness = 0;
+  for (uint8_t t = 0; t < Tasks; t++) {
+    // Signed difference, works across millis() overflow
+    int32_t late = (int32_t)(now - tasks[t].next);
+    if (!tasks[t].enabled || late < 0) continue;
+    if (task == Tasks || (uint32_t)late > lateness) {
+      task = t;
+      lateness = late;
+    }
+  }
+  if (task == Tasks) return Tasks;
+
+  task_state &state = tasks[task];
+  const task_config &config = configs[task];
+  state.runs++;
+  state.totalLateness += lateness;
+  if (lateness > state.maxLateness) state.maxLateness = lateness;
+  if (lateness > config.deadline) state.missed++;
+
+  // Skip runs that are already a whole period overdue instead of running them back to back
+  state.next += config.period;
+  while ((int32_t)(now - state.next) >= (int32_t)config.period) {
+    state.next += config.period;
+    state.missed++;
+  }
+  return task;
+}
+
+uint32_t Scheduler::nextWakeup(uint32_t now) const {
+  uint32_t wakeup = UINT32_MAX;
+  for (uint8_t t = 0; t < Tasks; t++) {
+    if (!tasks[t].enabled) continue;
+    int32_t remaining = (int32_t)(tasks[t].next - now);
+    if (remaining <= 0) return 0;
+    if ((uint32_t)remaining < wakeup) wakeup = remaining;
+  }
+  return wakeup;
+}
+
+void Scheduler::start(uint8_t task, uint32_t now) {
+  tasks[task].next = now + configs[task].period;
+  tasks[task].enabled = true;
+}
+
+void Scheduler::print(Print &out) const {
+  out.printf("Task           runs  missed  mean late ms  max late ms\n");
+  for (uint8_t t = 0; t < Tasks; t++) {
+    const task_state &state = tasks[t];
+    out.printf("%-12s %6u %7u %13u %12u%s\n", TaskName[t], (unsigned int)state.runs,
+               (unsigned int)state.missed,
+               (unsigned int)(state.runs > 0 ? state.totalLateness / state.runs : 0),
+               (unsigned int)state.maxLateness, state.enabled ? "" : " (stopped)");
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "constants.hpp"
+
+// Timing of one periodic task
+typedef struct {
+  uint32_t period;   // ms
+  uint32_t phase;    // ms, time from begin() to the first run
+  uint32_t deadline; // ms, a run started later than this after its scheduled time counts as missed
+} task_config;
+
+// Run statistics of one task
+typedef struct {
+  uint32_t next;          // ms, scheduled time of the next run
+  bool enabled;
+  uint32_t runs;
+  uint32_t missed;        // runs started after the deadline, or skipped entirely
+  uint32_t maxLateness;   // ms
+  uint32_t totalLateness; // ms
+} task_state;
+
+// Cooperative scheduler for a fixed set of periodic tasks
+// Runs are scheduled at multiples of the period from the phase, not from when the last run
+// happened, so periodic tasks don't drift. Giving tasks different phases keeps expensive ones
+// from landing in the same loop pass.
+class Scheduler {
+  public:
+    Scheduler(const task_config *configs);
+
+    void begin(uint32_t now);
+    // Take the most overdue task that is due, returns Tasks if none are due
+    uint8_t due(uint32_t now);
+    // Time until the next task is due, 0 if one is already due
+    uint32_t nextWakeup(uint32_t now) const;
+
+    // Restart a task, its next run is one period from now
+    void start(uint8_t task, uint32_t now);
+    void stop(uint8_t task) { tasks[task].enabled = false; }
+
+    const task_state &state(uint8_t task) const { return tasks[task]; }
+    void print(Print &out) const;
+
+  private:
+    const task_config *configs;
+    task_state tasks[Tasks];
+};
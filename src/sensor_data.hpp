@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+  float temperature;         // C - temperature compensated for sensor self-heating
+  float humidity;            // %RH - humidity compensated for sensor self-heating
+  float temperatureRaw;      // C - raw temperature - for debug purposes
+  float humidityRaw;         // %RH - raw relative humidity - for debug purposes
+  float absoluteHumidity;    // g/m^3 - always correct, independent of sensor temperature
+  float dewPoint;            // C - always correct, independent of sensor temperature
+  uint16_t tvoc;             // ppb
+  uint16_t eco2;             // ppm
+  uint16_t co2;              // ppm
+  uint16_t pm10;             // μg/m^3
+  uint16_t pm25;             // μg/m^3
+  uint16_t pm100;            // μg/m^3
+} sensor_data;
@@ -0,0 +1,265 @@
+#include "serial_protocol.hpp"
+#include "gzip.hpp"
+
+static const uint8_t SyncFirst = 0xA5;
+static const uint8_t SyncSecond = 0x5A;
+// Room for the largest request and then some, the rest waits for the next pass
+static const uint8_t SerialReadLimit = 32;
+
+void SerialProtocol::begin(HardwareSerial *port, const SensorHistory *history, SeriesLog *log) {
+  this->port = port;
+  this->history = history;
+  this->seriesLog = log;
+}
+
+int SerialProtocol::poll(uint32_t time) {
+  if (length == 0 && request != 0) nextFrame();
+  if (length > 0) {
+    if ((size_t)port->availableForWrite() < length) return -1;
+    port->write(buffer, length);
+    length = 0;
+  }
+  if (request != 0) return -1;
+
+  // A request cut short, by a host tool that was interrupted or a byte lost on the line, would
+  // otherwise take the start of whatever comes next as the rest of it
+  if (inputLength > 0 && time - lastInputTime > SerialRequestTimeout) {
+    errors++;
+    inputLength = 0;
+  }
+
+  for (uint8_t n = 0; n < SerialReadLimit && port->available() > 0; n++) {
+    uint8_t byte = port->read();
+    // Anything outside a frame is a text command
+    if (inputLength == 0 && byte != SyncFirst) return byte;
+    lastInputTime = time;
+    if (receive(byte)) return -1;
+  }
+  return -1;
+}
+
+void SerialProtocol::sendStats(const serial_stats &stats) {
+  memcpy(payload(), &stats, sizeof(stats));
+  frame(SerialFrameStats, sizeof(stats));
+  statsReady = true;
+  sent++;
+}
+
+// Collect one request frame, true once it's complete and the reply has started
+bool SerialProtocol::receive(uint8_t byte) {
+  input[inputLength++] = byte;
+  if (inputLength == 2 && byte != SyncSecond) {
+    inputLength = byte == SyncFirst ? 1 : 0;
+    return false;
+  }
+  if (inputLength < 5) return false;
+
+  uint16_t payloadLength = input[3] | input[4] << 8;
+  if (payloadLength > SerialRequestMaxPayload) {
+    errors++;
+    inputLength = 0;
+    return false;
+  }
+  if (inputLength < 5 + payloadLength + 4) return false;
+
+  inputLength = 0;
+  uint32_t crc;
+  memcpy(&crc, input + 5 + payloadLength, sizeof(crc));
+  if (crc != GzipEncoder::crc32(0, input + 2, 3 + payloadLength)) {
+    errors++;
+    return false;
+  }
+  frames++;
+  start(input[2], input + 5, payloadLength);
+  return true;
+}
+
+void SerialProtocol::start(uint8_t type, const uint8_t *data, uint8_t dataLength) {
+  request = type;
+  status = SerialStatusOk;
+  item = 0;
+  sent = 0;
+  statsReady = false;
+
+  bool valid = false;
+  switch (type) {
+    case SerialRequestConfig:
+    case SerialRequestStats:
+      valid = dataLength == 0;
+      break;
+
+    case SerialRequestHistory: {
+      serial_history_request history;
+      if (dataLength != sizeof(history)) break;
+      memcpy(&history, data, sizeof(history));
+      tier = history.tier;
+      valid = tier < HistoryTiers;
+      break;
+    }
+
+    case SerialRequestLog: {
+      serial_log_request log;
+      if (dataLength != sizeof(log)) break;
+      memcpy(&log, data, sizeof(log));
+      position = seriesLog->findBlock(log.from);
+      pendingSent = false;
+      to = log.to ? log.to : UINT32_MAX;
+      block = 0;
+      blockLength = 0;
+      blockOffset = 0;
+      valid = true;
+      break;
+    }
+  }
+
+  if (!valid) {
+    status = SerialStatusBadRequest;
+    finish();
+  }
+}
+
+// Put the next frame of the reply in the buffer, or the end frame once there are no more
+void SerialProtocol::nextFrame() {
+  switch (request) {
+    case SerialRequestConfig:
+      if (item == 0) {
+        serial_config config;
+        memset(&config, 0, sizeof(config));
+        config.version = SerialProtocolVersion;
+        config.updateInterval = UpdateInterval;
+        config.historyLength = DataHistoryLength;
+        config.historyTiers = HistoryTiers;
+        config.historyChannels = HistoryChannels;
+        config.historyStats = HistoryStats;
+        config.seriesChannels = SeriesChannels;
+        config.seriesBlockSize = SeriesBlockSize;
+        uint32_t seconds = DataHistoryUpdateInterval / 1000;
+        for (uint8_t t = 0; t < HistoryTiers; t++) {
+          if (t > 0) seconds *= HistoryTierFactor[t];
+          config.tierSeconds[t] = seconds;
+          snprintf(config.tierLabel[t], sizeof(config.tierLabel[t]), "%s", HistoryTierLabel[t]);
+        }
+        memcpy(payload(), &config, sizeof(config));
+        frame(SerialFrameConfig, sizeof(config));
+      } else if (item <= HistoryChannels + SeriesChannels) {
+        serial_channel channel;
+        memset(&channel, 0, sizeof(channel));
+        bool series = item > HistoryChannels;
+        channel.kind = series ? SerialChannelSeries : SerialChannelHistory;
+        channel.index = series ? item - 1 - HistoryChannels : item - 1;
+        channel.step = series ? SeriesStep[channel.index] : HistoryStep[channel.index];
+        channel.offset = series ? 0 : HistoryOffset[channel.index];
+        snprintf(channel.name, sizeof(channel.name), "%s",
+                 series ? SeriesChannelName[channel.index] : HistoryChannelName[channel.index]);
+        memcpy(payload(), &channel, sizeof(channel));
+        frame(SerialFrameChannel, sizeof(channel));
+      } else {
+        finish();
+        return;
+      }
+      item++;
+      sent++;
+      break;
+
+    case SerialRequestStats:
+      // The frame itself comes from sendStats()
+      if (statsReady) finish();
+      break;
+
+    case SerialRequestHistory: {
+      // Each statistic of each channel in turn, as raw column values from the oldest bucket
+      const SensorHistory::Tier &buckets = history->tier(tier);
+      uint16_t size = buckets.size();
+      uint32_t pieces = (size + SerialHistoryValues - 1) / SerialHistoryValues;
+      if (item >= pieces * HistoryChannels * HistoryStats) {
+        finish();
+        return;
+      }
+      uint32_t column = item / pieces;
+      serial_history_header header;
+      header.tier = tier;
+      header.channel = column / HistoryStats;
+      header.stat = column % HistoryStats;
+      header.size = size;
+      header.first = item % pieces * SerialHistoryValues;
+      header.count = min((uint16_t)SerialHistoryValues, (uint16_t)(size - header.first));
+      memcpy(payload(), &header, sizeof(header));
+      SensorHistory::Tier::ChannelView view = buckets.channel(header.channel, header.stat);
+      for (uint8_t i = 0; i < header.count; i++) {
+        uint16_t raw = view.raw(header.first + i);
+        memcpy(payload() + sizeof(header) + i * sizeof(raw), &raw, sizeof(raw));
+      }
+      frame(SerialFrameHistory, sizeof(header) + header.count * sizeof(uint16_t));
+      item++;
+      sent++;
+      break;
+    }
+
+    case SerialRequestLog:
+      if (!nextLogFrame()) finish();
+      break;
+  }
+}
+
+// Next piece of the current log block, reading the next block once it's all out
+// Returns false when the dump is complete. A block that can't be read is skipped and takes the pass.
+bool SerialProtocol::nextLogFrame() {
+  if (blockOffset >= blockLength) {
+    if (pendingSent) return false;
+    if (seriesLog->seek(position)) {
+      if (!seriesLog->readBlock(position, blockData)) {
+        status = SerialStatusReadError;
+        return true;
+      }
+    } else if (!seriesLog->pending.empty()) {
+      memcpy(blockData, seriesLog->pending.data(), seriesLog->pending.length());
+      memset(blockData + seriesLog->pending.length(), 0, SeriesBlockSize - seriesLog->pending.length());
+      pendingSent = true;
+    } else {
+      return false;
+    }
+
+    series_block_header header;
+    memcpy(&header, blockData, sizeof(header));
+    if (header.startTime > to) return false;
+    // Blocks are zero padded, the host pads them back
+    blockLength = SeriesBlockSize;
+    while (blockLength > sizeof(header) && blockData[blockLength - 1] == 0) blockLength--;
+    blockOffset = 0;
+  }
+
+  serial_log_header header;
+  header.block = block;
+  header.offset = blockOffset;
+  header.length = blockLength;
+  uint8_t piece = min((uint16_t)SerialLogPiece, (uint16_t)(blockLength - blockOffset));
+  memcpy(payload(), &header, sizeof(header));
+  memcpy(payload() + sizeof(header), blockData + blockOffset, piece);
+  frame(SerialFrameLog, sizeof(header) + piece);
+  blockOffset += piece;
+  if (blockOffset >= blockLength) block++;
+  sent++;
+  return true;
+}
+
+void SerialProtocol::frame(uint8_t type, uint8_t payloadLength) {
+  buffer[0] = SyncFirst;
+  buffer[1] = SyncSecond;
+  buffer[2] = type;
+  buffer[3] = payloadLength;
+  buffer[4] = 0;
+  uint32_t crc = GzipEncoder::crc32(0, buffer + 2, 3 + payloadLength);
+  memcpy(buffer + 5 + payloadLength, &crc, sizeof(crc));
+  length = 5 + payloadLength + sizeof(crc);
+}
+
+void SerialProtocol::finish() {
+  serial_end end;
+  end.request = request;
+  end.status = status;
+  end.reserved = 0;
+  end.frames = sent;
+  memcpy(payload(), &end, sizeof(end));
+  frame(SerialFrameEnd, sizeof(end));
+  request = 0;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "constants.hpp"
+#include "history.hpp"
+#include "series_log.hpp"
+
+// Frame: 0xA5 0x5A type length(uint16) payload CRC-32(type, length and payload)
+// Everything is little endian. Requests go from the host to the device, every request is answered
+// by zero or more data frames and an end frame. Frames are sized to fit the UART transmit FIFO and
+// only written once they fit whole, so text printed meanwhile never lands inside a frame and the
+// host can pick the frames out of the console output by their sync bytes and CRC.
+typedef enum : uint8_t {
+  SerialRequestConfig = 0x01,  // no payload
+  SerialRequestStats = 0x02,   // no payload
+  SerialRequestHistory = 0x03, // serial_history_request
+  SerialRequestLog = 0x04,     // serial_log_request
+
+  SerialFrameConfig = 0x81,    // serial_config
+  SerialFrameChannel = 0x82,   // serial_channel, one per history and log channel after the config
+  SerialFrameStats = 0x83,     // serial_stats
+  SerialFrameHistory = 0x84,   // serial_history_header and up to SerialHistoryValues raw values
+  SerialFrameLog = 0x85,       // serial_log_header and a piece of a log block
+  SerialFrameEnd = 0x8F        // serial_end
+} SerialFrameType;
+
+typedef enum : uint8_t {
+  SerialStatusOk,
+  SerialStatusBadRequest, // unknown type or wrong payload length
+  SerialStatusReadError   // a log block couldn't be read, the dump goes on without it
+} SerialStatus;
+
+typedef enum : uint8_t {
+  SerialChannelHistory,
+  SerialChannelSeries
+} SerialChannelKind;
+
+typedef struct __attribute__((packed)) {
+  uint8_t tier;
+} serial_history_request;
+
+typedef struct __attribute__((packed)) {
+  uint32_t from; // s, unix time
+  uint32_t to;   // s, 0 for everything up to the block in progress
+} serial_log_request;
+
+typedef struct __attribute__((packed)) {
+  uint16_t version;
+  uint32_t updateInterval;  // ms between readings
+  uint16_t historyLength;   // buckets per tier
+  uint8_t historyTiers;
+  uint8_t historyChannels;
+  uint8_t historyStats;
+  uint8_t seriesChannels;
+  uint16_t seriesBlockSize; // bytes
+  uint32_t tierSeconds[HistoryTiers]; // bucket length of each tier
+  char tierLabel[HistoryTiers][4];
+} serial_config;
+
+typedef struct __attribute__((packed)) {
+  uint8_t kind;  // SerialChannelKind
+  uint8_t index;
+  float step;    // value = raw * step + offset
+  float offset;
+  char name[16];
+} serial_channel;
+
+typedef struct __attribute__((packed)) {
+  uint32_t uptime;            // s
+  uint32_t time;              // s, unix time, 0 before NTP has synced
+  uint32_t freeHeap;          // bytes
+  int32_t rssi;               // dBm, 0 without WiFi
+  uint32_t logBlocks;
+  uint32_t logRecords;        // since boot
+  uint32_t logFailures;
+  uint32_t checkpoints;
+  uint32_t checkpointFailures;
+  uint32_t httpRequests;
+  uint32_t uploadPayloadBytes;
+  uint32_t uploadSentBytes;
+  uint32_t mhz19Frames;
+  uint32_t mhz19Errors;       // checksum errors and missed replies
+  uint32_t pmsFrames;
+  uint32_t pmsErrors;         // checksum errors and overflows
+  uint32_t serialFrames;      // requests received
+  uint32_t serialErrors;      // requests dropped for a bad CRC or length
+} serial_stats;
+
+typedef struct __attribute__((packed)) {
+  uint8_t tier;
+  uint8_t channel;
+  uint8_t stat;    // HistoryStat
+  uint8_t count;   // values in this frame
+  uint16_t size;   // buckets in the tier, the last one is the newest
+  uint16_t first;  // bucket of the first value, from the oldest
+} serial_history_header;
+
+typedef struct __attribute__((packed)) {
+  uint32_t block;  // blocks sent before this one in the same dump
+  uint16_t offset; // bytes
+  uint16_t length; // bytes of the block sent, the rest is zero
+} serial_log_header;
+
+typedef struct __attribute__((packed)) {
+  uint8_t request; // SerialFrameType of the request
+  uint8_t status;  // SerialStatus
+  uint16_t reserved;
+  uint32_t frames; // data frames sent
+} serial_end;
+
+const uint8_t SerialFrameOverhead = 9; // sync, type, length and CRC
+const uint8_t SerialHistoryValues = (SerialFramePayload - sizeof(serial_history_header)) / sizeof(uint16_t);
+const uint8_t SerialLogPiece = SerialFramePayload - sizeof(serial_log_header);
+
+static_assert(SerialFramePayload + SerialFrameOverhead <= SerialTxFifo, "frames must fit the UART FIFO");
+static_assert(sizeof(serial_config) <= SerialFramePayload, "config must fit one frame");
+static_assert(sizeof(serial_stats) <= SerialFramePayload, "stats must fit one frame");
+
+// Binary dump protocol on the serial console
+// poll() reads requests and writes at most one frame per call, once the FIFO has room for all of
+// it, so a dump runs at the full UART rate while the loop keeps going. Requests that arrive during
+// a dump wait in the receive buffer, as do text commands.
+class SerialProtocol {
+  public:
+    void begin(HardwareSerial *port, const SensorHistory *history, SeriesLog *log);
+    // Returns the next text command typed on the console, or -1
+    int poll(uint32_t time);
+    // True while a dump is in progress, the loop shouldn't sleep then
+    bool busy() const { return request != 0 || length > 0; }
+
+    // Stats are collected by the caller, answer with sendStats() once this is true
+    bool statsRequested() const { return request == SerialRequestStats && !statsReady; }
+    void sendStats(const serial_stats &stats);
+
+    uint32_t frames = 0; // requests received
+    uint32_t errors = 0; // requests dropped, including partial ones that timed out
+
+  private:
+    bool receive(uint8_t byte);
+    void start(uint8_t type, const uint8_t *data, uint8_t dataLength);
+    void nextFrame();
+    bool nextLogFrame();
+    uint8_t *payload() { return buffer + 5; }
+    // Complete the frame around the payload already in the buffer
+    void frame(uint8_t type, uint8_t payloadLength);
+    void finish();
+
+    HardwareSerial *port = nullptr;
+    const SensorHistory *history = nullptr;
+    SeriesLog *seriesLog = nullptr;
+
+    // Request being received
+    uint8_t input[5 + SerialRequestMaxPayload + 4];
+    uint8_t inputLength = 0;
+    uint32_t lastInputTime = 0; // ms, when the last byte of it was read
+
+    // Dump in progress
+    uint8_t request = 0;  // SerialFrameType, 0 when idle
+    uint8_t status = SerialStatusOk;
+    uint32_t item = 0;    // next channel or history frame
+    uint32_t sent = 0;    // data frames
+    bool statsReady = false;
+    uint8_t tier = 0;
+    uint32_t to = 0;
+    uint32_t block = 0;   // log blocks sent
+    series_position position = { 0, 0 }; // next log block in flash
+    bool pendingSent = false; // the block in progress is out
+    uint16_t blockLength = 0;
+    uint16_t blockOffset = 0;
+    uint8_t blockData[SeriesBlockSize];
+
+    // Frame being written
+    uint8_t buffer[SerialFramePayload + SerialFrameOverhead];
+    uint8_t length = 0;
+};
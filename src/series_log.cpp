@@ -0,0 +1,325 @@
+#include "series_log.hpp"
+
+static const char *SeriesDir = "/series";
+static const uint16_t SeriesMagic = 0x5331; // "S1"
+static const uint8_t SeriesRecordMaxSize = 5 + 1 + 5 * SeriesChannels; // time, mask and a varint per channel
+
+static_assert(SeriesChannels <= 8, "the change mask is one byte");
+
+static uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static uint8_t putVarint(uint8_t *out, uint32_t value) {
+  uint8_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = value | 0x80;
+    value >>= 7;
+  }
+  out[length++] = value;
+  return length;
+}
+
+void SeriesBlock::begin(uint32_t time) {
+  header().magic = SeriesMagic;
+  header().records = 0;
+  header().startTime = time;
+  used = sizeof(series_block_header);
+  lastTime = time;
+  lastInterval = 0;
+  for (uint8_t c = 0; c < SeriesChannels; c++) last[c] = 0;
+}
+
+bool SeriesBlock::append(const series_record &record) {
+  // Encode into a scratch record first, so a record that doesn't fit leaves the block unchanged
+  uint8_t encoded[SeriesRecordMaxSize];
+  int32_t interval = record.time - lastTime;
+  uint8_t length = putVarint(encoded, zigzag(interval - lastInterval));
+  uint8_t mask = 0;
+  uint8_t maskPosition = length++;
+  for (uint8_t c = 0; c < SeriesChannels; c++) {
+    int32_t delta = record.values[c] - last[c];
+    if (delta == 0) continue;
+    mask |= 1 << c;
+    length += putVarint(encoded + length, zigzag(delta));
+  }
+  encoded[maskPosition] = mask;
+  if (used + length > SeriesBlockSize) return false;
+
+  memcpy(buffer + used, encoded, length);
+  used += length;
+  header().records++;
+  lastTime = record.time;
+  lastInterval = interval;
+  for (uint8_t c = 0; c < SeriesChannels; c++) last[c] = record.values[c];
+  return true;
+}
+
+bool SeriesDecoder::begin(const uint8_t *data, size_t length) {
+  if (length < sizeof(series_block_header)) return false;
+  series_block_header header;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != SeriesMagic) return false;
+  this->data = data;
+  this->length = length;
+  position = sizeof(header);
+  count = header.records;
+  decoded = 0;
+  start = header.startTime;
+  lastTime = start;
+  lastInterval = 0;
+  for (uint8_t c = 0; c < SeriesChannels; c++) last[c] = 0;
+  return true;
+}
+
+bool SeriesDecoder::next(series_record &record) {
+  if (decoded >= count) return false;
+  uint32_t value;
+  if (!readVarint(value) || position >= length) return false;
+  lastInterval += unzigzag(value);
+  lastTime += lastInterval;
+  uint8_t mask = data[position++];
+  for (uint8_t c = 0; c < SeriesChannels; c++) {
+    if (!(mask & (1 << c))) continue;
+    if (!readVarint(value)) return false;
+    last[c] += unzigzag(value);
+  }
+
+  record.time = lastTime;
+  for (uint8_t c = 0; c < SeriesChannels; c++) record.values[c] = last[c];
+  decoded++;
+  return true;
+}
+
+bool SeriesDecoder::readVarint(uint32_t &value) {
+  value = 0;
+  for (uint8_t shift = 0; shift < 35 && position < length; shift += 7) {
+    uint8_t byte = data[position++];
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+bool SeriesLog::begin() {
+  if (!LittleFS.exists(SeriesDir)) LittleFS.mkdir(SeriesDir);
+  mounted = LittleFS.exists(SeriesDir);
+  if (!mounted) return false;
+
+  uint32_t first;
+  uint32_t last;
+  if (!scan(first, last)) return true;
+
+  // Segments are numbered consecutively, anything outside the window is stale
+  if (last - first >= SeriesSegments) first = last - SeriesSegments + 1;
+  firstSegment = first;
+  endSegment = last + 1;
+
+  // Remove the stale segments one at a time, the directory isn't changed while it's being read
+  char path[24];
+  uint32_t oldest;
+  while (scan(oldest, last) && oldest < firstSegment) {
+    segmentPath(path, oldest);
+    if (!LittleFS.remove(path)) break;
+    droppedSegments++;
+  }
+
+  // Build the index from the first block of each segment
+  for (uint32_t segment = firstSegment; segment < endSegment; segment++) {
+    series_block_header header;
+    segmentTime[segment % SeriesSegments] = readHeader(segment, 0, header) ? header.startTime : 0;
+  }
+  segmentPath(path, endSegment - 1);
+  File file = LittleFS.open(path, "r");
+  lastBlocks = file ? file.size() / SeriesBlockSize : 0;
+  file.close();
+  return true;
+}
+
+// Find the oldest and newest segment files, false if there are none
+bool SeriesLog::scan(uint32_t &first, uint32_t &last) {
+  bool found = false;
+  first = 0;
+  last = 0;
+#ifdef ESP8266
+  Dir dir = LittleFS.openDir(SeriesDir);
+  while (dir.next()) {
+    uint32_t segment = strtoul(dir.fileName().c_str(), nullptr, 16);
+#else
+  File dir = LittleFS.open(SeriesDir);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    const char *name = strrchr(file.name(), '/');
+    uint32_t segment = strtoul(name ? name + 1 : file.name(), nullptr, 16);
+#endif
+    if (!found || segment < first) first = segment;
+    if (!found || segment > last) last = segment;
+    found = true;
+  }
+  return found;
+}
+
+void SeriesLog::resume() {
+  if (pending.empty() || blocks() == 0) return;
+  series_block_header header;
+  if (readHeader(endSegment - 1, lastBlocks - 1, header) && header.startTime >= pending.startTime()) {
+    pending.clear();
+  }
+}
+
+void SeriesLog::addSample(const sensor_data &data) {
+  const float values[SeriesChannels] = {
+    data.temperature, data.humidity, (float)data.tvoc, (float)data.eco2, (float)data.co2,
+    (float)data.pm10, (float)data.pm25, (float)data.pm100
+  };
+  if (samples == 0) {
+    for (uint8_t c = 0; c < SeriesChannels; c++) sum[c] = 0;
+  }
+  for (uint8_t c = 0; c < SeriesChannels; c++) sum[c] += values[c];
+  samples++;
+}
+
+void SeriesLog::closeMinute(uint32_t time) {
+  if (samples == 0) return;
+  series_record record;
+  record.time = time;
+  for (uint8_t c = 0; c < SeriesChannels; c++) record.values[c] = lroundf(sum[c] / samples / SeriesStep[c]);
+  samples = 0;
+  if (time < ValidTimeStart) return;
+
+  if (pending.empty()) pending.begin(time);
+  if (!pending.append(record)) {
+    // Full, write it out and start the next block with this record
+    if (!writeBlock()) failures++;
+    pending.begin(time);
+    pending.append(record);
+  }
+  records++;
+}
+
+uint32_t SeriesLog::blocks() const {
+  if (endSegment == firstSegment) return 0;
+  return (endSegment - firstSegment - 1) * SeriesSegmentBlocks + lastBlocks;
+}
+
+bool SeriesLog::readBlock(uint32_t block, uint8_t *out) {
+  if (block >= blocks()) return false;
+  series_position position = { firstSegment + block / SeriesSegmentBlocks, (uint16_t)(block % SeriesSegmentBlocks) };
+  return readBlock(position, out);
+}
+
+bool SeriesLog::seek(series_position &position) const {
+  if (position.segment < firstSegment) {
+    position.segment = firstSegment;
+    position.block = 0;
+  }
+  if (position.block >= SeriesSegmentBlocks) {
+    position.segment++;
+    position.block = 0;
+  }
+  if (position.segment + 1 < endSegment) return true;
+  return position.segment + 1 == endSegment && position.block < lastBlocks;
+}
+
+bool SeriesLog::readBlock(series_position &position, uint8_t *out) {
+  if (!seek(position)) return false;
+  char path[24];
+  segmentPath(path, position.segment);
+  File file = LittleFS.open(path, "r");
+  bool ok = file && file.seek(position.block * SeriesBlockSize) &&
+            file.read(out, SeriesBlockSize) == SeriesBlockSize;
+  file.close();
+  position.block++;
+  return ok;
+}
+
+series_position SeriesLog::findBlock(uint32_t time) {
+  series_position position = { firstSegment, 0 };
+  if (blocks() == 0) return position;
+
+  // Newest segment starting at or before the time
+  for (uint32_t s = firstSegment + 1; s < endSegment; s++) {
+    if (segmentTime[s % SeriesSegments] > time) break;
+    position.segment = s;
+  }
+
+  // Then the newest block in it starting at or before the time
+  uint16_t count = position.segment + 1 == endSegment ? lastBlocks : SeriesSegmentBlocks;
+  uint16_t low = 0;
+  uint16_t high = count;
+  while (high - low > 1) {
+    uint16_t middle = (low + high) / 2;
+    series_block_header header;
+    if (readHeader(position.segment, middle, header) && header.startTime <= time) low = middle;
+    else high = middle;
+  }
+  position.block = low;
+  return position;
+}
+
+void SeriesLog::print(Print &out) {
+  out.printf("Series log: %u blocks in %u segments, %u records and %u blocks written since boot, %u failures, "
+             "%u stale segments removed\n", (unsigned int)blocks(), (unsigned int)(endSegment - firstSegment),
+             (unsigned int)records, (unsigned int)writtenBlocks, (unsigned int)failures,
+             (unsigned int)droppedSegments);
+  if (!pending.empty()) {
+    out.printf("Block in progress: %u records in %u bytes (%.1f bytes per record)\n", pending.records(),
+               pending.length(), (float)(pending.length() - sizeof(series_block_header)) / pending.records());
+  }
+}
+
+// Append the pending block to the newest segment, starting a new segment and dropping the oldest if needed
+bool SeriesLog::writeBlock() {
+  if (!mounted) return false;
+  if (endSegment == firstSegment || lastBlocks >= SeriesSegmentBlocks) {
+    endSegment++;
+    lastBlocks = 0;
+    if (endSegment - firstSegment > SeriesSegments) {
+      char path[24];
+      segmentPath(path, firstSegment);
+      LittleFS.remove(path);
+      firstSegment++;
+    }
+    segmentTime[(endSegment - 1) % SeriesSegments] = pending.startTime();
+  }
+
+  // Blocks are padded to their full size so they stay aligned in the file. Each is written at its
+  // offset rather than appended, so what a short write left behind is overwritten by the next block.
+  char path[24];
+  segmentPath(path, endSegment - 1);
+  File file = LittleFS.open(path, lastBlocks == 0 ? "w" : "r+");
+  if (!file) return false;
+  if (!file.seek(lastBlocks * SeriesBlockSize)) {
+    file.close();
+    return false;
+  }
+  static const uint8_t Padding[64] = { 0 };
+  size_t written = file.write(pending.data(), pending.length());
+  for (size_t remaining = SeriesBlockSize - pending.length(); remaining > 0;) {
+    size_t chunk = min(remaining, sizeof(Padding));
+    written += file.write(Padding, chunk);
+    remaining -= chunk;
+  }
+  file.close();
+  if (written != SeriesBlockSize) return false;
+  lastBlocks++;
+  writtenBlocks++;
+  return true;
+}
+
+bool SeriesLog::readHeader(uint32_t segment, uint16_t block, series_block_header &header) {
+  char path[24];
+  segmentPath(path, segment);
+  File file = LittleFS.open(path, "r");
+  bool ok = file && file.seek(block * SeriesBlockSize) &&
+            file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) && header.magic == SeriesMagic;
+  file.close();
+  return ok;
+}
+
+void SeriesLog::segmentPath(char *path, uint32_t segment) {
+  sprintf(path, "%s/%08x", SeriesDir, (unsigned int)segment);
+}
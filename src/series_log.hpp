@@ -0,0 +1,136 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include "constants.hpp"
+#include "sensor_data.hpp"
+
+// One minute of readings, values quantized by SeriesStep
+typedef struct {
+  uint32_t time; // s, unix time
+  int32_t values[SeriesChannels];
+} series_record;
+
+inline float seriesValue(int32_t raw, uint8_t channel) {
+  return raw * SeriesStep[channel];
+}
+
+// Header at the start of every block
+typedef struct {
+  uint16_t magic;
+  uint16_t records;
+  uint32_t startTime; // s, time of the first record
+} series_block_header;
+
+// Compressed block of records, each block decodes on its own
+// Timestamps are stored as the zigzag varint of the change in their interval (delta of delta), which
+// is 0 while records arrive once a minute. Each record then has a byte with a bit per channel that
+// changed, followed by the zigzag varint of the change of each of those channels. Quantized minute
+// averages mostly change by a few steps, so a record usually takes under 10 bytes.
+class SeriesBlock {
+  public:
+    void begin(uint32_t time);
+    // Add a record, false if the block is full
+    bool append(const series_record &record);
+
+    const uint8_t *data() const { return buffer; }
+    uint16_t length() const { return used; }
+    uint16_t records() const { return header().records; }
+    uint32_t startTime() const { return header().startTime; }
+    bool empty() const { return used == 0 || records() == 0; }
+    void clear() { used = 0; }
+
+  private:
+    series_block_header &header() { return *(series_block_header *)buffer; }
+    const series_block_header &header() const { return *(const series_block_header *)buffer; }
+
+    uint8_t buffer[SeriesBlockSize];
+    uint16_t used = 0; // bytes, including the header
+    uint32_t lastTime = 0;
+    int32_t lastInterval = 0;
+    int32_t last[SeriesChannels];
+};
+
+// Reads the records of a block in order
+class SeriesDecoder {
+  public:
+    // False if the data isn't a block
+    bool begin(const uint8_t *data, size_t length);
+    bool next(series_record &record);
+
+    uint16_t records() const { return count; }
+    uint32_t startTime() const { return start; }
+
+  private:
+    bool readVarint(uint32_t &value);
+
+    const uint8_t *data = nullptr;
+    size_t length = 0;
+    size_t position = 0;
+    uint16_t count = 0;
+    uint16_t decoded = 0;
+    uint32_t start = 0;
+    uint32_t lastTime = 0;
+    int32_t lastInterval = 0;
+    int32_t last[SeriesChannels];
+};
+
+// Where a reader is in the log: segments keep their number while older ones are dropped, so the
+// position stays on the same block as the log rotates
+typedef struct {
+  uint32_t segment;
+  uint16_t block; // within the segment
+} series_position;
+
+// Append-only log of minute averages on LittleFS
+// Blocks fill up in RAM and are appended to numbered segment files of SeriesSegmentBlocks blocks
+// each. Once SeriesSegments segments exist the oldest is deleted, so the log holds the most recent
+// months. The start time of each segment is kept in RAM as the block index, so finding the block
+// holding a time reads one segment and a few block headers.
+class SeriesLog {
+  public:
+    // Find the segments left over from before the last reboot, the filesystem must already be mounted
+    bool begin();
+    // Continue the block restored from a checkpoint, unless it was written out before the reboot
+    void resume();
+
+    void addSample(const sensor_data &data);
+    // Close the minute and log its averages, minutes before the clock is set are dropped
+    void closeMinute(uint32_t time);
+
+    // Blocks in flash, numbered from the oldest
+    uint32_t blocks() const;
+    bool readBlock(uint32_t block, uint8_t *out);
+    // First block that may hold records at or after the time
+    series_position findBlock(uint32_t time);
+    // Move a position off blocks dropped with their segment, true if a block in flash is there
+    bool seek(series_position &position) const;
+    // Read the block at a position and step past it, even if it couldn't be read
+    bool readBlock(series_position &position, uint8_t *out);
+
+    void print(Print &out);
+
+    // Block being filled, saved with the state checkpoints
+    SeriesBlock pending;
+
+    uint32_t records = 0;       // logged since boot
+    uint32_t writtenBlocks = 0; // written since boot
+    uint32_t failures = 0;
+    uint32_t droppedSegments = 0; // stale segments removed by begin()
+
+  private:
+    bool writeBlock();
+    bool scan(uint32_t &first, uint32_t &last);
+    bool readHeader(uint32_t segment, uint16_t block, series_block_header &header);
+    void segmentPath(char *path, uint32_t segment);
+
+    bool mounted = false;
+    uint32_t firstSegment = 0;  // oldest segment
+    uint32_t endSegment = 0;    // one past the segment being appended to
+    uint16_t lastBlocks = 0;    // blocks in the newest segment
+    uint32_t segmentTime[SeriesSegments]; // start time of each segment, by segment % SeriesSegments
+
+    float sum[SeriesChannels];
+    uint16_t samples = 0;
+};
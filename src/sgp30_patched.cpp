@@ -28,10 +28,34 @@
 #include "sgp30_patched.hpp"
 #include "Arduino.h"
 
+// CRC-8 lookup table, generated at compile time from SGP30_CRC8_POLYNOMIAL
+static constexpr uint8_t crc8Entry(uint8_t crc, uint8_t bits = 8) {
+  return bits == 0 ? crc
+                   : crc8Entry((crc & 0x80) ? (uint8_t)((crc << 1) ^ SGP30_CRC8_POLYNOMIAL)
+                                            : (uint8_t)(crc << 1),
+                               bits - 1);
+}
+
+#define CRC8_ROW(n)                                                            \
+  crc8Entry(n + 0), crc8Entry(n + 1), crc8Entry(n + 2), crc8Entry(n + 3),      \
+      crc8Entry(n + 4), crc8Entry(n + 5), crc8Entry(n + 6), crc8Entry(n + 7),  \
+      crc8Entry(n + 8), crc8Entry(n + 9), crc8Entry(n + 10), crc8Entry(n + 11), \
+      crc8Entry(n + 12), crc8Entry(n + 13), crc8Entry(n + 14), crc8Entry(n + 15)
+
+static const uint8_t crc8Table[256] = {
+    CRC8_ROW(0x00), CRC8_ROW(0x10), CRC8_ROW(0x20), CRC8_ROW(0x30),
+    CRC8_ROW(0x40), CRC8_ROW(0x50), CRC8_ROW(0x60), CRC8_ROW(0x70),
+    CRC8_ROW(0x80), CRC8_ROW(0x90), CRC8_ROW(0xA0), CRC8_ROW(0xB0),
+    CRC8_ROW(0xC0), CRC8_ROW(0xD0), CRC8_ROW(0xE0), CRC8_ROW(0xF0)};
+
+#undef CRC8_ROW
+
 /*!
  *  @brief  Instantiates a new SGP30 class
  */
-Adafruit_SGP30::Adafruit_SGP30() {}
+Adafruit_SGP30::Adafruit_SGP30() {
+  memset(commandStats, 0, sizeof(commandStats));
+}
 
 /*!
  *  @brief  Setups the hardware and detects a valid SGP30. Initializes I2C
@@ -226,6 +250,149 @@ boolean Adafruit_SGP30::setHumidity(uint32_t absolute_humidity) {
   return readWordFromCommand(command, 5, 10);
 }
 
+/*!
+ *  @brief  Starts an eCO2/VOC measurement without waiting for it to complete.
+ *          Use {@link commandReady()} and {@link commandCollect()} to place
+ *          the results in {@link TVOC} and {@link eCO2}
+ *  @return True if command was sent successfully, false if something went
+ *          wrong!
+ */
+boolean Adafruit_SGP30::IAQmeasureStart(void) {
+  uint8_t command[2];
+  command[0] = 0x20;
+  command[1] = 0x08;
+  return startCommand(SGP30_CMD_MEASURE, command, 2, 12, 2);
+}
+
+/*!
+ *  @brief  Starts an H2/ethanol raw measurement without waiting for it to
+ *          complete. Collecting it places the results in {@link rawH2} and
+ *          {@link rawEthanol}
+ *  @return True if command was sent successfully, false if something went
+ *          wrong!
+ */
+boolean Adafruit_SGP30::IAQmeasureRawStart(void) {
+  uint8_t command[2];
+  command[0] = 0x20;
+  command[1] = 0x50;
+  return startCommand(SGP30_CMD_MEASURE_RAW, command, 2, 25, 2);
+}
+
+/*!
+ *  @brief  Requests the baseline calibration values without waiting for the
+ *          reply. Collecting it places the results in {@link baselineECO2}
+ *          and {@link baselineTVOC}
+ *  @return True if command was sent successfully, false if something went
+ *          wrong!
+ */
+boolean Adafruit_SGP30::getIAQBaselineStart(void) {
+  uint8_t command[2];
+  command[0] = 0x20;
+  command[1] = 0x15;
+  return startCommand(SGP30_CMD_GET_BASELINE, command, 2, 10, 2);
+}
+
+/*!
+ *  @brief  Sets the absolute humidity value [mg/m^3] without waiting for the
+ *          sensor to process it. The command must still be collected before
+ *          the next one is sent.
+ *  @param  absolute_humidity
+ *          A uint32_t [mg/m^3] which we will be used for compensation.
+ *  @return True if command was sent successfully, false if something went
+ *          wrong!
+ */
+boolean Adafruit_SGP30::setHumidityStart(uint32_t absolute_humidity) {
+  if (absolute_humidity > 256000) {
+    return false;
+  }
+
+  uint16_t ah_scaled =
+      (uint16_t)(((uint64_t)absolute_humidity * 256 * 16777) >> 24);
+  uint8_t command[5];
+  command[0] = 0x20;
+  command[1] = 0x61;
+  command[2] = ah_scaled >> 8;
+  command[3] = ah_scaled & 0xFF;
+  command[4] = generateCRC(command + 2, 2);
+  return startCommand(SGP30_CMD_SET_HUMIDITY, command, 5, 10);
+}
+
+/*!
+ *  @brief  Checks whether a non-blocking command is waiting to be collected
+ *  @return True if a command was started and not collected yet
+ */
+boolean Adafruit_SGP30::commandPending(void) { return pending; }
+
+/*!
+ *  @brief  Checks whether the sensor has finished processing the pending
+ *          command
+ *  @return True if the pending command can be collected
+ */
+boolean Adafruit_SGP30::commandReady(void) {
+  return pending && millis() - pendingStart >= pendingDelay;
+}
+
+/*!
+ *  @brief  Time until the pending command can be collected, so the caller can
+ *          sleep until then
+ *  @return Milliseconds until the command is ready, 0 if it is ready or no
+ *          command is pending
+ */
+uint16_t Adafruit_SGP30::commandRemaining(void) {
+  if (!pending)
+    return 0;
+  uint32_t elapsed = millis() - pendingStart;
+  return elapsed >= pendingDelay ? 0 : pendingDelay - elapsed;
+}
+
+/*!
+ *  @brief  Reads the reply of the pending command and stores the result.
+ *          Must only be called once {@link commandReady()} returns true.
+ *  @return True if the reply was read successfully, false if something went
+ *          wrong!
+ */
+boolean Adafruit_SGP30::commandCollect(void) {
+  if (!pending)
+    return false;
+  pending = false;
+
+  uint32_t start = micros();
+  uint16_t reply[2];
+  bool ok = readReply(reply, pendingReadlen);
+  uint32_t transfer = pendingTransfer + (micros() - start);
+  uint32_t latency = millis() - pendingStart;
+
+  sgp30_command_stats_t *stats = &commandStats[pendingType];
+  stats->count++;
+  stats->lastTransferMicros = transfer;
+  if (transfer > stats->maxTransferMicros)
+    stats->maxTransferMicros = transfer;
+  stats->lastLatencyMillis = latency;
+  if (latency > stats->maxLatencyMillis)
+    stats->maxLatencyMillis = latency;
+
+  if (!ok)
+    return false;
+
+  switch (pendingType) {
+  case SGP30_CMD_MEASURE:
+    TVOC = reply[1];
+    eCO2 = reply[0];
+    break;
+  case SGP30_CMD_MEASURE_RAW:
+    rawEthanol = reply[1];
+    rawH2 = reply[0];
+    break;
+  case SGP30_CMD_GET_BASELINE:
+    baselineECO2 = reply[0];
+    baselineTVOC = reply[1];
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
 /*!
  *  @brief  I2C low level interfacing
  */
@@ -242,6 +409,30 @@ bool Adafruit_SGP30::readWordFromCommand(uint8_t command[],
 
   delay(delayms);
 
+  return readReply(readdata, readlen);
+}
+
+bool Adafruit_SGP30::startCommand(sgp30_command_t type, uint8_t command[],
+                                  uint8_t commandLength, uint16_t delayms,
+                                  uint8_t readlen) {
+  if (pending)
+    return false;
+
+  uint32_t start = micros();
+  if (!i2c_dev->write(command, commandLength)) {
+    Serial.println("i2c w fail");
+    return false;
+  }
+  pendingTransfer = micros() - start;
+  pendingStart = millis();
+  pendingDelay = delayms;
+  pendingReadlen = readlen;
+  pendingType = type;
+  pending = true;
+  return true;
+}
+
+bool Adafruit_SGP30::readReply(uint16_t *readdata, uint8_t readlen) {
   if (readlen == 0)
     return true;
 
@@ -253,24 +444,21 @@ bool Adafruit_SGP30::readWordFromCommand(uint8_t command[],
     return false;
   }
 
-  for (uint8_t i = 0; i < readlen; i++) {
-    uint8_t crc = generateCRC(replybuffer + i * 3, 2);
+  // Decode all words in one pass, each is 2 data bytes followed by their CRC
+  uint8_t *word = replybuffer;
+  for (uint8_t i = 0; i < readlen; i++, word += SGP30_WORD_LEN + 1) {
+    uint8_t crc = crc8Table[crc8Table[SGP30_CRC8_INIT ^ word[0]] ^ word[1]];
+    if (crc != word[2]) {
 #ifdef I2C_DEBUG
-    Serial.print("\t\tCRC calced: 0x");
-    Serial.print(crc, HEX);
-    Serial.print(" vs. 0x");
-    Serial.println(replybuffer[i * 3 + 2], HEX);
-#endif
-    //if (crc != replybuffer[i * 3 + 2])
-    //  return false;
-    // success! store it
-    readdata[i] = replybuffer[i * 3];
-    readdata[i] <<= 8;
-    readdata[i] |= replybuffer[i * 3 + 1];
-#ifdef I2C_DEBUG
-    Serial.print("\t\tRead: 0x");
-    Serial.println(readdata[i], HEX);
+      Serial.print("\t\tCRC calced: 0x");
+      Serial.print(crc, HEX);
+      Serial.print(" vs. 0x");
+      Serial.println(word[2], HEX);
 #endif
+      crcErrors++;
+      return false;
+    }
+    readdata[i] = (uint16_t)(word[0] << 8) | word[1];
   }
   return true;
 }
@@ -280,13 +468,7 @@ uint8_t Adafruit_SGP30::generateCRC(uint8_t *data, uint8_t datalen) {
   uint8_t crc = SGP30_CRC8_INIT;
 
   for (uint8_t i = 0; i < datalen; i++) {
-    crc ^= data[i];
-    for (uint8_t b = 0; b < 8; b++) {
-      if (crc & 0x80)
-        crc = (crc << 1) ^ SGP30_CRC8_POLYNOMIAL;
-      else
-        crc <<= 1;
-    }
+    crc = crc8Table[crc ^ data[i]];
   }
   return crc;
 }
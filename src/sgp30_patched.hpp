@@ -34,6 +34,24 @@
 #define SGP30_CRC8_INIT 0xFF       ///< Init value for CRC
 #define SGP30_WORD_LEN 2           ///< 2 bytes per word
 
+/** Commands that can be issued without blocking, used to index timing stats */
+typedef enum {
+  SGP30_CMD_MEASURE,      ///< Measure air quality
+  SGP30_CMD_MEASURE_RAW,  ///< Measure raw signals
+  SGP30_CMD_GET_BASELINE, ///< Get baseline
+  SGP30_CMD_SET_HUMIDITY, ///< Set humidity
+  SGP30_CMD_COUNT
+} sgp30_command_t;
+
+/** Timing of one type of command */
+typedef struct {
+  uint32_t count;             ///< Number of completed commands
+  uint32_t lastTransferMicros; ///< Time spent on the I2C bus for the last command
+  uint32_t maxTransferMicros; ///< Worst case time spent on the I2C bus
+  uint32_t lastLatencyMillis; ///< Time from issuing the last command to collecting it
+  uint32_t maxLatencyMillis;  ///< Worst case time from issuing to collecting
+} sgp30_command_stats_t;
+
 /*!
  *  @brief  Class that stores state and functions for interacting with
  *          SGP30 Gas Sensor
@@ -51,6 +69,26 @@ public:
   boolean setIAQBaseline(uint16_t eco2_base, uint16_t tvoc_base);
   boolean setHumidity(uint32_t absolute_humidity);
 
+  boolean IAQmeasureStart();
+  boolean IAQmeasureRawStart();
+  boolean getIAQBaselineStart();
+  boolean setHumidityStart(uint32_t absolute_humidity);
+  boolean commandPending();
+  boolean commandReady();
+  uint16_t commandRemaining();
+  boolean commandCollect();
+
+  /** Timing of the non-blocking commands, indexed by {@link sgp30_command_t} **/
+  sgp30_command_stats_t commandStats[SGP30_CMD_COUNT];
+
+  /** The last eCO2 baseline value. This value is set when you collect
+   *  {@link getIAQBaselineStart()} **/
+  uint16_t baselineECO2;
+
+  /** The last TVOC baseline value. This value is set when you collect
+   *  {@link getIAQBaselineStart()} **/
+  uint16_t baselineTVOC;
+
   /** The last measurement of the IAQ-calculated Total Volatile Organic
    *  Compounds in ppb. This value is set when you call {@link IAQmeasure()} **/
   uint16_t TVOC;
@@ -67,6 +105,9 @@ public:
    *  value is set when you call {@link IAQmeasureRaw()} **/
   uint16_t rawEthanol;
 
+  /** Number of replies dropped because of a CRC mismatch **/
+  uint32_t crcErrors = 0;
+
   /** The 48-bit serial number, this value is set when you call {@link begin()}
    * **/
   uint16_t serialnumber[3];
@@ -78,6 +119,17 @@ private:
   bool readWordFromCommand(uint8_t command[], uint8_t commandLength,
                            uint16_t delay, uint16_t *readdata = NULL,
                            uint8_t readlen = 0);
+  bool startCommand(sgp30_command_t type, uint8_t command[],
+                    uint8_t commandLength, uint16_t delayms,
+                    uint8_t readlen = 0);
+  bool readReply(uint16_t *readdata, uint8_t readlen);
+
+  bool pending = false;          ///< A non-blocking command was issued
+  sgp30_command_t pendingType;   ///< Type of the pending command
+  uint8_t pendingReadlen = 0;    ///< Words to read for the pending command
+  uint16_t pendingDelay = 0;     ///< Conversion time of the pending command
+  uint32_t pendingStart = 0;     ///< millis() when the command was issued
+  uint32_t pendingTransfer = 0;  ///< Microseconds spent writing the command
   uint8_t generateCRC(uint8_t data[], uint8_t datalen);
 };
 #endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free queue for exactly one producer and one consumer, e.g. one task on each core
+// head is only written by the producer and tail only by the consumer. The release store of each
+// index publishes the slot written before it to the other side's acquire load.
+template <typename T, size_t N>
+class SPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "queue length must be a power of 2");
+
+  public:
+    // Producer side, fails if the queue is full
+    bool push(const T &value) {
+      size_t h = head.load(std::memory_order_relaxed);
+      if (h - tail.load(std::memory_order_acquire) == N) return false;
+      slots[h & (N - 1)] = value;
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer side, fails if the queue is empty
+    bool pop(T &value) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if (t == head.load(std::memory_order_acquire)) return false;
+      value = slots[t & (N - 1)];
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Only exact when called from either side while the other is idle
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return N; }
+
+  private:
+    T slots[N];
+    std::atomic<size_t> head{0}; // next slot to write
+    std::atomic<size_t> tail{0}; // next slot to read
+};
@@ -0,0 +1,125 @@
+#include "state_store.hpp"
+#include "gzip.hpp"
+
+static const char *StateDir = "/state";
+static const uint32_t StateMagic = 0x53544154; // "STAT"
+
+bool StateStore::begin(const state_region *regions, uint8_t count, uint32_t layout) {
+  this->regions = regions;
+  this->count = count;
+  this->layout = layout;
+  if (!LittleFS.exists(StateDir)) LittleFS.mkdir(StateDir);
+
+  // Find the newest complete checkpoint
+  bool found = false;
+  uint8_t newest = 0;
+  for (uint8_t slot = 0; slot < StateSlots; slot++) {
+    state_trailer trailer;
+    if (!verify(slot, trailer)) continue;
+    if (!found || (int32_t)(trailer.sequence - sequence) > 0) {
+      sequence = trailer.sequence;
+      newest = slot;
+    }
+    found = true;
+  }
+  if (!found) return false;
+
+  // Already checked against the CRC, so it can be read straight into place
+  char path[16];
+  slotPath(path, newest);
+  File input = LittleFS.open(path, "r");
+  bool ok = (bool)input;
+  for (uint8_t i = 0; ok && i < count; i++) {
+    ok = input.read((uint8_t *)regions[i].data, regions[i].size) == regions[i].size;
+  }
+  input.close();
+  return ok;
+}
+
+void StateStore::save() {
+  if (active) file.close();
+
+  // Overwrite the oldest slot, the newest checkpoint stays intact until this one is complete
+  char path[16];
+  slotPath(path, (sequence + 1) % StateSlots);
+  file = LittleFS.open(path, "w");
+  active = (bool)file;
+  if (!active) failures++;
+  region = 0;
+  offset = 0;
+  crc = 0;
+}
+
+bool StateStore::step() {
+  if (!active) return false;
+
+  size_t budget = StateWriteChunk;
+  while (budget > 0 && region < count) {
+    const uint8_t *data = (const uint8_t *)regions[region].data + offset;
+    size_t length = min(budget, regions[region].size - offset);
+    if (file.write(data, length) != length) {
+      file.close();
+      active = false;
+      failures++;
+      return false;
+    }
+    crc = GzipEncoder::crc32(crc, data, length);
+    budget -= length;
+    offset += length;
+    if (offset == regions[region].size) {
+      region++;
+      offset = 0;
+    }
+  }
+  if (region < count) return false;
+
+  state_trailer trailer = { StateMagic, StateVersion, 0, layout, sequence + 1, (uint32_t)totalSize(), crc };
+  bool ok = file.write((const uint8_t *)&trailer, sizeof(trailer)) == sizeof(trailer);
+  file.close();
+  active = false;
+  if (!ok) {
+    failures++;
+    return false;
+  }
+  sequence++;
+  checkpoints++;
+  return true;
+}
+
+// Check the trailer and the CRC of the data in a slot
+bool StateStore::verify(uint8_t slot, state_trailer &trailer) {
+  char path[16];
+  slotPath(path, slot);
+  if (!LittleFS.exists(path)) return false;
+  File input = LittleFS.open(path, "r");
+  if (!input) return false;
+
+  size_t length = totalSize();
+  bool ok = input.size() == length + sizeof(trailer) && input.seek(length) &&
+            input.read((uint8_t *)&trailer, sizeof(trailer)) == sizeof(trailer) &&
+            trailer.magic == StateMagic && trailer.version == StateVersion && trailer.layout == layout &&
+            trailer.length == length;
+
+  // CRC in small pieces, the data can be larger than the free heap
+  uint32_t check = 0;
+  if (ok) ok = input.seek(0);
+  while (ok && length > 0) {
+    uint8_t buffer[64];
+    size_t chunk = min(length, sizeof(buffer));
+    ok = input.read(buffer, chunk) == chunk;
+    check = GzipEncoder::crc32(check, buffer, chunk);
+    length -= chunk;
+  }
+  input.close();
+  return ok && check == trailer.crc;
+}
+
+void StateStore::slotPath(char *path, uint8_t slot) {
+  sprintf(path, "%s/%u", StateDir, slot);
+}
+
+size_t StateStore::totalSize() const {
+  size_t size = 0;
+  for (uint8_t i = 0; i < count; i++) size += regions[i].size;
+  return size;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include "constants.hpp"
+
+// A block of memory saved with every checkpoint
+typedef struct {
+  void *data;
+  size_t size;
+} state_region;
+
+// Written after the data of each checkpoint, a checkpoint without a matching trailer is ignored
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t layout;  // hash of the constants the data depends on, see begin()
+  uint32_t sequence;
+  uint32_t length;  // bytes of data before the trailer
+  uint32_t crc;     // CRC-32 of the data
+} state_trailer;
+
+// Checkpoints of state that should survive a reboot, on LittleFS
+// Checkpoints rotate through StateSlots files, so writes are spread over several files and a power
+// cut during a write only loses that checkpoint; on boot the newest one with a valid CRC is loaded.
+// Saving is incremental, each step() writes at most StateWriteChunk bytes so a checkpoint never
+// holds up the loop for more than one small flash write.
+class StateStore {
+  public:
+    // Load the newest valid checkpoint into the regions, the filesystem must already be mounted
+    // Checkpoints saved with a different layout hash are ignored, so a change to the constants that
+    // define what the regions hold discards them instead of restoring data that means something else
+    bool begin(const state_region *regions, uint8_t count, uint32_t layout);
+
+    // Start a new checkpoint, or start the one in progress over
+    void save();
+    // Write the next chunk of the checkpoint in progress, returns true once it has been completed
+    bool step();
+    bool saving() const { return active; }
+
+    uint32_t sequence = 0; // of the newest checkpoint
+    uint32_t checkpoints = 0;
+    uint32_t failures = 0;
+
+  private:
+    bool verify(uint8_t slot, state_trailer &trailer);
+    void slotPath(char *path, uint8_t slot);
+    size_t totalSize() const;
+
+    const state_region *regions = nullptr;
+    uint8_t count = 0;
+    uint32_t layout = 0;
+
+    File file;
+    bool active = false;
+    uint8_t region = 0;  // region being written
+    size_t offset = 0;   // position in that region
+    uint32_t crc = 0;
+};
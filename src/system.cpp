@@ -1,26 +1,5 @@
 #include "system.hpp"
 
-// Approximate absolute humidity formula (grams / m^3)
-static float getAbsoluteHumidity(float t, float h) {
-  float b = 17.62;
-  float c = 243.12;
-  return 216.7f * ((h / 100.0f) * 6.112f * exp((b * t) / (c + t)) / (273.15f + t));
-}
-
-// Approximate dew point formula
-static float getDewPoint(float t, float h) {
-  float b = 17.62;
-  float c = 243.12;
-  return c * (log(h / 100.0f) + (b * t) / (c + t)) / (b - log(h / 100.0f) - (b * t) / (c + t));
-}
-
-// Approximate relative humidity formula
-static float getRelativeHumidity(float t, float td) {
-  float b = 17.62;
-  float c = 243.12;
-  return 100.0 * exp((c * b * (td - t)) / ((c + t) * (c + td)));
-}
-
 // Celsius to Fahrenheit
 static float cToF(float t) {
   return t * 1.8 + 32.0;
@@ -35,14 +14,53 @@ extern "C" homekit_characteristic_t cha_co2_level;
 extern "C" homekit_characteristic_t cha_air_quality;
 extern "C" homekit_characteristic_t cha_pm25;
 extern "C" homekit_characteristic_t cha_voc;
+
+// In HomeKitCharacteristic order
+static homekit_characteristic_t *const HomeKitCharacteristicTable[HomeKitCharacteristics] = {
+  &cha_temperature, &cha_humidity, &cha_co2_detected, &cha_co2_level, &cha_air_quality, &cha_pm25, &cha_voc
+};
 #endif
 
-System::System() {
+// Position and scaling of the history graph of each channel
+static const graph_layout GraphLayouts[HistoryChannels] = {
+  // x, y, w, h, padding, fromZero, showRange, decimalPlaces
+  { 0, 16, 62, 15, 1, false, false, 1 },  // Temperature
+  { 64, 16, 62, 15, 1, false, false, 1 }, // Humidity
+  { 0, 16, 128, 15, 0, true, true, 0 },   // TVOC
+  { 0, 16, 128, 15, 0, false, true, 0 },  // CO2
+  { 0, 16, 128, 15, 1, true, true, 0 },   // PM2.5
+};
+
+// Timing of the scheduled tasks
+// Phases are staggered so the sensor reads, network writes and other slow jobs run on different
+// passes of the loop
+static const task_config TaskConfigs[Tasks] = {
+  // period, phase, deadline
+  { UpdateInterval, 0, 50 },                                            // Sensors
+  { UploadCheckInterval, 500, 1000 },                                   // Upload
+  { DataHistoryUpdateInterval, DataHistoryUpdateInterval + 700, 1000 }, // History
+  { SGP30BaselineCheckInterval, 250, 1000 },                            // Baseline
+  { PMMeasurementInterval, 350, 1000 },                                 // PMWake
+  { PMMeasurementInterval, 350 + PMWakeDelay + PMReadPeriod, 1000 },    // PMSleep
+  { DisplayAutoCycleInterval, 800, 200 },                               // DisplayCycle
+  { DisplayTimeout, 950, 1000 },                                        // DisplayTimeout
+  { ProfileReportInterval, ProfileReportInterval + 900, 5000 },         // Profile
+  { HomeKitFlushInterval, 200, 500 },                                   // HomeKit
+  { NetworkCheckInterval, 600, 1000 },                                  // Network
+  { StateCheckpointInterval, StateCheckpointInterval + 100, 1000 },     // Checkpoint
+};
+
+#ifdef ESP8266_HOMEKIT
+System::System() : homekit(HomeKitCharacteristicTable), scheduler(TaskConfigs) {
+}
+#else
+System::System() : scheduler(TaskConfigs) {
 }
+#endif
 
 // Initialize everything
 void System::init() {
-  Serial.begin(115200);
+  Serial.begin(SerialBaudRate);
   Serial.printf("Initializing...\n");
 
   // Inputs
@@ -77,93 +95,107 @@ void System::init() {
   if (!sgp30.begin()) Serial.printf("Failed to communicate with SGP30 sensor\n");
   Serial.printf("SGP30 Serial number: %04x%04x%04x\n",
                 sgp30.serialnumber[0], sgp30.serialnumber[1], sgp30.serialnumber[2]);
-  sgp30.setIAQBaseline(SGP30BaselineECO2, SGP30BaselineTVOC);
 
   // CO2
   //mhz19.setDebug(true);
   mhz19.setAutoCalibrate(false);
 
+  // Flash storage for data that could not be uploaded
+  if (!offlineBuffer.begin()) Serial.printf("Failed to mount filesystem\n");
+  else if (!offlineBuffer.empty()) Serial.printf("%d segments of buffered data in flash\n", offlineBuffer.segments());
+
+  // Minute averages kept in flash for months
+  if (!seriesLog.begin()) Serial.printf("Failed to open the time-series log\n");
+  else Serial.printf("%u blocks of logged data in flash\n", seriesLog.blocks());
+
+  // SGP30 baseline, history and PM reading from before the last reboot
+  restoreState();
+
   // PM
   pinMode(PinPMS5003Enable, OUTPUT);
-  digitalWrite(PinPMS5003Enable, true);
-  pms5003.begin_UART(pmSerial);
   digitalWrite(PinPMS5003Enable, false);
 
-  // Display startup screen
-  u8g2.setFont(u8g2_font_profont10_tf);
-  u8g2.drawStr(0, 6, "Connecting to WiFi...");
-  u8g2.sendBuffer();
+  // Records are timestamped when they are queued and written in batches, so retries are handled
+  // by the upload queue
+  influx.begin(INFLUXDB_URL, INFLUXDB_ORG, INFLUXDB_BUCKET, INFLUXDB_TOKEN, InfluxDbCloud2CACert);
 
-  // Connect to wifi
-  Serial.printf("Connecting to WiFi...");
+  // WiFi, NTP, InfluxDB and HomeKit come up in the background in updateNetwork(), the sensors and
+  // display start right away and the MH-Z19 preheats while they run
   WiFi.persistent(false);
   WiFi.mode(WIFI_STA);
-  for (uint8_t i = 0; i < WiFiCount; i++) wifiMulti.addAP(WiFiSSID[i], WiFiPassword[i]);
-  while (wifiMulti.run() != WL_CONNECTED) {
-    Serial.printf(".");
-    delay(100);
-  }
-  Serial.printf("\n");
-  timeSync(TZ_INFO, "pool.ntp.org", "time.nis.gov");
-
-  temperaturePoint.addTag("ssid", WiFi.SSID());
-  humidityPoint.addTag("ssid", WiFi.SSID());
-  vocPoint.addTag("ssid", WiFi.SSID());
-  co2Point.addTag("ssid", WiFi.SSID());
-  pmPoint.addTag("ssid", WiFi.SSID());
-
-  // Check server connection
-  if (client.validateConnection()) {
-    Serial.printf("Connected to InfluxDB: ");
-    Serial.println(client.getServerUrl());
-  } else {
-    Serial.printf("InfluxDB connection failed: ");
-    Serial.println(client.getLastErrorMessage());
-  }
-
-#ifdef ESP8266_HOMEKIT
-  arduino_homekit_setup(&config);
-#endif
-
-  // Wait for CO2 sensor
-  Serial.printf("CO2 sensor preheat...\n");
-  u8g2.drawStr(0, 6 + 10, "CO2 sensor preheat...");
-  u8g2.drawFrame(0, 24, MHZ19StartupPeriod + 4, 8);
-  u8g2.sendBuffer();
-  for (uint8_t i = 0; i < MHZ19StartupPeriod; i++) {
-    u8g2.drawBox(2, 26, i, 4);
-    u8g2.sendBuffer();
-    delay(1000);
-  }
+  connectWiFi(millis());
+  // Local scrapes, served once WiFi is up
+  metricsServer.begin(&currentSensorData, &dataHistory, &seriesLog);
+  // History dumps over the console
+  serialProtocol.begin(&Serial, &dataHistory, &seriesLog);
 
   Serial.printf("\n\n");
+  scheduler.begin(millis());
+  // Started once the network is up
+  scheduler.stop(TaskHomeKit);
+
+#ifdef DUAL_CORE
+  // loop() runs on core 1, uploads go to core 0 next to the WiFi stack
+  scheduler.stop(TaskUpload);
+  xTaskCreatePinnedToCore(networkTask, "network", NetworkTaskStack, this, 1, nullptr, 0);
+#endif
 }
 
 // Update function, called in a loop
 void System::tick() {
+  PROFILE_STAGE(ProfileTick);
 #ifdef ESP8266_HOMEKIT
-  arduino_homekit_loop();;
+  if (networkState == NetworkReady) {
+    PROFILE_STAGE(ProfileHomeKit);
+    arduino_homekit_loop();
+  }
 #endif
 
   uint32_t time = millis();
 
+  // Answer dump requests a frame at a time, and print diagnostics on request
+  int command;
+  {
+    PROFILE_STAGE(ProfileSerial);
+    command = serialProtocol.poll(time);
+    if (serialProtocol.statsRequested()) sendSerialStats();
+  }
+  if (command >= 0) {
+    if (command == 'v') {
+      logLevel = logLevel == LogLevelVerbose ? LogLevelStatus : LogLevelVerbose;
+      Serial.printf("Verbose output %s\n", logLevel == LogLevelVerbose ? "on" : "off");
+    }
+#ifdef PROFILING
+    if (command == 'p') profiler.print(Serial);
+#endif
+    if (command == 's') scheduler.print(Serial);
+    if (command == 'u') publishFilter.print(Serial);
+    if (command == 'l') seriesLog.print(Serial);
+#ifdef ESP8266_HOMEKIT
+    if (command == 'h') homekit.print(Serial);
+#endif
+  }
+
   // Check button
   bool buttonState = !digitalRead(PinButton);
   if (buttonState != prevButtonState) {
     if (time - lastButtonChange > DebounceInterval && buttonState) {
-      lastDisplayOn = time;
+      scheduler.start(TaskDisplayTimeout, time);
       if (displayOn == false) {
         // If display is off, turn it on
         setDisplayBrightness(DisplayBrightness);
         displayOn = true;
         displayNeedsUpdate = true;
-        lastDisplayCycle = time;
+        scheduler.start(TaskDisplayCycle, time);
       } else if (displayCycle == true) {
         // If display is on, stop display from cycling automatically
         displayCycle = false;
       } else if (displayCycle == false) {
-        // Manually cycle display state
-        if (++displayState == DisplayStates) displayState = 0;
+        // Manually cycle display state, then move on to the next history tier
+        if (++displayState == DisplayStates) {
+          displayState = 0;
+          if (++displayTier == HistoryTiers) displayTier = 0;
+        }
         displayNeedsUpdate = true;
       }
     }
@@ -171,197 +203,478 @@ void System::tick() {
   }
   prevButtonState = buttonState;
 
-  // Rate limit the loop
-  if (time - lastUpdate >= UpdateInterval) {
-    // Temp/Humidity
-#ifdef AHTx0
-    sensors_event_t humidity, temp;
-    aht.getEvent(&humidity, &temp);
-    currentSensorData.temperatureRaw = temp.temperature;
-    currentSensorData.temperature = temp.temperature;
-    currentSensorData.humidityRaw = humidity.relative_humidity;
-#endif
-#ifdef SHT31
-    sht.readBoth(&currentSensorData.temperatureRaw, &currentSensorData.humidityRaw);
-    currentSensorData.temperature = currentSensorData.temperatureRaw + TemperatureOffset;
+  // Serve scrapes a chunk at a time
+  {
+    PROFILE_STAGE(ProfileHttp);
+    metricsServer.poll(time);
+  }
+
+  // Collect pending VOC sensor commands and whatever the serial sensors have sent
+  updateSGP30();
+  pollCO2();
+  pollPM(time);
+
+#ifndef DUAL_CORE
+  // A request to InfluxDB takes a step every pass until it's complete
+  if (uploadState != UploadIdle) updateUpload(time);
 #endif
 
-    // Compensate humidity readings for sensor self-heating
-    currentSensorData.absoluteHumidity = getAbsoluteHumidity(currentSensorData.temperatureRaw,
-                                                             currentSensorData.humidityRaw);
-    currentSensorData.dewPoint = getDewPoint(currentSensorData.temperatureRaw,
-                                             currentSensorData.humidityRaw);
-    currentSensorData.humidity = getRelativeHumidity(currentSensorData.temperature,
-                                                     currentSensorData.dewPoint);
-
-    // VOC
-    sgp30.setHumidity((uint32_t)(1000.0 * currentSensorData.absoluteHumidity));
-    if (!sgp30.IAQmeasure()) {
-      Serial.printf("SGP30 Failed to read VOC level\n");
-    } else {
-      currentSensorData.tvoc = sgp30.TVOC;
-      currentSensorData.eco2 = sgp30.eCO2;
+  // Run at most one scheduled task per pass
+  uint8_t task = scheduler.due(time);
+  if (task != Tasks) runTask(task, time);
+
+  // Checkpoints are written a chunk per pass, and started over if the history changed meanwhile
+  if (stateStore.saving()) {
+    PROFILE_STAGE(ProfileState);
+    if (dataHistory.changes() != checkpointHistoryChanges) {
+      checkpointHistoryChanges = dataHistory.changes();
+      stateStore.save();
     }
+    if (stateStore.step()) Serial.printf("Saved checkpoint %d\n", stateStore.sequence);
+  }
 
-    // CO2
-    int16_t co2 = mhz19.readCO2UART();
-    if (co2 >= 0) {
-      currentSensorData.co2 = co2;
-      // Send data
-      co2Point.clearFields();
-      co2Point.addField("CO2 PPM", currentSensorData.co2);
-      sendSensorData(co2Point);
+  if (displayNeedsUpdate) updateDisplay();
+}
+
+void System::runTask(uint8_t task, uint32_t time) {
+  switch (task) {
+    case TaskSensors: {
+      readSensors();
+      // Readings taken while the MH-Z19 preheats are meaningless
+      if (time >= MHZ19StartupPeriod * 1000UL) requestCO2(time);
+      publishSensorData();
+      if (logLevel >= LogLevelVerbose) printSensorData(time);
+
+      // Save historical data
+      if (firstUpdate) dataHistory.fill(currentSensorData);
+      dataHistory.addSample(currentSensorData);
+      firstUpdate = false;
+      // Only log complete readings
+      if (!firstCO2Reading) seriesLog.addSample(currentSensorData);
+      displayNeedsUpdate = true;
+      break;
+    }
+
+    case TaskUpload:
+      updateUpload(time);
+      break;
+
+    case TaskNetwork:
+      updateNetwork(time);
+      break;
 
+    case TaskHomeKit:
 #ifdef ESP8266_HOMEKIT
-      cha_co2_detected.value.int_value = currentSensorData.co2 > CO2DetectedThreshold ? 1 : 0;
-      cha_co2_level.value.float_value = currentSensorData.co2;
-      homekit_characteristic_notify(&cha_co2_detected, cha_co2_detected.value);
-      homekit_characteristic_notify(&cha_co2_level, cha_co2_level.value);
-      cha_air_quality.value.int_value = getSubjectiveAirQuality();
-      homekit_characteristic_notify(&cha_air_quality, cha_air_quality.value);
+      homekit.flush(time);
 #endif
-    } else {
-      Serial.printf("MHZ19 No new data available\n");
-    }
+      break;
+
+    case TaskHistory:
+      dataHistory.closeMinute();
+      seriesLog.closeMinute(::time(nullptr));
+      break;
+
+    case TaskBaseline:
+      // Requested after the next measurement
+      sgp30BaselineDue = true;
+      break;
 
-    // Particulate matter
-    bool pmRead;
-    PM25_AQI_Data pm;
-    if (time - lastPMWake >= PMMeasurementInterval || firstUpdate) {
+    case TaskPMWake:
       Serial.printf("PMS5003 Wake\n");
       digitalWrite(PinPMS5003Enable, true);
       lastPMWake = time;
-      pmMeasurementDone = false;
-    } else if (time - lastPMWake >= PMWakeDelay + PMReadPeriod && !pmMeasurementDone) {
-      Serial.printf("PMS5003 Sleep\n");
-      digitalWrite(PinPMS5003Enable, false);
-      pmMeasurementDone = true;
-      if (pmSampleCount > 0) {
-        currentSensorData.pm10 = pmTempData.pm10 / pmSampleCount;
-        currentSensorData.pm25 = pmTempData.pm25 / pmSampleCount;
-        currentSensorData.pm100 = pmTempData.pm100 / pmSampleCount;
-        pmPoint.clearFields();
-        pmPoint.addField("PM 1.0 μg/m^3", currentSensorData.pm10);
-        pmPoint.addField("PM 2.5 μg/m^3", currentSensorData.pm25);
-        pmPoint.addField("PM 10 μg/m^3", currentSensorData.pm100);
-        sendSensorData(pmPoint);
-#ifdef ESP8266_HOMEKIT
-        cha_pm25.value.float_value = currentSensorData.pm25;
-        homekit_characteristic_notify(&cha_pm25, cha_pm25.value);
-#endif
-      }
-      pmTempData.pm10 = 0;
-      pmTempData.pm25 = 0;
-      pmTempData.pm100 = 0;
-      pmSampleCount = 0;
-    }
+      break;
+
+    case TaskPMSleep:
+      finishPMMeasurement();
+      break;
 
-    pmRead = pms5003.read(&pm);
-    if (pmRead) {
-      if (time - lastPMWake >= PMWakeDelay &&
-          time - lastPMWake < PMWakeDelay + PMReadPeriod) {
-        Serial.printf("PMS5003 Sample %d\n", ++pmSampleCount);
-        pmTempData.pm10 += pm.pm10_standard;
-        pmTempData.pm25 += pm.pm25_standard;
-        pmTempData.pm100 += pm.pm100_standard;
+    case TaskDisplayCycle:
+      if (displayCycle) {
+        if (++displayState == DisplayStates) displayState = 0;
+        displayNeedsUpdate = true;
       }
-    } else {
-      Serial.printf("PMS5003 No new data available\n");
-    }
+      break;
 
-    // Serial output
-    Serial.printf("Free Heap           : %d\n", ESP.getFreeHeap());
-    Serial.printf("Temperature C       : %f\n", currentSensorData.temperature);
-    Serial.printf("Temperature C (raw) : %f\n", currentSensorData.temperatureRaw);
-    Serial.printf("Humidity %%RH        : %f\n", currentSensorData.humidity);
-    Serial.printf("Humidity %%RH (raw)  : %f\n", currentSensorData.humidityRaw);
-    Serial.printf("Humidity g/m^3      : %f\n", currentSensorData.absoluteHumidity);
-    Serial.printf("Dew Point C         : %f\n", currentSensorData.dewPoint);
-    Serial.printf("TVOC ppb            : %d\n", currentSensorData.tvoc);
-    Serial.printf("eCO2 ppm            : %d\n", currentSensorData.eco2);
-    Serial.printf("CO2 ppm             : %d\n", currentSensorData.co2);
-    if (pmRead) {
-      Serial.printf("PM1.0 μg/m^3 (live) : %d\n", pm.pm10_standard);
-      Serial.printf("PM2.5 μg/m^3 (live) : %d\n", pm.pm25_standard);
-      Serial.printf("PM10 μg/m^3 (live)  : %d\n", pm.pm100_standard);
-    } else {
-      Serial.printf("PM1.0 μg/m^3 (old)  : %d\n", currentSensorData.pm10);
-      Serial.printf("PM2.5 μg/m^3 (old)  : %d\n", currentSensorData.pm25);
-      Serial.printf("PM10 μg/m^3 (old)   : %d\n", currentSensorData.pm100);
-    }
-    if (pmSampleCount > 0) {
-      Serial.printf("PM1.0 μg/m^3 (avg)  : %d\n", pmTempData.pm10 / pmSampleCount);
-      Serial.printf("PM2.5 μg/m^3 (avg)  : %d\n", pmTempData.pm25 / pmSampleCount);
-      Serial.printf("PM10 μg/m^3 (avg)   : %d\n", pmTempData.pm100 / pmSampleCount);
+    case TaskDisplayTimeout:
+      setDisplayBrightness(0, 7, 7);
+      displayOn = false;
+      displayCycle = true;
+      scheduler.stop(TaskDisplayTimeout);
+      break;
+
+    case TaskProfile:
+#ifdef PROFILING
+      queueProfile();
+#endif
+      break;
+
+    case TaskCheckpoint:
+      checkpointState();
+      break;
+  }
+}
+
+// Temperature and humidity, then start the VOC measurement compensated for the new humidity
+void System::readSensors() {
+  PROFILE_STAGE(ProfileSensors);
+  // Temp/Humidity
+#ifdef AHTx0
+  sensors_event_t humidity, temp;
+  aht.getEvent(&humidity, &temp);
+  currentSensorData.temperatureRaw = temp.temperature;
+  currentSensorData.temperature = temp.temperature;
+  currentSensorData.humidityRaw = humidity.relative_humidity;
+#endif
+#ifdef SHT31
+  sht.readBoth(&currentSensorData.temperatureRaw, &currentSensorData.humidityRaw);
+  currentSensorData.temperature = currentSensorData.temperatureRaw + TemperatureOffset;
+#endif
+
+  // Compensate humidity readings for sensor self-heating
+  currentSensorData.absoluteHumidity = getAbsoluteHumidity(currentSensorData.temperatureRaw,
+                                                           currentSensorData.humidityRaw);
+  currentSensorData.dewPoint = getDewPoint(currentSensorData.temperatureRaw,
+                                           currentSensorData.humidityRaw);
+  currentSensorData.humidity = getRelativeHumidity(currentSensorData.temperature,
+                                                   currentSensorData.dewPoint);
+
+  // VOC - the sensor is busy for a while after each command, so the measurement is collected by
+  // updateSGP30() on a later pass instead of waiting for it here
+  if (sgp30BaselineReset && sgp30State == SGP30StateIdle) {
+    // Waits for the command, but only happens once after a stale checkpoint
+    if (!sgp30.setIAQBaseline(sgp30Eco2Base, sgp30TvocBase)) Serial.printf("SGP30 Failed to set baseline\n");
+    sgp30BaselineReset = false;
+  }
+  if (sgp30State != SGP30StateIdle) {
+    Serial.printf("SGP30 Previous measurement still pending\n");
+  } else if (sgp30.setHumidityStart((uint32_t)(1000.0 * currentSensorData.absoluteHumidity))) {
+    sgp30State = SGP30StateHumidity;
+  } else if (sgp30.IAQmeasureStart()) {
+    sgp30State = SGP30StateMeasure;
+  } else {
+    Serial.printf("SGP30 Failed to start measurement\n");
+  }
+}
+
+// Ask the CO2 sensor for a reading, the reply is picked up by pollCO2()
+void System::requestCO2(uint32_t time) {
+  if (mhz19Pending) {
+    mhz19MissedReplies++;
+    Serial.printf("MHZ19 No reply to the last request\n");
+  }
+  uint8_t command[MHZ19Parser::FrameLength] = { 0xFF, 0x01, 0x86, 0, 0, 0, 0, 0, 0 };
+  command[MHZ19Parser::FrameLength - 1] = MHZ19Parser::checksum(command);
+  co2Serial->write(command, sizeof(command));
+  mhz19Pending = true;
+  mhz19RequestTime = time;
+}
+
+// Feed received bytes to the CO2 frame parser, never waits for more
+void System::pollCO2() {
+  PROFILE_STAGE(ProfileCO2);
+  while (co2Serial->available() > 0) {
+    if (!mhz19Parser.feed(co2Serial->read())) continue;
+    mhz19Pending = false;
+    currentSensorData.co2 = mhz19Parser.co2();
+    // History started before the first CO2 reading, restart it so the graphs don't begin at 0 ppm
+    if (firstCO2Reading) {
+      if (!stateRestored) dataHistory.fill(currentSensorData);
+      firstCO2Reading = false;
     }
-    Serial.printf("\n");
-
-    // Send data to server
-    if (time - lastDataPoint >= DataPushToServerInterval) {
-      temperaturePoint.clearFields();
-      temperaturePoint.addField("Temperature C", currentSensorData.temperature);
-      temperaturePoint.addField("Dew Point C", currentSensorData.dewPoint);
-      sendSensorData(temperaturePoint);
-      humidityPoint.clearFields();
-      humidityPoint.addField("Relative Humidity %", currentSensorData.humidity);
-      humidityPoint.addField("Absolute Humidity g/m^3", currentSensorData.absoluteHumidity);
-      sendSensorData(humidityPoint);
-      vocPoint.clearFields();
-      vocPoint.addField("TVOC PPB", currentSensorData.tvoc);
-      sendSensorData(vocPoint);
+    bool changed = publish(MeasurementCO2, currentSensorData.co2);
 
 #ifdef ESP8266_HOMEKIT
-      cha_temperature.value.float_value = currentSensorData.temperature;
-      cha_humidity.value.float_value = currentSensorData.humidity;
-      homekit_characteristic_notify(&cha_temperature, cha_temperature.value);
-      homekit_characteristic_notify(&cha_humidity, cha_humidity.value);
-      cha_voc.value.float_value = (float)currentSensorData.tvoc * VOCPPBToUGM3;
-      homekit_characteristic_notify(&cha_voc, cha_voc.value);
+    // Values are always current for reads, controllers are only notified of published changes
+    homekit.setInt(HomeKitCO2Detected, currentSensorData.co2 > CO2DetectedThreshold ? 1 : 0);
+    homekit.setFloat(HomeKitCO2Level, currentSensorData.co2);
+    homekit.setInt(HomeKitAirQuality, getSubjectiveAirQuality());
+    // Crossing the alarm threshold or an air quality level is always worth an event
+    homekit.notify(HomeKitCO2Detected);
+    homekit.notify(HomeKitAirQuality);
+    if (changed) homekit.notify(HomeKitCO2Level);
+#else
+    (void)changed;
 #endif
+  }
+}
 
-      lastDataPoint = time;
-    }
+// Send the readings of the SGP30 and the temperature/humidity sensor that changed
+void System::publishSensorData() {
+  bool temperatureChanged = publish(MeasurementTemperature, currentSensorData.temperature, currentSensorData.dewPoint);
+  bool humidityChanged = publish(MeasurementHumidity, currentSensorData.humidity, currentSensorData.absoluteHumidity);
+  bool vocChanged = publish(MeasurementVOC, currentSensorData.tvoc);
 
-    // Save historical data
-    if (time - lastDataHistoryUpdate >= DataHistoryUpdateInterval || firstUpdate) {
-      for (uint8_t i = 0; i < DataHistoryLength - 1; i++) {
-        if (firstUpdate) oldSensorData[i] = currentSensorData;
-        else oldSensorData[i] = oldSensorData[i + 1];
-      }
-      oldSensorData[DataHistoryLength - 1] = currentSensorData;
-      firstUpdate = false;
-      lastDataHistoryUpdate = time;
-    }
+#ifdef ESP8266_HOMEKIT
+  homekit.setFloat(HomeKitTemperature, currentSensorData.temperature);
+  homekit.setFloat(HomeKitHumidity, currentSensorData.humidity);
+  homekit.setFloat(HomeKitVOC, (float)currentSensorData.tvoc * VOCPPBToUGM3);
+  if (temperatureChanged) homekit.notify(HomeKitTemperature);
+  if (humidityChanged) homekit.notify(HomeKitHumidity);
+  if (vocChanged) homekit.notify(HomeKitVOC);
+#else
+  (void)temperatureChanged;
+  (void)humidityChanged;
+  (void)vocChanged;
+#endif
+}
 
-    // SGP30 baseline check
-    if (time - lastBaselineCheck >= SGP30BaselineCheckInterval) {
-      if (!sgp30.getIAQBaseline(&sgp30Eco2Base, &sgp30TvocBase)) {
-        Serial.printf("SGP30 Failed to read baseline values\n");
-      }
-      Serial.printf("SGP30 Baseline eCO2 %04x TVOC %04x\n\n", sgp30Eco2Base, sgp30TvocBase);
-      lastBaselineCheck = time;
+// Particulate matter, the sensor is woken up every PMMeasurementInterval and every frame it sends
+// during PMReadPeriod, once it has settled, is averaged
+void System::pollPM(uint32_t time) {
+  PROFILE_STAGE(ProfilePM);
+#ifdef SWSERIAL
+  if (pmSerial->overflow()) pmOverflows++;
+#endif
+  while (pmSerial->available() > 0) {
+    if (!pmsParser.feed(pmSerial->read())) continue;
+    lastPMFrame = time;
+    const PM25_AQI_Data &pm = pmsParser.data();
+    if (time - lastPMWake >= PMWakeDelay &&
+        time - lastPMWake < PMWakeDelay + PMReadPeriod) {
+      pmSampleCount++;
+      if (logLevel >= LogLevelVerbose) Serial.printf("PMS5003 Sample %d\n", pmSampleCount);
+      pmTempData.pm10 += pm.pm10_standard;
+      pmTempData.pm25 += pm.pm25_standard;
+      pmTempData.pm100 += pm.pm100_standard;
     }
+  }
+}
 
-    // Cycle display states
-    if (displayCycle && time - lastDisplayCycle >= DisplayAutoCycleInterval) {
-      if (++displayState == DisplayStates) displayState = 0;
-      lastDisplayCycle = time;
-    }
+// Put the sensor back to sleep and send the average of the samples taken while it was awake
+void System::finishPMMeasurement() {
+  Serial.printf("PMS5003 Sleep\n");
+  digitalWrite(PinPMS5003Enable, false);
+  if (pmSampleCount > 0) {
+    currentSensorData.pm10 = pmTempData.pm10 / pmSampleCount;
+    currentSensorData.pm25 = pmTempData.pm25 / pmSampleCount;
+    currentSensorData.pm100 = pmTempData.pm100 / pmSampleCount;
+    bool changed = publish(MeasurementPM, currentSensorData.pm10, currentSensorData.pm25, currentSensorData.pm100);
+#ifdef ESP8266_HOMEKIT
+    homekit.setFloat(HomeKitPM25, currentSensorData.pm25);
+    if (changed) homekit.notify(HomeKitPM25);
+#else
+    (void)changed;
+#endif
+  }
+  pmTempData.pm10 = 0;
+  pmTempData.pm25 = 0;
+  pmTempData.pm100 = 0;
+  pmSampleCount = 0;
+}
 
-    // Display timeout
-    if (time - lastDisplayOn >= DisplayTimeout) {
-      setDisplayBrightness(0, 7, 7);
-      displayOn = false;
-      displayCycle = true;
-    }
-    displayNeedsUpdate = true;
-    lastUpdate = time;
+void System::printSensorData(uint32_t time) {
+  PROFILE_STAGE(ProfileSerial);
+  Serial.printf("Free Heap           : %d\n", ESP.getFreeHeap());
+  Serial.printf("Temperature C       : %f\n", currentSensorData.temperature);
+  Serial.printf("Temperature C (raw) : %f\n", currentSensorData.temperatureRaw);
+  Serial.printf("Humidity %%RH        : %f\n", currentSensorData.humidity);
+  Serial.printf("Humidity %%RH (raw)  : %f\n", currentSensorData.humidityRaw);
+  Serial.printf("Humidity g/m^3      : %f\n", currentSensorData.absoluteHumidity);
+  Serial.printf("Dew Point C         : %f\n", currentSensorData.dewPoint);
+  Serial.printf("TVOC ppb            : %d\n", currentSensorData.tvoc);
+  Serial.printf("eCO2 ppm            : %d\n", currentSensorData.eco2);
+  Serial.printf("CO2 ppm             : %d\n", currentSensorData.co2);
+  if (time - lastPMFrame < UpdateInterval) {
+    const PM25_AQI_Data &pm = pmsParser.data();
+    Serial.printf("PM1.0 μg/m^3 (live) : %d\n", pm.pm10_standard);
+    Serial.printf("PM2.5 μg/m^3 (live) : %d\n", pm.pm25_standard);
+    Serial.printf("PM10 μg/m^3 (live)  : %d\n", pm.pm100_standard);
+  } else {
+    Serial.printf("PM1.0 μg/m^3 (old)  : %d\n", currentSensorData.pm10);
+    Serial.printf("PM2.5 μg/m^3 (old)  : %d\n", currentSensorData.pm25);
+    Serial.printf("PM10 μg/m^3 (old)   : %d\n", currentSensorData.pm100);
+  }
+  if (pmSampleCount > 0) {
+    Serial.printf("PM1.0 μg/m^3 (avg)  : %d\n", pmTempData.pm10 / pmSampleCount);
+    Serial.printf("PM2.5 μg/m^3 (avg)  : %d\n", pmTempData.pm25 / pmSampleCount);
+    Serial.printf("PM10 μg/m^3 (avg)   : %d\n", pmTempData.pm100 / pmSampleCount);
+  }
+  Serial.printf("MHZ19 frames        : %d (%d checksum errors, %d bytes skipped, %d missed)\n",
+                mhz19Parser.stats.frames, mhz19Parser.stats.checksumErrors,
+                mhz19Parser.stats.discardedBytes, mhz19MissedReplies);
+  Serial.printf("PMS5003 frames      : %d (%d checksum errors, %d bytes skipped, %d overflows)\n",
+                pmsParser.stats.frames, pmsParser.stats.checksumErrors,
+                pmsParser.stats.discardedBytes, pmOverflows);
+  Serial.printf("Display bytes/frame : %d (avg %d)\n", frameDiff.lastFrameBytes,
+                frameDiff.frames > 0 ? frameDiff.totalBytes / frameDiff.frames : 0);
+  Serial.printf("Upload bytes        : %u (%u sent)\n", influx.payloadBytes, influx.sentBytes);
+  Serial.printf("Checkpoints         : %u (%u failed)\n", stateStore.checkpoints, stateStore.failures);
+#ifdef DUAL_CORE
+  Serial.printf("Samples dropped     : %u (network task behind)\n", droppedSamples);
+#endif
+  Serial.printf("\n");
+}
+
+void System::sendSerialStats() {
+  serial_stats stats;
+  stats.uptime = millis() / 1000;
+  stats.time = ::time(nullptr) >= ValidTimeStart ? ::time(nullptr) : 0;
+  stats.freeHeap = ESP.getFreeHeap();
+  stats.rssi = WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0;
+  stats.logBlocks = seriesLog.blocks();
+  stats.logRecords = seriesLog.records;
+  stats.logFailures = seriesLog.failures;
+  stats.checkpoints = stateStore.checkpoints;
+  stats.checkpointFailures = stateStore.failures;
+  stats.httpRequests = metricsServer.requests;
+  stats.uploadPayloadBytes = influx.payloadBytes;
+  stats.uploadSentBytes = influx.sentBytes;
+  stats.mhz19Frames = mhz19Parser.stats.frames;
+  stats.mhz19Errors = mhz19Parser.stats.checksumErrors + mhz19MissedReplies;
+  stats.pmsFrames = pmsParser.stats.frames;
+  stats.pmsErrors = pmsParser.stats.checksumErrors + pmOverflows;
+  stats.serialFrames = serialProtocol.frames;
+  stats.serialErrors = serialProtocol.errors;
+  serialProtocol.sendStats(stats);
+}
+
+// Sleep until the next task is due or the pending SGP30 command is ready
+// Sleeps are capped at IdleMaxSleep so the button is still polled within the debounce interval
+void System::idle() {
+  if (!IdleSleep) return;
+  uint32_t time = millis();
+  uint32_t sleep = min(scheduler.nextWakeup(time), IdleMaxSleep);
+  if (sgp30.commandPending()) sleep = min(sleep, (uint32_t)sgp30.commandRemaining());
+  // Software serial can't receive while the CPU is in light sleep
+  if (mhz19Pending && time - mhz19RequestTime < MHZ19ReplyTimeout) sleep = 0;
+  if (digitalRead(PinPMS5003Enable)) sleep = 0;
+  if (stateStore.saving()) sleep = 0;
+  if (metricsServer.busy()) sleep = 0;
+  if (serialProtocol.busy()) sleep = 0;
+#ifndef DUAL_CORE
+  if (uploadState != UploadIdle) sleep = 0;
+#endif
+  if (sleep == 0) return;
+
+#ifdef PROFILING
+  uint32_t start = micros();
+#endif
+  delay(sleep);
+#ifdef PROFILING
+  profiler.recordIdle(micros() - start);
+#endif
+}
+
+// Hash of the constants that give the stored history values their meaning, a checkpoint saved with
+// different ones is not restored
+static uint32_t stateLayout() {
+  const uint16_t sizes[] = { DataHistoryLength, HistoryChannels, HistoryTiers, HistoryStats };
+  uint32_t hash = GzipEncoder::crc32(0, (const uint8_t *)sizes, sizeof(sizes));
+  hash = GzipEncoder::crc32(hash, (const uint8_t *)HistoryStep, sizeof(HistoryStep));
+  hash = GzipEncoder::crc32(hash, (const uint8_t *)HistoryOffset, sizeof(HistoryOffset));
+  return GzipEncoder::crc32(hash, HistoryTierFactor, sizeof(HistoryTierFactor));
+}
+
+// Load the checkpoint saved before the last reboot, so the SGP30 doesn't have to learn its
+// baseline again and the graphs and PM reading carry on where they were
+// The clock isn't set yet at boot, checkStateAge() discards what turns out to be too old once it is
+void System::restoreState() {
+  stateRegions[0] = { &savedState, sizeof(savedState) };
+  stateRegions[1] = { &dataHistory, sizeof(dataHistory) };
+  stateRegions[2] = { &seriesLog.pending, sizeof(seriesLog.pending) };
+  stateRestored = stateStore.begin(stateRegions, 3, stateLayout());
+  stateAgeUnchecked = stateRestored;
+  if (stateRestored) {
+    Serial.printf("Restored checkpoint %d, SGP30 baseline eCO2 %04x TVOC %04x\n", stateStore.sequence,
+                  savedState.sgp30Eco2Base, savedState.sgp30TvocBase);
+    sgp30Eco2Base = savedState.sgp30Eco2Base;
+    sgp30TvocBase = savedState.sgp30TvocBase;
+    currentSensorData.pm10 = savedState.pm10;
+    currentSensorData.pm25 = savedState.pm25;
+    currentSensorData.pm100 = savedState.pm100;
+    firstUpdate = false;
+    seriesLog.resume();
+  } else {
+    Serial.printf("No saved state, using the default SGP30 baseline\n");
+    sgp30Eco2Base = SGP30BaselineECO2;
+    sgp30TvocBase = SGP30BaselineTVOC;
+  }
+  sgp30.setIAQBaseline(sgp30Eco2Base, sgp30TvocBase);
+}
+
+// Called once the clock has been set, discards a restored baseline or history that is too old
+void System::checkStateAge() {
+  stateAgeUnchecked = false;
+  uint32_t now = ::time(nullptr);
+  uint32_t age = savedState.time > 0 && now > savedState.time ? now - savedState.time : 0;
+  bool unknown = savedState.time == 0;
+  Serial.printf("Restored checkpoint is %u s old%s\n", age, unknown ? " (saved before the clock was set)" : "");
+
+  if (unknown || age > StateBaselineMaxAge) {
+    Serial.printf("Discarding the restored SGP30 baseline\n");
+    sgp30Eco2Base = SGP30BaselineECO2;
+    sgp30TvocBase = SGP30BaselineTVOC;
+    sgp30BaselineReset = true;
+  }
+  if (unknown || age > StateHistoryMaxAge) {
+    Serial.printf("Discarding the restored history\n");
+    // Started over from the current readings, or from the first CO2 reading if there hasn't been one
+    stateRestored = false;
+    if (!firstCO2Reading) dataHistory.fill(currentSensorData);
   }
+}
 
-  if (displayNeedsUpdate) updateDisplay();
+// Start writing a checkpoint, tick() writes it in chunks
+// The small values are copied so they stay consistent while it's written, the history is written
+// in place
+void System::checkpointState() {
+  savedState.sgp30Eco2Base = sgp30Eco2Base;
+  savedState.sgp30TvocBase = sgp30TvocBase;
+  savedState.pm10 = currentSensorData.pm10;
+  savedState.pm25 = currentSensorData.pm25;
+  savedState.pm100 = currentSensorData.pm100;
+  // Until the clock is set, the time of the restored checkpoint is kept, the data is at least that old
+  if (::time(nullptr) >= ValidTimeStart) savedState.time = ::time(nullptr);
+  checkpointHistoryChanges = dataHistory.changes();
+  stateStore.save();
+}
+
+// Step through the SGP30 command sequence, one command per pass once the sensor is ready
+void System::updateSGP30() {
+  PROFILE_STAGE(ProfileSGP30);
+  if (!sgp30.commandReady()) return;
+  bool ok = sgp30.commandCollect();
+
+  if (sgp30State == SGP30StateHumidity) {
+    if (sgp30.IAQmeasureStart()) {
+      sgp30State = SGP30StateMeasure;
+    } else {
+      Serial.printf("SGP30 Failed to start measurement\n");
+      sgp30State = SGP30StateIdle;
+    }
+  } else if (sgp30State == SGP30StateMeasure) {
+    if (!ok) {
+      Serial.printf("SGP30 Failed to read VOC level\n");
+    } else {
+      currentSensorData.tvoc = sgp30.TVOC;
+      currentSensorData.eco2 = sgp30.eCO2;
+    }
+    sgp30State = SGP30StateIdle;
+    if (sgp30BaselineDue && sgp30.getIAQBaselineStart()) sgp30State = SGP30StateBaseline;
+    sgp30BaselineDue = false;
+  } else if (sgp30State == SGP30StateBaseline) {
+    if (!ok) {
+      Serial.printf("SGP30 Failed to read baseline values\n");
+    } else {
+      sgp30Eco2Base = sgp30.baselineECO2;
+      sgp30TvocBase = sgp30.baselineTVOC;
+    }
+    Serial.printf("SGP30 Baseline eCO2 %04x TVOC %04x\n", sgp30Eco2Base, sgp30TvocBase);
+    Serial.printf("SGP30 CRC errors %d\n", sgp30.crcErrors);
+    Serial.printf("SGP30 Measure took %d us on the bus, %d ms total (max %d us, %d ms)\n\n",
+                  sgp30.commandStats[SGP30_CMD_MEASURE].lastTransferMicros,
+                  sgp30.commandStats[SGP30_CMD_MEASURE].lastLatencyMillis,
+                  sgp30.commandStats[SGP30_CMD_MEASURE].maxTransferMicros,
+                  sgp30.commandStats[SGP30_CMD_MEASURE].maxLatencyMillis);
+    sgp30State = SGP30StateIdle;
+  } else {
+    sgp30State = SGP30StateIdle;
+  }
 }
 
 void System::updateDisplay() {
+  PROFILE_STAGE(ProfileDisplay);
   displayNeedsUpdate = false;
   u8g2.clearBuffer();
   char line[32];
@@ -383,24 +696,8 @@ void System::updateDisplay() {
       u8g2.drawUTF8(66 + width, 11, "%RH");
 
       // Line graphs
-      float values[DataHistoryLength];
-      float min = 100;
-      float max = -100;
-      for (uint8_t i = 0; i < DataHistoryLength; i++) {
-        values[i] = oldSensorData[i].temperature;
-        if (values[i] < min) min = values[i];
-        if (values[i] > max) max = values[i];
-      }
-      drawLineGraph(0, 16, 62, 15, values, DataHistoryLength, min - 1, max + 1, false);
-
-      min = 100;
-      max = -100;
-      for (uint8_t i = 0; i < DataHistoryLength; i++) {
-        values[i] = oldSensorData[i].humidity;
-        if (values[i] < min) min = values[i];
-        if (values[i] > max) max = values[i];
-      }
-      drawLineGraph(64, 16, 62, 15, values, DataHistoryLength, min - 1, max + 1, false);
+      drawGraph(HistoryTemperature);
+      drawGraph(HistoryHumidity);
     } else if (displayState == DisplayStateVOC) {
       // Big text
       u8g2.setFont(u8g2_font_profont22_tf);
@@ -410,15 +707,17 @@ void System::updateDisplay() {
       u8g2.drawUTF8(width, 11, "ppb VOC");
 
       // Line graph
-      int32_t values[DataHistoryLength];
-      int32_t min = 65535;
-      int32_t max = 0;
-      for (uint8_t i = 0; i < DataHistoryLength; i++) {
-        values[i] = oldSensorData[i].tvoc;
-        if (values[i] < min) min = values[i];
-        if (values[i] > max) max = values[i];
-      }
-      drawLineGraph(0, 16, 128, 15, values, DataHistoryLength, 0, max, true);
+      drawGraph(HistoryTVOC);
+    } else if (displayState == DisplayStateCO2 && firstCO2Reading) {
+      // Preheat countdown until the first reading
+      uint32_t elapsed = millis() / 1000;
+      u8g2.setFont(u8g2_font_profont22_tf);
+      sprintf(line, "%3ds", elapsed < MHZ19StartupPeriod ? MHZ19StartupPeriod - elapsed : 0);
+      width = u8g2.drawUTF8(0, 14, line);
+      u8g2.setFont(u8g2_font_profont12_tf);
+      u8g2.drawUTF8(width, 11, "CO2 warm-up");
+      u8g2.drawFrame(0, 24, MHZ19StartupPeriod + 4, 8);
+      u8g2.drawBox(2, 26, min(elapsed, (uint32_t)MHZ19StartupPeriod), 4);
     } else if (displayState == DisplayStateCO2) {
       // Big text
       u8g2.setFont(u8g2_font_profont22_tf);
@@ -428,15 +727,7 @@ void System::updateDisplay() {
       u8g2.drawUTF8(width, 11, "ppm CO2");
 
       // Line graph
-      int32_t values[DataHistoryLength];
-      int32_t min = 65535;
-      int32_t max = 0;
-      for (uint8_t i = 0; i < DataHistoryLength; i++) {
-        values[i] = oldSensorData[i].co2;
-        if (values[i] < min) min = values[i];
-        if (values[i] > max) max = values[i];
-      }
-      drawLineGraph(0, 16, 128, 15, values, DataHistoryLength, min, max, true);
+      drawGraph(HistoryCO2);
     } else if (displayState == DisplayStatePM) {
       // Big text
       u8g2.setFont(u8g2_font_profont22_tf);
@@ -446,66 +737,87 @@ void System::updateDisplay() {
       u8g2.drawUTF8(width, 11, "ug/m^3 PM2.5");
 
       // Line graph
-      int32_t values[DataHistoryLength];
-      int32_t min = 65535;
-      int32_t max = 0;
-      for (uint8_t i = 0; i < DataHistoryLength; i++) {
-        values[i] = oldSensorData[i].pm25;
-        if (values[i] < min) min = values[i];
-        if (values[i] > max) max = values[i];
-      }
-      drawLineGraph(0, 16, 128, 15, values, DataHistoryLength, 0, max + 1, true);
+      drawGraph(HistoryPM25);
     }
   }
 
-  u8g2.sendBuffer();
-}
-
-void System::drawLineGraph(uint8_t x, uint8_t y, uint8_t w, uint8_t h,
-                           int32_t values[], uint8_t count, int32_t min, int32_t max,
-                           bool showRange, uint8_t decimalPlaces, uint16_t scaling) {
-  uint8_t xOffset = 0;
-  if (showRange) {
-    char line[6];
-    u8g2.setFont(u8g2_font_tom_thumb_4x6_mn);
+  // Label graphs of the longer history tiers with their time span
+  if ((displayOn || DisplayAlwaysOn) && displayTier != HistoryTierMinute) {
+    u8g2.setFont(u8g2_font_tom_thumb_4x6_mr);
     u8g2.setFontMode(0);
+    u8g2.drawStr(128 - u8g2.getStrWidth(HistoryTierLabel[displayTier]), 22, HistoryTierLabel[displayTier]);
+    u8g2.setFontMode(1);
+  }
+
+  sendDisplayBuffer();
+}
 
-    sprintf(line, "%.*f", decimalPlaces, (float)max / (float)scaling);
-    u8g2.drawStr(x, y + 6, line);
-    xOffset = u8g2.getStrWidth(line);
+// Send only the tiles that changed since the last frame, most redraws only change a few digits
+void System::sendDisplayBuffer() {
+  tile_run runs[FrameDiff::MaxRuns];
+  uint8_t count = frameDiff.diff(u8g2.getBufferPtr(), runs);
+  for (uint8_t i = 0; i < count; i++) {
+    u8g2.updateDisplayArea(runs[i].x, runs[i].y, runs[i].w, 1);
+  }
+}
 
-    sprintf(line, "%.*f", decimalPlaces, (float)min / (float)scaling);
-    u8g2.drawStr(x, y + h + 1, line);
-    uint8_t xOffset2 = u8g2.getStrWidth(line);
-    if (xOffset2 > xOffset) xOffset = xOffset2;
+// Draw the history graph of a channel from its cached geometry
+void System::drawGraph(uint8_t channel) {
+  const graph_layout &layout = GraphLayouts[channel];
+  graph_cache &cache = graphCache[channel];
+  if (!cache.valid || cache.tier != displayTier || cache.version != dataHistory.version(displayTier)) {
+    updateGraph(channel);
+  }
 
+  if (layout.showRange) {
+    u8g2.setFont(u8g2_font_tom_thumb_4x6_mn);
+    u8g2.setFontMode(0);
+    u8g2.drawStr(layout.x, layout.y + 6, cache.maxLabel);
+    u8g2.drawStr(layout.x, layout.y + layout.h + 1, cache.minLabel);
     u8g2.setFontMode(1);
   }
 
-  uint8_t graphW = w - xOffset;
-  if (min != max && graphW / count >= 1) {
-    uint8_t lastY = map(values[0], min, max, y + h, y);
-    for (uint8_t i = 1; i < count; i++) {
-      uint8_t thisY = map(values[i], min, max, y + h, y);
-      u8g2.drawLine(x + xOffset + (i - 1) * graphW / count, lastY,
-                    x + xOffset + i * graphW / count, thisY);
-      lastY = thisY;
-    }
+  uint8_t graphW = layout.w - cache.xOffset;
+  uint8_t x = layout.x + cache.xOffset;
+  for (uint16_t i = 1; i < cache.count; i++) {
+    u8g2.drawLine(x + (i - 1) * graphW / cache.count, cache.points[i - 1],
+                  x + i * graphW / cache.count, cache.points[i]);
   }
 }
 
-void System::drawLineGraph(uint8_t x, uint8_t y, uint8_t w, uint8_t h,
-                           float values[], uint8_t count, float min, float max,
-                           bool showRange, uint8_t decimalPlaces) {
-  uint16_t scaling = 10;
-  for (uint8_t i = 0; i < decimalPlaces - 1; i++) scaling *= 10;
-  int32_t intValues[count];
-  for (uint8_t i = 0; i < DataHistoryLength; i++) {
-    intValues[i] = (int32_t)(values[i] * scaling);
+// Recompute the graph geometry of a channel, only needed when the displayed history changes
+void System::updateGraph(uint8_t channel) {
+  const graph_layout &layout = GraphLayouts[channel];
+  graph_cache &cache = graphCache[channel];
+  const SensorHistory::Tier &tier = dataHistory.tier(displayTier);
+  cache.valid = true;
+  cache.tier = displayTier;
+  cache.version = dataHistory.version(displayTier);
+  cache.count = 0;
+
+  // Range in stored units, padded by the layout's margin
+  uint16_t rawMin, rawMax;
+  tier.meanRange(channel, rawMin, rawMax);
+  int32_t padding = (int32_t)(layout.padding / HistoryStep[channel] + 0.5f);
+  int32_t rangeMin = layout.fromZero ? historyQuantize(0, channel) : max((int32_t)rawMin - padding, (int32_t)0);
+  int32_t rangeMax = min((int32_t)rawMax + padding, (int32_t)65535);
+
+  cache.xOffset = 0;
+  if (layout.showRange) {
+    u8g2.setFont(u8g2_font_tom_thumb_4x6_mn);
+    sprintf(cache.maxLabel, "%.*f", layout.decimalPlaces, historyDequantize(rangeMax, channel));
+    sprintf(cache.minLabel, "%.*f", layout.decimalPlaces, historyDequantize(rangeMin, channel));
+    cache.xOffset = max(u8g2.getStrWidth(cache.maxLabel), u8g2.getStrWidth(cache.minLabel));
   }
-  drawLineGraph(x, y, w, h,
-                intValues, count, (int32_t)(min * scaling), (int32_t)(max * scaling),
-                showRange, decimalPlaces, scaling);
+
+  uint8_t graphW = layout.w - cache.xOffset;
+  uint16_t count = tier.size();
+  if (rangeMin == rangeMax || count == 0 || graphW / count < 1) return;
+  auto values = tier.channel(channel);
+  for (uint16_t i = 0; i < count; i++) {
+    cache.points[i] = map(values.raw(i), rangeMin, rangeMax, layout.y + layout.h, layout.y);
+  }
+  cache.count = count;
 }
 
 void System::setDisplayBrightness(uint8_t brightness, uint8_t p1, uint8_t p2) {
@@ -522,20 +834,301 @@ void System::setDisplayBrightness(uint8_t brightness, uint8_t p1, uint8_t p2) {
   u8g2.setContrast(brightness);
 }
 
-void System::sendSensorData(Point sensor) {
-  Serial.printf("Writing data point...\n");
-  // Check WiFi connection and reconnect if needed
-  if ((WiFi.RSSI() == 0) && wifiMulti.run() != WL_CONNECTED) {
-    Serial.printf("WiFi connection lost\n");
+// Queue a reading if it moved past the deadband or the heartbeat is due, returns true if it was
+// Nothing is published until the clock is set, records need a timestamp
+bool System::publish(uint8_t measurement, float v0, float v1, float v2) {
+  if (::time(nullptr) < ValidTimeStart) return false;
+  float values[3] = { v0, v1, v2 };
+  if (!publishFilter.update(measurement, values, millis())) return false;
+  queueSample(measurement, v0, v1, v2);
+  return true;
+}
+
+// Hand a reading to the upload side, timestamped now since it may be queued for a while
+// Dropped until NTP has synced, a record timestamped in 1970 would be stored as such
+void System::queueSample(uint8_t measurement, float v0, float v1, float v2, uint8_t index) {
+  if (::time(nullptr) < ValidTimeStart) return;
+  sample_record sample;
+  sample.time = ::time(nullptr);
+  sample.measurement = measurement;
+  sample.index = index;
+  sample.values[0] = v0;
+  sample.values[1] = v1;
+  sample.values[2] = v2;
+#ifdef DUAL_CORE
+  if (!sampleQueue.push(sample)) droppedSamples++;
+#else
+  formatSample(sample);
+#endif
+}
+
+// Serialize a sample as line protocol into the upload queue
+void System::formatSample(const sample_record &sample) {
+  if (sample.measurement >= Measurements) return;
+  LineProtocolWriter line(lineBuffer, sizeof(lineBuffer));
+  line.begin(MeasurementName[sample.measurement]);
+  if (sample.measurement != MeasurementProfile) line.tag("ssid", ssidTag);
+
+  switch (sample.measurement) {
+    case MeasurementTemperature:
+      line.field("Temperature C", sample.values[0]);
+      line.field("Dew Point C", sample.values[1]);
+      break;
+    case MeasurementHumidity:
+      line.field("Relative Humidity %", sample.values[0]);
+      line.field("Absolute Humidity g/m^3", sample.values[1]);
+      break;
+    case MeasurementVOC:
+      line.field("TVOC PPB", (uint32_t)sample.values[0]);
+      break;
+    case MeasurementCO2:
+      line.field("CO2 PPM", (uint32_t)sample.values[0]);
+      break;
+    case MeasurementPM:
+      line.field("PM 1.0 μg/m^3", (uint32_t)sample.values[0]);
+      line.field("PM 2.5 μg/m^3", (uint32_t)sample.values[1]);
+      line.field("PM 10 μg/m^3", (uint32_t)sample.values[2]);
+      break;
+    case MeasurementProfile:
+      // One line per stage, InfluxDB merges them into one point since they share the timestamp
+      if (sample.index < ProfileStages) {
+        char name[24];
+        sprintf(name, "%s mean us", ProfileStageName[sample.index]);
+        line.field(name, (uint32_t)sample.values[0]);
+        sprintf(name, "%s max us", ProfileStageName[sample.index]);
+        line.field(name, (uint32_t)sample.values[1]);
+      } else {
+        line.field("Duty cycle %", sample.values[0]);
+        line.field("Estimated current mA", sample.values[1]);
+      }
+      break;
+  }
+
+  size_t length = line.end(sample.time);
+  if (length == 0 || !uploadQueue.push(lineBuffer, length)) {
+    Serial.printf("Upload queue full, data point dropped\n");
+  }
+}
+
+#ifdef DUAL_CORE
+// Network side of the dual core pipeline, turns samples into line protocol and uploads them so
+// blocking HTTP requests never delay the sensor loop
+void System::networkTask(void *parameter) {
+  System *system = (System *)parameter;
+  sample_record sample;
+  while (true) {
+    while (system->sampleQueue.pop(sample)) system->formatSample(sample);
+    system->updateUpload(millis());
+    vTaskDelay(pdMS_TO_TICKS(NetworkTaskInterval));
+  }
+}
+#endif
+
+// Send queued data to the server, or spill it to flash while the server can't be reached
+// A request in progress takes a step per call and nothing else is done until it completes
+void System::updateUpload(uint32_t time) {
+  if (networkState < NetworkReady) return;
+#ifndef DUAL_CORE
+  // The profiler belongs to the sensor loop, on dual core this runs in the network task
+  PROFILE_STAGE(ProfileUpload);
+#endif
+  if (uploadState != UploadIdle) {
+    uint8_t result = influx.poll();
+    if (result != InfluxPending) finishUpload(time, result);
+    return;
+  }
+
+  // updateNetwork() reconnects WiFi, records go to flash meanwhile
+  if (networkState == NetworkReconnecting) {
+    if (uploadQueue.full()) spillUploadQueue();
+    return;
+  }
+  if (!serverReachable) {
+    if (uploadQueue.full()) spillUploadQueue();
+    if (time - lastUpload < uploadBackoff) return;
+    lastUpload = time;
+    uploadState = UploadHealthCheck;
+    influx.startHealthCheck();
+    return;
   }
 
-  // Write point
-  if (!client.writePoint(sensor)) {
-    Serial.print("InfluxDB write failed: ");
-    Serial.println(client.getLastErrorMessage());
+  if (!uploadQueue.empty() && (time - lastUpload >= UploadFlushInterval || uploadQueue.full())) {
+    lastUpload = time;
+    flushUploadQueue();
+  } else if (!offlineBuffer.empty() && time - lastOfflineDrain >= OfflineDrainInterval) {
+    lastOfflineDrain = time;
+    drainOfflineBuffer();
+  }
+}
+
+void System::finishUpload(uint32_t time, uint8_t result) {
+  uint8_t kind = uploadState;
+  uploadState = UploadIdle;
+  switch (kind) {
+    case UploadHealthCheck:
+      // Back off exponentially until the server responds again
+      if (result == InfluxOk) {
+        Serial.printf("InfluxDB reachable, %d segments buffered in flash\n", offlineBuffer.segments());
+        serverReachable = true;
+        uploadBackoff = UploadFlushInterval;
+      } else {
+        uploadBackoff = min(uploadBackoff * 2, UploadMaxBackoff);
+        Serial.printf("InfluxDB unreachable, retrying in %d s\n", uploadBackoff / 1000);
+      }
+      break;
+
+    case UploadQueued: {
+      bool done = batchDone(result);
+      uploadQueue.release(done);
+      if (!done) {
+        serverReachable = false;
+        if (uploadQueue.full()) spillUploadQueue();
+      }
+      break;
+    }
+
+    case UploadOffline:
+      if (batchDone(result)) {
+        offlineBuffer.consumeBatch();
+      } else {
+        serverReachable = false;
+        lastUpload = time;
+      }
+      break;
   }
 }
 
+// Start connecting to the current access point, the connection is checked by updateNetwork()
+void System::connectWiFi(uint32_t time) {
+  Serial.printf("Connecting to WiFi %s...\n", WiFiSSID[wifiAccessPoint]);
+  WiFi.begin(WiFiSSID[wifiAccessPoint], WiFiPassword[wifiAccessPoint]);
+  wifiConnectStart = time;
+}
+
+// Startup of the network services, one step per call so nothing here waits on the network
+// except for opening the connection to InfluxDB. Afterwards it watches the connection and
+// reconnects the same way, without setting the services up again.
+void System::updateNetwork(uint32_t time) {
+  switch (networkState) {
+    case NetworkConnecting:
+    case NetworkReconnecting:
+      if (WiFi.status() != WL_CONNECTED) {
+        if (time - wifiConnectStart >= WiFiConnectTimeout) {
+          // Try the next access point
+          wifiAccessPoint = (wifiAccessPoint + 1) % WiFiCount;
+          connectWiFi(time);
+        }
+        break;
+      }
+      strncpy(ssidTag, WiFi.SSID().c_str(), sizeof(ssidTag) - 1);
+      ssidTag[sizeof(ssidTag) - 1] = '\0';
+      if (networkState == NetworkReconnecting) {
+        Serial.printf("Reconnected to WiFi %s\n", ssidTag);
+        networkState = NetworkReady;
+        break;
+      }
+
+      Serial.printf("Connected to WiFi after %d ms\n", time);
+      // Let the modem sleep between beacons, on the ESP8266 this also lets the CPU light sleep
+      // during delay()
+      if (IdleSleep) {
+#ifdef ESP8266_WIFI
+        WiFi.setSleepMode(WIFI_LIGHT_SLEEP, WiFiListenInterval);
+#else
+        WiFi.setSleep(true);
+#endif
+      }
+#ifdef ESP8266
+      configTime(TZ_INFO, "pool.ntp.org", "time.nis.gov");
+#else
+      configTzTime(TZ_INFO, "pool.ntp.org", "time.nis.gov");
+#endif
+      networkState = NetworkTimeSync;
+      break;
+
+    case NetworkTimeSync:
+      if (::time(nullptr) < ValidTimeStart) break;
+      Serial.printf("Time synced after %d ms\n", time);
+      if (stateAgeUnchecked) checkStateAge();
+      influx.startHealthCheck();
+      networkState = NetworkServerCheck;
+      break;
+
+    case NetworkServerCheck: {
+      uint8_t result = influx.poll();
+      if (result == InfluxPending) break;
+      if (result == InfluxOk) {
+        Serial.printf("Connected to InfluxDB: %s\n", influx.serverUrl());
+      } else {
+        Serial.printf("InfluxDB connection failed: %s\n", influx.lastErrorMessage());
+        serverReachable = false;
+      }
+#ifdef ESP8266_HOMEKIT
+      arduino_homekit_setup(&config);
+      scheduler.start(TaskHomeKit, time);
+#endif
+      networkState = NetworkReady;
+      break;
+    }
+
+    case NetworkReady:
+      if (WiFi.status() == WL_CONNECTED) break;
+      // The core reconnects to the same access point by itself, the others are tried if that
+      // takes longer than usual
+      Serial.printf("WiFi connection lost\n");
+      networkState = NetworkReconnecting;
+      wifiConnectStart = time;
+      break;
+  }
+}
+
+#ifdef PROFILING
+// Export the mean and maximum time of each stage over the last interval, then start a new interval
+void System::queueProfile() {
+  for (uint8_t s = 0; s < ProfileStages; s++) {
+    if (profiler.stats(s).count == 0) continue;
+    queueSample(MeasurementProfile, profiler.mean(s), profiler.stats(s).max, 0, s);
+  }
+  queueSample(MeasurementProfile, profiler.dutyCycle() * 100, profiler.estimatedCurrent(), 0, ProfileStages);
+  profiler.reset();
+}
+#endif
+
+// Records queued while the batch is sent are kept for the next one
+void System::flushUploadQueue() {
+  Serial.printf("Writing %d data points...\n", uploadQueue.count());
+  uploadQueue.lock();
+  writeBatch(UploadQueued, uploadQueue.data(), uploadQueue.lockedSize());
+}
+
+// Send the oldest batch of records stored in flash
+void System::drainOfflineBuffer() {
+  size_t length = offlineBuffer.readBatch();
+  if (length == 0) return;
+  Serial.printf("Writing %u bytes of buffered data...\n", (unsigned int)length);
+  writeBatch(UploadOffline, offlineBuffer.batch(), length);
+}
+
+// Move the upload queue to flash, only full queues are written to limit flash wear
+void System::spillUploadQueue() {
+  Serial.printf("Buffering %d data points in flash\n", uploadQueue.count());
+  if (offlineBuffer.append(uploadQueue.data(), uploadQueue.size())) uploadQueue.clear();
+}
+
+// Start writing a batch of records in one request, finishUpload() gets the result
+void System::writeBatch(uint8_t kind, const char *data, size_t length) {
+  uploadState = kind;
+  influx.startWrite(data, length);
+}
+
+// True if the batch is done with, batches rejected by the server are dropped rather than retried
+bool System::batchDone(uint8_t result) {
+  if (result == InfluxOk) return true;
+  Serial.printf("InfluxDB write failed: %s\n", influx.lastErrorMessage());
+  int status = influx.lastStatusCode();
+  return status >= 400 && status < 500 && status != 429;
+}
+
 uint8_t System::getSubjectiveAirQuality() {
   if (currentSensorData.co2 > CO2Threshold5 ||
       currentSensorData.tvoc > VOCThreshold5 ||
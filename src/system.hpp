@@ -8,11 +8,28 @@
 #include <Adafruit_PM25AQI.h>
 #include <MHZ.h>
 #include <U8g2lib.h>
-#include <InfluxDbClient.h>
 #include <InfluxDbCloud.h>
 
 #include "constants.hpp"
 #include "credentials.hpp"
+#include "upload_queue.hpp"
+#include "offline_buffer.hpp"
+#include "sensor_data.hpp"
+#include "history.hpp"
+#include "frame_diff.hpp"
+#include "psychrometrics.hpp"
+#include "profiler.hpp"
+#include "scheduler.hpp"
+#include "uart_parsers.hpp"
+#include "sample_record.hpp"
+#include "spsc_queue.hpp"
+#include "line_protocol.hpp"
+#include "influx_writer.hpp"
+#include "publish_filter.hpp"
+#include "state_store.hpp"
+#include "series_log.hpp"
+#include "metrics_server.hpp"
+#include "serial_protocol.hpp"
 
 #ifdef SWSERIAL
 #include <SoftwareSerial.h>
@@ -21,62 +38,144 @@
 #endif
 
 #ifdef ESP8266_WIFI
-#include <ESP8266WiFiMulti.h>
+#include <ESP8266WiFi.h>
 #else
-#include <WiFiMulti.h>
+#include <WiFi.h>
 #endif
 
 #ifdef ESP8266_HOMEKIT
 #include <arduino_homekit_server.h>
+#include "homekit_notifier.hpp"
 #endif
 
+#ifdef DUAL_CORE
+#include <atomic>
+
+// State shared by the sensor loop on core 1 and the network task on core 0
+template <typename T> using Shared = std::atomic<T>;
+#else
+template <typename T> using Shared = T;
+#endif
+
+typedef enum : uint8_t {
+  SGP30StateIdle,
+  SGP30StateHumidity,
+  SGP30StateMeasure,
+  SGP30StateBaseline
+} SGP30State;
+
+typedef struct {
+  uint8_t x, y, w, h;
+  float padding;         // added above the maximum and below the minimum
+  bool fromZero;         // start the range at 0 instead of the minimum
+  bool showRange;
+  uint8_t decimalPlaces;
+} graph_layout;
+
+// Graph geometry, recomputed only when the history it was built from changes
 typedef struct {
-  float temperature;         // C - temperature compensated for sensor self-heating
-  float humidity;            // %RH - humidity compensated for sensor self-heating
-  float temperatureRaw;      // C - raw temperature - for debug purposes
-  float humidityRaw;         // %RH - raw relative humidity - for debug purposes
-  float absoluteHumidity;    // g/m^3 - always correct, independent of sensor temperature
-  float dewPoint;            // C - always correct, independent of sensor temperature
-  uint16_t tvoc;             // ppb
-  uint16_t eco2;             // ppm
-  uint16_t co2;              // ppm
-  uint16_t pm10;             // μg/m^3
-  uint16_t pm25;             // μg/m^3
-  uint16_t pm100;            // μg/m^3
-} sensor_data;
+  bool valid;
+  uint8_t tier;
+  uint32_t version;
+  uint8_t xOffset;
+  uint16_t count;                      // points to draw, 0 if the graph is flat
+  uint8_t points[DataHistoryLength];   // y coordinates
+  char minLabel[8];
+  char maxLabel[8];
+} graph_cache;
+
+// Restored after a reboot along with the history, see StateStore
+typedef struct {
+  uint16_t sgp30Eco2Base;
+  uint16_t sgp30TvocBase;
+  uint16_t pm10;  // last PM measurement, μg/m^3
+  uint16_t pm25;
+  uint16_t pm100;
+  uint32_t time;  // s, unix time the checkpoint was taken, 0 if the clock was never set
+} saved_state;
 
 class System {
   public:
     System();
     void init();
     void tick();
+    void idle();
+#ifdef PIO_UNIT_TESTING
+    // Display path, for timing it from test/
+    void redrawDisplay(uint8_t state) { displayState = state; updateDisplay(); }
+    void invalidateGraphs() { for (uint8_t c = 0; c < HistoryChannels; c++) graphCache[c].valid = false; }
+    const uint8_t *displayBuffer() { return u8g2.getBufferPtr(); }
+#endif
 
   private:
+    void runTask(uint8_t task, uint32_t time);
+    void readSensors();
+    void requestCO2(uint32_t time);
+    void pollCO2();
+    void pollPM(uint32_t time);
+    void finishPMMeasurement();
+    void publishSensorData();
+    void printSensorData(uint32_t time);
+    void sendSerialStats();
+    void updateSGP30();
+    void restoreState();
+    void checkStateAge();
+    void checkpointState();
     void updateDisplay();
 
-    void drawLineGraph(uint8_t x, uint8_t y, uint8_t w, uint8_t h,
-                       int32_t values[], uint8_t count, int32_t min, int32_t max,
-                       bool showRange, uint8_t decimalPlaces = 0, uint16_t scaling = 1);
-    void drawLineGraph(uint8_t x, uint8_t y, uint8_t w, uint8_t h,
-                       float values[], uint8_t count, float min, float max,
-                       bool showRange, uint8_t decimalPlaces = 1);
+    void sendDisplayBuffer();
+    void drawGraph(uint8_t channel);
+    void updateGraph(uint8_t channel);
     void setDisplayBrightness(uint8_t brightness, uint8_t p1 = 1, uint8_t p2 = 10);
-    void sendSensorData(Point sensor);
+    bool publish(uint8_t measurement, float v0, float v1 = 0, float v2 = 0);
+    void queueSample(uint8_t measurement, float v0, float v1 = 0, float v2 = 0, uint8_t index = 0);
+    void formatSample(const sample_record &sample);
+#ifdef DUAL_CORE
+    static void networkTask(void *parameter);
+#endif
+    void connectWiFi(uint32_t time);
+    void updateNetwork(uint32_t time);
+    void updateUpload(uint32_t time);
+    void finishUpload(uint32_t time, uint8_t result);
+    void flushUploadQueue();
+    void drainOfflineBuffer();
+    void spillUploadQueue();
+    void writeBatch(uint8_t kind, const char *data, size_t length);
+    bool batchDone(uint8_t result);
+#ifdef PROFILING
+    void queueProfile();
+#endif
     uint8_t getSubjectiveAirQuality();
 
-    Point temperaturePoint = Point("Temperature");
-    Point humidityPoint = Point("Humidity");
-    Point vocPoint = Point("Volatile Organic Compounds");
-    Point co2Point = Point("Carbon Dioxide");
-    Point pmPoint = Point("Particulate Matter");
+    // Records are serialized into fixed buffers, the String based Point API fragments the heap
+    char ssidTag[33];
+    char lineBuffer[LineProtocolMaxLength];
 
-#ifdef ESP8266_WIFI
-    ESP8266WiFiMulti wifiMulti;
-#else
-    WiFiMulti wifiMulti;
+    InfluxWriter influx;
+    PublishFilter publishFilter;
+#ifdef ESP8266_HOMEKIT
+    HomeKitNotifier homekit;
 #endif
-
-    InfluxDBClient client = InfluxDBClient(INFLUXDB_URL, INFLUXDB_ORG, INFLUXDB_BUCKET, INFLUXDB_TOKEN, InfluxDbCloud2CACert);
+    UploadQueue uploadQueue;
+#ifdef DUAL_CORE
+    SPSCQueue<sample_record, SampleQueueLength> sampleQueue;
+    uint32_t droppedSamples = 0;
+#endif
+    OfflineBuffer offlineBuffer;
+    SeriesLog seriesLog;
+    MetricsServer metricsServer;
+    SerialProtocol serialProtocol;
+    uint8_t logLevel = DefaultLogLevel;
+    StateStore stateStore;
+    state_region stateRegions[3];
+    saved_state savedState;
+    bool stateRestored = false;
+    bool stateAgeUnchecked = false; // restored before the clock was set
+    bool sgp30BaselineReset = false; // set the default baseline before the next measurement
+    uint32_t checkpointHistoryChanges = 0;
+    Shared<bool> serverReachable{true};
+    Shared<uint32_t> uploadBackoff{UploadFlushInterval};
+    Shared<uint8_t> uploadState{UploadIdle};
 
 #ifdef AHTx0
     Adafruit_AHTX0 aht = Adafruit_AHTX0();
@@ -96,19 +195,29 @@ class System {
 #endif
 
     MHZ mhz19 = MHZ(co2Serial, MHZ19C);
-    Adafruit_PM25AQI pms5003 = Adafruit_PM25AQI();
+    MHZ19Parser mhz19Parser;
+    PMS5003Parser pmsParser;
+    bool mhz19Pending = false;
+    uint32_t mhz19RequestTime = 0;
+    uint32_t mhz19MissedReplies = 0;
+    uint32_t pmOverflows = 0;
+    uint32_t lastPMFrame = 0;
 
     U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C u8g2 = U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C(U8G2_R2);
+    FrameDiff frameDiff;
 
+    Scheduler scheduler;
     bool firstUpdate = true;
-    uint32_t lastUpdate = 0;
-    uint32_t lastBaselineCheck = 0;
-    uint32_t lastDataHistoryUpdate = 0;
-    uint32_t lastDataPoint = 0;
-    uint32_t lastDisplayCycle = 0;
-    uint32_t lastDisplayOn = 0;
+    bool firstCO2Reading = true;
+    Shared<uint8_t> networkState{NetworkConnecting};
+    uint8_t wifiAccessPoint = 0;
+    uint32_t wifiConnectStart = 0;
     uint32_t lastPMWake = 0;
-    bool pmMeasurementDone = false;
+    uint32_t lastUpload = 0;
+    uint32_t lastOfflineDrain = 0;
+#ifdef PROFILING
+    Profiler profiler;
+#endif
 
     bool prevButtonState = false;
     uint32_t lastButtonChange = 0;
@@ -117,11 +226,15 @@ class System {
     bool displayCycle = true;
     bool displayNeedsUpdate = true;
     uint8_t displayState = 0;
+    uint8_t displayTier = HistoryTierMinute;
+    graph_cache graphCache[HistoryChannels];
 
     // Sensor data
     sensor_data currentSensorData;
-    sensor_data oldSensorData[DataHistoryLength];
+    SensorHistory dataHistory;
 
+    uint8_t sgp30State = SGP30StateIdle;
+    bool sgp30BaselineDue = false;
     uint16_t sgp30TvocBase = 0;
     uint16_t sgp30Eco2Base = 0;
 
@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "uart_parsers.hpp"
+
+static const uint8_t MHZ19Start = 0xFF;
+static const uint8_t MHZ19ReadCO2 = 0x86;
+static const uint8_t PMS5003Start1 = 0x42;
+static const uint8_t PMS5003Start2 = 0x4D;
+
+bool MHZ19Parser::feed(uint8_t byte) {
+  buffer[length++] = byte;
+
+  // Check the header as far as it has arrived, skipping bytes until it matches
+  while (length > 0) {
+    if (buffer[0] != MHZ19Start || (length >= 2 && buffer[1] != MHZ19ReadCO2)) {
+      discard(1);
+      continue;
+    }
+    if (length < FrameLength) return false;
+
+    if (checksum(buffer) != buffer[FrameLength - 1]) {
+      // The frame may have started later, search the rest of it for a header
+      stats.checksumErrors++;
+      discard(1);
+      continue;
+    }
+
+    value = buffer[2] << 8 | buffer[3];
+    temp = (int16_t)buffer[4] - 40;
+    length = 0;
+    stats.frames++;
+    return true;
+  }
+  return false;
+}
+
+uint8_t MHZ19Parser::checksum(const uint8_t *frame) {
+  uint8_t sum = 0;
+  for (uint8_t i = 1; i < FrameLength - 1; i++) sum += frame[i];
+  return 0xFF - sum + 1;
+}
+
+void MHZ19Parser::discard(uint8_t count) {
+  memmove(buffer, buffer + count, length - count);
+  length -= count;
+  stats.discardedBytes += count;
+}
+
+bool PMS5003Parser::feed(uint8_t byte) {
+  buffer[length++] = byte;
+
+  while (length > 0) {
+    if (buffer[0] != PMS5003Start1 || (length >= 2 && buffer[1] != PMS5003Start2) ||
+        (length >= 4 && (buffer[2] << 8 | buffer[3]) != FrameLength - 4)) {
+      discard(1);
+      continue;
+    }
+    if (length < FrameLength) return false;
+
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < FrameLength - 2; i++) sum += buffer[i];
+    if (sum != (buffer[FrameLength - 2] << 8 | buffer[FrameLength - 1])) {
+      stats.checksumErrors++;
+      discard(1);
+      continue;
+    }
+
+    // Same layout as the Adafruit library: every big endian word after the start bytes
+    uint16_t words[(FrameLength - 2) / 2];
+    for (uint8_t i = 0; i < (FrameLength - 2) / 2; i++) {
+      words[i] = buffer[2 + i * 2] << 8 | buffer[3 + i * 2];
+    }
+    memcpy((void *)&frame, words, sizeof(words));
+    length = 0;
+    stats.frames++;
+    return true;
+  }
+  return false;
+}
+
+void PMS5003Parser::discard(uint8_t count) {
+  memmove(buffer, buffer + count, length - count);
+  length -= count;
+  stats.discardedBytes += count;
+}
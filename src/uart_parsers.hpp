@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Adafruit_PM25AQI.h>
+
+// Counters shared by the serial frame parsers
+typedef struct {
+  uint32_t frames;         // valid frames delivered
+  uint32_t checksumErrors; // frames dropped because of a bad checksum
+  uint32_t discardedBytes; // bytes skipped while looking for the start of a frame
+} frame_parser_stats;
+
+// Incremental parser for MH-Z19 "read CO2" replies, fed one byte at a time
+// Reply: 0xFF 0x86 CO2-high CO2-low temperature+40 status - - checksum
+class MHZ19Parser {
+  public:
+    static const uint8_t FrameLength = 9;
+
+    // Returns true when the byte completes a valid frame
+    bool feed(uint8_t byte);
+
+    uint16_t co2() const { return value; }
+    int8_t temperature() const { return temp; }
+
+    // Checksum of a command or reply, over every byte but the first and the last
+    static uint8_t checksum(const uint8_t *frame);
+
+    frame_parser_stats stats = { 0, 0, 0 };
+
+  private:
+    void discard(uint8_t count);
+
+    uint8_t buffer[FrameLength];
+    uint8_t length = 0;
+    uint16_t value = 0;
+    int8_t temp = 0;
+};
+
+// Incremental parser for PMS5003 data frames, fed one byte at a time
+// Frame: 0x42 0x4D length(28) 13 data words, checksum word over all bytes before it
+class PMS5003Parser {
+  public:
+    static const uint8_t FrameLength = 32;
+
+    // Returns true when the byte completes a valid frame
+    bool feed(uint8_t byte);
+
+    const PM25_AQI_Data &data() const { return frame; }
+
+    frame_parser_stats stats = { 0, 0, 0 };
+
+  private:
+    void discard(uint8_t count);
+
+    uint8_t buffer[FrameLength];
+    uint8_t length = 0;
+    PM25_AQI_Data frame;
+};
@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "upload_queue.hpp"
+
+UploadQueue::UploadQueue() {
+  buffer[0] = '\0';
+}
+
+// Append a record, dropping the oldest records if there is not enough space left
+// Locked records aren't dropped, if they take all the space the new record is
+bool UploadQueue::push(const char *record, size_t recordLength) {
+  if (recordLength == 0 || recordLength + 1 > UploadQueueSize) return false;
+  while (length + recordLength + 1 > UploadQueueSize) {
+    if (!dropOldest()) {
+      droppedRecords++;
+      return false;
+    }
+  }
+
+  memcpy(buffer + length, record, recordLength);
+  length += recordLength;
+  buffer[length++] = '\n';
+  buffer[length] = '\0';
+  records++;
+  return true;
+}
+
+void UploadQueue::clear() {
+  length = 0;
+  records = 0;
+  lockedLength = 0;
+  lockedRecords = 0;
+  buffer[0] = '\0';
+}
+
+void UploadQueue::lock() {
+  lockedLength = length;
+  lockedRecords = records;
+}
+
+void UploadQueue::release(bool sent) {
+  if (sent) {
+    memmove(buffer, buffer + lockedLength, length - lockedLength);
+    length -= lockedLength;
+    records -= lockedRecords;
+    buffer[length] = '\0';
+  }
+  lockedLength = 0;
+  lockedRecords = 0;
+}
+
+// Drop the oldest record that isn't locked, false if there is none
+bool UploadQueue::dropOldest() {
+  if (lockedLength == length) return false;
+  char *start = buffer + lockedLength;
+  const char *end = (const char *)memchr(start, '\n', length - lockedLength);
+  size_t recordLength = end ? end - start + 1 : length - lockedLength;
+  memmove(start, start + recordLength, length - lockedLength - recordLength);
+  length -= recordLength;
+  buffer[length] = '\0';
+  records--;
+  droppedRecords++;
+  return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "constants.hpp"
+
+// Bounded in-RAM queue of InfluxDB line protocol records
+// Records are stored back to back, separated by newlines, so the whole queue can be sent as the
+// body of a single write request
+class UploadQueue {
+  public:
+    UploadQueue();
+
+    bool push(const char *record, size_t length);
+    void clear();
+    // Keep the records queued so far in place while they're being sent, later records are still
+    // queued behind them
+    void lock();
+    // Remove the locked records once they're sent, or keep them for the next attempt
+    void release(bool sent);
+
+    const char *data() const { return buffer; }
+    size_t size() const { return length; }
+    size_t lockedSize() const { return lockedLength; }
+    uint16_t count() const { return records; }
+    bool empty() const { return records == 0; }
+    bool full() const { return length >= UploadQueueFlushThreshold; }
+
+    uint32_t droppedRecords = 0;
+
+  private:
+    bool dropOldest();
+
+    char buffer[UploadQueueSize + 1];
+    size_t length = 0;
+    uint16_t records = 0;
+    size_t lockedLength = 0;
+    uint16_t lockedRecords = 0;
+};
@@ -0,0 +1,92 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string>
+#include <chrono>
+
+#include "sim.hpp"
+#include "system.hpp"
+
+// CPU time of a display frame with the graph cache against rebuilding the graphs every frame
+// Rebuilding is what every frame did before the cache: scan the history for its range, scale
+// every point and format the range labels. The cache is only rebuilt when a bucket is added to
+// the displayed tier, once a minute.
+
+extern System device;
+void setup();
+
+static char fsRoot[] = "/tmp/test_display_graph_XXXXXX";
+
+static void run(uint32_t seconds) {
+  uint64_t end = simulation.micros() + seconds * 1000000ULL;
+  while (simulation.micros() < end) {
+    device.tick();
+    device.idle();
+    simulation.advance(1000);
+  }
+}
+
+// Host time of one frame in ns, the graphs rebuilt first when asked to
+static double frameTime(uint8_t state, bool rebuild) {
+  static const uint32_t Frames = 4000;
+  typedef std::chrono::steady_clock Clock;
+  double total = 0;
+  for (uint32_t n = 0; n < Frames; n++) {
+    if (rebuild) device.invalidateGraphs();
+    Clock::time_point start = Clock::now();
+    device.redrawDisplay(state);
+    total += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  }
+  return total / Frames;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Both paths draw the same frame
+void test_same_frame() {
+  static const size_t FrameBytes = DisplayTileWidth * DisplayTileHeight * 8;
+  for (uint8_t state = DisplayStateTempHumidity; state <= DisplayStatePM; state++) {
+    device.invalidateGraphs();
+    device.redrawDisplay(state);
+    uint8_t rebuilt[FrameBytes];
+    memcpy(rebuilt, device.displayBuffer(), FrameBytes);
+    device.redrawDisplay(state);
+    TEST_ASSERT_EQUAL_MEMORY(rebuilt, device.displayBuffer(), FrameBytes);
+  }
+}
+
+// Best of a few interleaved rounds, so a stall on a busy host doesn't decide the comparison
+void test_frame_benchmark() {
+  static const char *const Names[] = { "temperature/humidity", "VOC", "CO2", "PM2.5" };
+  static const uint8_t Rounds = 5;
+  for (uint8_t state = DisplayStateTempHumidity; state <= DisplayStatePM; state++) {
+    double rebuilt = 1e9, cached = 1e9;
+    for (uint8_t round = 0; round < Rounds; round++) {
+      rebuilt = min(rebuilt, frameTime(state, true));
+      cached = min(cached, frameTime(state, false));
+    }
+    char message[128];
+    snprintf(message, sizeof(message), "%s frame: graphs rebuilt %.0f ns, cached %.0f ns (host)",
+             Names[state], rebuilt, cached);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN(rebuilt, cached);
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.fsRoot = mkdtemp(fsRoot);
+  simulation.quiet = true;
+  setup();
+  // A couple of hours of history, so the graphs have points to draw
+  run(7200);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_same_frame);
+  RUN_TEST(test_frame_benchmark);
+  int failures = UNITY_END();
+
+  system((std::string("rm -rf ") + fsRoot).c_str());
+  return failures;
+}
@@ -0,0 +1,127 @@
+#include <unity.h>
+#include <stdio.h>
+
+#include "sim.hpp"
+#include "U8g2lib.h"
+#include "frame_diff.hpp"
+
+// FrameDiff against the simulated display: after every frame, the tiles sent must leave the
+// display controller holding exactly the frame that was drawn
+
+static U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C display(U8G2_R2);
+static const size_t FrameBytes = DisplayTileWidth * DisplayTileHeight * 8;
+// Full frame: the addressing commands and 128 bytes of every tile row
+static const uint32_t FullFrameBytes = 4 * (8 + 128);
+
+static uint32_t seed = 1;
+static uint32_t nextRandom(uint32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % range;
+}
+
+// Send a frame the way System::sendDisplayBuffer() does, returns the bytes it took
+static uint32_t send(FrameDiff &diff) {
+  uint32_t before = display.getU8x8()->bytes;
+  tile_run runs[FrameDiff::MaxRuns];
+  uint8_t count = diff.diff(display.getBufferPtr(), runs);
+  for (uint8_t i = 0; i < count; i++) {
+    display.updateDisplayArea(runs[i].x, runs[i].y, runs[i].w, 1);
+  }
+  return display.getU8x8()->bytes - before;
+}
+
+static void assertScreenMatches() {
+  TEST_ASSERT_EQUAL_MEMORY(display.getBufferPtr(), display.screen, FrameBytes);
+}
+
+// A frame like the CO2 page: a big reading that changes now and then and a graph that shifts
+// once a minute, redrawn every second
+static void drawPage(uint32_t second, uint16_t co2) {
+  char line[16];
+  display.clearBuffer();
+  display.setFont(u8g2_font_profont22_tf);
+  snprintf(line, sizeof(line), "%4d", co2);
+  uint8_t width = display.drawUTF8(0, 14, line);
+  display.setFont(u8g2_font_profont12_tf);
+  display.drawUTF8(width, 11, "ppm CO2");
+  uint32_t minute = second / 60;
+  for (uint8_t i = 1; i < 60; i++) {
+    uint8_t y0 = 16 + (minute + i - 1) * 7 % 15;
+    uint8_t y1 = 16 + (minute + i) * 7 % 15;
+    display.drawLine(20 + (i - 1) * 108 / 60, y0, 20 + i * 108 / 60, y1);
+  }
+}
+
+void setUp() {
+  display.begin();
+}
+void tearDown() {}
+
+// The first frame goes out in full, an unchanged frame sends nothing
+void test_first_and_unchanged() {
+  FrameDiff diff;
+  drawPage(0, 415);
+  TEST_ASSERT_EQUAL(FullFrameBytes, send(diff));
+  assertScreenMatches();
+  TEST_ASSERT_EQUAL(0, send(diff));
+  TEST_ASSERT_EQUAL(1, diff.unchangedFrames);
+
+  diff.invalidate();
+  TEST_ASSERT_EQUAL(FullFrameBytes, send(diff));
+}
+
+// Single pixels anywhere, including tile edges and gaps of one tile that get merged into a run
+void test_pixels() {
+  FrameDiff diff;
+  display.clearBuffer();
+  send(diff);
+  for (uint32_t n = 0; n < 20000; n++) {
+    uint8_t changes = 1 + nextRandom(6);
+    for (uint8_t i = 0; i < changes; i++) {
+      uint8_t x = nextRandom(128), y = nextRandom(32);
+      display.getBufferPtr()[(y / 8) * 128 + x] ^= 1 << (y % 8);
+    }
+    send(diff);
+    if (memcmp(display.getBufferPtr(), display.screen, FrameBytes) != 0) TEST_FAIL_MESSAGE("screen differs");
+  }
+}
+
+// Whole random frames, every tile changes
+void test_random_frames() {
+  FrameDiff diff;
+  for (uint32_t n = 0; n < 200; n++) {
+    for (size_t i = 0; i < FrameBytes; i++) display.getBufferPtr()[i] = nextRandom(256);
+    send(diff);
+    assertScreenMatches();
+  }
+}
+
+// A day of one redraw per second, as the display pages do, and the traffic saved
+void test_page_traffic() {
+  FrameDiff diff;
+  uint32_t sent = 0, frames = 0;
+  uint16_t co2 = 600;
+  for (uint32_t second = 0; second < 86400; second++) {
+    if (second % 5 == 0) co2 += nextRandom(21) - 10;
+    drawPage(second, co2);
+    sent += send(diff);
+    frames++;
+    if (memcmp(display.getBufferPtr(), display.screen, FrameBytes) != 0) TEST_FAIL_MESSAGE("screen differs");
+  }
+  char message[160];
+  snprintf(message, sizeof(message), "%u frames: %u bytes sent, %u as full frames (%.1f%%), %u frames unchanged",
+           frames, sent, frames * FullFrameBytes, 100.0 * sent / (frames * FullFrameBytes), diff.unchangedFrames);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(frames * FullFrameBytes / 4, sent);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_first_and_unchanged);
+  RUN_TEST(test_pixels);
+  RUN_TEST(test_random_frames);
+  RUN_TEST(test_page_traffic);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <zlib.h>
+
+#include "gzip.hpp"
+#include "line_protocol.hpp"
+
+// GzipEncoder output inflated by zlib, the way InfluxDB reads it, for line protocol, random data and
+// the edge cases of the match finder; and its time per batch and ratio against zlib's best
+
+static GzipEncoder encoder; // static as on the device
+static uint8_t compressed[UploadQueueSize + UploadQueueSize / 8 + 64];
+static uint8_t inflated[UploadQueueSize * 2];
+
+static uint32_t seed = 1;
+static uint32_t nextRandom(uint32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % range;
+}
+
+// Records as the firmware writes them, up to a full upload queue
+static size_t lineProtocolBatch(char *batch, size_t capacity, uint32_t time) {
+  size_t length = 0;
+  for (uint32_t n = 0;; n++) {
+    char record[LineProtocolMaxLength];
+    LineProtocolWriter line(record, sizeof(record));
+    Measurement measurement = (Measurement)(n % (Measurements - 1));
+    line.begin(MeasurementName[measurement]);
+    line.tag("ssid", "HomeNetwork");
+    switch (measurement) {
+      case MeasurementTemperature:
+        line.field("Temperature C", 20 + nextRandom(300) * 0.01f);
+        line.field("Dew Point C", 8 + nextRandom(300) * 0.01f);
+        break;
+      case MeasurementHumidity:
+        line.field("Relative Humidity %", 40 + nextRandom(200) * 0.01f);
+        line.field("Absolute Humidity g/m3", 7 + nextRandom(100) * 0.01f);
+        break;
+      case MeasurementVOC:
+        line.field("VOC PPB", (uint32_t)nextRandom(500));
+        break;
+      case MeasurementCO2:
+        line.field("CO2 PPM", (uint32_t)(400 + nextRandom(800)));
+        break;
+      default:
+        line.field("PM1.0 ug/m3", (uint32_t)nextRandom(20));
+        line.field("PM2.5 ug/m3", (uint32_t)nextRandom(30));
+        line.field("PM10 ug/m3", (uint32_t)nextRandom(40));
+        break;
+    }
+    size_t recordLength = line.end(time + n * 6);
+    if (length + recordLength + 1 > capacity) return length;
+    memcpy(batch + length, record, recordLength);
+    length += recordLength;
+    batch[length++] = '\n';
+  }
+}
+
+static size_t gunzip(const uint8_t *data, size_t length) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  TEST_ASSERT_EQUAL(Z_OK, inflateInit2(&stream, 16 + MAX_WBITS));
+  stream.next_in = (Bytef *)data;
+  stream.avail_in = length;
+  stream.next_out = inflated;
+  stream.avail_out = sizeof(inflated);
+  int result = inflate(&stream, Z_FINISH);
+  size_t inflatedLength = stream.total_out;
+  inflateEnd(&stream);
+  TEST_ASSERT_EQUAL(Z_STREAM_END, result); // also checks the CRC and length in the trailer
+  return inflatedLength;
+}
+
+static void assertRoundTrip(const uint8_t *data, size_t length) {
+  size_t compressedLength = encoder.compress(data, length, compressed, sizeof(compressed));
+  TEST_ASSERT_GREATER_THAN(0, compressedLength);
+  TEST_ASSERT_EQUAL(length, gunzip(compressed, compressedLength));
+  TEST_ASSERT_EQUAL_MEMORY(data, inflated, length);
+}
+
+static size_t zlibBest(const uint8_t *data, size_t length) {
+  uint8_t out[sizeof(compressed)];
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, 9, Z_DEFLATED, 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY);
+  stream.next_in = (Bytef *)data;
+  stream.avail_in = length;
+  stream.next_out = out;
+  stream.avail_out = sizeof(out);
+  deflate(&stream, Z_FINISH);
+  size_t compressedLength = stream.total_out;
+  deflateEnd(&stream);
+  return compressedLength;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_line_protocol() {
+  char batch[UploadQueueSize];
+  for (uint32_t n = 0; n < 500; n++) {
+    size_t length = lineProtocolBatch(batch, sizeof(batch), 1700000000 + n * 600);
+    assertRoundTrip((const uint8_t *)batch, length);
+  }
+}
+
+// The same batch cut at every length up to a full queue
+void test_lengths() {
+  char batch[UploadQueueSize];
+  size_t full = lineProtocolBatch(batch, sizeof(batch), 1700000000);
+  for (size_t length = 0; length <= full; length++) {
+    assertRoundTrip((const uint8_t *)batch, length);
+  }
+}
+
+// Incompressible data takes the literal path all the way and grows a little, within the bound
+void test_random() {
+  uint8_t data[UploadQueueSize];
+  for (uint32_t n = 0; n < 200; n++) {
+    size_t length = 1 + nextRandom(sizeof(data));
+    for (size_t i = 0; i < length; i++) data[i] = nextRandom(256);
+    assertRoundTrip(data, length);
+  }
+}
+
+// Long runs and repeats just inside and outside the window: the longest and farthest matches
+void test_matches() {
+  uint8_t data[UploadQueueSize];
+  memset(data, 'a', sizeof(data));
+  assertRoundTrip(data, sizeof(data));
+
+  for (size_t period = GzipWindowSize - 2; period <= GzipWindowSize + 2; period++) {
+    for (size_t i = 0; i < period; i++) data[i] = nextRandom(256);
+    for (size_t i = period; i < sizeof(data); i++) data[i] = data[i - period];
+    assertRoundTrip(data, sizeof(data));
+  }
+
+  // Few distinct bytes, many short and overlapping matches
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = "ab"[nextRandom(2)];
+  assertRoundTrip(data, sizeof(data));
+}
+
+// An output buffer too small is reported, without writing past it
+void test_overflow() {
+  uint8_t data[512];
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = nextRandom(256);
+  memset(compressed, 0xA5, sizeof(compressed));
+  TEST_ASSERT_EQUAL(0, encoder.compress(data, sizeof(data), compressed, 300));
+  TEST_ASSERT_EQUAL(0xA5, compressed[300]);
+  TEST_ASSERT_EQUAL(0, encoder.compress(data, 0, compressed, 10)); // smaller than the header
+}
+
+// Full upload queues of line protocol: time per batch, ratio, and zlib -9 on the same batches
+void test_benchmark() {
+  static const uint32_t Batches = 2000;
+  typedef std::chrono::steady_clock Clock;
+  char batch[UploadQueueSize];
+  size_t raw = 0, ours = 0, zlib = 0;
+  double elapsed = 0;
+
+  for (uint32_t n = 0; n < Batches; n++) {
+    size_t length = lineProtocolBatch(batch, sizeof(batch), 1700000000 + n * 600);
+    Clock::time_point start = Clock::now();
+    size_t compressedLength = encoder.compress((const uint8_t *)batch, length, compressed, UploadCompressedSize);
+    elapsed += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    TEST_ASSERT_GREATER_THAN(0, compressedLength);
+    raw += length;
+    ours += compressedLength;
+    zlib += zlibBest((const uint8_t *)batch, length);
+  }
+
+  char message[192];
+  snprintf(message, sizeof(message),
+           "%u batches of %u bytes: %.1f us per batch (host), ratio %.2f, zlib -9 %.2f; %u bytes of RAM",
+           Batches, (unsigned int)(raw / Batches), elapsed / Batches, (double)raw / ours, (double)raw / zlib,
+           (unsigned int)(sizeof(GzipEncoder) + UploadCompressedSize));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(3 * ours, raw);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_line_protocol);
+  RUN_TEST(test_lengths);
+  RUN_TEST(test_random);
+  RUN_TEST(test_matches);
+  RUN_TEST(test_overflow);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
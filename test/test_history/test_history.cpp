@@ -0,0 +1,208 @@
+#include <unity.h>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+
+#include "history.hpp"
+
+// Quantized column-wise history, and its footprint and scan speed against the layout it replaced:
+// a ring of whole sensor_data readings, scanned one member at a time
+
+typedef struct {
+  sensor_data data[DataHistoryLength];
+  RingIndex<DataHistoryLength> index;
+
+  void push(const sensor_data &value) { data[index.push()] = value; }
+  const sensor_data &operator[](size_t i) const { return data[index.slot(i)]; }
+  const sensor_data &back() const { return (*this)[index.size() - 1]; }
+} OldHistory;
+
+static uint32_t seed = 1;
+static uint32_t nextRandom(uint32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % range;
+}
+
+static sensor_data reading(float temperature, float humidity, uint16_t tvoc, uint16_t co2, uint16_t pm25) {
+  sensor_data data = {};
+  data.temperature = temperature;
+  data.humidity = humidity;
+  data.tvoc = tvoc;
+  data.co2 = co2;
+  data.pm25 = pm25;
+  return data;
+}
+
+static history_accumulator bucket(uint16_t value) {
+  history_accumulator acc;
+  for (uint8_t c = 0; c < HistoryChannels; c++) {
+    acc.sum[c] = value;
+    acc.min[c] = value;
+    acc.max[c] = value;
+  }
+  acc.count = 1;
+  return acc;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Values in range come back within half a step, values outside are clamped
+void test_quantize() {
+  for (int32_t i = -4000; i <= 8500; i++) {
+    float temperature = i * 0.01f;
+    float restored = historyDequantize(historyQuantize(temperature, HistoryTemperature), HistoryTemperature);
+    if (fabsf(restored - temperature) > HistoryStep[HistoryTemperature] * 0.51f) TEST_FAIL_MESSAGE("temperature");
+  }
+  for (uint32_t co2 = 0; co2 <= 65535; co2++) {
+    if (historyQuantize(co2, HistoryCO2) != co2) TEST_FAIL_MESSAGE("co2");
+  }
+  TEST_ASSERT_EQUAL(0, historyQuantize(-200, HistoryTemperature));
+  TEST_ASSERT_EQUAL(65535, historyQuantize(1e6f, HistoryCO2));
+  TEST_ASSERT_EQUAL(0, historyQuantize(-1, HistoryHumidity));
+}
+
+// Minute buckets fold into the higher tiers with the mean of their means and the overall min/max
+void test_tiers() {
+  static SensorHistory history;
+  uint32_t minutes = 600;
+  for (uint32_t m = 0; m < minutes; m++) {
+    for (uint8_t s = 0; s < 6; s++) {
+      uint16_t co2 = 400 + m + (s == 0 ? 50 : 0);
+      history.addSample(reading(20 + m * 0.01f, 50, m, co2, s));
+    }
+    history.closeMinute();
+  }
+  TEST_ASSERT_EQUAL(DataHistoryLength, history.tier(HistoryTierMinute).size());
+  TEST_ASSERT_EQUAL(minutes / 10, history.tier(HistoryTier10Minutes).size());
+  TEST_ASSERT_EQUAL(minutes / 60, history.tier(HistoryTierHour).size());
+  TEST_ASSERT_EQUAL(0, history.tier(HistoryTierDay).size());
+  TEST_ASSERT_EQUAL(minutes / 10, history.version(HistoryTier10Minutes));
+
+  // Newest minute: five samples of 400 + m and one of 450 + m
+  uint32_t m = minutes - 1;
+  SensorHistory::Tier::ChannelView co2 = history.channel(HistoryTierMinute, HistoryCO2);
+  TEST_ASSERT_EQUAL((6 * (400 + m) + 50 + 3) / 6, co2.raw(co2.size() - 1));
+  TEST_ASSERT_EQUAL(400 + m, history.channel(HistoryTierMinute, HistoryCO2, HistoryMin).raw(co2.size() - 1));
+  TEST_ASSERT_EQUAL(450 + m, history.channel(HistoryTierMinute, HistoryCO2, HistoryMax).raw(co2.size() - 1));
+
+  // First hour bucket spans minutes 0 to 59
+  SensorHistory::Tier::ChannelView hour = history.channel(HistoryTierHour, HistoryCO2, HistoryMin);
+  TEST_ASSERT_EQUAL(400, hour.raw(0));
+  TEST_ASSERT_EQUAL(450 + 59, history.channel(HistoryTierHour, HistoryCO2, HistoryMax).raw(0));
+  // Minute means are 408 + m, ten minute means 413 + 10k, rounded at each step
+  TEST_ASSERT_EQUAL(438, history.channel(HistoryTierHour, HistoryCO2).raw(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 50, history.channel(HistoryTierHour, HistoryHumidity)[0]);
+}
+
+// The cached range of the means always matches a full scan, also after its extremes are evicted
+void test_mean_range() {
+  static HistoryBuckets<DataHistoryLength> buckets;
+  for (uint32_t n = 0; n < DataHistoryLength * 50; n++) {
+    buckets.push(bucket(nextRandom(n % 200 < 100 ? 1000 : 60000)));
+    for (uint8_t c = 0; c < HistoryChannels; c += 2) {
+      uint16_t min, max;
+      buckets.meanRange(c, min, max);
+      uint16_t scanMin = 65535, scanMax = 0;
+      HistoryBuckets<DataHistoryLength>::ChannelView view = buckets.channel(c);
+      for (size_t i = 0; i < view.size(); i++) {
+        if (view.raw(i) < scanMin) scanMin = view.raw(i);
+        if (view.raw(i) > scanMax) scanMax = view.raw(i);
+      }
+      if (min != scanMin || max != scanMax) TEST_FAIL_MESSAGE("range differs from a scan");
+    }
+  }
+}
+
+// The new layout keeps min and max as well as the mean and is still smaller per bucket
+void test_footprint() {
+  size_t oldBytes = sizeof(OldHistory);
+  size_t newBytes = sizeof(SensorHistory::Tier);
+  char message[192];
+  snprintf(message, sizeof(message),
+           "%u buckets: sensor_data ring %u bytes (means only), columns %u bytes (mean/min/max), "
+           "all %u tiers %u bytes, %d bytes less free heap", DataHistoryLength, (unsigned)oldBytes,
+           (unsigned)newBytes, HistoryTiers, (unsigned)sizeof(SensorHistory),
+           (int)(sizeof(SensorHistory) - oldBytes));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(oldBytes, newBytes);
+  TEST_ASSERT_LESS_OR_EQUAL(DataHistoryMaxBytes, sizeof(SensorHistory));
+}
+
+// Finding the graph range of one channel, as updateDisplay() does for every frame
+void test_scan_benchmark() {
+  static const uint32_t Scans = 200000;
+  typedef std::chrono::steady_clock Clock;
+  volatile float sink = 0;
+
+  static OldHistory old;
+  static HistoryBuckets<DataHistoryLength> buckets;
+  for (uint16_t n = 0; n < DataHistoryLength + 17; n++) {
+    old.push(reading(20, 50, 0, 400 + nextRandom(1000), 0));
+    buckets.push(bucket(old.back().co2));
+  }
+
+  Clock::time_point start = Clock::now();
+  for (uint32_t n = 0; n < Scans; n++) {
+    int32_t min = 65535, max = 0;
+    for (size_t i = 0; i < old.index.size(); i++) {
+      uint16_t co2 = old[i].co2;
+      if (co2 < min) min = co2;
+      if (co2 > max) max = co2;
+    }
+    sink = sink + min + max;
+  }
+  double rowScan = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Scans;
+
+  start = Clock::now();
+  for (uint32_t n = 0; n < Scans; n++) {
+    HistoryBuckets<DataHistoryLength>::ChannelView co2 = buckets.channel(HistoryCO2);
+    float min = 65535, max = 0;
+    for (size_t i = 0; i < co2.size(); i++) {
+      float value = co2[i];
+      if (value < min) min = value;
+      if (value > max) max = value;
+    }
+    sink = sink + min + max;
+  }
+  double channelView = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Scans;
+
+  start = Clock::now();
+  for (uint32_t n = 0; n < Scans; n++) {
+    HistoryBuckets<DataHistoryLength>::ChannelView co2 = buckets.channel(HistoryCO2);
+    uint16_t min = 65535, max = 0;
+    for (size_t i = 0; i < co2.size(); i++) {
+      uint16_t value = co2.raw(i);
+      if (value < min) min = value;
+      if (value > max) max = value;
+    }
+    sink = sink + min + max;
+  }
+  double rawView = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Scans;
+
+  start = Clock::now();
+  for (uint32_t n = 0; n < Scans; n++) {
+    uint16_t min, max;
+    buckets.meanRange(HistoryCO2, min, max);
+    sink = sink + min + max;
+  }
+  double cached = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Scans;
+
+  char message[192];
+  snprintf(message, sizeof(message),
+           "range of %u buckets: sensor_data ring %.1f ns, dequantized column %.1f ns, raw column %.1f ns, "
+           "cached %.1f ns (host)", DataHistoryLength, rowScan, channelView, rawView, cached);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_quantize);
+  RUN_TEST(test_tiers);
+  RUN_TEST(test_mean_range);
+  RUN_TEST(test_footprint);
+  RUN_TEST(test_scan_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,187 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <chrono>
+
+#include "sim.hpp"
+#include "system.hpp"
+#include "line_protocol.hpp"
+
+// LineProtocolWriter output and speed, and a month of the firmware against the simulated server
+// with every heap allocation counted: the record path must not allocate at all, only opening
+// files does, for checkpoints and log blocks
+
+extern System device;
+void setup();
+
+static const uint32_t SoakDays = 30;
+
+static char fsRoot[] = "/tmp/test_line_protocol_XXXXXX";
+
+static void run(uint32_t seconds) {
+  uint64_t end = simulation.micros() + seconds * 1000000ULL;
+  while (simulation.micros() < end) {
+    device.tick();
+    device.idle();
+    simulation.advance(1000);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_format() {
+  char buffer[128];
+  LineProtocolWriter line(buffer, sizeof(buffer));
+  line.begin("Temperature");
+  line.tag("ssid", "My Net,1=a");
+  line.field("Temperature C", 21.456f);
+  line.field("Dew Point C", -3.004f);
+  size_t length = line.end(1700000000);
+  TEST_ASSERT_EQUAL(strlen(buffer), length);
+  TEST_ASSERT_EQUAL_STRING("Temperature,ssid=My\\ Net\\,1\\=a Temperature\\ C=21.46,Dew\\ Point\\ C=-3.00 1700000000",
+                           buffer);
+
+  line.begin("CO2");
+  line.tag("ssid", "");
+  line.field("CO2 PPM", (uint32_t)415);
+  line.field("Bad", NAN);
+  line.field("Small", -0.001f);
+  line.end(5);
+  TEST_ASSERT_EQUAL_STRING("CO2 CO2\\ PPM=415i,Small=0.00 5", buffer);
+}
+
+// Same digits as printf over the range the sensors produce, except that exact ties round away from
+// zero rather than to even, and there is no "-0.00"
+void test_float_digits() {
+  char buffer[64], expected[64];
+  LineProtocolWriter line(buffer, sizeof(buffer));
+  for (int32_t i = -500000; i <= 500000; i += 7) {
+    float value = i * 0.001f;
+    line.begin("m");
+    line.field("f", value);
+    line.end(0);
+    snprintf(expected, sizeof(expected), "m f=%.2f 0", value);
+    bool tie = fmod(fabs((double)value) * 100, 1.0) == 0.5;
+    if (strcmp(buffer, expected) != 0 && !tie && !(value < 0 && value > -0.005f)) {
+      TEST_ASSERT_EQUAL_STRING(expected, buffer);
+    }
+  }
+}
+
+// A record that doesn't fit is reported, without writing past the buffer
+void test_overflow() {
+  char buffer[24];
+  memset(buffer, 'x', sizeof(buffer));
+  LineProtocolWriter line(buffer, 20);
+  line.begin("Humidity");
+  line.field("Relative Humidity %", 45.5f);
+  TEST_ASSERT_EQUAL(0, line.end(1700000000));
+  TEST_ASSERT_TRUE(line.overflowed());
+  TEST_ASSERT_EQUAL('x', buffer[20]);
+
+  line.begin("m");
+  TEST_ASSERT_EQUAL(0, line.end(1)); // no fields
+}
+
+// One temperature record: the writer, snprintf, and a String built up the way the Point API did,
+// with the heap allocations each takes
+void test_benchmark() {
+  static const uint32_t Records = 500000;
+  typedef std::chrono::steady_clock Clock;
+  char buffer[LineProtocolMaxLength];
+  volatile size_t sink = 0;
+
+  simulation.heapAllocations = 0;
+  simulation.countAllocations = true;
+  Clock::time_point start = Clock::now();
+  for (uint32_t n = 0; n < Records; n++) {
+    LineProtocolWriter line(buffer, sizeof(buffer));
+    line.begin("Temperature");
+    line.tag("ssid", "HomeNetwork");
+    line.field("Temperature C", 20 + (n % 1000) * 0.01f);
+    line.field("Dew Point C", 10 + (n % 700) * 0.01f);
+    sink = sink + line.end(1700000000 + n);
+  }
+  double writer = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Records;
+  uint64_t writerAllocations = simulation.heapAllocations;
+
+  start = Clock::now();
+  for (uint32_t n = 0; n < Records; n++) {
+    sink = sink + snprintf(buffer, sizeof(buffer), "Temperature,ssid=%s Temperature\\ C=%.2f,Dew\\ Point\\ C=%.2f %u",
+                           "HomeNetwork", 20 + (n % 1000) * 0.01f, 10 + (n % 700) * 0.01f, 1700000000 + n);
+  }
+  double formatted = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Records;
+
+  simulation.heapAllocations = 0;
+  start = Clock::now();
+  for (uint32_t n = 0; n < Records; n++) {
+    char value[16];
+    String record("Temperature");
+    record += ",ssid=";
+    record += "HomeNetwork";
+    snprintf(value, sizeof(value), "%.2f", 20 + (n % 1000) * 0.01f);
+    record += " Temperature\\ C=";
+    record += value;
+    snprintf(value, sizeof(value), "%.2f", 10 + (n % 700) * 0.01f);
+    record += ",Dew\\ Point\\ C=";
+    record += value;
+    record += " ";
+    record += String(1700000000 + n);
+    sink = sink + record.length();
+  }
+  double string = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Records;
+  uint64_t stringAllocations = simulation.heapAllocations;
+  simulation.countAllocations = false;
+  simulation.heapAllocations = 0;
+
+  char message[192];
+  snprintf(message, sizeof(message),
+           "per record: writer %.0f ns (%.1f allocations), snprintf %.0f ns, String %.0f ns (%.1f allocations) (host)",
+           writer, (double)writerAllocations / Records, formatted, string, (double)stringAllocations / Records);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(0, writerAllocations);
+}
+
+// A month of sensing and uploading, no allocation that isn't a file open
+void test_heap_soak() {
+  simulation.heapAllocations = 0;
+  simulation.heapAllocatedBytes = 0;
+  simulation.fileOpens = 0;
+  uint32_t records = simulation.recordsWritten;
+  simulation.countAllocations = true;
+  run(SoakDays * 86400);
+  simulation.countAllocations = false;
+  records = simulation.recordsWritten - records;
+
+  char message[192];
+  snprintf(message, sizeof(message), "%u days: %u records, %llu allocations (%llu bytes), %llu file opens",
+           SoakDays, records, (unsigned long long)simulation.heapAllocations,
+           (unsigned long long)simulation.heapAllocatedBytes, (unsigned long long)simulation.fileOpens);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(SoakDays * 10000, records);
+  TEST_ASSERT_EQUAL(simulation.fileOpens, simulation.heapAllocations);
+  TEST_ASSERT_EQUAL(0, simulation.rejectedRequests);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.fsRoot = mkdtemp(fsRoot);
+  simulation.quiet = true;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_format);
+  RUN_TEST(test_float_digits);
+  RUN_TEST(test_overflow);
+  RUN_TEST(test_benchmark);
+  setup();
+  RUN_TEST(test_heap_soak);
+  int failures = UNITY_END();
+
+  system((std::string("rm -rf ") + fsRoot).c_str());
+  return failures;
+}
@@ -0,0 +1,122 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+
+#include "sim.hpp"
+#include "ESP8266WiFi.h"
+#include "metrics_server.hpp"
+
+// /log scrapes by the simulated HTTP clients while the series log is full and every new segment
+// drops the oldest. Each response is checked to hold every record from the requested time to the
+// newest, so a scrape that loses its place when the log rotates under it fails.
+
+static char fsRoot[] = "/tmp/test_metrics_server_XXXXXX";
+
+static const uint32_t LogInterval = 60; // s between records
+static const uint32_t Rotations = 6;
+
+static sensor_data current;
+static SensorHistory history;
+static SeriesLog seriesLog;
+static MetricsServer server;
+static uint32_t nextRecord = 1600000000; // s, time of the next record
+
+// Close a minute of simulated room readings into the log
+static void logRecord() {
+  sim_environment env = simulation.environment();
+  current.temperature = env.temperature;
+  current.humidity = env.humidity;
+  current.tvoc = env.tvoc;
+  current.eco2 = env.eco2;
+  current.co2 = env.co2;
+  current.pm10 = env.pm10;
+  current.pm25 = env.pm25;
+  current.pm100 = env.pm100;
+  seriesLog.addSample(current);
+  seriesLog.closeMinute(nextRecord);
+  nextRecord += LogInterval;
+}
+
+// A loop pass: serve, let the clients read and write, and log a record when its minute is up
+static void pass() {
+  server.poll(millis());
+  httpLoad.update();
+  simulation.advance(1000);
+  if ((uint32_t)simTime(nullptr) >= nextRecord) logRecord();
+}
+
+static uint32_t scrapes() {
+  return httpLoad.ok + httpLoad.failed + httpLoad.timeouts + httpLoad.resets;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Rotate the log a few passes into a scrape, at a different point of the response each time
+void test_rotation_during_scrapes() {
+  for (uint32_t rotation = 0; rotation < Rotations; rotation++) {
+    uint32_t done = scrapes();
+    while (!server.busy()) pass();
+    for (uint32_t i = 0; i < rotation; i++) pass();
+
+    // Records up to the next segment, which drops the oldest
+    uint32_t blocks;
+    do {
+      blocks = seriesLog.blocks();
+      logRecord();
+    } while (seriesLog.blocks() >= blocks);
+
+    while (scrapes() == done) pass();
+  }
+
+  char message[128];
+  snprintf(message, sizeof(message), "%u scrapes: %u ok, %u failed, %u timed out, %u reset, %u read errors",
+           scrapes(), httpLoad.ok, httpLoad.failed, httpLoad.timeouts, httpLoad.resets, server.readErrors);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(Rotations, scrapes());
+  TEST_ASSERT_EQUAL(scrapes(), httpLoad.ok);
+  TEST_ASSERT_EQUAL(0, server.readErrors);
+}
+
+// Then ten minutes of scrapes every second while records are logged as they come
+void test_steady_scrapes() {
+  uint32_t done = scrapes();
+  uint32_t ok = httpLoad.ok;
+  uint64_t end = simulation.millis() + 600000;
+  while (simulation.millis() < end) pass();
+  while (server.busy()) pass();
+  TEST_ASSERT_GREATER_THAN(500, scrapes() - done);
+  TEST_ASSERT_EQUAL(scrapes() - done, httpLoad.ok - ok);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.fsRoot = mkdtemp(fsRoot);
+  simulation.quiet = true;
+
+  WiFi.begin("simulated", "");
+  configTime("UTC0", "pool.ntp.org");
+  while (WiFi.status() != WL_CONNECTED || simTime(nullptr) < (time_t)ValidTimeStart) simulation.advance(1000);
+
+  // A full log but for one block, which ends at the current time
+  seriesLog.begin();
+  while (seriesLog.blocks() < SeriesSegments * SeriesSegmentBlocks - 1) logRecord();
+  simulation.epochStart = nextRecord - simulation.millis() / 1000;
+
+  server.begin(&current, &history, &seriesLog);
+  httpLoad.clients = 1;
+  httpLoad.interval = 1;
+  httpLoad.onlyPath = 2;
+  httpLoad.logInterval = LogInterval;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_rotation_during_scrapes);
+  RUN_TEST(test_steady_scrapes);
+  int failures = UNITY_END();
+
+  system((std::string("rm -rf ") + fsRoot).c_str());
+  return failures;
+}
@@ -0,0 +1,119 @@
+#include <unity.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+
+#include "sim.hpp"
+#include "system.hpp"
+
+// A six hour outage and the catch-up afterwards, against the simulated InfluxDB server
+// The records of the outage have to fit the offline buffer and reach the server once it's back,
+// and the drain rate is reported.
+
+extern System device;
+void setup();
+
+static const uint32_t Step = 1000; // us between passes, as in the simulator
+static const uint32_t OutageLength = 6 * 3600; // s
+static const uint32_t CatchUpLimit = 3600; // s
+
+static char fsRoot[] = "/tmp/test_offline_XXXXXX";
+
+// Segment files left in the offline buffer, with their size and records
+typedef struct {
+  uint32_t segments;
+  uint64_t bytes;
+  uint32_t records;
+} backlog;
+
+static backlog offlineBacklog() {
+  backlog result = { 0, 0, 0 };
+  std::string path = std::string(fsRoot) + "/offline";
+  DIR *dir = opendir(path.c_str());
+  if (!dir) return result;
+  while (struct dirent *entry = readdir(dir)) {
+    if (entry->d_name[0] == '.') continue;
+    FILE *file = fopen((path + "/" + entry->d_name).c_str(), "rb");
+    if (!file) continue;
+    result.segments++;
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+      result.bytes++;
+      if (c == '\n') result.records++;
+    }
+    fclose(file);
+  }
+  closedir(dir);
+  return result;
+}
+
+static void run(uint32_t seconds) {
+  uint64_t end = simulation.micros() + seconds * 1000000ULL;
+  while (simulation.micros() < end) {
+    device.tick();
+    device.idle();
+    simulation.advance(Step);
+  }
+}
+
+static backlog buffered;
+static uint32_t writtenBeforeCatchUp;
+
+void setUp() {}
+void tearDown() {}
+
+void test_outage_fits_in_flash() {
+  run(3600);
+  TEST_ASSERT_EQUAL(0, offlineBacklog().segments);
+
+  uint64_t now = simulation.micros() / 1000000;
+  simulation.outageStart = now + 60;
+  simulation.outageEnd = simulation.outageStart + OutageLength;
+  run(60 + OutageLength);
+
+  buffered = offlineBacklog();
+  writtenBeforeCatchUp = simulation.recordsWritten;
+  char message[128];
+  snprintf(message, sizeof(message), "%u records buffered in %u segments, %llu bytes", buffered.records,
+           buffered.segments, (unsigned long long)buffered.bytes);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(0, buffered.records);
+  // Nothing was dropped to make room
+  TEST_ASSERT_LESS_THAN(OfflineBufferSegments, buffered.segments);
+}
+
+void test_catch_up() {
+  uint32_t seconds = 0;
+  while (seconds < CatchUpLimit && offlineBacklog().segments > 0) {
+    run(10);
+    seconds += 10;
+  }
+  TEST_ASSERT_EQUAL(0, offlineBacklog().segments);
+
+  char message[160];
+  snprintf(message, sizeof(message), "caught up in %u s: %.0f records/s, %.0f bytes/s of line protocol", seconds,
+           (double)buffered.records / seconds, (double)buffered.bytes / seconds);
+  TEST_MESSAGE(message);
+  // Everything buffered reached the server, along with what was recorded meanwhile
+  TEST_ASSERT_GREATER_OR_EQUAL(writtenBeforeCatchUp + buffered.records, simulation.recordsWritten);
+  TEST_ASSERT_EQUAL(0, simulation.rejectedRequests);
+  TEST_ASSERT_EQUAL(0, simulation.staleRecords);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.fsRoot = mkdtemp(fsRoot);
+  simulation.quiet = true;
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_outage_fits_in_flash);
+  RUN_TEST(test_catch_up);
+  int failures = UNITY_END();
+
+  system((std::string("rm -rf ") + fsRoot).c_str());
+  return failures;
+}
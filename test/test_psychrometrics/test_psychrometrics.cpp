@@ -0,0 +1,117 @@
+#include <unity.h>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+
+#include "psychrometrics.hpp"
+
+// Exhaustive sweep of the table based psychrometrics against the exp()/log() formulas they replaced,
+// over the range of the temperature/humidity sensors: T -40 to 85 C in 0.01 C steps, RH 1 to 100 %
+// in 0.1 % steps. The bounds are the ones documented in psychrometrics.hpp.
+
+static const double MaxAbsoluteHumidityError = 0.021; // %, relative
+static const double MaxDewPointError = 0.004;         // C
+static const double MaxRelativeHumidityError = 0.021; // %RH
+
+static const double B = 17.62;
+static const double C = 243.12;
+
+static double absoluteHumidity(double t, double h) {
+  return 216.7 * (h / 100.0) * 6.112 * exp(B * t / (C + t)) / (273.15 + t);
+}
+
+static double dewPoint(double t, double h) {
+  double gamma = log(h / 100.0) + B * t / (C + t);
+  return C * gamma / (B - gamma);
+}
+
+static double relativeHumidity(double t, double td) {
+  return 100.0 * exp(C * B * (td - t) / ((C + t) * (C + td)));
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_sweep() {
+  double absoluteError = 0, dewPointError = 0, relativeError = 0;
+  float worstT = 0, worstH = 0;
+  for (int32_t ti = -4000; ti <= 8500; ti++) {
+    float t = ti * 0.01f;
+    for (int32_t hi = 10; hi <= 1000; hi++) {
+      float h = hi * 0.1f;
+      double ah = absoluteHumidity(t, h);
+      double error = fabs(getAbsoluteHumidity(t, h) - ah) / ah * 100;
+      if (error > absoluteError) absoluteError = error;
+
+      double td = dewPoint(t, h);
+      error = fabs(getDewPoint(t, h) - td);
+      if (error > dewPointError) {
+        dewPointError = error;
+        worstT = t;
+        worstH = h;
+      }
+
+      // Back from the exact dew point, as the sensor pages convert it
+      error = fabs(getRelativeHumidity(t, td) - relativeHumidity(t, td));
+      if (error > relativeError) relativeError = error;
+    }
+  }
+
+  char message[192];
+  snprintf(message, sizeof(message),
+           "max error: absolute humidity %.4f %%, dew point %.4f C (at %.2f C %.1f %%RH), relative humidity %.4f %%RH",
+           absoluteError, dewPointError, worstT, worstH, relativeError);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL(MaxAbsoluteHumidityError * 1e6, absoluteError * 1e6);
+  TEST_ASSERT_LESS_OR_EQUAL(MaxDewPointError * 1e6, dewPointError * 1e6);
+  TEST_ASSERT_LESS_OR_EQUAL(MaxRelativeHumidityError * 1e6, relativeError * 1e6);
+}
+
+// Outside the table the results are clamped instead of extrapolated
+void test_clamping() {
+  TEST_ASSERT_EQUAL_FLOAT(getSaturationVaporPressure(-80), getSaturationVaporPressure(-120));
+  TEST_ASSERT_EQUAL_FLOAT(getSaturationVaporPressure(90), getSaturationVaporPressure(150));
+  TEST_ASSERT_EQUAL_FLOAT(-80, getDewPoint(-85, 1));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 6.112f, getSaturationVaporPressure(0));
+}
+
+// Time per call of the table against the float exp()/log() formulas, on the host. With an FPU and
+// libm's expf()/logf() the formulas are the faster ones here, so this only reports; the table is for
+// the ESP8266, which has neither
+void test_benchmark() {
+  static const uint32_t Calls = 1000000;
+  typedef std::chrono::steady_clock Clock;
+  volatile float sink = 0;
+  const float b = 17.62f, c = 243.12f;
+
+  Clock::time_point start = Clock::now();
+  for (uint32_t n = 0; n < Calls; n++) {
+    float t = -20 + (n % 6000) * 0.01f, h = 20 + (n % 700) * 0.1f;
+    float ah = 216.7f * ((h / 100.0f) * 6.112f * expf((b * t) / (c + t)) / (273.15f + t));
+    float td = c * (logf(h / 100.0f) + (b * t) / (c + t)) / (b - logf(h / 100.0f) - (b * t) / (c + t));
+    sink = sink + ah + td;
+  }
+  double formulas = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Calls;
+
+  start = Clock::now();
+  for (uint32_t n = 0; n < Calls; n++) {
+    float t = -20 + (n % 6000) * 0.01f, h = 20 + (n % 700) * 0.1f;
+    sink = sink + getAbsoluteHumidity(t, h) + getDewPoint(t, h);
+  }
+  double table = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Calls;
+
+  char message[128];
+  snprintf(message, sizeof(message), "absolute humidity and dew point: exp()/log() %.1f ns, table %.1f ns (host)",
+           formulas, table);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_sweep);
+  RUN_TEST(test_clamping);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,123 @@
+#include <unity.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "sim.hpp"
+#include "psychrometrics.hpp"
+#include "publish_filter.hpp"
+
+// A day of readings from the simulated room replayed through PublishFilter at the cadence the
+// firmware reads each sensor: most are suppressed, none of the suppressed ones is a deadband or
+// more away from what the server last received, and no measurement goes longer than the heartbeat
+// without being sent
+
+static const uint32_t Day = 86400000; // ms
+
+// Firmware reads every sensor each UpdateInterval, except the PMS5003 which wakes to measure
+static const uint32_t Cadence[Measurements - 1] = {
+  UpdateInterval, UpdateInterval, UpdateInterval, UpdateInterval, PMMeasurementInterval
+};
+
+typedef struct {
+  uint32_t readings;
+  uint32_t published;
+  uint32_t longestGap; // ms between publishes
+} replay_result;
+
+static replay_result results[Measurements - 1];
+
+// Fields of a measurement as System::publish() gets them from the sensors
+static void readings(const sim_environment &env, float values[Measurements - 1][3]) {
+  float temperature = env.temperature;
+  float humidity = env.humidity;
+  values[MeasurementTemperature][0] = temperature;
+  values[MeasurementTemperature][1] = getDewPoint(temperature, humidity);
+  values[MeasurementTemperature][2] = 0;
+  values[MeasurementHumidity][0] = humidity;
+  values[MeasurementHumidity][1] = getAbsoluteHumidity(temperature, humidity);
+  values[MeasurementHumidity][2] = 0;
+  values[MeasurementVOC][0] = roundf(env.tvoc);
+  values[MeasurementVOC][1] = values[MeasurementVOC][2] = 0;
+  values[MeasurementCO2][0] = roundf(env.co2);
+  values[MeasurementCO2][1] = values[MeasurementCO2][2] = 0;
+  values[MeasurementPM][0] = roundf(env.pm10);
+  values[MeasurementPM][1] = roundf(env.pm25);
+  values[MeasurementPM][2] = roundf(env.pm100);
+}
+
+static PublishFilter filter;
+
+void setUp() {}
+void tearDown() {}
+
+void test_replay() {
+  uint32_t lastPublish[Measurements - 1];
+  for (uint32_t time = 0; time < Day; time += UpdateInterval) {
+    simulation.advance(UpdateInterval * 1000ULL);
+    float values[Measurements - 1][3];
+    readings(simulation.environment(), values);
+    for (uint8_t m = 0; m < Measurements - 1; m++) {
+      if (time % Cadence[m] != 0) continue;
+      replay_result &result = results[m];
+      result.readings++;
+      if (!filter.update(m, values[m], time)) continue;
+      if (result.published > 0 && time - lastPublish[m] > result.longestGap) {
+        result.longestGap = time - lastPublish[m];
+      }
+      result.published++;
+      lastPublish[m] = time;
+    }
+  }
+
+  uint32_t readings = 0, published = 0;
+  for (uint8_t m = 0; m < Measurements - 1; m++) {
+    const publish_stats &stats = filter.stats(m);
+    char message[192];
+    snprintf(message, sizeof(message), "%-26s %5u of %5u readings, longest gap %3u s, max error %.3f %.3f %.3f",
+             MeasurementName[m], results[m].published, results[m].readings, results[m].longestGap / 1000,
+             stats.maxError[0], stats.maxError[1], stats.maxError[2]);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL(results[m].published, stats.published);
+    TEST_ASSERT_EQUAL(results[m].readings, stats.published + stats.suppressed);
+    // Particulates are read every few minutes and their noise spans the deadband, so most are sent
+    if (Cadence[m] == UpdateInterval) TEST_ASSERT_LESS_THAN(results[m].readings / 10, results[m].published);
+    readings += results[m].readings;
+    published += results[m].published;
+  }
+  TEST_ASSERT_LESS_THAN(readings / 10, published);
+}
+
+// The value a receiver holds is never a deadband away from the reading it stands for
+void test_deadband() {
+  for (uint8_t m = 0; m < Measurements - 1; m++) {
+    const publish_stats &stats = filter.stats(m);
+    for (uint8_t f = 0; f < 3; f++) {
+      if (PublishDeadband[m][f] == 0) continue; // not compared, e.g. the unused fields
+      if (stats.maxError[f] >= PublishDeadband[m][f]) {
+        char message[96];
+        snprintf(message, sizeof(message), "%s field %u off by %.3f", MeasurementName[m], f, stats.maxError[f]);
+        TEST_FAIL_MESSAGE(message);
+      }
+    }
+  }
+}
+
+// Readings each UpdateInterval are sent at least every PublishHeartbeat; a sensor read less often
+// is sent on its first reading at or past the heartbeat
+void test_heartbeat() {
+  for (uint8_t m = 0; m < Measurements - 1; m++) {
+    uint32_t limit = Cadence[m] == UpdateInterval ? PublishHeartbeat : PublishHeartbeat + Cadence[m] - 1;
+    TEST_ASSERT_GREATER_THAN(0, results[m].longestGap);
+    TEST_ASSERT_LESS_OR_EQUAL(limit, results[m].longestGap);
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_replay);
+  RUN_TEST(test_deadband);
+  RUN_TEST(test_heartbeat);
+  return UNITY_END();
+}
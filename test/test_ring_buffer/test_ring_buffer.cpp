@@ -0,0 +1,166 @@
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+
+#include "ring_buffer.hpp"
+
+// RingIndex over an array of samples, and what the ring saves over the array that was shifted
+// down by one element on every update
+
+typedef struct {
+  float temperature;
+  float humidity;
+  uint16_t co2;
+  uint16_t tvoc;
+  uint16_t pm25;
+  uint32_t time;
+} sample;
+
+static const size_t Length = 60; // as DataHistoryLength
+
+static sample make(uint32_t n) {
+  sample s;
+  s.temperature = 20 + n * 0.1f;
+  s.humidity = 40 + n % 20;
+  s.co2 = 400 + n;
+  s.tvoc = n * 3;
+  s.pm25 = n % 50;
+  s.time = n;
+  return s;
+}
+
+// Samples stored the way HistoryBuckets stores its columns: an array and the index into it
+typedef struct {
+  sample data[Length];
+  RingIndex<Length> index;
+
+  void push(const sample &value) { data[index.push()] = value; }
+  const sample &operator[](size_t i) const { return data[index.slot(i)]; }
+} ring;
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty() {
+  RingIndex<Length> index;
+  TEST_ASSERT_TRUE(index.empty());
+  TEST_ASSERT_FALSE(index.full());
+  TEST_ASSERT_EQUAL(0, index.size());
+}
+
+// Elements stay in order from the oldest while the ring fills, then the oldest is overwritten,
+// at every position of the head
+void test_wraparound() {
+  static ring samples;
+  for (uint32_t n = 0; n < Length * 3 + 7; n++) {
+    samples.push(make(n));
+    size_t expected = n + 1 < Length ? n + 1 : Length;
+    TEST_ASSERT_EQUAL(expected, samples.index.size());
+    TEST_ASSERT_EQUAL(expected == Length, samples.index.full());
+    uint32_t oldest = n + 1 - expected;
+    for (size_t i = 0; i < samples.index.size(); i++) {
+      if (samples[i].time != oldest + i) TEST_FAIL_MESSAGE("element out of order");
+    }
+  }
+}
+
+// Filling every slot and resetting to full, as HistoryBuckets::fill() does, then clearing
+void test_fill_and_clear() {
+  static ring samples;
+  for (uint32_t n = 0; n < 25; n++) samples.push(make(n));
+  for (size_t i = 0; i < Length; i++) samples.data[i] = make(1000);
+  samples.index.reset(Length);
+  TEST_ASSERT_TRUE(samples.index.full());
+  for (size_t i = 0; i < Length; i++) TEST_ASSERT_EQUAL(1000, samples[i].time);
+
+  // After a fill the next push replaces the oldest
+  samples.push(make(1001));
+  TEST_ASSERT_EQUAL(Length, samples.index.size());
+  TEST_ASSERT_EQUAL(1000, samples[0].time);
+  TEST_ASSERT_EQUAL(1001, samples[Length - 1].time);
+
+  samples.index.reset();
+  TEST_ASSERT_TRUE(samples.index.empty());
+  samples.push(make(5));
+  TEST_ASSERT_EQUAL(1, samples.index.size());
+  TEST_ASSERT_EQUAL(5, samples[0].time);
+}
+
+// Indices of a partly filled ring restored from storage
+void test_index_reset() {
+  RingIndex<8> index;
+  index.reset(5);
+  TEST_ASSERT_EQUAL(5, index.size());
+  for (size_t i = 0; i < 5; i++) TEST_ASSERT_EQUAL(i, index.slot(i));
+  TEST_ASSERT_EQUAL(5, index.push());
+  index.reset(8);
+  TEST_ASSERT_TRUE(index.full());
+  TEST_ASSERT_EQUAL(0, index.slot(0));
+  TEST_ASSERT_EQUAL(0, index.push());
+  TEST_ASSERT_EQUAL(1, index.slot(0));
+  TEST_ASSERT_EQUAL(0, index.slot(7));
+}
+
+// A history update, and a graph scan of one field, as the display did them before and after
+void test_benchmark() {
+  static const uint32_t Updates = 200000;
+  typedef std::chrono::steady_clock Clock;
+  volatile int32_t sink = 0;
+
+  sample shifted[Length];
+  for (size_t i = 0; i < Length; i++) shifted[i] = make(0);
+  Clock::time_point start = Clock::now();
+  for (uint32_t n = 0; n < Updates; n++) {
+    for (size_t i = 0; i < Length - 1; i++) shifted[i] = shifted[i + 1];
+    shifted[Length - 1] = make(n);
+    sink = sink + shifted[n % Length].co2;
+  }
+  double shiftUpdate = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Updates;
+  start = Clock::now();
+  for (uint32_t n = 0; n < Updates; n++) {
+    int32_t values[Length];
+    int32_t max = 0;
+    for (size_t i = 0; i < Length; i++) {
+      values[i] = shifted[i].co2;
+      if (values[i] > max) max = values[i];
+    }
+    sink = sink + max + values[n % Length];
+  }
+  double shiftScan = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Updates;
+
+  static ring samples;
+  for (size_t i = 0; i < Length; i++) samples.push(make(0));
+  start = Clock::now();
+  for (uint32_t n = 0; n < Updates; n++) {
+    samples.push(make(n));
+    sink = sink + samples[n % Length].co2;
+  }
+  double ringUpdate = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Updates;
+  start = Clock::now();
+  for (uint32_t n = 0; n < Updates; n++) {
+    int32_t max = 0;
+    for (size_t i = 0; i < samples.index.size(); i++) {
+      if (samples[i].co2 > max) max = samples[i].co2;
+    }
+    sink = sink + max + samples[n % Length].co2;
+  }
+  double ringScan = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Updates;
+
+  char message[160];
+  snprintf(message, sizeof(message),
+           "%u samples, update/scan: shifted array %.1f/%.1f ns, ring %.1f/%.1f ns (host)",
+           (unsigned)Length, shiftUpdate, shiftScan, ringUpdate, ringScan);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_wraparound);
+  RUN_TEST(test_fill_and_clear);
+  RUN_TEST(test_index_reset);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
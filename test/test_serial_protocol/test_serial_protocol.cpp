@@ -0,0 +1,259 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "sim.hpp"
+#include "gzip.hpp"
+#include "serial_protocol.hpp"
+
+// SerialProtocol fed corrupted, oversized, truncated and unknown requests on the simulated console,
+// with the replies picked out of the console output by their sync bytes and CRC as the host does:
+// a damaged request is counted and never answered, a well formed but invalid one gets an end frame
+// with a status, and a request cut short is dropped after SerialRequestTimeout so the next one
+// gets through
+
+static char fsRoot[] = "/tmp/test_serial_protocol_XXXXXX";
+
+static SensorHistory history;
+static SeriesLog seriesLog;
+static SerialProtocol protocol;
+static FILE *output;
+static std::string commands; // text typed on the console, as poll() returned it
+
+typedef struct {
+  uint8_t type;
+  std::string payload;
+} reply_frame;
+
+static std::string request(uint8_t type, const void *payload = nullptr, uint16_t length = 0) {
+  std::string frame("\xA5\x5A", 2);
+  frame += (char)type;
+  frame += (char)(length & 0xFF);
+  frame += (char)(length >> 8);
+  frame.append((const char *)payload, length);
+  uint32_t crc = GzipEncoder::crc32(0, (const uint8_t *)frame.data() + 2, 3 + length);
+  frame.append((const char *)&crc, sizeof(crc));
+  return frame;
+}
+
+static void send(const std::string &bytes) {
+  for (char byte : bytes) simulation.consoleInput.push_back({ simulation.micros(), (uint8_t)byte });
+}
+
+// Run the loop for a while, answering stats requests the way System does
+static void run(uint32_t ms) {
+  uint64_t end = simulation.millis() + ms;
+  while (simulation.millis() < end || protocol.busy()) {
+    int command = protocol.poll(millis());
+    if (command >= 0) commands += (char)command;
+    if (protocol.statsRequested()) {
+      serial_stats stats;
+      memset(&stats, 0, sizeof(stats));
+      stats.serialFrames = protocol.frames;
+      stats.serialErrors = protocol.errors;
+      protocol.sendStats(stats);
+    }
+    simulation.advance(1000);
+  }
+}
+
+// Frames with a valid CRC in what the console sent since the last call
+static std::vector<reply_frame> replies() {
+  fflush(output);
+  long size = ftell(output);
+  std::string out(size, '\0');
+  rewind(output);
+  size_t read = fread(&out[0], 1, size, output);
+  out.resize(read);
+  rewind(output);
+  if (ftruncate(fileno(output), 0) != 0) TEST_FAIL_MESSAGE("can't reset the capture");
+
+  std::vector<reply_frame> frames;
+  for (size_t i = 0; i + 9 <= out.size(); i++) {
+    if ((uint8_t)out[i] != 0xA5 || (uint8_t)out[i + 1] != 0x5A) continue;
+    uint16_t length = (uint8_t)out[i + 3] | (uint8_t)out[i + 4] << 8;
+    if (i + 9 + length > out.size()) continue;
+    uint32_t crc;
+    memcpy(&crc, out.data() + i + 5 + length, sizeof(crc));
+    if (crc != GzipEncoder::crc32(0, (const uint8_t *)out.data() + i + 2, 3 + length)) continue;
+    frames.push_back({ (uint8_t)out[i + 2], out.substr(i + 5, length) });
+    i += 8 + length;
+  }
+  return frames;
+}
+
+static serial_end endOf(const std::vector<reply_frame> &frames) {
+  serial_end end;
+  memset(&end, 0xFF, sizeof(end));
+  if (frames.empty() || frames.back().type != SerialFrameEnd) TEST_FAIL_MESSAGE("no end frame");
+  else memcpy(&end, frames.back().payload.data(), sizeof(end));
+  return end;
+}
+
+void setUp() {
+  run(10);
+  replies();
+  commands.clear();
+}
+
+void tearDown() {}
+
+void test_config() {
+  uint32_t frames = protocol.frames;
+  send(request(SerialRequestConfig));
+  run(10);
+  std::vector<reply_frame> frames_ = replies();
+  TEST_ASSERT_EQUAL(2 + HistoryChannels + SeriesChannels, frames_.size());
+  TEST_ASSERT_EQUAL(SerialFrameConfig, frames_[0].type);
+  serial_end end = endOf(frames_);
+  TEST_ASSERT_EQUAL(SerialRequestConfig, end.request);
+  TEST_ASSERT_EQUAL(SerialStatusOk, end.status);
+  TEST_ASSERT_EQUAL(1 + HistoryChannels + SeriesChannels, end.frames);
+  TEST_ASSERT_EQUAL(frames + 1, protocol.frames);
+}
+
+// Every byte of a request flipped in turn: never answered, counted once, and the next request works
+void test_corrupted() {
+  std::string good = request(SerialRequestStats);
+  for (size_t i = 2; i < good.size(); i++) {
+    std::string bad = good;
+    bad[i] ^= 0x10;
+    uint32_t errors = protocol.errors;
+    send(bad);
+    run(SerialRequestTimeout + 10);
+    TEST_ASSERT_EQUAL(0, replies().size());
+    TEST_ASSERT_EQUAL(errors + 1, protocol.errors);
+  }
+
+  send(good);
+  run(10);
+  std::vector<reply_frame> frames = replies();
+  TEST_ASSERT_EQUAL(2, frames.size());
+  TEST_ASSERT_EQUAL(SerialFrameStats, frames[0].type);
+  TEST_ASSERT_EQUAL(SerialStatusOk, endOf(frames).status);
+}
+
+// A length field past SerialRequestMaxPayload is dropped at once, the payload is read as text
+void test_oversized() {
+  uint8_t payload[SerialRequestMaxPayload + 1];
+  memset(payload, 'x', sizeof(payload));
+  uint32_t errors = protocol.errors;
+  send(request(SerialRequestConfig, payload, sizeof(payload)));
+  run(100); // a text command a pass
+  TEST_ASSERT_EQUAL(0, replies().size());
+  TEST_ASSERT_EQUAL(errors + 1, protocol.errors);
+  TEST_ASSERT_GREATER_OR_EQUAL(sizeof(payload), std::count(commands.begin(), commands.end(), 'x'));
+}
+
+// Well formed requests the device can't serve get an end frame with SerialStatusBadRequest
+void test_bad_requests() {
+  uint32_t errors = protocol.errors;
+  uint8_t tier = HistoryTiers;
+  const std::string bad[] = {
+    request(0x7E),
+    request(SerialRequestConfig, &tier, 1),
+    request(SerialRequestHistory),
+    request(SerialRequestLog, &tier, 1),
+  };
+  for (const std::string &frame : bad) {
+    send(frame);
+    run(10);
+    std::vector<reply_frame> frames = replies();
+    TEST_ASSERT_EQUAL(1, frames.size());
+    serial_end end = endOf(frames);
+    TEST_ASSERT_EQUAL((uint8_t)frame[2], end.request);
+    TEST_ASSERT_EQUAL(SerialStatusBadRequest, end.status);
+    TEST_ASSERT_EQUAL(0, end.frames);
+  }
+  TEST_ASSERT_EQUAL(errors, protocol.errors);
+}
+
+// A request cut short at every length: once SerialRequestTimeout has passed it's dropped and
+// counted, and the request after it is answered
+void test_truncated() {
+  std::string good = request(SerialRequestConfig);
+  for (size_t cut = 1; cut < good.size(); cut++) {
+    uint32_t errors = protocol.errors;
+    send(good.substr(0, cut));
+    run(SerialRequestTimeout / 2);
+    TEST_ASSERT_EQUAL(errors, protocol.errors); // still waiting for the rest
+    run(SerialRequestTimeout);
+    TEST_ASSERT_EQUAL(0, replies().size());
+
+    send(good);
+    run(10);
+    TEST_ASSERT_EQUAL(errors + 1, protocol.errors);
+    std::vector<reply_frame> frames = replies();
+    TEST_ASSERT_EQUAL(SerialStatusOk, endOf(frames).status);
+    TEST_ASSERT_EQUAL(SerialFrameConfig, frames[0].type);
+  }
+}
+
+// Text commands around and between frames still come through
+void test_text_commands() {
+  send("s" + request(SerialRequestStats) + "v");
+  run(10);
+  TEST_ASSERT_EQUAL_STRING("sv", commands.c_str());
+  TEST_ASSERT_EQUAL(SerialStatusOk, endOf(replies()).status);
+}
+
+// A log block that can't be read is skipped, and the end frame says so
+void test_log_read_error() {
+  sensor_data data = {};
+  uint32_t time = 1700000000;
+  while (seriesLog.blocks() < 3) {
+    data.co2 = 400 + time / 60 % 97;
+    data.temperature = 20 + time / 60 % 13 * 0.37f;
+    seriesLog.addSample(data);
+    seriesLog.closeMinute(time);
+    time += 60;
+  }
+  serial_log_request log = { 0, 0 };
+  send(request(SerialRequestLog, &log, sizeof(log)));
+  run(10);
+  std::vector<reply_frame> frames = replies();
+  TEST_ASSERT_EQUAL(SerialStatusOk, endOf(frames).status);
+  uint32_t pieces = frames.size() - 1;
+
+  // Cut the segment short, the last block of it is gone
+  truncate((std::string(fsRoot) + "/series/00000000").c_str(), 2 * SeriesBlockSize + 8);
+  send(request(SerialRequestLog, &log, sizeof(log)));
+  run(10);
+  frames = replies();
+  serial_end end = endOf(frames);
+  TEST_ASSERT_EQUAL(SerialStatusReadError, end.status);
+  TEST_ASSERT_LESS_THAN(pieces, end.frames);
+  TEST_ASSERT_GREATER_THAN(0, end.frames);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.fsRoot = mkdtemp(fsRoot);
+  simulation.quiet = true;
+  output = tmpfile();
+  simulation.consoleCapture = output;
+
+  seriesLog.begin();
+  protocol.begin(&Serial, &history, &seriesLog);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_config);
+  RUN_TEST(test_corrupted);
+  RUN_TEST(test_oversized);
+  RUN_TEST(test_bad_requests);
+  RUN_TEST(test_truncated);
+  RUN_TEST(test_text_commands);
+  RUN_TEST(test_log_read_error);
+  int failures = UNITY_END();
+
+  simulation.consoleCapture = nullptr;
+  fclose(output);
+  system((std::string("rm -rf ") + fsRoot).c_str());
+  return failures;
+}
@@ -0,0 +1,223 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "sim.hpp"
+#include "series_log.hpp"
+
+// SeriesLog on the simulated LittleFS: a block cut short by a full flash must not shift the blocks
+// written after it, and segments left outside the window are deleted at boot. Then the block codec
+// on its own: a month of minute records decodes to exactly what was encoded, with the ratio and
+// throughput --bench-series reports for the log the simulator wrote.
+
+static char fsRoot[] = "/tmp/test_series_log_XXXXXX";
+
+static const uint32_t Start = 1700000000; // s
+
+static uint32_t minute = 0;
+
+// A minute of simulated room readings averaged and quantized as SeriesLog::closeMinute() does
+static series_record nextRecord() {
+  float sum[SeriesChannels] = {};
+  for (uint8_t second = 0; second < 60; second++) {
+    simulation.advance(1000000);
+    sim_environment env = simulation.environment();
+    const float values[SeriesChannels] = {
+      env.temperature, env.humidity, (float)env.tvoc, (float)env.eco2, (float)env.co2,
+      (float)env.pm10, (float)env.pm25, (float)env.pm100
+    };
+    for (uint8_t c = 0; c < SeriesChannels; c++) sum[c] += values[c];
+  }
+  series_record record;
+  record.time = Start + 60 * minute++;
+  for (uint8_t c = 0; c < SeriesChannels; c++) record.values[c] = lroundf(sum[c] / 60 / SeriesStep[c]);
+  return record;
+}
+
+static void removeLog() {
+  system((std::string("rm -rf ") + fsRoot + "/series").c_str());
+}
+
+static bool segmentExists(uint32_t segment) {
+  char path[24];
+  sprintf(path, "/series/%08x", (unsigned int)segment);
+  return LittleFS.exists(path);
+}
+
+// Minutes of simulated room readings, one sample each
+static void logMinutes(SeriesLog &log, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    simulation.advance(60000000ULL);
+    sim_environment env = simulation.environment();
+    sensor_data data = {};
+    data.temperature = env.temperature;
+    data.humidity = env.humidity;
+    data.tvoc = lroundf(env.tvoc);
+    data.eco2 = lroundf(env.eco2);
+    data.co2 = lroundf(env.co2);
+    data.pm10 = lroundf(env.pm10);
+    data.pm25 = lroundf(env.pm25);
+    data.pm100 = lroundf(env.pm100);
+    log.addSample(data);
+    log.closeMinute(Start + 60 * minute++);
+  }
+}
+
+// Every block decodes, and the records run on in time from one block to the next
+static void assertBlocks(SeriesLog &log) {
+  static uint8_t block[SeriesBlockSize];
+  uint32_t lastTime = 0;
+  for (uint32_t b = 0; b < log.blocks(); b++) {
+    TEST_ASSERT_TRUE(log.readBlock(b, block));
+    SeriesDecoder decoder;
+    TEST_ASSERT_TRUE_MESSAGE(decoder.begin(block, sizeof(block)), "block misaligned");
+    TEST_ASSERT_GREATER_THAN(lastTime, decoder.startTime());
+    series_record record;
+    uint16_t records = 0;
+    while (decoder.next(record)) {
+      TEST_ASSERT_GREATER_OR_EQUAL(lastTime + 60, record.time);
+      lastTime = record.time;
+      records++;
+    }
+    TEST_ASSERT_EQUAL(decoder.records(), records);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+// The flash fills up halfway through a block, then space is freed again
+void test_short_write() {
+  SeriesLog log;
+  TEST_ASSERT_TRUE(log.begin());
+  while (log.writtenBlocks < 2) logMinutes(log, 1);
+
+  simulation.fsWriteBudget = SeriesBlockSize / 3;
+  while (log.failures == 0) logMinutes(log, 1);
+  simulation.fsWriteBudget = -1;
+  TEST_ASSERT_EQUAL(2, log.blocks());
+
+  while (log.writtenBlocks < 5) logMinutes(log, 1);
+  TEST_ASSERT_EQUAL(1, log.failures);
+  TEST_ASSERT_EQUAL(5, log.blocks());
+  assertBlocks(log);
+
+  // After a reboot as well
+  SeriesLog restarted;
+  TEST_ASSERT_TRUE(restarted.begin());
+  TEST_ASSERT_EQUAL(5, restarted.blocks());
+  assertBlocks(restarted);
+}
+
+// More segments than the window holds, as left by a reboot between starting a segment and dropping
+// the oldest: begin() keeps the newest SeriesSegments and deletes the rest
+void test_stale_segments() {
+  static const uint32_t First = 0x40;
+  static const uint32_t Stale = 5;
+  removeLog();
+  {
+    SeriesLog log;
+    TEST_ASSERT_TRUE(log.begin());
+    while (log.writtenBlocks < 1) logMinutes(log, 1);
+  }
+  static uint8_t block[SeriesBlockSize];
+  File file = LittleFS.open("/series/00000000", "r");
+  TEST_ASSERT_EQUAL(SeriesBlockSize, file.read(block, sizeof(block)));
+  file.close();
+  LittleFS.remove("/series/00000000");
+  for (uint32_t segment = First; segment < First + SeriesSegments + Stale; segment++) {
+    char path[24];
+    sprintf(path, "/series/%08x", (unsigned int)segment);
+    file = LittleFS.open(path, "w");
+    file.write(block, sizeof(block));
+    file.close();
+  }
+
+  SeriesLog log;
+  TEST_ASSERT_TRUE(log.begin());
+  TEST_ASSERT_EQUAL(Stale, log.droppedSegments);
+  for (uint32_t segment = First; segment < First + Stale; segment++) TEST_ASSERT_FALSE(segmentExists(segment));
+  for (uint32_t segment = First + Stale; segment < First + SeriesSegments + Stale; segment++) {
+    TEST_ASSERT_TRUE(segmentExists(segment));
+  }
+
+  // Nothing is left to remove at the next boot
+  SeriesLog restarted;
+  TEST_ASSERT_TRUE(restarted.begin());
+  TEST_ASSERT_EQUAL(0, restarted.droppedSegments);
+}
+
+// decode(encode(x)) == x over a month of minutes, cut into blocks as the log does
+void test_round_trip() {
+  static const uint32_t Records = 30 * 1440;
+  typedef std::chrono::steady_clock Clock;
+  std::vector<series_record> records(Records);
+  for (uint32_t i = 0; i < Records; i++) records[i] = nextRecord();
+  // A gap, as while the device was off, and a record late by a few seconds
+  for (uint32_t i = Records / 2; i < Records; i++) records[i].time += 3 * 3600;
+  records[Records / 3].time += 7;
+
+  std::vector<uint8_t> blocks;
+  SeriesBlock block;
+  Clock::time_point start = Clock::now();
+  block.begin(records[0].time);
+  for (const series_record &record : records) {
+    if (block.append(record)) continue;
+    blocks.insert(blocks.end(), block.data(), block.data() + block.length());
+    blocks.resize(blocks.size() + SeriesBlockSize - block.length());
+    block.begin(record.time);
+    block.append(record);
+  }
+  blocks.insert(blocks.end(), block.data(), block.data() + block.length());
+  blocks.resize(blocks.size() + SeriesBlockSize - block.length());
+  double encodeTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<series_record> decoded;
+  decoded.reserve(Records);
+  start = Clock::now();
+  for (size_t offset = 0; offset < blocks.size(); offset += SeriesBlockSize) {
+    SeriesDecoder decoder;
+    TEST_ASSERT_TRUE(decoder.begin(&blocks[offset], SeriesBlockSize));
+    series_record record;
+    while (decoder.next(record)) decoded.push_back(record);
+  }
+  double decodeTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+  TEST_ASSERT_EQUAL(Records, decoded.size());
+  for (uint32_t i = 0; i < Records; i++) {
+    TEST_ASSERT_EQUAL(records[i].time, decoded[i].time);
+    TEST_ASSERT_EQUAL_MEMORY(records[i].values, decoded[i].values, sizeof(records[i].values));
+  }
+
+  // A plain binary record: the time and each channel as a float
+  const size_t rawSize = sizeof(uint32_t) + SeriesChannels * sizeof(float);
+  double perRecord = (double)blocks.size() / Records;
+  char message[192];
+  snprintf(message, sizeof(message),
+           "%u records in %u blocks: %.2f bytes per record with padding, %.1fx vs %u byte raw records; "
+           "encode %.1f M records/s, decode %.1f M records/s (host)",
+           Records, (unsigned int)(blocks.size() / SeriesBlockSize), perRecord, rawSize / perRecord,
+           (unsigned int)rawSize, Records / encodeTime / 1e6, Records / decodeTime / 1e6);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(4 * perRecord, rawSize);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.fsRoot = mkdtemp(fsRoot);
+  simulation.quiet = true;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_short_write);
+  RUN_TEST(test_stale_segments);
+  RUN_TEST(test_round_trip);
+  int failures = UNITY_END();
+
+  system((std::string("rm -rf ") + fsRoot).c_str());
+  return failures;
+}
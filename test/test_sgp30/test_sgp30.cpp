@@ -0,0 +1,163 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "sim.hpp"
+#include "sgp30_patched.hpp"
+
+// Reply decoding of the patched SGP30 driver against the simulated sensor
+// Every word of a reply carries its own CRC, a reply with any bad word or fewer bytes than asked for
+// must be dropped whole and leave the last good values in place.
+
+static Adafruit_SGP30 sgp;
+
+// Bitwise CRC-8 as in the Sensirion datasheet, the reference for the driver's lookup table
+static uint8_t bitwiseCRC(const uint8_t *data, uint8_t length) {
+  uint8_t crc = SGP30_CRC8_INIT;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) crc = crc & 0x80 ? (crc << 1) ^ SGP30_CRC8_POLYNOMIAL : crc << 1;
+  }
+  return crc;
+}
+
+static bool measure() {
+  if (!sgp.IAQmeasureStart()) return false;
+  delay(sgp.commandRemaining());
+  return sgp.commandCollect();
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Both words of a two word reply are decoded, in order
+void test_multi_word_decode() {
+  TEST_ASSERT_TRUE(sgp.setIAQBaseline(0x1234, 0xABCD));
+  uint16_t eco2 = 0, tvoc = 0;
+  TEST_ASSERT_TRUE(sgp.getIAQBaseline(&eco2, &tvoc));
+  TEST_ASSERT_EQUAL_HEX16(0x1234, eco2);
+  TEST_ASSERT_EQUAL_HEX16(0xABCD, tvoc);
+
+  TEST_ASSERT_TRUE(sgp.getIAQBaselineStart());
+  delay(sgp.commandRemaining());
+  TEST_ASSERT_TRUE(sgp.commandCollect());
+  TEST_ASSERT_EQUAL_HEX16(0x1234, sgp.baselineECO2);
+  TEST_ASSERT_EQUAL_HEX16(0xABCD, sgp.baselineTVOC);
+
+  // Three words, the serial number read by begin()
+  TEST_ASSERT_EQUAL_HEX16(0x0000, sgp.serialnumber[0]);
+  TEST_ASSERT_EQUAL_HEX16(0x0123, sgp.serialnumber[1]);
+  TEST_ASSERT_EQUAL_HEX16(0x4567, sgp.serialnumber[2]);
+  TEST_ASSERT_EQUAL(0, sgp.crcErrors);
+}
+
+// A flipped bit anywhere in either word or its CRC drops the reply and counts one error
+void test_bad_crc_each_word() {
+  TEST_ASSERT_TRUE(sgp.setIAQBaseline(0x1234, 0xABCD));
+  for (int byte = 0; byte < 6; byte++) {
+    uint32_t errors = sgp.crcErrors;
+    simulation.sgp30CorruptByte = byte;
+    uint16_t eco2 = 0, tvoc = 0;
+    TEST_ASSERT_FALSE(sgp.getIAQBaseline(&eco2, &tvoc));
+    TEST_ASSERT_EQUAL(errors + 1, sgp.crcErrors);
+    TEST_ASSERT_EQUAL(0, eco2);
+    TEST_ASSERT_EQUAL(0, tvoc);
+  }
+
+  // The non-blocking path keeps the previous measurement
+  TEST_ASSERT_TRUE(measure());
+  uint16_t eco2 = sgp.eCO2, tvoc = sgp.TVOC;
+  for (int byte = 0; byte < 6; byte++) {
+    simulation.sgp30CorruptByte = byte;
+    TEST_ASSERT_FALSE(measure());
+    TEST_ASSERT_EQUAL(eco2, sgp.eCO2);
+    TEST_ASSERT_EQUAL(tvoc, sgp.TVOC);
+  }
+  TEST_ASSERT_TRUE(measure());
+}
+
+// A reply shorter than asked for fails the read, without counting as a CRC error
+void test_short_read() {
+  TEST_ASSERT_TRUE(measure());
+  uint16_t eco2 = sgp.eCO2, tvoc = sgp.TVOC;
+  uint32_t errors = sgp.crcErrors;
+  for (uint8_t missing = 1; missing <= 6; missing++) {
+    simulation.sgp30ShortReply = missing;
+    TEST_ASSERT_FALSE(measure());
+    TEST_ASSERT_EQUAL(eco2, sgp.eCO2);
+    TEST_ASSERT_EQUAL(tvoc, sgp.TVOC);
+  }
+  TEST_ASSERT_EQUAL(errors, sgp.crcErrors);
+  TEST_ASSERT_TRUE(measure());
+}
+
+// Every possible word goes through the driver's table CRC both ways
+void test_all_words() {
+  uint32_t errors = sgp.crcErrors;
+  for (uint32_t word = 0; word <= 0xFFFF; word++) {
+    uint16_t eco2 = 0, tvoc = 0;
+    if (!sgp.setIAQBaseline(word, ~word) || !sgp.getIAQBaseline(&eco2, &tvoc)) {
+      TEST_FAIL_MESSAGE("baseline round trip failed");
+    }
+    if (eco2 != word || tvoc != (uint16_t)~word) TEST_FAIL_MESSAGE("baseline mismatch");
+  }
+  TEST_ASSERT_EQUAL(errors, sgp.crcErrors);
+}
+
+// Decoding cost of the table against the bitwise loop it replaced, per reply word
+void test_crc_benchmark() {
+  static const uint32_t Words = 1 << 20;
+  static uint8_t data[Words * 3];
+  uint8_t table[256];
+  // Same table as the driver's, indexed by crc ^ byte
+  for (uint16_t i = 0; i < 256; i++) {
+    uint8_t crc = i;
+    for (uint8_t b = 0; b < 8; b++) crc = crc & 0x80 ? (crc << 1) ^ SGP30_CRC8_POLYNOMIAL : crc << 1;
+    table[i] = crc;
+  }
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < Words; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i * 3] = seed >> 16;
+    data[i * 3 + 1] = seed >> 24;
+    data[i * 3 + 2] = bitwiseCRC(data + i * 3, 2);
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  uint32_t valid = 0;
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 0; i < Words; i++) {
+    const uint8_t *word = data + i * 3;
+    valid += bitwiseCRC(word, 2) == word[2];
+  }
+  double bitwise = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Words;
+  TEST_ASSERT_EQUAL(Words, valid);
+
+  valid = 0;
+  start = Clock::now();
+  for (uint32_t i = 0; i < Words; i++) {
+    const uint8_t *word = data + i * 3;
+    valid += table[table[SGP30_CRC8_INIT ^ word[0]] ^ word[1]] == word[2];
+  }
+  double lookup = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Words;
+  TEST_ASSERT_EQUAL(Words, valid);
+
+  char message[96];
+  snprintf(message, sizeof(message), "CRC per word: bitwise %.2f ns, table %.2f ns (host)", bitwise, lookup);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.quiet = true;
+  sgp.begin();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_multi_word_decode);
+  RUN_TEST(test_bad_crc_each_word);
+  RUN_TEST(test_short_read);
+  RUN_TEST(test_all_words);
+  RUN_TEST(test_crc_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,256 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "constants.hpp"
+#include "line_protocol.hpp"
+#include "spsc_queue.hpp"
+
+// SPSCQueue with a producer and a consumer thread, as the sensor loop and the network task use it
+// on the ESP32; its hand-over latency against a queue guarded by a mutex, and the time the sensor
+// loop spends per sample against the single-threaded loop, which formats and uploads inline
+
+typedef std::chrono::steady_clock Clock;
+
+// Same size as a sample_record, a sequence number and a payload derived from it
+typedef struct {
+  uint32_t sequence;
+  uint32_t check;
+  float values[3];
+  uint32_t sent; // ns since the start of the run
+} item;
+
+static const size_t Length = SampleQueueLength;
+
+static Clock::time_point epoch;
+static uint32_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+}
+
+// Ring buffer under a mutex, what the queue would be without the lock-free indices
+template <typename T, size_t N>
+class LockedQueue {
+  public:
+    bool push(const T &value) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (count == N) return false;
+      slots[(first + count++) % N] = value;
+      return true;
+    }
+    bool pop(T &value) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (count == 0) return false;
+      value = slots[first];
+      first = (first + 1) % N;
+      count--;
+      return true;
+    }
+
+  private:
+    std::mutex mutex;
+    T slots[N];
+    size_t first = 0;
+    size_t count = 0;
+};
+
+typedef struct {
+  uint32_t received;
+  uint32_t outOfOrder;
+  uint32_t corrupted;
+  uint32_t full; // failed pushes
+  std::vector<uint32_t> latencies;
+} run_result;
+
+// Push Items through the queue from one thread to another, every item retried until it fits
+template <typename Queue>
+static run_result run(Queue &queue, uint32_t items, bool measure) {
+  run_result result = { 0, 0, 0, 0, {} };
+  if (measure) result.latencies.reserve(items);
+  epoch = Clock::now();
+
+  std::thread producer([&]() {
+    for (uint32_t i = 0; i < items; i++) {
+      item value;
+      value.sequence = i;
+      value.check = i * 2654435761u;
+      value.values[0] = value.values[1] = value.values[2] = i;
+      value.sent = measure ? now() : 0;
+      while (!queue.push(value)) {
+        result.full++;
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t expected = 0;
+  while (expected < items) {
+    item value;
+    if (!queue.pop(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (measure) result.latencies.push_back(now() - value.sent);
+    if (value.sequence != expected) result.outOfOrder++;
+    if (value.check != value.sequence * 2654435761u || value.values[2] != (float)value.sequence) result.corrupted++;
+    expected = value.sequence + 1;
+    result.received++;
+  }
+  producer.join();
+  return result;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &values, double p) {
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(p * (values.size() - 1))];
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_single_thread() {
+  SPSCQueue<item, Length> queue;
+  item value;
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_FALSE(queue.pop(value));
+  for (uint32_t i = 0; i < Length; i++) {
+    value.sequence = i;
+    TEST_ASSERT_TRUE(queue.push(value));
+  }
+  TEST_ASSERT_FALSE(queue.push(value));
+  TEST_ASSERT_EQUAL(Length, queue.size());
+  for (uint32_t i = 0; i < Length; i++) {
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL(i, value.sequence);
+  }
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+// A million items through a queue that is full most of the time: none lost, reordered or torn
+void test_stress() {
+  static SPSCQueue<item, Length> queue;
+  static const uint32_t Items = 1000000;
+  run_result result = run(queue, Items, false);
+  char message[128];
+  snprintf(message, sizeof(message), "%u items, %u pushes found the queue full", result.received, result.full);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(Items, result.received);
+  TEST_ASSERT_EQUAL(0, result.outOfOrder);
+  TEST_ASSERT_EQUAL(0, result.corrupted);
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+// Time from push to pop, lock-free against the mutex
+void test_latency() {
+  static const uint32_t Items = 200000;
+  static SPSCQueue<item, Length> lockFree;
+  static LockedQueue<item, Length> locked;
+
+  Clock::time_point start = Clock::now();
+  run_result a = run(lockFree, Items, true);
+  double lockFreeTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Items;
+  start = Clock::now();
+  run_result b = run(locked, Items, true);
+  double lockedTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / Items;
+  TEST_ASSERT_EQUAL(0, a.outOfOrder + a.corrupted);
+  TEST_ASSERT_EQUAL(0, b.outOfOrder + b.corrupted);
+
+  char message[192];
+  snprintf(message, sizeof(message), "latency p50/p99: lock-free %u/%u ns, mutex %u/%u ns; per item %.0f/%.0f ns (host)",
+           percentile(a.latencies, 0.5), percentile(a.latencies, 0.99), percentile(b.latencies, 0.5),
+           percentile(b.latencies, 0.99), lockFreeTime, lockedTime);
+  TEST_MESSAGE(message);
+}
+
+// The sensor loop produces a sample, then sleeps until the next reading; every UploadBatch records
+// a blocking upload of UploadTime. Single-threaded the loop formats and uploads itself, on dual
+// core it only pushes and a second thread formats and uploads. Measured is the time the loop is
+// busy per sample, not counting its sleep.
+void test_loop_latency() {
+  static const uint32_t Samples = 2000;
+  static const uint32_t UploadBatch = 16;
+  static const std::chrono::microseconds SensorInterval(100);
+  static const std::chrono::microseconds UploadTime(1000);
+  static SPSCQueue<item, Length> queue;
+  char buffer[LineProtocolMaxLength];
+  volatile size_t sink = 0;
+
+  auto format = [&](const item &value) {
+    LineProtocolWriter line(buffer, sizeof(buffer));
+    line.begin("Temperature");
+    line.tag("ssid", "HomeNetwork");
+    line.field("Temperature C", value.values[0]);
+    line.field("Dew Point C", value.values[1]);
+    sink = sink + line.end(1700000000 + value.sequence);
+  };
+
+  std::vector<uint32_t> single, queued;
+  single.reserve(Samples);
+  queued.reserve(Samples);
+
+  epoch = Clock::now();
+  for (uint32_t i = 0; i < Samples; i++) {
+    item value = { i, 0, { 20 + i * 0.01f, 10 + i * 0.01f, 0 }, 0 };
+    uint32_t start = now();
+    format(value);
+    if ((i + 1) % UploadBatch == 0) std::this_thread::sleep_for(UploadTime);
+    single.push_back(now() - start);
+    std::this_thread::sleep_for(SensorInterval);
+  }
+
+  std::atomic<bool> done(false);
+  uint32_t dropped = 0, formatted = 0;
+  std::thread network([&]() {
+    item value;
+    while (true) {
+      bool last = done.load();
+      while (queue.pop(value)) {
+        format(value);
+        if (++formatted % UploadBatch == 0) std::this_thread::sleep_for(UploadTime);
+      }
+      if (last) break;
+      std::this_thread::yield();
+    }
+  });
+  for (uint32_t i = 0; i < Samples; i++) {
+    item value = { i, 0, { 20 + i * 0.01f, 10 + i * 0.01f, 0 }, 0 };
+    uint32_t start = now();
+    if (!queue.push(value)) dropped++;
+    queued.push_back(now() - start);
+    std::this_thread::sleep_for(SensorInterval);
+  }
+  done.store(true);
+  network.join();
+
+  uint32_t singleMax = *std::max_element(single.begin(), single.end());
+  uint32_t queuedMax = *std::max_element(queued.begin(), queued.end());
+  char message[192];
+  snprintf(message, sizeof(message),
+           "sensor loop busy per sample p50/p99/max: single-threaded %u/%u/%u ns, queue %u/%u/%u ns, "
+           "%u dropped (host)",
+           percentile(single, 0.5), percentile(single, 0.99), singleMax, percentile(queued, 0.5),
+           percentile(queued, 0.99), queuedMax, dropped);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(0, dropped);
+  TEST_ASSERT_EQUAL(Samples, formatted);
+  // One sample in UploadBatch waits for an upload when done inline, so the p99 does too
+  TEST_ASSERT_GREATER_OR_EQUAL(std::chrono::duration_cast<std::chrono::nanoseconds>(UploadTime).count(),
+                               percentile(single, 0.99));
+  TEST_ASSERT_LESS_THAN(percentile(single, 0.99) / 10, percentile(queued, 0.99));
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_single_thread);
+  RUN_TEST(test_stress);
+  RUN_TEST(test_latency);
+  RUN_TEST(test_loop_latency);
+  return UNITY_END();
+}
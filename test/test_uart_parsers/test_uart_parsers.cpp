@@ -0,0 +1,235 @@
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+
+#include "uart_parsers.hpp"
+
+// MH-Z19 and PMS5003 frame parsers fed truncated frames, corrupted frames and garbage
+// Whatever comes before it, a complete valid frame must be delivered, and nothing that fails its
+// checksum ever is. The one exception is the MH-Z19's 8 bit checksum: a stray header in the garbage
+// followed by the start of a real frame passes it one time in 256, and that real frame is lost.
+
+static uint32_t seed = 1;
+static uint32_t nextRandom(uint32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % range;
+}
+
+static void mhz19Frame(uint8_t frame[MHZ19Parser::FrameLength], uint16_t co2, int8_t temperature) {
+  frame[0] = 0xFF;
+  frame[1] = 0x86;
+  frame[2] = co2 >> 8;
+  frame[3] = co2 & 0xFF;
+  frame[4] = temperature + 40;
+  frame[5] = 0;
+  frame[6] = 0;
+  frame[7] = 0;
+  frame[8] = MHZ19Parser::checksum(frame);
+}
+
+static void pmsFrame(uint8_t frame[PMS5003Parser::FrameLength], uint16_t pm25) {
+  frame[0] = 0x42;
+  frame[1] = 0x4D;
+  frame[2] = 0;
+  frame[3] = PMS5003Parser::FrameLength - 4;
+  for (uint8_t i = 4; i < PMS5003Parser::FrameLength - 2; i += 2) {
+    uint16_t word = i == 6 ? pm25 : nextRandom(65536);
+    frame[i] = word >> 8;
+    frame[i + 1] = word & 0xFF;
+  }
+  uint16_t sum = 0;
+  for (uint8_t i = 0; i < PMS5003Parser::FrameLength - 2; i++) sum += frame[i];
+  frame[PMS5003Parser::FrameLength - 2] = sum >> 8;
+  frame[PMS5003Parser::FrameLength - 1] = sum & 0xFF;
+}
+
+// Feed bytes, returns the number of frames completed
+template <typename Parser>
+static uint32_t feed(Parser &parser, const uint8_t *data, size_t length) {
+  uint32_t frames = 0;
+  for (size_t i = 0; i < length; i++) frames += parser.feed(data[i]);
+  return frames;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_mhz19_valid() {
+  MHZ19Parser parser;
+  uint8_t frame[MHZ19Parser::FrameLength];
+  // Values that put the start bytes inside the frame
+  const uint16_t values[] = { 400, 0xFF86, 0x86FF, 0xFFFF, 0 };
+  for (uint16_t co2 : values) {
+    mhz19Frame(frame, co2, 21);
+    TEST_ASSERT_EQUAL(1, feed(parser, frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(co2, parser.co2());
+    TEST_ASSERT_EQUAL(21, parser.temperature());
+  }
+  TEST_ASSERT_EQUAL(0, parser.stats.discardedBytes);
+}
+
+// A frame cut off at any point, then a complete one: only the complete one is delivered
+void test_mhz19_truncated() {
+  uint8_t frame[MHZ19Parser::FrameLength];
+  for (uint8_t cut = 1; cut < MHZ19Parser::FrameLength; cut++) {
+    MHZ19Parser parser;
+    mhz19Frame(frame, 1234, 20);
+    feed(parser, frame, cut);
+    mhz19Frame(frame, 567, 25);
+    TEST_ASSERT_EQUAL(1, feed(parser, frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(567, parser.co2());
+    TEST_ASSERT_EQUAL(25, parser.temperature());
+  }
+}
+
+// Every single bit error is caught, and the parser picks up the next frame
+void test_mhz19_corrupted() {
+  MHZ19Parser parser;
+  uint8_t frame[MHZ19Parser::FrameLength];
+  for (uint8_t byte = 0; byte < MHZ19Parser::FrameLength; byte++) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      mhz19Frame(frame, 800 + byte, 22);
+      frame[byte] ^= 1 << bit;
+      TEST_ASSERT_EQUAL(0, feed(parser, frame, sizeof(frame)));
+      mhz19Frame(frame, 900 + bit, 23);
+      TEST_ASSERT_EQUAL(1, feed(parser, frame, sizeof(frame)));
+      TEST_ASSERT_EQUAL(900 + bit, parser.co2());
+    }
+  }
+}
+
+// Random garbage, including start bytes, in front of every frame
+// Frames are only lost to garbage that passes the checksum by chance, at most one per 256 failed checks
+void test_mhz19_resync() {
+  MHZ19Parser parser;
+  uint8_t frame[MHZ19Parser::FrameLength];
+  uint8_t garbage[64];
+  uint32_t lost = 0;
+  for (uint32_t n = 0; n < 20000; n++) {
+    size_t length = nextRandom(sizeof(garbage));
+    for (size_t i = 0; i < length; i++) {
+      uint32_t r = nextRandom(8);
+      garbage[i] = r == 0 ? 0xFF : r == 1 ? 0x86 : nextRandom(256);
+    }
+    feed(parser, garbage, length);
+    uint16_t co2 = nextRandom(5000);
+    mhz19Frame(frame, co2, 20);
+    uint32_t frames = feed(parser, frame, sizeof(frame));
+    if (frames < 1 || parser.co2() != co2) lost++;
+  }
+  char message[128];
+  snprintf(message, sizeof(message), "%u frames, %u lost, %u checksum errors, %u bytes discarded",
+           parser.stats.frames, lost, parser.stats.checksumErrors, parser.stats.discardedBytes);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL(parser.stats.checksumErrors / 256 + 1, lost);
+}
+
+void test_pms5003_truncated() {
+  uint8_t frame[PMS5003Parser::FrameLength];
+  for (uint8_t cut = 1; cut < PMS5003Parser::FrameLength; cut++) {
+    PMS5003Parser parser;
+    pmsFrame(frame, 99);
+    feed(parser, frame, cut);
+    pmsFrame(frame, 12);
+    TEST_ASSERT_EQUAL(1, feed(parser, frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(12, parser.data().pm25_standard);
+    TEST_ASSERT_EQUAL(PMS5003Parser::FrameLength - 4, parser.data().framelen);
+  }
+}
+
+void test_pms5003_corrupted() {
+  PMS5003Parser parser;
+  uint8_t frame[PMS5003Parser::FrameLength];
+  for (uint8_t byte = 0; byte < PMS5003Parser::FrameLength; byte++) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      pmsFrame(frame, 50);
+      frame[byte] ^= 1 << bit;
+      TEST_ASSERT_EQUAL(0, feed(parser, frame, sizeof(frame)));
+      pmsFrame(frame, 60 + bit);
+      TEST_ASSERT_EQUAL(1, feed(parser, frame, sizeof(frame)));
+      TEST_ASSERT_EQUAL(60 + bit, parser.data().pm25_standard);
+    }
+  }
+}
+
+void test_pms5003_resync() {
+  PMS5003Parser parser;
+  uint8_t frame[PMS5003Parser::FrameLength];
+  uint8_t garbage[96];
+  for (uint32_t n = 0; n < 20000; n++) {
+    size_t length = nextRandom(sizeof(garbage));
+    for (size_t i = 0; i < length; i++) {
+      uint32_t r = nextRandom(8);
+      garbage[i] = r == 0 ? 0x42 : r == 1 ? 0x4D : r == 2 ? 0x1C : nextRandom(256);
+    }
+    feed(parser, garbage, length);
+    uint16_t pm25 = nextRandom(1000);
+    pmsFrame(frame, pm25);
+    uint32_t frames = feed(parser, frame, sizeof(frame));
+    if (frames < 1 || parser.data().pm25_standard != pm25) TEST_FAIL_MESSAGE("frame after garbage lost");
+  }
+}
+
+// Pure noise hardly ever passes for a frame: it needs the header and a matching checksum
+void test_random_bytes() {
+  MHZ19Parser mhz19;
+  PMS5003Parser pms;
+  static const uint32_t Bytes = 4000000;
+  for (uint32_t i = 0; i < Bytes; i++) {
+    uint8_t byte = nextRandom(256);
+    mhz19.feed(byte);
+    pms.feed(byte);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(2, mhz19.stats.frames);
+  TEST_ASSERT_EQUAL(0, pms.stats.frames);
+}
+
+// Bytes per second through each parser, valid frames and noise
+void test_throughput() {
+  static const uint32_t Frames = 200000;
+  typedef std::chrono::steady_clock Clock;
+  static uint8_t stream[Frames * PMS5003Parser::FrameLength];
+  char message[160];
+
+  MHZ19Parser mhz19;
+  for (uint32_t i = 0; i < Frames; i++) mhz19Frame(stream + i * MHZ19Parser::FrameLength, 400 + i % 1000, 20);
+  Clock::time_point start = Clock::now();
+  uint32_t frames = feed(mhz19, stream, Frames * MHZ19Parser::FrameLength);
+  double mhz19Valid = std::chrono::duration<double, std::nano>(Clock::now() - start).count() /
+                      (Frames * MHZ19Parser::FrameLength);
+  TEST_ASSERT_EQUAL(Frames, frames);
+
+  PMS5003Parser pms;
+  for (uint32_t i = 0; i < Frames; i++) pmsFrame(stream + i * PMS5003Parser::FrameLength, i % 500);
+  start = Clock::now();
+  frames = feed(pms, stream, sizeof(stream));
+  double pmsValid = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / sizeof(stream);
+  TEST_ASSERT_EQUAL(Frames, frames);
+
+  // Noise rich in start bytes is the worst case, every byte starts a search
+  for (size_t i = 0; i < sizeof(stream); i++) stream[i] = nextRandom(2) ? 0x42 : nextRandom(256);
+  stream[0] = 0x42;
+  start = Clock::now();
+  feed(pms, stream, sizeof(stream));
+  double pmsNoise = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / sizeof(stream);
+
+  snprintf(message, sizeof(message), "per byte: MH-Z19 frames %.1f ns, PMS5003 frames %.1f ns, PMS5003 noise %.1f ns (host)",
+           mhz19Valid, pmsValid, pmsNoise);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_mhz19_valid);
+  RUN_TEST(test_mhz19_truncated);
+  RUN_TEST(test_mhz19_corrupted);
+  RUN_TEST(test_mhz19_resync);
+  RUN_TEST(test_pms5003_truncated);
+  RUN_TEST(test_pms5003_corrupted);
+  RUN_TEST(test_pms5003_resync);
+  RUN_TEST(test_random_bytes);
+  RUN_TEST(test_throughput);
+  return UNITY_END();
+}
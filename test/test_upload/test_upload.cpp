@@ -0,0 +1,133 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+
+#include "sim.hpp"
+#include "system.hpp"
+
+// Loop timing of the upload path against the simulated InfluxDB server
+// A write used to hold up the loop for the whole request: a round trip and the transfer per batch,
+// and the HTTP timeout when the server didn't answer. Requests now take a step every pass.
+// Known gap: opening the connection still blocks. WiFiClient::connect() and the TLS handshake have
+// no non-blocking form in the Arduino cores, so the pass that connects waits a round trip, or
+// UploadTimeout when the server doesn't answer. That happens once after startup and after each
+// outage or failed request, and on the ESP32 it happens on the network core instead of the loop.
+// The tests check that every pass slower than LocalWork is one of those connection attempts.
+
+extern System device;
+void setup();
+
+static const uint32_t Step = 1000; // us between passes, as in the simulator
+static const uint32_t Latency = 500; // ms, round trip
+static const uint32_t LocalWork = 30; // ms, longest pass without a network wait: SHT31 conversion, display, flash
+
+static char fsRoot[] = "/tmp/test_upload_XXXXXX";
+
+static uint32_t slowPasses; // longer than LocalWork, in the last run()
+static uint32_t connectAttempts; // in the last run()
+
+// Run the firmware for a while, returns the longest tick() in ms
+static uint32_t run(uint32_t seconds) {
+  uint64_t end = simulation.micros() + seconds * 1000000ULL;
+  uint64_t longest = 0;
+  uint32_t connects = simulation.connectAttempts;
+  slowPasses = 0;
+  while (simulation.micros() < end) {
+    uint64_t start = simulation.micros();
+    device.tick();
+    uint64_t elapsed = simulation.micros() - start;
+    longest = std::max(longest, elapsed);
+    if (elapsed > LocalWork * 1000ULL) slowPasses++;
+    device.idle();
+    simulation.advance(Step);
+  }
+  connectAttempts = simulation.connectAttempts - connects;
+  return longest / 1000;
+}
+
+static void report(const char *phase, uint32_t longest) {
+  char message[128];
+  snprintf(message, sizeof(message),
+           "%s: longest tick %u ms, %u slow passes, %u connects, %u records written, %u requests (%u failed)", phase,
+           longest, slowPasses, connectAttempts, simulation.recordsWritten, simulation.networkRequests,
+           simulation.networkFailures);
+  TEST_MESSAGE(message);
+}
+
+void setUp() {}
+void tearDown() {}
+
+// The first request opens the connection, that round trip is the only wait
+void test_startup() {
+  uint32_t longest = run(600);
+  report("startup", longest);
+  TEST_ASSERT_GREATER_THAN(0, simulation.recordsWritten);
+  TEST_ASSERT_LESS_OR_EQUAL(Latency + LocalWork, longest);
+  TEST_ASSERT_LESS_OR_EQUAL(connectAttempts, slowPasses);
+}
+
+// With the connection open, no pass waits on the network at all
+void test_steady_state() {
+  uint32_t longest = run(3600);
+  report("steady state", longest);
+  TEST_ASSERT_EQUAL(0, connectAttempts);
+  TEST_ASSERT_EQUAL(0, slowPasses);
+  TEST_ASSERT_LESS_OR_EQUAL(LocalWork, longest);
+}
+
+// The batches buffered in flash during an outage are drained without a pass waiting on the
+// network, apart from opening a new connection
+void test_outage() {
+  uint32_t written = simulation.recordsWritten;
+  simulation.outageStart = simulation.micros() / 1000000 + 60;
+  simulation.outageEnd = simulation.outageStart + 1800;
+  uint32_t longest = run(3600);
+  report("outage", longest);
+  TEST_ASSERT_GREATER_THAN(written, simulation.recordsWritten);
+  TEST_ASSERT_LESS_OR_EQUAL(Latency + LocalWork, longest);
+  TEST_ASSERT_LESS_OR_EQUAL(connectAttempts, slowPasses);
+}
+
+// A server slower than the timeout costs at most one UploadTimeout per pass, while connecting
+void test_unresponsive_server() {
+  simulation.networkLatency = UploadTimeout + 1000;
+  uint32_t longest = run(600);
+  report("unresponsive server", longest);
+  TEST_ASSERT_LESS_OR_EQUAL(UploadTimeout + LocalWork, longest);
+  TEST_ASSERT_LESS_OR_EQUAL(connectAttempts, slowPasses);
+
+  simulation.networkLatency = Latency;
+  uint32_t written = simulation.recordsWritten;
+  longest = run(1800);
+  report("recovered", longest);
+  TEST_ASSERT_GREATER_THAN(written, simulation.recordsWritten);
+  TEST_ASSERT_LESS_OR_EQUAL(Latency + LocalWork, longest);
+  TEST_ASSERT_LESS_OR_EQUAL(connectAttempts, slowPasses);
+}
+
+// Every batch was accepted, with a valid timestamp
+void test_records_valid() {
+  TEST_ASSERT_EQUAL(0, simulation.rejectedRequests);
+  TEST_ASSERT_EQUAL(0, simulation.staleRecords);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  simulation.fsRoot = mkdtemp(fsRoot);
+  simulation.quiet = true;
+  simulation.networkLatency = Latency;
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_startup);
+  RUN_TEST(test_steady_state);
+  RUN_TEST(test_outage);
+  RUN_TEST(test_unresponsive_server);
+  RUN_TEST(test_records_valid);
+  int failures = UNITY_END();
+
+  system((std::string("rm -rf ") + fsRoot).c_str());
+  return failures;
+}
@@ -0,0 +1,349 @@
+#!/usr/bin/env python3
+"""Pull history, stats and config off a sensor over its serial console.
+
+Speaks the framed protocol in src/serial_protocol.hpp and writes what comes back as CSV, or as a
+directory per table with one .npy file per column (numpy.load / pandas read them without this
+script). Text the firmware prints between frames is skipped.
+
+  serial_dump.py --port /dev/ttyUSB0 log --from 1700000000 --out dump
+  serial_dump.py --port /dev/ttyUSB0 history --tier 60h --format columns --out dump
+  serial_dump.py --port /dev/ttyUSB0 stats
+
+--capture decodes a saved console stream instead, e.g. from the simulator's --serial-out, and
+--request prints a request in the \\xHH form the simulator's --send takes.
+"""
+
+import argparse
+import json
+import math
+import os
+import struct
+import sys
+import time
+import zlib
+
+SYNC = b"\xa5\x5a"
+MAX_PAYLOAD = 112  # SerialFramePayload
+
+REQUEST_CONFIG = 0x01
+REQUEST_STATS = 0x02
+REQUEST_HISTORY = 0x03
+REQUEST_LOG = 0x04
+
+FRAME_CONFIG = 0x81
+FRAME_CHANNEL = 0x82
+FRAME_STATS = 0x83
+FRAME_HISTORY = 0x84
+FRAME_LOG = 0x85
+FRAME_END = 0x8F
+
+STATUS = {0: "ok", 1: "bad request", 2: "log read error"}
+HISTORY_STATS = ["mean", "min", "max"]
+STATS_FIELDS = [
+    "uptime", "time", "free_heap", "rssi", "log_blocks", "log_records", "log_failures",
+    "checkpoints", "checkpoint_failures", "http_requests", "upload_payload_bytes",
+    "upload_sent_bytes", "mhz19_frames", "mhz19_errors", "pms_frames", "pms_errors",
+    "serial_frames", "serial_errors",
+]
+SERIES_MAGIC = 0x5331
+CONFIG_FORMAT = "<HIHBBBBH"  # serial_config up to the tier tables
+NPY_FORMAT = {"<u4": "I", "<i4": "i", "<f4": "f"}
+
+
+def encode_request(kind, payload=b""):
+    body = struct.pack("<BH", kind, len(payload)) + payload
+    return SYNC + body + struct.pack("<I", zlib.crc32(body))
+
+
+def frames(data):
+    """Yield (type, payload, end) for every valid frame in data, skipping anything else."""
+    position = 0
+    while True:
+        start = data.find(SYNC, position)
+        if start < 0 or start + 5 > len(data):
+            return
+        kind, length = struct.unpack_from("<BH", data, start + 2)
+        end = start + 5 + length + 4
+        if length > MAX_PAYLOAD or end > len(data):
+            position = start + 1
+            continue
+        (crc,) = struct.unpack_from("<I", data, end - 4)
+        if crc != zlib.crc32(data[start + 2:end - 4]):
+            position = start + 1
+            continue
+        yield kind, data[start + 5:end - 4], end
+        position = end
+
+
+def zigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_block(block, channels):
+    """Records of one time-series log block, see SeriesBlock in src/series_log.hpp."""
+    magic, count, start = struct.unpack_from("<HHI", block)
+    if magic != SERIES_MAGIC:
+        return []
+    position = 8
+
+    def varint():
+        nonlocal position
+        value = shift = 0
+        while True:
+            byte = block[position]
+            position += 1
+            value |= (byte & 0x7F) << shift
+            if not byte & 0x80:
+                return value
+            shift += 7
+
+    records = []
+    last_time, interval, last = start, 0, [0] * channels
+    try:
+        for _ in range(count):
+            interval += zigzag(varint())
+            last_time += interval
+            mask = block[position]
+            position += 1
+            for c in range(channels):
+                if mask & (1 << c):
+                    last[c] += zigzag(varint())
+            records.append((last_time, list(last)))
+    except IndexError:
+        print("warning: truncated log block at %d" % start, file=sys.stderr)
+    return records
+
+
+class Dump:
+    """Reassembles the replies found in a console stream."""
+
+    def __init__(self):
+        self.config = None
+        self.channels = {"history": [], "series": []}
+        self.stats = None
+        self.history = {}  # tier -> {(channel, stat): [raw]}
+        self.blocks = {}   # block -> bytearray
+        self.block_pieces = {}
+        self.ends = []
+
+    def feed(self, kind, payload):
+        if kind == FRAME_CONFIG:
+            fields = struct.unpack_from(CONFIG_FORMAT, payload)
+            tiers = fields[3]
+            offset = struct.calcsize(CONFIG_FORMAT)
+            seconds = struct.unpack_from("<%dI" % tiers, payload, offset)
+            offset += 4 * tiers
+            labels = [payload[offset + 4 * t:offset + 4 * t + 4].split(b"\0")[0].decode() for t in range(tiers)]
+            self.config = {
+                "version": fields[0], "update_interval_ms": fields[1], "history_length": fields[2],
+                "history_tiers": tiers, "history_channels": fields[4], "history_stats": fields[5],
+                "series_channels": fields[6], "series_block_size": fields[7],
+                "tier_seconds": list(seconds), "tier_labels": labels,
+            }
+            self.channels = {"history": [], "series": []}
+        elif kind == FRAME_CHANNEL:
+            channel_kind, index, step, offset = struct.unpack_from("<BBff", payload)
+            name = payload[10:26].split(b"\0")[0].decode()
+            table = self.channels["series" if channel_kind else "history"]
+            table.append({"index": index, "name": name, "step": step, "offset": offset})
+        elif kind == FRAME_STATS:
+            values = struct.unpack_from("<IIIi14I", payload)
+            self.stats = dict(zip(STATS_FIELDS, values))
+        elif kind == FRAME_HISTORY:
+            tier, channel, stat, count, size, first = struct.unpack_from("<BBBBHH", payload)
+            column = self.history.setdefault(tier, {}).setdefault((channel, stat), [0] * size)
+            column[first:first + count] = struct.unpack_from("<%dH" % count, payload, 8)
+        elif kind == FRAME_LOG:
+            block, offset, length = struct.unpack_from("<IHH", payload)
+            if block == 0 and offset == 0:
+                # A new dump
+                self.blocks, self.block_pieces = {}, {}
+            data = self.blocks.setdefault(block, bytearray(self.block_size()))
+            piece = payload[8:]
+            data[offset:offset + len(piece)] = piece
+            self.block_pieces.setdefault(block, [length, 0])[1] += len(piece)
+        elif kind == FRAME_END:
+            request, status, _, count = struct.unpack_from("<BBHI", payload)
+            self.ends.append((request, status, count))
+            if status:
+                print("warning: request 0x%02x: %s" % (request, STATUS.get(status, status)), file=sys.stderr)
+
+    def block_size(self):
+        return self.config["series_block_size"] if self.config else 512
+
+    def log_records(self, start=0, end=None):
+        channels = len(self.channels["series"])
+        seen = set()
+        rows = []
+        for block in sorted(self.blocks):
+            length, received = self.block_pieces[block]
+            if received < length:
+                print("warning: log block %d incomplete, skipped" % block, file=sys.stderr)
+                continue
+            for record_time, values in decode_block(bytes(self.blocks[block]), channels):
+                if record_time < start or (end and record_time > end) or record_time in seen:
+                    continue
+                seen.add(record_time)
+                rows.append((record_time, values))
+        return rows
+
+
+def decimals(step):
+    return max(0, int(round(-math.log10(step)))) if step < 1 else 0
+
+
+def write_npy(path, dtype, values):
+    """Write a one dimensional .npy file, version 1.0."""
+    header = "{'descr': '%s', 'fortran_order': False, 'shape': (%d,), }" % (dtype, len(values))
+    header += " " * ((64 - (10 + len(header) + 1) % 64) % 64) + "\n"
+    with open(path, "wb") as out:
+        out.write(b"\x93NUMPY\x01\x00" + struct.pack("<H", len(header)) + header.encode("latin1"))
+        out.write(struct.pack("<%d%s" % (len(values), NPY_FORMAT[dtype]), *values))
+
+
+def write_table(out_dir, name, columns, rows, file_format):
+    """columns: list of (name, npy dtype, decimals), rows: list of tuples."""
+    os.makedirs(out_dir, exist_ok=True)
+    if file_format == "csv":
+        path = os.path.join(out_dir, name + ".csv")
+        with open(path, "w") as out:
+            out.write(",".join(column[0] for column in columns) + "\n")
+            for row in rows:
+                out.write(",".join("%.*f" % (column[2], value) if column[1] == "<f4" else str(value)
+                                   for column, value in zip(columns, row)) + "\n")
+    else:
+        path = os.path.join(out_dir, name)
+        os.makedirs(path, exist_ok=True)
+        for i, (column, dtype, _) in enumerate(columns):
+            write_npy(os.path.join(path, column + ".npy"), dtype, [row[i] for row in rows])
+        with open(os.path.join(path, "schema.json"), "w") as out:
+            json.dump({"rows": len(rows), "columns": [{"name": c[0], "dtype": c[1]} for c in columns]},
+                      out, indent=2)
+    print("%s: %d rows" % (path, len(rows)), file=sys.stderr)
+
+
+def write_outputs(dump, args):
+    if dump.config is None:
+        sys.exit("no config frames, request the config first")
+    out = args.out
+    os.makedirs(out, exist_ok=True)
+    with open(os.path.join(out, "config.json"), "w") as config:
+        json.dump({"config": dump.config, "channels": dump.channels}, config, indent=2)
+
+    if dump.stats is not None:
+        write_table(out, "stats", [(name, "<i4" if name == "rssi" else "<u4", 0) for name in STATS_FIELDS],
+                    [tuple(dump.stats[name] for name in STATS_FIELDS)], args.format)
+        if args.command == "stats":
+            for name in STATS_FIELDS:
+                print("%-20s %d" % (name, dump.stats[name]))
+
+    for tier, table in sorted(dump.history.items()):
+        label = dump.config["tier_labels"][tier]
+        seconds = dump.config["tier_seconds"][tier]
+        size = max(len(column) for column in table.values())
+        columns = [("age_s", "<u4", 0)]
+        keys = sorted(table)
+        for channel, stat in keys:
+            info = dump.channels["history"][channel]
+            columns.append(("%s_%s" % (info["name"], HISTORY_STATS[stat]), "<f4", decimals(info["step"])))
+        rows = []
+        for i in range(size):
+            row = [(size - 1 - i) * seconds]
+            for channel, stat in keys:
+                info = dump.channels["history"][channel]
+                row.append(table[(channel, stat)][i] * info["step"] + info["offset"])
+            rows.append(tuple(row))
+        write_table(out, "history_" + label, columns, rows, args.format)
+
+    if dump.blocks:
+        series = dump.channels["series"]
+        columns = [("time", "<u4", 0)] + [(c["name"], "<f4", decimals(c["step"])) for c in series]
+        start = getattr(args, "start", 0) or 0
+        end = getattr(args, "end", 0) or None
+        rows = [(record_time,) + tuple(v * c["step"] for v, c in zip(values, series))
+                for record_time, values in dump.log_records(start, end)]
+        write_table(out, "log", columns, rows, args.format)
+
+
+def request_for(args):
+    if args.command == "stats":
+        return encode_request(REQUEST_STATS)
+    if args.command == "history":
+        return encode_request(REQUEST_HISTORY, struct.pack("<B", args.tier))
+    if args.command == "log":
+        return encode_request(REQUEST_LOG, struct.pack("<II", args.start, args.end))
+    return encode_request(REQUEST_CONFIG)
+
+
+def exchange(port, request, dump, timeout):
+    """Send a request and feed the frames of the reply to dump until its end frame."""
+    port.write(request)
+    data = bytearray()
+    ends = len(dump.ends)
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        chunk = port.read(4096)
+        if not chunk:
+            continue
+        deadline = time.monotonic() + timeout
+        data += chunk
+        # Keep the tail, it may hold the start of a frame
+        consumed = 0
+        for kind, payload, end in frames(bytes(data)):
+            dump.feed(kind, payload)
+            consumed = end
+        del data[:consumed]
+        if len(dump.ends) > ends:
+            return
+    sys.exit("no reply within %g s" % timeout)
+
+
+def parse_tier(value):
+    labels = ["1h", "10h", "60h", "60d"]  # HistoryTierLabel
+    return labels.index(value) if value in labels else int(value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--port", help="serial device, e.g. /dev/ttyUSB0")
+    source.add_argument("--capture", help="decode a saved console stream instead of a device")
+    source.add_argument("--request", action="store_true", help="print the request for the simulator's --send")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--timeout", type=float, default=5, help="seconds without a byte before giving up")
+    parser.add_argument("--out", default="dump", help="output directory")
+    parser.add_argument("--format", choices=["csv", "columns"], default="csv")
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("config")
+    commands.add_parser("stats")
+    history = commands.add_parser("history")
+    history.add_argument("--tier", type=parse_tier, default=0, help="1h, 10h, 60h, 60d or the tier number")
+    log = commands.add_parser("log")
+    log.add_argument("--from", dest="start", type=int, default=0, help="unix time")
+    log.add_argument("--to", dest="end", type=int, default=0, help="unix time, 0 for now")
+    args = parser.parse_args()
+
+    if args.request:
+        print("".join("\\x%02x" % byte for byte in request_for(args)))
+        return
+
+    dump = Dump()
+    if args.capture:
+        with open(args.capture, "rb") as capture:
+            for kind, payload, _ in frames(capture.read()):
+                dump.feed(kind, payload)
+    else:
+        try:
+            import serial
+        except ImportError:
+            sys.exit("pyserial is needed to talk to a device: pip install pyserial")
+        with serial.Serial(args.port, args.baud, timeout=0.1) as port:
+            port.reset_input_buffer()
+            exchange(port, encode_request(REQUEST_CONFIG), dump, args.timeout)
+            if args.command != "config":
+                exchange(port, request_for(args), dump, args.timeout)
+    write_outputs(dump, args)
+
+
+if __name__ == "__main__":
+    main()